@@ -165,6 +165,18 @@ void start_fsals(void)
 	load_fsal_static("PSEUDO", pseudo_fsal_init);
 }
 
+/**
+ * @brief Start only FSAL_TC
+ *
+ * For TC clients that do not serve a pseudo file system.
+ */
+
+void start_tc_fsal(void)
+{
+	load_state = idle;
+	load_fsal_static("TCNFS", fs_init);
+}
+
 /**
  * Enforced filename for FSAL library objects.
  */
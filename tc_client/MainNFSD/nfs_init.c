@@ -242,6 +242,49 @@ int nfs_set_param_from_conf(config_file_t parse_tree,
 	return 0;
 }
 
+/**
+ * @brief Load only the parameters a TC client needs from config file
+ *
+ * Unlike nfs_set_param_from_conf(), the server-only blocks (IP/name cache,
+ * KRB5, cache inode) are left with their defaults.
+ *
+ * @param[in]  parse_tree Parsed config file
+ *
+ * @return -1 on failure.
+ */
+int nfs_set_client_param_from_conf(config_file_t parse_tree)
+{
+	struct config_error_type err_type;
+
+	client_pkginit();
+	export_pkginit();
+
+	(void) load_config_from_parse(parse_tree,
+				    &nfs_core,
+				    &nfs_param.core_param,
+				    true,
+				    &err_type);
+	if (!config_error_is_harmless(&err_type)) {
+		LogCrit(COMPONENT_INIT,
+			"Error while parsing core configuration");
+		return -1;
+	}
+
+	/* for the ID mapper, which is initialized on first use */
+	(void) load_config_from_parse(parse_tree,
+				    &version4_param,
+				    &nfs_param.nfsv4_param,
+				    true,
+				    &err_type);
+	if (!config_error_is_harmless(&err_type)) {
+		LogCrit(COMPONENT_INIT,
+			"Error while parsing NFSv4 specific configuration");
+		return -1;
+	}
+
+	return 0;
+}
+
 int init_server_pkgs(void)
 {
 	cache_inode_status_t cache_status;
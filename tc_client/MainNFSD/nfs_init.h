@@ -53,6 +53,12 @@ void nfs_prereq_init(const char *program_name, const char *host_name,
 int nfs_set_param_from_conf(config_file_t config_struct,
 			    nfs_start_info_t *p_start_info);
 
+/**
+ * nfs_set_client_param_from_conf:
+ * Load only the core and NFSv4 parameters, for tc_init_lite().
+ */
+int nfs_set_client_param_from_conf(config_file_t config_struct);
+
 /**
  * Initialization that needs config file parse but must be done
  * before any services actually start (exports, net sockets...)
@@ -54,14 +54,10 @@
 #include "idmapper.h"
 
 static struct gsh_buffdesc owner_domain;
+static pthread_once_t idmapper_once = PTHREAD_ONCE_INIT;
+static bool idmapper_ready;
 
-/**
- * @brief Initialize the ID Mapper
- *
- * @return true on success, false on failure
- */
-
-bool idmapper_init(void)
+static bool idmapper_do_init(void)
 {
 #ifdef USE_NFSIDMAP
 	if (!nfs_param.nfsv4_param.use_getpwnam) {
@@ -94,6 +90,26 @@ bool idmapper_init(void)
 	return true;
 }
 
+static void idmapper_init_once(void)
+{
+	idmapper_ready = idmapper_do_init();
+}
+
+/**
+ * @brief Initialize the ID Mapper
+ *
+ * It is done only once, and is also done on first use if the caller
+ * skipped it (e.g., tc_init_lite()).
+ *
+ * @return true on success, false on failure
+ */
+
+bool idmapper_init(void)
+{
+	pthread_once(&idmapper_once, idmapper_init_once);
+	return idmapper_ready;
+}
+
 /**
  * @brief Encode a UID or GID as a string
  *
@@ -111,6 +127,9 @@ static bool xdr_encode_nfs4_princ(XDR *xdrs, uint32_t id, bool group)
 	uint32_t not_a_size_t;
 	bool success = false;
 
+	if (unlikely(!idmapper_init()))
+		return false;
+
 	PTHREAD_RWLOCK_rdlock(group ? &idmapper_group_lock :
 			      &idmapper_user_lock);
 	if (group)
@@ -441,6 +460,9 @@ static bool name2id(const struct gsh_buffdesc *name, uint32_t *id, bool group,
 {
 	bool success;
 
+	if (unlikely(!idmapper_init()))
+		return false;
+
 	PTHREAD_RWLOCK_rdlock(group ? &idmapper_group_lock :
 			      &idmapper_user_lock);
 	if (group)
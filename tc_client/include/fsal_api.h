@@ -583,6 +583,7 @@ static inline void fsal_put(struct fsal_module *fsal_hdl)
  */
 
 void start_fsals(void);
+void start_tc_fsal(void);
 int load_fsal(const char *name,
 	      struct fsal_module **fsal_hdl);
 
@@ -1211,6 +1212,17 @@ typedef uint64_t fsal_cookie_t;
 
 typedef bool(*fsal_readdir_cb) (const char *name, void *dir_state,
 				fsal_cookie_t cookie);
+/**
+ * @brief NFSv4 state of a file used by tc_lockv and friends.
+ */
+struct tc_lock_state {
+	int fd;			/* the TC fd the state belongs to */
+	nfs_fh4 fh;
+	stateid4 open_stateid;
+	stateid4 lock_stateid;
+	bool has_lock_stateid;
+};
+
 /**
  * @brief FSAL objectoperations vector
  */
@@ -1321,8 +1333,36 @@ struct fsal_obj_ops {
 	tc_res (*tc_closev)(const nfs_fh4 *fh4s, int count, stateid4 *sids,
 			    seqid4 *seqs);
 
+/**
+ * @brief Queue the CLOSEs to be sent with later compounds.
+ *
+ * Return the number of leading files whose CLOSEs are queued, which is less
+ * than "count" if lazy close is disabled or the queue is full and cannot be
+ * flushed; the caller should then close the rest.
+ */
+	int (*tc_defer_closev)(const nfs_fh4 *fh4s, int count,
+			       stateid4 *sids, seqid4 *seqs);
+
+/**
+ * @brief Enable or disable lazy close; disabling it sends queued CLOSEs.
+ */
+	void (*tc_set_lazy_close)(bool enabled);
+
 	tc_res (*tc_lgetattrsv)(struct tc_attrs *attrs, int count);
 
+/**
+ * @brief Same as tc_lgetattrsv, but verify and read the symlinks "links"
+ * (may be NULL element-wise) in the same compound.
+ *
+ * A symlink whose fileid differs from "linkids" (if not NULL) fails the
+ * compound with EAGAIN before its target is used.  "linkbufs" are buffers of
+ * PATH_MAX bytes receiving the symlink contents.
+ */
+	tc_res (*tc_lgetattrsv_links)(struct tc_attrs *attrs, int count,
+				      const char **links,
+				      const uint64_t *linkids,
+				      char **linkbufs);
+
 	tc_res (*tc_lsetattrsv)(struct tc_attrs *attrs, int count);
 
 	fsal_status_t (*tc_destroysession)();
@@ -1345,6 +1385,14 @@ struct fsal_obj_ops {
 
 	tc_res (*tc_lcopyv)(struct tc_extent_pair *pairs, int count);
 
+/**
+ * @brief Same as tc_lcopyv, but verify and read the symlinks "links" (may be
+ * NULL element-wise) in the same compound, like tc_lgetattrsv_links.
+ */
+	tc_res (*tc_lcopyv_links)(struct tc_extent_pair *pairs, int count,
+				  const char **links, const uint64_t *linkids,
+				  char **linkbufs);
+
 	tc_res (*tc_hardlinkv)(const char **oldpaths, const char **newpaths,
 			       int count);
 
@@ -1354,6 +1402,64 @@ struct fsal_obj_ops {
 	tc_res (*tc_readlinkv)(const char **paths, char **bufs,
 			       size_t *bufsizes, int count);
 
+/**
+ * @brief OPEN, GETATTR, READ and CLOSE files in a single compound.
+ *
+ * "reads" are read as by tc_readv(), and "sizes" are set to the sizes of
+ * their files.
+ */
+	tc_res (*tc_read_files)(struct tc_iovec *reads, size_t *sizes,
+				int count);
+
+/**
+ * @brief Operations of a user-composed compound in a single compound.
+ *
+ * tc_res.index is the number of operations sent on success.
+ */
+	tc_res (*tc_cpdv)(struct tc_cpd_op *ops, int count);
+
+/**
+ * @brief Multiple LOCK/LOCKU/LOCKT in a single compound.
+ *
+ * "states" has the open state of the file of each of "locks".  LOCK sets
+ * the lock stateid of a state whose "has_lock_stateid" is false.
+ */
+	tc_res (*tc_lockv)(struct tc_lock *locks, struct tc_lock_state *states,
+			   int count);
+
+	tc_res (*tc_unlockv)(struct tc_lock *locks,
+			     struct tc_lock_state *states, int count);
+
+/*
+ * A compound stops at a conflicting LOCKT, so tc_res.index is the number of
+ * locks tested on success: it is right after the first conflicting lock, if
+ * any, and the remaining locks are to be tested in another compound.
+ */
+	tc_res (*tc_testlockv)(struct tc_lock *locks,
+			       struct tc_lock_state *states, int count);
+
+/**
+ * @brief Allocate or deallocate multiple extents in a single compound.
+ *
+ * Extents of TC_FILE_DESCRIPTOR files must have their "fd_data" filled.
+ */
+	tc_res (*tc_fallocatev)(struct tc_extent *extents, int count);
+
+	tc_res (*tc_punchholev)(struct tc_extent *extents, int count);
+
+/**
+ * @brief Get, set, or list extended attributes of multiple files in a single
+ * compound.
+ *
+ * Extended attributes are named attributes reached by OPENATTR.
+ */
+	tc_res (*tc_getxattrsv)(struct tc_xattr *xattrs, int count);
+
+	tc_res (*tc_setxattrsv)(struct tc_xattr *xattrs, int count);
+
+	tc_res (*tc_listxattrsv)(const char **paths, char **bufs,
+				 size_t *bufsizes, int count);
+
 	fsal_status_t (*root_lookup)(struct fsal_obj_handle **handle);
 
 	fsal_status_t (*lookup_plus)(const char *path,
@@ -32,21 +32,30 @@ const size_t TC_SPLIT_THRESHOLD = 4096;
 
 /**
  * Split an array of tc_iovec specified by "iova" to multiple arrays of
- * tc_iovec so that the total size of tc_iovecs in each array is no larger than
- * size_limit.  The caller own the returned array of tc_iov_array, and is
- * responsible for freeing them by calling tc_restore_iov_array().
+ * tc_iovec so that the XDR size of the compound (call and reply) of each array
+ * is no larger than size_limit.  The caller own the returned array of
+ * tc_iov_array, and is responsible for freeing them by calling
+ * tc_restore_iov_array().
+ *
+ * The tc_iovecs are packed first-fit-decreasing when that takes fewer
+ * compounds or splits fewer of them than filling compounds in order, and no
+ * two of them are of the same file.  When no tc_iovec is split, the parts
+ * are views into "iova", which may be reordered until tc_restore_iov_array();
+ * otherwise they are views into pieces owned by the returned array.
  *
  * @iova: the input tc_iov_array to be split
  * @size_limit: size limit of each resultant tc_iov_array
  * @nparts: the number of tc_iov_arrays "iova" is split into
- * Returns an array of tc_iov_array.
+ * Returns an array of tc_iov_array, or NULL if out of memory.
  *
  */
 struct tc_iov_array *tc_split_iov_array(const struct tc_iov_array *iova,
 					int size_limit, int *nparts);
 
 /**
- * Update the original "iova" from the results of its split parts.
+ * Update the original "iova" from the results of its split parts, and put
+ * it back in order.  The result of a split tc_iovec ends at its first short
+ * or EOF piece.
  *
  * It also release the memory allocated for "parts".
  *
@@ -55,7 +64,33 @@ struct tc_iov_array *tc_split_iov_array(const struct tc_iov_array *iova,
 bool tc_restore_iov_array(struct tc_iov_array *iova,
 			  struct tc_iov_array **parts, int nparts);
 
-bool tc_merge_iov_array(struct tc_iov_array *iova);
+/**
+ * Merge tc_iovecs of the same file whose ranges are adjacent or overlap into
+ * one tc_iovec of at most "max_io" bytes, which is placed where the first of
+ * them was.  Data of merged reads are read into a bounce buffer unless the
+ * buffers of the tc_iovecs are contiguous as well; data of merged writes are
+ * copied into one in the order of the tc_iovecs, so the last writer wins.
+ * Nothing is merged if overlapping writes do not fit in "max_io" together,
+ * because merging only some of them could reorder them.
+ *
+ * tc_iovecs of TC_FILE_CURRENT or TC_FILE_SAVED, or at TC_OFFSET_CUR or
+ * TC_OFFSET_END, are never merged.
+ *
+ * Returns the merged array, which must be released by tc_unmerge_iov_array(),
+ * or NULL if there is nothing to merge.
+ */
+struct tc_iov_array *tc_merge_iov_array(const struct tc_iov_array *iova,
+					size_t max_io, bool write);
+
+/**
+ * Update the original "iova" from the results of the "merged" array as if
+ * its tc_iovecs were sent separately: the data of reads are scattered, and
+ * "length", "is_eof", "is_failure" and "is_write_stable" are set.
+ *
+ * It also releases the memory allocated for "merged".
+ */
+void tc_unmerge_iov_array(struct tc_iov_array *iova,
+			  struct tc_iov_array **merged, bool write);
 
 #ifdef __cplusplus
 }
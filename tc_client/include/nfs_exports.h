@@ -323,6 +323,7 @@ void kill_export_root_entry(cache_entry_t *entry);
 void kill_export_junction_entry(cache_entry_t *entry);
 
 int ReadExports(config_file_t in_config);
+int ReadClientExports(config_file_t in_config);
 void free_export_resources(struct gsh_export *export);
 void exports_pkginit(void);
 int fsal_load_init(void *node, const char *name,
@@ -38,6 +38,51 @@ extern "C" {
 int tc_path_tokenize(const char *path, slice_t **components);
 int tc_path_tokenize_s(slice_t path, slice_t **components);
 
+/**
+ * Room for the components of any path that fits in a compound; callers of the
+ * "_a" functions below can use it to size "comps" on the stack.
+ */
+#define TC_PATH_MAX_COMPS 256
+
+/**
+ * Like tc_path_tokenize_s() but without allocation: the components are stored
+ * into "comps", which has room for "max_comps" of them.
+ *
+ * Return the number of components, or -1 if there are more than "max_comps".
+ */
+int tc_path_tokenize_a(slice_t path, slice_t *comps, int max_comps);
+
+/**
+ * Return the number of components tc_path_tokenize_s() would find in "path".
+ */
+int tc_path_count_s(slice_t path);
+
+/**
+ * Iterator over the raw components of a path; it allocates nothing.  Empty
+ * components and "." are skipped, but ".." is returned as it is.
+ */
+struct tc_path_iter {
+	const char *pos;
+	const char *end;
+};
+
+static inline void tc_path_iter_init(struct tc_path_iter *it, slice_t path)
+{
+	it->pos = path.data;
+	it->end = path.data + path.size;
+}
+
+/**
+ * Set "comp" to the next component; return false at the end of the path.
+ */
+bool tc_path_iter_next(struct tc_path_iter *it, slice_t *comp);
+
+/**
+ * Return the first '/' among the "n" bytes at "s", or "s + n" if there is
+ * none.  Long strings are scanned 16 bytes at a time when SSE2 is available.
+ */
+const char *tc_path_find_sep(const char *s, size_t n);
+
 /**
  * Normalize a path and save the result into "buf".  Normalization include
  * removing ".", "..", consecutive "//", and trailing "/".
@@ -85,6 +130,18 @@ int tc_path_rebase(const char *base, const char *path, char *buf,
 		   size_t buf_size);
 int tc_path_rebase_s(slice_t base, slice_t path, buf_t *pbuf);
 
+/**
+ * Like tc_path_rebase_s() but without a buffer: the components of the
+ * relative path are stored into "comps", which has room for "max_comps" of
+ * them.  Each ".." points to a static string and the other components point
+ * into "path".  "base" and "path" must be both absolute or both relative.
+ *
+ * Return the number of components, which is 0 when "path" is "base", or -1
+ * if there are more than "max_comps" or the paths are of different kinds.
+ */
+int tc_path_rebase_a(slice_t base, slice_t path, slice_t *comps,
+		     int max_comps);
+
 /**
  * Join "path1" and "path2" to "buf".
  *
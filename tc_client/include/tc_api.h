@@ -51,6 +51,16 @@ extern "C" {
 void *tc_init(const char *config_path, const char *log_path,
 	      uint16_t export_id);
 
+/**
+ * Same as tc_init(), but faster for short-lived programs: with the NFS4
+ * backend, only the client and export parameters are read, and only the
+ * connection and session are set up before returning.  The server-side
+ * layers of NFS-Ganesha are not started, the ID mapper is set up on first
+ * use, and counters are not written to /tmp/tc-counters.json.
+ */
+void *tc_init_lite(const char *config_path, const char *log_path,
+		   uint16_t export_id);
+
 /*
  * Free the reference to module and op_ctx
  * Should be called if tc_init() was called previously
@@ -59,6 +69,77 @@ void *tc_init(const char *config_path, const char *log_path,
  */
 void tc_deinit(void *module);
 
+/**
+ * Start or stop tracing the compounds sent by the NFS4 backend; it has no
+ * effect with the POSIX backend.  If the TC_TRACE_SIGUSR2 environment
+ * variable is set when tracing is first started, a SIGUSR2 handler is
+ * installed that dumps the traces into /tmp/tc-trace.<pid>.
+ */
+void tc_enable_tracing(bool enabled);
+
+/**
+ * Dump the traced compounds into "path"; tc_trace_stat summarizes the dump.
+ *
+ * Return 0 on success or -errno.
+ */
+int tc_dump_trace(const char *path);
+
+/**
+ * Start or stop closing files lazily with the NFS4 backend: tc_closev()
+ * returns at once, and the CLOSEs are sent with later compounds that have
+ * room for them, or by a timer.  Files opened again meanwhile are not
+ * affected.  Stopping sends the queued CLOSEs; tc_deinit() stops it.
+ */
+void tc_enable_lazy_close(bool enabled);
+
+/**
+ * Priority classes of the compounds sent by the NFS4 backend.  When the
+ * session is busy, waiting compounds get slots in proportion to the weights
+ * of their classes, and each class has a limit of compounds in flight.  By
+ * default, the weights are 8, 4 and 1, and bulk compounds can take at most
+ * half of the slots.
+ */
+enum TC_PRIORITY {
+	TC_PRIO_INTERACTIVE = 0,	/* e.g., tc_stat() of a user */
+	TC_PRIO_NORMAL,			/* the default */
+	TC_PRIO_BULK,			/* e.g., tc_cp_recursive() */
+	TC_PRIO_COUNT,
+};
+
+/**
+ * Set the class of the compounds sent by the calling thread; to tag one
+ * call, set it before the call and restore it afterwards.
+ *
+ * Return the previous class, or -EINVAL.
+ */
+int tc_set_thread_priority(int prio);
+
+/**
+ * Set the limit of compounds in flight, and the weight, of class "prio".
+ *
+ * Return 0 or -EINVAL.
+ */
+int tc_set_priority_limits(int prio, int max_inflight, int weight);
+
+struct tc_sched_stats
+{
+	int queued;		/* # of compounds waiting now */
+	int inflight;		/* # of compounds in flight now */
+	int max_inflight;
+	int weight;
+	uint64_t compounds;	/* # of compounds sent so far */
+	uint64_t wait_ns;	/* total queueing delay of them */
+	uint64_t max_wait_ns;
+};
+
+/**
+ * Get the scheduling statistics of class "prio".  The percentiles of the
+ * queueing delay are in the "sched_wait_<class>" counters.
+ *
+ * Return 0, -EINVAL, or -ENOTSUP with the POSIX backend.
+ */
+int tc_get_priority_stats(int prio, struct tc_sched_stats *stats);
+
 enum TC_FILETYPE {
 	TC_FILE_NULL = 0,
 	TC_FILE_DESCRIPTOR,
@@ -382,6 +463,23 @@ static inline bool tx_writev(struct tc_iovec *writes, int count)
 	return tc_okay(tc_writev(writes, count, true));
 }
 
+/**
+ * Read small files in full.
+ *
+ * @paths: the files to read
+ * @bufs: output; "bufs[i]" is set to a buffer of "sizes[i]" bytes holding
+ * the content of "paths[i]", which the caller must free()
+ * @sizes: output; the sizes of the files
+ * @count: the count of files
+ * @cap: the bytes to read of each file together with its size, so that files
+ * of at most "cap" bytes are read in one round trip; the rest of larger files
+ * is read afterwards.
+ *
+ * On failure, "bufs" are all NULL.
+ */
+tc_res tc_read_files(const char **paths, char **bufs, size_t *sizes,
+		     int count, size_t cap);
+
 /**
  * The bitmap indicating the presence of file attributes.
  */
@@ -399,6 +497,8 @@ struct tc_attrs_masks
 	unsigned int has_atime : 1; /* time of last access */
 	unsigned int has_mtime : 1; /* time of last modification */
 	unsigned int has_ctime : 1; /* time of last status change */
+	unsigned int has_change : 1; /* change attribute; not in
+					TC_ATTRS_MASK_ALL */
 };
 
 /**
@@ -419,6 +519,9 @@ struct tc_attrs
 	struct timespec atime;
 	struct timespec mtime;
 	struct timespec ctime;
+	/* changes whenever the file does; it is "ctime" in nanoseconds on
+	 * POSIX */
+	uint64_t change;
 };
 
 static inline void tc_attrs_set_mode(struct tc_attrs *attrs, mode_t mode)
@@ -484,6 +587,12 @@ static inline void tc_attrs_set_rdev(struct tc_attrs *attrs, dev_t rdev)
 	attrs->masks.has_rdev = true;
 }
 
+static inline void tc_attrs_set_change(struct tc_attrs *attrs, uint64_t change)
+{
+	attrs->change = change;
+	attrs->masks.has_change = true;
+}
+
 static inline void tc_set_up_creation(struct tc_attrs *newobj, const char *name,
 				      mode_t mode)
 {
@@ -527,6 +636,10 @@ static inline void tc_stat2attrs(const struct stat *st, struct tc_attrs *attrs)
 		attrs->ctime.tv_sec = st->st_ctime;
 		attrs->ctime.tv_nsec = 0;
 	}
+	if (attrs->masks.has_change) {
+		attrs->change = (uint64_t)st->st_ctim.tv_sec * 1000000000 +
+				st->st_ctim.tv_nsec;
+	}
 }
 
 static inline void tc_attrs2stat(const struct tc_attrs *attrs, struct stat *st)
@@ -563,7 +676,8 @@ extern const struct tc_attrs_masks TC_ATTRS_MASK_NONE;
 		.has_mode = true, .has_size = true, .has_nlink = true,         \
 		.has_fileid = true, .has_uid = true, .has_gid = true,          \
 		.has_rdev = true, .has_atime = true, .has_mtime = true,        \
-		.has_ctime = true, .has_blocks = true                          \
+		.has_ctime = true, .has_blocks = true,                         \
+		.has_change = false                                            \
 	}
 
 #define TC_MASK_INIT_NONE                                                      \
@@ -571,7 +685,8 @@ extern const struct tc_attrs_masks TC_ATTRS_MASK_NONE;
 		.has_mode = false, .has_size = false, .has_nlink = false,      \
 		.has_fileid = false, .has_uid = false, .has_gid = false,       \
 		.has_rdev = false, .has_atime = false, .has_mtime = false,     \
-		.has_ctime = false, .has_blocks = false                        \
+		.has_ctime = false, .has_blocks = false,                       \
+		.has_change = false                                            \
 	}
 
 /**
@@ -703,6 +818,28 @@ typedef struct tc_file_pair
  */
 tc_res tc_renamev(struct tc_file_pair *pairs, int count, bool is_transaction);
 
+/**
+ * Conditional writes: writes[i] is done only if the file of conds[i] has
+ * the attributes selected by "conds[i].masks", as VERIFY of NFSv4 checks
+ * them.  Use "has_change" for compare-and-swap of the whole file.  A
+ * "conds[i].file" of TC_FILE_NULL means the file of writes[i]; NULL paths
+ * are not allowed.
+ *
+ * Each condition and its write are sent together, and all of them usually
+ * in one compound.  A false condition does not stop the others:
+ * "conflicts[i]" is set to whether writes[i] was skipped because of its
+ * condition.  tc_res reports other errors only.
+ */
+tc_res tc_writev_if(struct tc_iovec *writes, const struct tc_attrs *conds,
+		    bool *conflicts, int count);
+
+/**
+ * Conditional renames; see tc_writev_if().  A "conds[i].file" of
+ * TC_FILE_NULL means "src_file" of pairs[i].
+ */
+tc_res tc_renamev_if(struct tc_file_pair *pairs, const struct tc_attrs *conds,
+		     bool *conflicts, int count);
+
 static inline bool tx_renamev(tc_file_pair *pairs, int count)
 {
 	return tc_okay(tc_renamev(pairs, count, true));
@@ -778,6 +915,9 @@ static inline bool tx_copyv(struct tc_extent_pair *pairs, int count)
 /**
  * Copy the data from "src_path" to "dst_path" by reading from "src_path" and
  * then writing to "dst_path".
+ *
+ * Destinations of extents of 1MB or more are preallocated with
+ * tc_fallocatev() before the writes, which costs one more round trip.
  */
 tc_res tc_dupv(struct tc_extent_pair *pairs, int count, bool is_transaction);
 tc_res tc_ldupv(struct tc_extent_pair *pairs, int count, bool is_transaction);
@@ -825,6 +965,280 @@ static inline int tc_readlink(const char *path, char *buf, size_t bufsize)
 	return tc_readlinkv(&path, &buf, &bufsize, 1, false).err_no;
 }
 
+/**
+ * A byte-range lock of an open file, similar to "struct flock".
+ */
+struct tc_lock
+{
+	tc_file file;	/* must be a TC_FILE_DESCRIPTOR */
+	short type;	/* F_RDLCK, F_WRLCK, or F_UNLCK */
+	size_t offset;
+	/**
+	 * A length of 0 means the lock extends to the end of file, as
+	 * l_len of "struct flock".
+	 */
+	size_t length;
+};
+
+static inline void tc_fill_lock(struct tc_lock *lock, tc_file file, short type,
+				size_t offset, size_t length)
+{
+	lock->file = file;
+	lock->type = type;
+	lock->offset = offset;
+	lock->length = length;
+}
+
+/**
+ * Acquire the byte-range "locks" without blocking, like fcntl(F_SETLK).
+ * Locks of one client (process) never conflict with each other.
+ *
+ * A conflicting lock fails with EAGAIN.  The locks acquired before the
+ * failing one are kept.
+ *
+ * @locks: the array of locks to acquire
+ * @count: the count of the preceding "tc_lock" array
+ * @is_transaction: whether to execute the compound as a transaction
+ */
+tc_res tc_lockv(struct tc_lock *locks, int count, bool is_transaction);
+
+/**
+ * Release the byte-range "locks"; "type" of each lock is ignored.
+ */
+tc_res tc_unlockv(struct tc_lock *locks, int count, bool is_transaction);
+
+/**
+ * Test whether the "locks" could be acquired, like fcntl(F_GETLK).
+ *
+ * On success, "type" of a lock is set to F_UNLCK if there is no conflict;
+ * otherwise, "type", "offset", and "length" are set to those of a
+ * conflicting lock.  A conflict is not a failure: all "locks" are tested on
+ * success.
+ */
+tc_res tc_testlockv(struct tc_lock *locks, int count, bool is_transaction);
+
+static inline bool tx_lockv(struct tc_lock *locks, int count)
+{
+	return tc_okay(tc_lockv(locks, count, true));
+}
+
+/**
+ * A byte range of a file to allocate or deallocate.
+ */
+struct tc_extent
+{
+	tc_file file;
+	size_t offset;
+	size_t length;
+	/* whether to create the file if it does not exist; fallocate only */
+	bool is_creation;
+};
+
+static inline void tc_fill_extent(struct tc_extent *ext, tc_file file,
+				  size_t offset, size_t length,
+				  bool is_creation)
+{
+	ext->file = file;
+	ext->offset = offset;
+	ext->length = length;
+	ext->is_creation = is_creation;
+}
+
+/**
+ * Allocate space for each of "extents", like fallocate(fd, 0, ...): the
+ * ranges not yet allocated read as zeros, and a file is extended if the
+ * range goes beyond its end.  Lengths must not be 0.
+ *
+ * @extents: the array of file ranges to allocate
+ * @count: the count of the preceding "tc_extent" array
+ * @is_transaction: whether to execute the compound as a transaction
+ */
+tc_res tc_fallocatev(struct tc_extent *extents, int count,
+		     bool is_transaction);
+
+/**
+ * Deallocate each of "extents", like fallocate(fd, FALLOC_FL_PUNCH_HOLE |
+ * FALLOC_FL_KEEP_SIZE, ...): the ranges read as zeros afterwards, and file
+ * sizes do not change.
+ */
+tc_res tc_punchholev(struct tc_extent *extents, int count,
+		     bool is_transaction);
+
+static inline bool tx_fallocatev(struct tc_extent *extents, int count)
+{
+	return tc_okay(tc_fallocatev(extents, count, true));
+}
+
+/**
+ * An extended attribute of a file, such as "user.checksum".
+ */
+struct tc_xattr
+{
+	tc_file file;
+	const char *name;
+	char *value;
+	/* [IN] size of "value"; [OUT] size of the value got */
+	size_t size;
+	/* XATTR_CREATE or XATTR_REPLACE of <sys/xattr.h>; setxattr only */
+	int flags;
+};
+
+static inline void tc_fill_xattr(struct tc_xattr *xattr, tc_file file,
+				 const char *name, char *value, size_t size,
+				 int flags)
+{
+	xattr->file = file;
+	xattr->name = name;
+	xattr->value = value;
+	xattr->size = size;
+	xattr->flags = flags;
+}
+
+/**
+ * Get extended attributes of files, like lgetxattr(2) of each of "xattrs".
+ * Symlinks are not followed.
+ *
+ * The value of xattrs[i] is read into its "value" and "size" is set to the
+ * size of the value.  If "size" is 0, only the size is got.  A value larger
+ * than a non-zero "size" fails with ERANGE, and a missing attribute with
+ * ENODATA.
+ *
+ * @xattrs: the array of extended attributes to get
+ * @count: the count of the preceding "tc_xattr" array
+ * @is_transaction: whether to execute the compound as a transaction
+ */
+tc_res tc_getxattrsv(struct tc_xattr *xattrs, int count, bool is_transaction);
+
+/**
+ * Set extended attributes of files, like lsetxattr(2) of each of "xattrs"
+ * with their "flags".  The value of xattrs[i] is its "size" bytes at
+ * "value".
+ */
+tc_res tc_setxattrsv(struct tc_xattr *xattrs, int count, bool is_transaction);
+
+/**
+ * List the names of extended attributes of files, like llistxattr(2).
+ *
+ * The names of the attributes of paths[i] are copied into bufs[i], each
+ * ending with '\0', and bufsizes[i] is set to the total length of the names.
+ * If bufsizes[i] is 0, only the length is got.  Names that do not fit in a
+ * non-zero bufsizes[i] fail with ERANGE.
+ */
+tc_res tc_listxattrsv(const char **paths, char **bufs, size_t *bufsizes,
+		      int count, bool is_transaction);
+
+static inline bool tx_setxattrsv(struct tc_xattr *xattrs, int count)
+{
+	return tc_okay(tc_setxattrsv(xattrs, count, true));
+}
+
+/**
+ * Operations of a user-composed compound.
+ */
+enum TC_CPD_OP_TYPE {
+	TC_CPD_READ = 0,	/* "iov" */
+	TC_CPD_WRITE,		/* "iov" */
+	TC_CPD_GETATTRS,	/* "attrs"; symlinks are not followed */
+	TC_CPD_SETATTRS,	/* "attrs"; symlinks are not followed */
+	TC_CPD_MKDIR,		/* "attrs" */
+	TC_CPD_REMOVE,		/* "file" */
+	TC_CPD_RENAME,		/* "pair" */
+	TC_CPD_VERIFY,		/* "attrs"; fails with EAGAIN if they differ */
+	TC_CPD_NVERIFY,		/* "attrs"; fails with EAGAIN if all equal */
+};
+
+/**
+ * An operation of a compound, with its arguments and, after execution, its
+ * results in the same fields as the vectorized call of its type would give.
+ */
+struct tc_cpd_op
+{
+	int type;
+
+	/**
+	 * 0 if the operation succeeded, errno if it failed, or ECANCELED if it
+	 * was not executed because an earlier one failed.
+	 */
+	int err_no;
+
+	union
+	{
+		struct tc_iovec iov;
+		struct tc_attrs attrs;
+		tc_file file;
+		tc_file_pair pair;
+	};
+};
+
+/**
+ * A compound built with tc_cpd_*() and executed with tc_cpd_execute().
+ *
+ * Operations are executed in the order they are added; files are opened and
+ * closed as needed.  The NFS4 backend sends them in as few compounds as the
+ * session allows; the POSIX backend executes them one by one.
+ */
+struct tc_compound
+{
+	struct tc_cpd_op *ops;
+	int count;
+	int capacity;
+};
+
+#define TC_COMPOUND_INITIALIZER { .ops = NULL, .count = 0, .capacity = 0 }
+
+/**
+ * Release the operations of "cpd" so it can be reused.
+ */
+void tc_cpd_destroy(struct tc_compound *cpd);
+
+/**
+ * Add an operation of "type" with zeroed arguments to "cpd".
+ *
+ * Return the operation, which is valid until the next operation is added, or
+ * NULL if out of memory.
+ */
+struct tc_cpd_op *tc_cpd_add(struct tc_compound *cpd, int type);
+
+/**
+ * Helpers that add one operation; they return the index of the operation
+ * in "cpd->ops", or -ENOMEM.
+ */
+int tc_cpd_read(struct tc_compound *cpd, tc_file file, size_t offset,
+		size_t length, char *buf);
+
+int tc_cpd_write(struct tc_compound *cpd, tc_file file, size_t offset,
+		 size_t length, char *data, bool is_creation);
+
+int tc_cpd_getattrs(struct tc_compound *cpd, tc_file file,
+		    struct tc_attrs_masks masks);
+
+int tc_cpd_setattrs(struct tc_compound *cpd, const struct tc_attrs *attrs);
+
+int tc_cpd_mkdir(struct tc_compound *cpd, const char *path, mode_t mode);
+
+int tc_cpd_remove(struct tc_compound *cpd, tc_file file);
+
+int tc_cpd_rename(struct tc_compound *cpd, tc_file src, tc_file dst);
+
+/**
+ * Guards: the operations after them run only if the file has (VERIFY), or
+ * does not have (NVERIFY), the attributes of "attrs" selected by its masks.
+ * Only the permission bits of "mode" are compared.
+ */
+int tc_cpd_verify(struct tc_compound *cpd, const struct tc_attrs *attrs);
+
+int tc_cpd_nverify(struct tc_compound *cpd, const struct tc_attrs *attrs);
+
+/**
+ * Execute the operations of "cpd"; results are in "cpd->ops".
+ *
+ * Execution stops at the first failing operation, whose index is returned
+ * in tc_res.
+ *
+ * @is_transaction: whether to execute the compound as a transaction
+ */
+tc_res tc_cpd_execute(struct tc_compound *cpd, bool is_transaction);
+
 /**
  * Application data blocks (ADB).
  *
@@ -846,7 +1260,8 @@ struct tc_adb
 
 	/**
 	 * IN: requested number of ADB blocks to write
-	 * OUT: number of ADB blocks successfully written.
+	 * OUT: number of ADB blocks successfully written, which is 0 for the
+	 * patterns after a failed one.
 	 */
 	size_t adb_block_count;
 
@@ -880,6 +1295,9 @@ struct tc_adb
 /**
  * Write Application Data Blocks (ADB) to one or more files.
  *
+ * Files of patterns of 1MB or more are preallocated with tc_fallocatev()
+ * before the writes, which costs one more round trip.
+ *
  * @patterns: the array of ADB patterns to write
  * @count: the count of the preceding pattern array
  * @is_transaction: whether to execute the compound as a transaction
@@ -0,0 +1,115 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/**
+ * C++ wrapper of the compound builder (tc_cpd_*() in tc_api.h):
+ *
+ *	tc::Compound cpd;
+ *	cpd.Write(tc_file_from_path("a.dat"), 0, hdr.size(), hdr.data(), true);
+ *	cpd.SetAttrs(mode_attrs);
+ *	int st = cpd.GetAttrs(tc_file_from_path("b.dat"), masks);
+ *	if (tc_okay(cpd.Execute()))
+ *		use(cpd[st].attrs);
+ */
+
+#ifndef __TC_COMPOUND_H__
+#define __TC_COMPOUND_H__
+
+#include "tc_api.h"
+
+#ifdef __cplusplus
+
+namespace tc {
+
+class Compound
+{
+public:
+	Compound() : cpd_(TC_COMPOUND_INITIALIZER) {}
+	~Compound() { tc_cpd_destroy(&cpd_); }
+
+	Compound(const Compound &) = delete;
+	Compound &operator=(const Compound &) = delete;
+
+	/* Each of these returns the index of the new op, or -ENOMEM. */
+	int Read(tc_file file, size_t offset, size_t length, char *buf)
+	{
+		return tc_cpd_read(&cpd_, file, offset, length, buf);
+	}
+
+	int Write(tc_file file, size_t offset, size_t length, char *data,
+		  bool is_creation = false)
+	{
+		return tc_cpd_write(&cpd_, file, offset, length, data,
+				    is_creation);
+	}
+
+	int GetAttrs(tc_file file, struct tc_attrs_masks masks)
+	{
+		return tc_cpd_getattrs(&cpd_, file, masks);
+	}
+
+	int SetAttrs(const struct tc_attrs &attrs)
+	{
+		return tc_cpd_setattrs(&cpd_, &attrs);
+	}
+
+	int Mkdir(const char *path, mode_t mode)
+	{
+		return tc_cpd_mkdir(&cpd_, path, mode);
+	}
+
+	int Remove(tc_file file) { return tc_cpd_remove(&cpd_, file); }
+
+	int Rename(tc_file src, tc_file dst)
+	{
+		return tc_cpd_rename(&cpd_, src, dst);
+	}
+
+	int Verify(const struct tc_attrs &attrs)
+	{
+		return tc_cpd_verify(&cpd_, &attrs);
+	}
+
+	int NVerify(const struct tc_attrs &attrs)
+	{
+		return tc_cpd_nverify(&cpd_, &attrs);
+	}
+
+	tc_res Execute(bool is_transaction = false)
+	{
+		return tc_cpd_execute(&cpd_, is_transaction);
+	}
+
+	/* Drop all ops so the compound can be reused. */
+	void Clear() { tc_cpd_destroy(&cpd_); }
+
+	int size() const { return cpd_.count; }
+
+	const struct tc_cpd_op &operator[](int i) const { return cpd_.ops[i]; }
+
+private:
+	struct tc_compound cpd_;
+};
+
+} // namespace tc
+
+#endif // __cplusplus
+
+#endif // __TC_COMPOUND_H__
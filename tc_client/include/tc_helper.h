@@ -34,17 +34,51 @@
 extern "C" {
 #endif
 
+/*
+ * Latency histograms are log-linear: every power of two of nanoseconds is
+ * split into 2^TC_HIST_SUB_BITS buckets, so a percentile is off by at most
+ * 1/2^TC_HIST_SUB_BITS.  Latencies of 2^TC_HIST_MAX_BITS ns (~18 minutes) or
+ * longer go to the last bucket.
+ */
+#define TC_HIST_SUB_BITS 3
+#define TC_HIST_MAX_BITS 40
+#define TC_HIST_BUCKETS                                                        \
+	((TC_HIST_MAX_BITS - TC_HIST_SUB_BITS + 1) << TC_HIST_SUB_BITS)
+
+/*
+ * Each thread updates one shard of a counter, so that threads do not contend
+ * on the same cache line; shards are merged on read.
+ */
+#define TC_COUNTER_SHARDS 16
+
+struct tc_counter_shard {
+	uint64_t calls;      /* # of calls (or RPCs) */
+	uint64_t failures;   /* # of failures of the calls */
+	uint64_t micro_ops;  /* # of operations (or RPC bytes) */
+	uint64_t time_ns;    /* the total time in calling these functions */
+	uint32_t hist[TC_HIST_BUCKETS];	/* latencies of successful calls */
+} __attribute__((aligned(64)));
+
 /**
  * A counter of function calling statistics.
  */
 struct tc_func_counter {
 	const char *name;
-	uint32_t calls;      /* # of calls (or RPCs) */
-	uint32_t failures;   /* # of failures of the calls */
-	uint64_t micro_ops;  /* # of operations (or RPC bytes) */
-	uint64_t time_ns;    /* the total time in calling these functions */
 	struct tc_func_counter *next;
 	bool registered;
+	struct tc_counter_shard shards[TC_COUNTER_SHARDS];
+};
+
+/**
+ * Statistics of a counter merged from all its shards.
+ */
+struct tc_counter_stats {
+	const char *name;
+	uint64_t calls;
+	uint64_t failures;
+	uint64_t micro_ops;
+	uint64_t time_ns;
+	uint64_t hist[TC_HIST_BUCKETS];
 };
 
 void tc_register_counter(struct tc_func_counter *tfc);
@@ -53,36 +87,86 @@ void tc_iterate_counters(bool (*tfc_reader)(struct tc_func_counter *tfc,
 					    void *arg),
 			 void *arg);
 
+extern __thread int tc_counter_shard_id;
+
+int tc_new_counter_shard();
+
+static inline struct tc_counter_shard *
+tc_counter_shard(struct tc_func_counter *tfc)
+{
+	if (tc_counter_shard_id < 0) {
+		tc_counter_shard_id = tc_new_counter_shard();
+	}
+	return &tfc->shards[tc_counter_shard_id];
+}
+
+static inline int tc_hist_bucket(uint64_t ns)
+{
+	int msb;
+
+	if (ns < (1 << TC_HIST_SUB_BITS)) {
+		return ns;
+	}
+	msb = 63 - __builtin_clzll(ns);
+	if (msb >= TC_HIST_MAX_BITS) {
+		return TC_HIST_BUCKETS - 1;
+	}
+	return ((msb - TC_HIST_SUB_BITS + 1) << TC_HIST_SUB_BITS) +
+	       ((ns >> (msb - TC_HIST_SUB_BITS)) &
+		((1 << TC_HIST_SUB_BITS) - 1));
+}
+
+static inline void tc_counter_record(struct tc_func_counter *tfc,
+				     uint64_t ops, uint64_t ns, bool succeed)
+{
+	struct tc_counter_shard *shard = tc_counter_shard(tfc);
+
+	__atomic_fetch_add(&shard->calls, 1, __ATOMIC_RELAXED);
+	if (succeed) {
+		__atomic_fetch_add(&shard->micro_ops, ops, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&shard->time_ns, ns, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&shard->hist[tc_hist_bucket(ns)], 1,
+				   __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_add(&shard->failures, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Merge the shards of "tfc" into "stats".
+ */
+void tc_read_counter(struct tc_func_counter *tfc,
+		     struct tc_counter_stats *stats);
+
+/**
+ * Return the "p"-th (0 < p < 1) percentile latency in ns of "stats".
+ */
+uint64_t tc_counter_percentile(const struct tc_counter_stats *stats, double p);
+
+/**
+ * Append all counters to "pbuf" as a JSON object.
+ */
+void tc_counters_to_json(buf_t *pbuf);
+
 #define TC_COUNTER_OUTPUT_INTERVAL 5
 
 #define TC_DECLARE_COUNTER(nm)                                                 \
 	struct timespec nm##_start_tm;                                         \
 	struct timespec nm##_stop_tm;                                          \
 	static struct tc_func_counter nm##_tc_counter = { .name = #nm,         \
-							  .calls = 0,          \
-							  .micro_ops = 0,      \
-							  .time_ns = 0,        \
 							  .next = NULL,        \
 							  .registered =        \
 							      false };         \
-	static bool nm##_registered = false;                                   \
 	tc_register_counter(&nm##_tc_counter)
 
-#define TC_START_COUNTER(nm)                                                   \
-	now(&nm##_start_tm);                                                   \
-	__sync_fetch_and_add(&nm##_tc_counter.calls, 1)
+#define TC_START_COUNTER(nm) now(&nm##_start_tm)
 
 #define TC_STOP_COUNTER(nm, ops, succeed)                                      \
 	do {                                                                   \
 		now(&nm##_stop_tm);                                            \
-		if (succeed) {                                                 \
-			__sync_fetch_and_add(&nm##_tc_counter.micro_ops, ops); \
-			__sync_fetch_and_add(                                  \
-			    &nm##_tc_counter.time_ns,                          \
-			    timespec_diff(&nm##_start_tm, &nm##_stop_tm));     \
-		} else {                                                       \
-			__sync_fetch_and_add(&nm##_tc_counter.failures, 1);    \
-		}                                                              \
+		tc_counter_record(                                             \
+		    &nm##_tc_counter, ops,                                     \
+		    timespec_diff(&nm##_start_tm, &nm##_stop_tm), succeed);    \
 	} while (false)
 
 /**
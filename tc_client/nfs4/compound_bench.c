@@ -0,0 +1,528 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include "compound_bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsal.h"
+#include "fsal_nfsv4_macros.h"
+#include "idmapper.h"
+#include "nfs4_util.h"
+
+#define BENCH_MAX_OPS 256
+#define BENCH_ATTR_BUFSIZE 512
+#define BENCH_BIT(b) (1U << (b))
+#define BENCH_BIT2(b) (1U << ((b) - 32))
+
+/* What fs_bitmap_getattr of handle.c asks for */
+static const struct bitmap4 bench_bitmap_getattr = {
+	.map[0] = (BENCH_BIT(FATTR4_TYPE) | BENCH_BIT(FATTR4_CHANGE) |
+		   BENCH_BIT(FATTR4_SIZE) | BENCH_BIT(FATTR4_FSID) |
+		   BENCH_BIT(FATTR4_FILEID)),
+	.map[1] = (BENCH_BIT2(FATTR4_MODE) | BENCH_BIT2(FATTR4_NUMLINKS) |
+		   BENCH_BIT2(FATTR4_OWNER) | BENCH_BIT2(FATTR4_OWNER_GROUP) |
+		   BENCH_BIT2(FATTR4_RAWDEV) | BENCH_BIT2(FATTR4_SPACE_USED) |
+		   BENCH_BIT2(FATTR4_TIME_ACCESS) |
+		   BENCH_BIT2(FATTR4_TIME_METADATA) |
+		   BENCH_BIT2(FATTR4_TIME_MODIFY)),
+	.bitmap4_len = 2
+};
+
+struct nfs4_compound_bench {
+	enum nfs4_bench_kind kind;
+	int nfiles;
+	size_t iosize;
+	COMPOUND4args args;
+	nfs_argop4 *argops;
+	nfs_resop4 *server_resops;	/* the reply sent by the server */
+	nfs_resop4 *client_resops;	/* the reply as decoded by the client */
+	char *names;			/* "nfiles" names of NAME_MAX + 1 */
+	fattr4 *fattrs;			/* one per file */
+	char *attr_bufs;		/* server-side values of "fattrs" */
+	char *attr_blobs;		/* client-side buffers of GETATTR */
+	char *data;			/* file content on the server */
+	char *iobufs;			/* client-side buffers of READ/WRITE */
+	entry4 *entries;		/* READDIR entries */
+	char *sendbuf;
+	size_t sendbuf_size;
+	char *replybuf;
+	size_t reply_len;
+};
+
+static char bench_owner[] = "tc_bench";
+
+static pthread_once_t bench_once = PTHREAD_ONCE_INIT;
+
+/* Owner names are mapped through the idmapper cache as in the client. */
+static void bench_init_once(void)
+{
+	idmapper_cache_init();
+}
+
+static inline char *bench_name(struct nfs4_compound_bench *b, int i)
+{
+	return b->names + i * (NAME_MAX + 1);
+}
+
+/* Zero "x" so that the argop decoder does not take x_public as lookahead. */
+static void bench_xdrmem_create(XDR *x, char *buf, u_int size, enum xdr_op op)
+{
+	memset(x, 0, sizeof(*x));
+	xdrmem_create(x, buf, size, op);
+}
+
+static bool bench_encode_owner(XDR *x, unsigned id)
+{
+	char buf[16];
+	utf8string owner;
+
+	owner.utf8string_len = snprintf(buf, sizeof(buf), "%u", id);
+	owner.utf8string_val = buf;
+	return xdr_fattr4_owner(x, &owner);
+}
+
+/* Encode the attributes a server returns for file "i". */
+static bool bench_encode_fattr(struct nfs4_compound_bench *b, int i)
+{
+	fattr4 *fattr = &b->fattrs[i];
+	char *buf = b->attr_bufs + i * BENCH_ATTR_BUFSIZE;
+	nfs_ftype4 type = NF4REG;
+	changeid4 change = 1000 + i;
+	uint64_t size = b->iosize;
+	fsid4 fsid = { .major = 0x7c, .minor = 0 };
+	uint64_t fileid = 100 + i;
+	uint32_t mode = 0644;
+	uint32_t nlink = 1;
+	specdata4 rawdev = { 0, 0 };
+	uint64_t used = (b->iosize + 511) & ~511ULL;
+	nfstime4 t = { .seconds = 1467000000 + i, .nseconds = 1000 * i };
+	XDR x;
+
+	bench_xdrmem_create(&x, buf, BENCH_ATTR_BUFSIZE, XDR_ENCODE);
+	if (!xdr_fattr4_type(&x, &type) || !xdr_fattr4_change(&x, &change) ||
+	    !xdr_fattr4_size(&x, &size) || !xdr_fattr4_fsid(&x, &fsid) ||
+	    !xdr_fattr4_fileid(&x, &fileid) || !xdr_fattr4_mode(&x, &mode) ||
+	    !xdr_fattr4_numlinks(&x, &nlink) ||
+	    !bench_encode_owner(&x, 1000) || !bench_encode_owner(&x, 1000) ||
+	    !xdr_fattr4_rawdev(&x, &rawdev) ||
+	    !xdr_fattr4_space_used(&x, &used) ||
+	    !xdr_fattr4_time_access(&x, &t) ||
+	    !xdr_fattr4_time_metadata(&x, &t) ||
+	    !xdr_fattr4_time_modify(&x, &t))
+		return false;
+	fattr->attrmask = bench_bitmap_getattr;
+	fattr->attr_vals.attrlist4_val = buf;
+	fattr->attr_vals.attrlist4_len = xdr_getpos(&x);
+
+	return true;
+}
+
+/* Add the ops looking up the test directory; return the new op count. */
+static inline int bench_lookup_dir(struct nfs4_compound_bench *b, int opcnt)
+{
+	COMPOUNDV4_ARG_ADD_OP_PUTROOTFH(opcnt, b->argops);
+	COMPOUNDV4_ARG_ADD_OP_LOOKUP(opcnt, b->argops, "vfs0");
+	COMPOUNDV4_ARG_ADD_OP_LOOKUP(opcnt, b->argops, "tc_bench");
+	return opcnt;
+}
+
+static int bench_ops_per_file(enum nfs4_bench_kind kind)
+{
+	switch (kind) {
+	case NFS4_BENCH_READ:
+	case NFS4_BENCH_WRITE:
+		return 6;	/* PUTROOTFH, LOOKUP * 2, OPEN, READ/WRITE, CLOSE */
+	case NFS4_BENCH_GETATTR:
+		return 5;	/* PUTROOTFH, LOOKUP * 3, GETATTR */
+	default:
+		return 0;
+	}
+}
+
+/* Build the arguments of the compound. */
+static void bench_build_args(struct nfs4_compound_bench *b)
+{
+	stateid4 sid;
+	stateid4 *psid = &sid;
+	fattr4 no_attrs;
+	int opcnt = 0;
+	nfs_argop4 *op;
+	int i;
+
+	memset(&sid, 0, sizeof(sid));
+	sid.seqid = 1;
+	memset(&no_attrs, 0, sizeof(no_attrs));
+
+	op = b->argops + opcnt++;
+	op->argop = NFS4_OP_SEQUENCE;
+	memset(op->nfs_argop4_u.opsequence.sa_sessionid, 0x5a,
+	       NFS4_SESSIONID_SIZE);
+	op->nfs_argop4_u.opsequence.sa_sequenceid = 7;
+	op->nfs_argop4_u.opsequence.sa_slotid = 3;
+	op->nfs_argop4_u.opsequence.sa_highest_slotid = 127;
+
+	if (b->kind == NFS4_BENCH_READDIR) {
+		opcnt = bench_lookup_dir(b, opcnt);
+		COMPOUNDV4_ARG_ADD_OP_READDIR(opcnt, b->argops, 0,
+					      bench_bitmap_getattr);
+		goto out;
+	}
+
+	for (i = 0; i < b->nfiles; ++i) {
+		char *name = bench_name(b, i);
+		char *iobuf = b->iobufs + i * b->iosize;
+
+		opcnt = bench_lookup_dir(b, opcnt);
+		switch (b->kind) {
+		case NFS4_BENCH_READ:
+		case NFS4_BENCH_WRITE:
+			COMPOUNDV4_ARG_ADD_OP_OPEN_CREATE(opcnt, b->argops,
+							  name, no_attrs, 1,
+							  bench_owner,
+							  strlen(bench_owner));
+			op = b->argops + opcnt - 1;
+			if (b->kind == NFS4_BENCH_READ) {
+				op->nfs_argop4_u.opopen.share_access =
+				    OPEN4_SHARE_ACCESS_READ;
+				op->nfs_argop4_u.opopen.openhow.opentype =
+				    OPEN4_NOCREATE;
+				COMPOUNDV4_ARG_ADD_OP_READ(opcnt, b->argops, 0,
+							   b->iosize);
+			} else {
+				COMPOUNDV4_ARG_ADD_OP_WRITE(opcnt, b->argops,
+							    0, iobuf,
+							    b->iosize);
+			}
+			COMPOUNDV4_ARG_ADD_OP_CLOSE(opcnt, b->argops, psid);
+			break;
+		case NFS4_BENCH_GETATTR:
+			COMPOUNDV4_ARG_ADD_OP_LOOKUP(opcnt, b->argops, name);
+			COMPOUNDV4_ARG_ADD_OP_GETATTR(opcnt, b->argops,
+						      bench_bitmap_getattr);
+			break;
+		default:
+			break;
+		}
+	}
+
+out:
+	b->args.minorversion = 1;
+	b->args.argarray.argarray_len = opcnt;
+	b->args.argarray.argarray_val = b->argops;
+}
+
+/* Fill the reply of a server to the compound. */
+static void bench_build_reply(struct nfs4_compound_bench *b)
+{
+	const nfs_argop4 *arg;
+	nfs_resop4 *res;
+	int i;
+	int f = 0;
+
+	for (i = 0; i < b->args.argarray.argarray_len; ++i) {
+		arg = &b->argops[i];
+		res = &b->server_resops[i];
+		res->resop = arg->argop;
+		switch (arg->argop) {
+		case NFS4_OP_SEQUENCE: {
+			SEQUENCE4resok *ok =
+			    &res->nfs_resop4_u.opsequence.SEQUENCE4res_u
+				 .sr_resok4;
+			const SEQUENCE4args *a = &arg->nfs_argop4_u.opsequence;
+
+			memcpy(ok->sr_sessionid, a->sa_sessionid,
+			       NFS4_SESSIONID_SIZE);
+			ok->sr_sequenceid = a->sa_sequenceid;
+			ok->sr_slotid = a->sa_slotid;
+			ok->sr_highest_slotid = a->sa_highest_slotid;
+			ok->sr_target_highest_slotid = 127;
+			break;
+		}
+		case NFS4_OP_OPEN: {
+			OPEN4resok *ok =
+			    &res->nfs_resop4_u.opopen.OPEN4res_u.resok4;
+
+			ok->stateid.seqid = 1;
+			memset(ok->stateid.other, f, sizeof(ok->stateid.other));
+			ok->cinfo.atomic = TRUE;
+			ok->cinfo.before = 10;
+			ok->cinfo.after = 11;
+			ok->rflags = OPEN4_RESULT_LOCKTYPE_POSIX;
+			ok->delegation.delegation_type = OPEN_DELEGATE_NONE;
+			break;
+		}
+		case NFS4_OP_READ: {
+			READ4resok *ok =
+			    &res->nfs_resop4_u.opread.READ4res_u.resok4;
+
+			ok->eof = TRUE;
+			ok->data.data_len = b->iosize;
+			ok->data.data_val = b->data;
+			break;
+		}
+		case NFS4_OP_WRITE: {
+			WRITE4resok *ok =
+			    &res->nfs_resop4_u.opwrite.WRITE4res_u.resok4;
+
+			ok->count = b->iosize;
+			ok->committed = FILE_SYNC4;
+			memset(ok->writeverf, 0x77, NFS4_VERIFIER_SIZE);
+			break;
+		}
+		case NFS4_OP_CLOSE:
+			res->nfs_resop4_u.opclose.CLOSE4res_u.open_stateid =
+			    arg->nfs_argop4_u.opclose.open_stateid;
+			++f;
+			break;
+		case NFS4_OP_GETATTR:
+			res->nfs_resop4_u.opgetattr.GETATTR4res_u.resok4
+			    .obj_attributes = b->fattrs[f++];
+			break;
+		case NFS4_OP_READDIR: {
+			READDIR4resok *ok =
+			    &res->nfs_resop4_u.opreaddir.READDIR4res_u.resok4;
+			int e;
+
+			for (e = 0; e < b->nfiles; ++e) {
+				b->entries[e].cookie = e + 3;
+				b->entries[e].name.utf8string_val =
+				    bench_name(b, e);
+				b->entries[e].name.utf8string_len =
+				    strlen(bench_name(b, e));
+				b->entries[e].attrs = b->fattrs[e];
+				b->entries[e].nextentry =
+				    e + 1 < b->nfiles ? &b->entries[e + 1]
+						      : NULL;
+			}
+			ok->reply.entries = b->entries;
+			ok->reply.eof = TRUE;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+/* Preset the results the way handle.c does before sending a compound. */
+static void bench_preset_results(struct nfs4_compound_bench *b)
+{
+	nfs_resop4 *res;
+	int i;
+	int f = 0;
+
+	for (i = 0; i < b->args.argarray.argarray_len; ++i) {
+		res = &b->client_resops[i];
+		switch (b->argops[i].argop) {
+		case NFS4_OP_READ:
+			res->nfs_resop4_u.opread.READ4res_u.resok4.data
+			    .data_val = b->iobufs + f * b->iosize;
+			break;
+		case NFS4_OP_CLOSE:
+			++f;
+			break;
+		case NFS4_OP_GETATTR: {
+			GETATTR4resok *a =
+			    &res->nfs_resop4_u.opgetattr.GETATTR4res_u.resok4;
+
+			a->obj_attributes.attr_vals.attrlist4_val =
+			    b->attr_blobs + f * BENCH_ATTR_BUFSIZE;
+			a->obj_attributes.attr_vals.attrlist4_len =
+			    BENCH_ATTR_BUFSIZE;
+			++f;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+void nfs4_compound_bench_free(struct nfs4_compound_bench *b)
+{
+	if (!b)
+		return;
+	free(b->argops);
+	free(b->server_resops);
+	free(b->client_resops);
+	free(b->names);
+	free(b->fattrs);
+	free(b->attr_bufs);
+	free(b->attr_blobs);
+	free(b->data);
+	free(b->iobufs);
+	free(b->entries);
+	free(b->sendbuf);
+	free(b->replybuf);
+	free(b);
+}
+
+struct nfs4_compound_bench *nfs4_compound_bench_new(enum nfs4_bench_kind kind,
+						   int nfiles, size_t iosize)
+{
+	struct nfs4_compound_bench *b;
+	COMPOUND4res res;
+	XDR x;
+	int nops;
+	int i;
+
+	pthread_once(&bench_once, bench_init_once);
+
+	if (kind == NFS4_BENCH_READDIR)
+		nops = 5;	/* SEQUENCE, PUTROOTFH, LOOKUP * 2, READDIR */
+	else
+		nops = 1 + nfiles * bench_ops_per_file(kind);
+	if (nfiles <= 0 || nops > BENCH_MAX_OPS)
+		return NULL;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+	b->kind = kind;
+	b->nfiles = nfiles;
+	b->iosize = (kind == NFS4_BENCH_READ || kind == NFS4_BENCH_WRITE)
+			? iosize
+			: 0;
+	b->argops = calloc(nops, sizeof(*b->argops));
+	b->server_resops = calloc(nops, sizeof(*b->server_resops));
+	b->client_resops = calloc(nops, sizeof(*b->client_resops));
+	b->names = calloc(nfiles, NAME_MAX + 1);
+	b->fattrs = calloc(nfiles, sizeof(*b->fattrs));
+	b->attr_bufs = calloc(nfiles, BENCH_ATTR_BUFSIZE);
+	b->attr_blobs = calloc(nfiles, BENCH_ATTR_BUFSIZE);
+	b->data = calloc(1, b->iosize + 1);
+	b->iobufs = calloc(nfiles, b->iosize + 1);
+	b->entries = calloc(nfiles, sizeof(*b->entries));
+	if (!b->argops || !b->server_resops || !b->client_resops ||
+	    !b->names || !b->fattrs || !b->attr_bufs || !b->attr_blobs ||
+	    !b->data || !b->iobufs || !b->entries)
+		goto err;
+
+	memset(b->data, 'x', b->iosize);
+	for (i = 0; i < nfiles; ++i) {
+		snprintf(bench_name(b, i), NAME_MAX + 1, "file-%d", i);
+		if (!bench_encode_fattr(b, i))
+			goto err;
+	}
+
+	bench_build_args(b);
+	bench_build_reply(b);
+	bench_preset_results(b);
+
+	/* headroom for the RPC header, as in fs_compoundv4_call() */
+	b->sendbuf_size = 1024 + nops * (NAME_MAX + 64) + nfiles * b->iosize;
+	b->sendbuf = malloc(b->sendbuf_size);
+	b->replybuf = malloc(b->sendbuf_size + nfiles * BENCH_ATTR_BUFSIZE);
+	if (!b->sendbuf || !b->replybuf)
+		goto err;
+
+	memset(&res, 0, sizeof(res));
+	res.status = NFS4_OK;
+	res.resarray.resarray_len = b->args.argarray.argarray_len;
+	res.resarray.resarray_val = b->server_resops;
+	bench_xdrmem_create(&x, b->replybuf,
+			    b->sendbuf_size + nfiles * BENCH_ATTR_BUFSIZE,
+			    XDR_ENCODE);
+	if (!xdr_COMPOUND4res(&x, &res))
+		goto err;
+	b->reply_len = xdr_getpos(&x);
+
+	return b;
+
+err:
+	nfs4_compound_bench_free(b);
+	return NULL;
+}
+
+int nfs4_compound_bench_nops(const struct nfs4_compound_bench *b)
+{
+	return b->args.argarray.argarray_len;
+}
+
+int nfs4_compound_bench_encode(struct nfs4_compound_bench *b)
+{
+	XDR x;
+
+	bench_xdrmem_create(&x, b->sendbuf, b->sendbuf_size, XDR_ENCODE);
+	if (!xdr_COMPOUND4args(&x, &b->args))
+		return -1;
+	return xdr_getpos(&x);
+}
+
+int nfs4_compound_bench_decode(struct nfs4_compound_bench *b)
+{
+	COMPOUND4res res;
+	READDIR4resok *rdok;
+	XDR x;
+	int n;
+
+	memset(&res, 0, sizeof(res));
+	res.resarray.resarray_len = b->args.argarray.argarray_len;
+	res.resarray.resarray_val = b->client_resops;
+	bench_xdrmem_create(&x, b->replybuf, b->reply_len, XDR_DECODE);
+	if (!xdr_COMPOUND4res(&x, &res))
+		return -1;
+	n = xdr_getpos(&x);
+
+	/* READDIR entries are allocated by XDR and freed after use */
+	if (b->kind == NFS4_BENCH_READDIR) {
+		rdok = &b->client_resops[res.resarray.resarray_len - 1]
+			    .nfs_resop4_u.opreaddir.READDIR4res_u.resok4;
+		memset(&x, 0, sizeof(x));
+		x.x_op = XDR_FREE;
+		xdr_dirlist4(&x, &rdok->reply);
+		rdok->reply.entries = NULL;
+	}
+
+	return n;
+}
+
+int nfs4_compound_bench_convert_attrs(struct nfs4_compound_bench *b,
+				      struct tc_attrs *attrs)
+{
+	const nfs_resop4 *res;
+	const entry4 *e;
+	int i;
+	int n = 0;
+
+	for (i = 0; i < b->args.argarray.argarray_len; ++i) {
+		res = &b->server_resops[i];
+		if (res->resop == NFS4_OP_GETATTR) {
+			fattr4_to_tc_attrs(&res->nfs_resop4_u.opgetattr
+						.GETATTR4res_u.resok4
+						.obj_attributes,
+					   attrs + n++);
+		} else if (res->resop == NFS4_OP_READDIR) {
+			for (e = res->nfs_resop4_u.opreaddir.READDIR4res_u
+				     .resok4.reply.entries;
+			     e; e = e->nextentry) {
+				fattr4_to_tc_attrs(&e->attrs, attrs + n++);
+			}
+		}
+	}
+
+	return n;
+}
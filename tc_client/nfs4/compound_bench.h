@@ -0,0 +1,89 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Compounds for benchmarking the XDR work of the NFS4 backend without a
+ * server.
+ *
+ * A benchmark compound is built the way handle.c builds it, with the same
+ * macros and attributes, together with the reply a server would send
+ * for it.  The reply is encoded once; it is then decoded as many times as
+ * needed into results preset the way the client presets them.  This lives in
+ * C because "nfsv41.h" cannot be included from C++.
+ */
+
+#ifndef __TC_NFS4_COMPOUND_BENCH_H__
+#define __TC_NFS4_COMPOUND_BENCH_H__
+
+#include <stddef.h>
+
+#include "tc_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum nfs4_bench_kind {
+	NFS4_BENCH_READ,	/* OPEN, READ and CLOSE each file by path */
+	NFS4_BENCH_WRITE,	/* OPEN, WRITE and CLOSE each file by path */
+	NFS4_BENCH_GETATTR,	/* LOOKUP and GETATTR each file by path */
+	NFS4_BENCH_READDIR,	/* READDIR a directory of "nfiles" entries */
+};
+
+struct nfs4_compound_bench;
+
+/**
+ * Build a compound of "kind" over "nfiles" files, each reading or writing
+ * "iosize" bytes, with its reply.
+ *
+ * Return NULL if the compound does not fit in a session (256 ops).
+ */
+struct nfs4_compound_bench *nfs4_compound_bench_new(enum nfs4_bench_kind kind,
+						   int nfiles, size_t iosize);
+
+void nfs4_compound_bench_free(struct nfs4_compound_bench *b);
+
+/**
+ * Return the number of operations in the compound.
+ */
+int nfs4_compound_bench_nops(const struct nfs4_compound_bench *b);
+
+/**
+ * XDR-encode the COMPOUND4args; return the encoded size or -1.
+ */
+int nfs4_compound_bench_encode(struct nfs4_compound_bench *b);
+
+/**
+ * XDR-decode the COMPOUND4res; return the decoded size or -1.
+ */
+int nfs4_compound_bench_decode(struct nfs4_compound_bench *b);
+
+/**
+ * Convert every fattr4 of the reply with fattr4_to_tc_attrs() into "attrs",
+ * which has room for "nfiles" entries.  Return the number converted.
+ */
+int nfs4_compound_bench_convert_attrs(struct nfs4_compound_bench *b,
+				      struct tc_attrs *attrs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TC_NFS4_COMPOUND_BENCH_H__
@@ -0,0 +1,224 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "compound_sched.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "tc_helper.h"
+
+/* virtual time taken by a compound of weight 1 */
+#define TC_SCHED_COST (1ULL << 20)
+
+struct tc_sched_waiter {
+	struct tc_sched_waiter *next;
+	pthread_cond_t cv;
+	uint64_t tag;		/* virtual finish tag */
+	bool admitted;
+};
+
+struct tc_sched_class {
+	struct tc_sched_waiter *head;	/* FIFO of waiting compounds */
+	struct tc_sched_waiter *tail;
+	int queued;
+	int inflight;
+	int max_inflight;
+	int weight;
+	uint64_t last_tag;	/* tag of the last compound queued */
+	uint64_t compounds;	/* # of compounds admitted */
+	uint64_t wait_ns;
+	uint64_t max_wait_ns;
+};
+
+static pthread_mutex_t tc_sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static int tc_sched_inflight;
+static uint64_t tc_sched_vtime;	/* tag of the last compound admitted */
+
+/*
+ * Bulk compounds can never take all slots, and interactive ones get eight
+ * times the slots of bulk ones when all classes are busy.
+ */
+static struct tc_sched_class tc_sched_classes[TC_PRIO_COUNT] = {
+	[TC_PRIO_INTERACTIVE] = { .max_inflight = TC_SCHED_CAPACITY,
+				  .weight = 8 },
+	[TC_PRIO_NORMAL] = { .max_inflight = TC_SCHED_CAPACITY, .weight = 4 },
+	[TC_PRIO_BULK] = { .max_inflight = TC_SCHED_CAPACITY / 2,
+			   .weight = 1 },
+};
+
+static struct tc_func_counter tc_sched_counters[TC_PRIO_COUNT] = {
+	[TC_PRIO_INTERACTIVE] = { .name = "sched_wait_interactive" },
+	[TC_PRIO_NORMAL] = { .name = "sched_wait_normal" },
+	[TC_PRIO_BULK] = { .name = "sched_wait_bulk" },
+};
+
+static __thread int tc_sched_thread_class = TC_PRIO_NORMAL;
+
+static inline bool tc_sched_valid_class(int prio)
+{
+	return prio >= 0 && prio < TC_PRIO_COUNT;
+}
+
+int tc_sched_set_thread_class(int prio)
+{
+	int old = tc_sched_thread_class;
+
+	if (!tc_sched_valid_class(prio)) {
+		return -EINVAL;
+	}
+	tc_sched_thread_class = prio;
+	return old;
+}
+
+/*
+ * Admit the waiting compound with the smallest tag among the classes below
+ * their limits, as long as there is capacity.  Called with "tc_sched_lock"
+ * held.
+ */
+static void tc_sched_dispatch(void)
+{
+	struct tc_sched_class *cls;
+	struct tc_sched_class *best;
+	struct tc_sched_waiter *w;
+	int i;
+
+	while (tc_sched_inflight < TC_SCHED_CAPACITY) {
+		best = NULL;
+		for (i = 0; i < TC_PRIO_COUNT; ++i) {
+			cls = &tc_sched_classes[i];
+			if (cls->head && cls->inflight < cls->max_inflight &&
+			    (!best || cls->head->tag < best->head->tag)) {
+				best = cls;
+			}
+		}
+		if (!best) {
+			return;
+		}
+		w = best->head;
+		best->head = w->next;
+		if (!best->head) {
+			best->tail = NULL;
+		}
+		--best->queued;
+		++best->inflight;
+		++tc_sched_inflight;
+		if (w->tag > tc_sched_vtime) {
+			tc_sched_vtime = w->tag;
+		}
+		w->admitted = true;
+		pthread_cond_signal(&w->cv);
+	}
+}
+
+int tc_sched_set_class_limits(int prio, int max_inflight, int weight)
+{
+	if (!tc_sched_valid_class(prio) || max_inflight < 1 ||
+	    max_inflight > TC_SCHED_CAPACITY || weight < 1) {
+		return -EINVAL;
+	}
+	pthread_mutex_lock(&tc_sched_lock);
+	tc_sched_classes[prio].max_inflight = max_inflight;
+	tc_sched_classes[prio].weight = weight;
+	tc_sched_dispatch();
+	pthread_mutex_unlock(&tc_sched_lock);
+	return 0;
+}
+
+int tc_sched_get_stats(int prio, struct tc_sched_stats *stats)
+{
+	struct tc_sched_class *cls;
+
+	if (!tc_sched_valid_class(prio)) {
+		return -EINVAL;
+	}
+	cls = &tc_sched_classes[prio];
+	pthread_mutex_lock(&tc_sched_lock);
+	stats->queued = cls->queued;
+	stats->inflight = cls->inflight;
+	stats->max_inflight = cls->max_inflight;
+	stats->weight = cls->weight;
+	stats->compounds = cls->compounds;
+	stats->wait_ns = cls->wait_ns;
+	stats->max_wait_ns = cls->max_wait_ns;
+	pthread_mutex_unlock(&tc_sched_lock);
+	return 0;
+}
+
+int tc_sched_enter(void)
+{
+	int prio = tc_sched_thread_class;
+	struct tc_sched_class *cls = &tc_sched_classes[prio];
+	struct tc_sched_waiter w;
+	struct timespec start;
+	struct timespec stop;
+	uint64_t ns;
+
+	tc_register_counter(&tc_sched_counters[prio]);
+	now(&start);
+
+	w.next = NULL;
+	w.admitted = false;
+	pthread_cond_init(&w.cv, NULL);
+
+	pthread_mutex_lock(&tc_sched_lock);
+	/* a class idle for a while starts from the current virtual time */
+	w.tag = (cls->last_tag > tc_sched_vtime ? cls->last_tag
+						 : tc_sched_vtime) +
+		TC_SCHED_COST / cls->weight;
+	cls->last_tag = w.tag;
+	if (cls->tail) {
+		cls->tail->next = &w;
+	} else {
+		cls->head = &w;
+	}
+	cls->tail = &w;
+	++cls->queued;
+
+	tc_sched_dispatch();
+	while (!w.admitted) {
+		pthread_cond_wait(&w.cv, &tc_sched_lock);
+	}
+
+	now(&stop);
+	ns = timespec_diff(&start, &stop);
+	++cls->compounds;
+	cls->wait_ns += ns;
+	if (ns > cls->max_wait_ns) {
+		cls->max_wait_ns = ns;
+	}
+	pthread_mutex_unlock(&tc_sched_lock);
+
+	pthread_cond_destroy(&w.cv);
+	tc_counter_record(&tc_sched_counters[prio], 1, ns, true);
+	return prio;
+}
+
+void tc_sched_leave(int prio)
+{
+	pthread_mutex_lock(&tc_sched_lock);
+	assert(tc_sched_classes[prio].inflight > 0);
+	--tc_sched_classes[prio].inflight;
+	--tc_sched_inflight;
+	tc_sched_dispatch();
+	pthread_mutex_unlock(&tc_sched_lock);
+}
@@ -0,0 +1,90 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Scheduling of the compounds sent by the NFS4 backend.
+ *
+ * A compound with SEQUENCE is admitted by tc_sched_enter() before it takes
+ * a session slot, and leaves by tc_sched_leave() once the slot is freed.  At
+ * most TC_SCHED_CAPACITY (16) compounds are in flight, well below the 128
+ * RPC contexts and session slots the client has.  Admitted compounds can
+ * still wait for a slot if the server lowers its target_highest_slotid
+ * below TC_SCHED_CAPACITY.
+ *
+ * Each compound belongs to the priority class (TC_PRIO_*) of the thread
+ * sending it.  A class has a limit of compounds in flight, and a weight:
+ * waiting compounds are admitted in the order of their virtual finish tags
+ * (weighted fair queueing), so a class gets slots in proportion to its
+ * weight when all of them are busy.  The queueing delay of each class is
+ * recorded by the "sched_wait_<class>" counters.
+ */
+
+#ifndef __TC_NFS4_COMPOUND_SCHED_H__
+#define __TC_NFS4_COMPOUND_SCHED_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tc_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TC_SCHED_CAPACITY 16
+
+/**
+ * Set the class of the compounds of the calling thread.
+ *
+ * Return the previous class, or -EINVAL if "prio" is invalid.
+ */
+int tc_sched_set_thread_class(int prio);
+
+/**
+ * Set the limit of compounds in flight (1 to TC_SCHED_CAPACITY) and the
+ * weight (>= 1) of class "prio".
+ *
+ * Return 0 on success or -EINVAL.
+ */
+int tc_sched_set_class_limits(int prio, int max_inflight, int weight);
+
+/**
+ * Return 0 and fill "stats" of class "prio", or -EINVAL.
+ */
+int tc_sched_get_stats(int prio, struct tc_sched_stats *stats);
+
+/**
+ * Wait until a compound of the calling thread's class can be sent.  It is
+ * thread-safe.
+ *
+ * Return the class, which is to be passed to tc_sched_leave().
+ */
+int tc_sched_enter(void);
+
+/**
+ * A compound of class "prio" admitted by tc_sched_enter() is done.
+ */
+void tc_sched_leave(int prio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __TC_NFS4_COMPOUND_SCHED_H__ */
@@ -0,0 +1,318 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "compound_trace.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+struct tc_trace_ring {
+	struct tc_trace_ring *next;
+	bool in_use;		/* owned by a live thread */
+	uint64_t head;		/* # of records ever written */
+	struct tc_compound_trace records[TC_TRACE_RING_SIZE];
+};
+
+bool tc_trace_enabled = false;
+
+static struct tc_trace_ring *tc_trace_rings = NULL;
+static pthread_mutex_t tc_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tc_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tc_trace_key;
+static volatile sig_atomic_t tc_trace_dump_requested = 0;
+
+static __thread struct tc_trace_ring *tc_trace_my_ring = NULL;
+static __thread struct tc_compound_trace tc_trace_cur;
+
+static const char *tc_trace_op_names[NFS4_OP_IO_ADVISE + 1] = {
+	[NFS4_OP_ACCESS] = "ACCESS",
+	[NFS4_OP_CLOSE] = "CLOSE",
+	[NFS4_OP_COMMIT] = "COMMIT",
+	[NFS4_OP_CREATE] = "CREATE",
+	[NFS4_OP_DELEGPURGE] = "DELEGPURGE",
+	[NFS4_OP_DELEGRETURN] = "DELEGRETURN",
+	[NFS4_OP_GETATTR] = "GETATTR",
+	[NFS4_OP_GETFH] = "GETFH",
+	[NFS4_OP_LINK] = "LINK",
+	[NFS4_OP_LOCK] = "LOCK",
+	[NFS4_OP_LOCKT] = "LOCKT",
+	[NFS4_OP_LOCKU] = "LOCKU",
+	[NFS4_OP_LOOKUP] = "LOOKUP",
+	[NFS4_OP_LOOKUPP] = "LOOKUPP",
+	[NFS4_OP_NVERIFY] = "NVERIFY",
+	[NFS4_OP_OPEN] = "OPEN",
+	[NFS4_OP_OPENATTR] = "OPENATTR",
+	[NFS4_OP_OPEN_CONFIRM] = "OPEN_CONFIRM",
+	[NFS4_OP_OPEN_DOWNGRADE] = "OPEN_DOWNGRADE",
+	[NFS4_OP_PUTFH] = "PUTFH",
+	[NFS4_OP_PUTPUBFH] = "PUTPUBFH",
+	[NFS4_OP_PUTROOTFH] = "PUTROOTFH",
+	[NFS4_OP_READ] = "READ",
+	[NFS4_OP_READDIR] = "READDIR",
+	[NFS4_OP_READLINK] = "READLINK",
+	[NFS4_OP_REMOVE] = "REMOVE",
+	[NFS4_OP_RENAME] = "RENAME",
+	[NFS4_OP_RENEW] = "RENEW",
+	[NFS4_OP_RESTOREFH] = "RESTOREFH",
+	[NFS4_OP_SAVEFH] = "SAVEFH",
+	[NFS4_OP_SECINFO] = "SECINFO",
+	[NFS4_OP_SETATTR] = "SETATTR",
+	[NFS4_OP_SETCLIENTID] = "SETCLIENTID",
+	[NFS4_OP_SETCLIENTID_CONFIRM] = "SETCLIENTID_CONFIRM",
+	[NFS4_OP_VERIFY] = "VERIFY",
+	[NFS4_OP_WRITE] = "WRITE",
+	[NFS4_OP_RELEASE_LOCKOWNER] = "RELEASE_LOCKOWNER",
+	[NFS4_OP_BACKCHANNEL_CTL] = "BACKCHANNEL_CTL",
+	[NFS4_OP_BIND_CONN_TO_SESSION] = "BIND_CONN_TO_SESSION",
+	[NFS4_OP_EXCHANGE_ID] = "EXCHANGE_ID",
+	[NFS4_OP_CREATE_SESSION] = "CREATE_SESSION",
+	[NFS4_OP_DESTROY_SESSION] = "DESTROY_SESSION",
+	[NFS4_OP_FREE_STATEID] = "FREE_STATEID",
+	[NFS4_OP_GET_DIR_DELEGATION] = "GET_DIR_DELEGATION",
+	[NFS4_OP_GETDEVICEINFO] = "GETDEVICEINFO",
+	[NFS4_OP_GETDEVICELIST] = "GETDEVICELIST",
+	[NFS4_OP_LAYOUTCOMMIT] = "LAYOUTCOMMIT",
+	[NFS4_OP_LAYOUTGET] = "LAYOUTGET",
+	[NFS4_OP_LAYOUTRETURN] = "LAYOUTRETURN",
+	[NFS4_OP_SECINFO_NO_NAME] = "SECINFO_NO_NAME",
+	[NFS4_OP_SEQUENCE] = "SEQUENCE",
+	[NFS4_OP_SET_SSV] = "SET_SSV",
+	[NFS4_OP_TEST_STATEID] = "TEST_STATEID",
+	[NFS4_OP_WANT_DELEGATION] = "WANT_DELEGATION",
+	[NFS4_OP_DESTROY_CLIENTID] = "DESTROY_CLIENTID",
+	[NFS4_OP_RECLAIM_COMPLETE] = "RECLAIM_COMPLETE",
+	[NFS4_OP_ALLOCATE] = "ALLOCATE",
+	[NFS4_OP_COPY] = "COPY",
+	[NFS4_OP_OFFLOAD_ABORT] = "OFFLOAD_ABORT",
+	[NFS4_OP_COPY_NOTIFY] = "COPY_NOTIFY",
+	[NFS4_OP_OFFLOAD_REVOKE] = "OFFLOAD_REVOKE",
+	[NFS4_OP_OFFLOAD_STATUS] = "OFFLOAD_STATUS",
+	[NFS4_OP_WRITE_PLUS] = "WRITE_PLUS",
+	[NFS4_OP_READ_PLUS] = "READ_PLUS",
+	[NFS4_OP_SEEK] = "SEEK",
+	[NFS4_OP_IO_ADVISE] = "IO_ADVISE",
+};
+
+static inline uint64_t tc_trace_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void tc_trace_release_ring(void *arg)
+{
+	struct tc_trace_ring *ring = arg;
+
+	pthread_mutex_lock(&tc_trace_lock);
+	ring->in_use = false;
+	pthread_mutex_unlock(&tc_trace_lock);
+}
+
+static void tc_trace_sigusr2(int sig)
+{
+	tc_trace_dump_requested = 1;
+}
+
+static void tc_trace_init_once(void)
+{
+	struct sigaction sa;
+
+	pthread_key_create(&tc_trace_key, tc_trace_release_ring);
+
+	/* opt-in, as the application or the log may use SIGUSR2 itself */
+	if (!getenv("TC_TRACE_SIGUSR2")) {
+		return;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = tc_trace_sigusr2;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, NULL);
+}
+
+void tc_trace_enable(bool enabled)
+{
+	if (enabled) {
+		pthread_once(&tc_trace_once, tc_trace_init_once);
+	}
+	__atomic_store_n(&tc_trace_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Return the ring of the calling thread: a ring left by an exited thread if
+ * any, or a new one.
+ */
+static struct tc_trace_ring *tc_trace_ring()
+{
+	struct tc_trace_ring *ring;
+
+	if (tc_trace_my_ring)
+		return tc_trace_my_ring;
+
+	pthread_mutex_lock(&tc_trace_lock);
+	for (ring = tc_trace_rings; ring; ring = ring->next) {
+		if (!ring->in_use)
+			break;
+	}
+	if (!ring) {
+		ring = calloc(1, sizeof(*ring));
+		if (ring) {
+			ring->next = tc_trace_rings;
+			tc_trace_rings = ring;
+		}
+	}
+	if (ring)
+		ring->in_use = true;
+	pthread_mutex_unlock(&tc_trace_lock);
+
+	if (ring) {
+		pthread_setspecific(tc_trace_key, ring);
+		tc_trace_my_ring = ring;
+	}
+	return ring;
+}
+
+void tc_trace_reset_impl()
+{
+	memset(&tc_trace_cur, 0, sizeof(tc_trace_cur));
+	tc_trace_cur.slotid = -1;
+	tc_trace_cur.reset_ns = tc_trace_now();
+}
+
+void tc_trace_slot_impl(int slotid)
+{
+	tc_trace_cur.slotid = slotid;
+	tc_trace_cur.slot_ns = tc_trace_now();
+}
+
+void tc_trace_send_impl(uint32_t xid, const COMPOUND4args *args,
+			uint32_t bytes, uint32_t max_bytes, int max_ops)
+{
+	struct tc_compound_trace *t = &tc_trace_cur;
+	u_int i;
+
+	t->xid = xid;
+	t->nops = args->argarray.argarray_len;
+	t->max_ops = max_ops;
+	for (i = 0; i < t->nops && i < TC_TRACE_MAX_OPS; ++i)
+		t->ops[i] = args->argarray.argarray_val[i].argop;
+	t->request_bytes = bytes;
+	t->max_request_bytes = max_bytes;
+	t->send_ns = tc_trace_now();
+}
+
+void tc_trace_reply_impl(int bytes)
+{
+	tc_trace_cur.reply_bytes = bytes > 0 ? bytes : 0;
+	tc_trace_cur.reply_ns = tc_trace_now();
+}
+
+void tc_trace_done_impl(const char *caller, int rpc_status, int nfs_status)
+{
+	struct tc_trace_ring *ring;
+	struct tc_compound_trace *t = &tc_trace_cur;
+	char path[64];
+
+	if (t->send_ns != 0 && (ring = tc_trace_ring()) != NULL) {
+		t->caller = caller;
+		t->tid = syscall(SYS_gettid);
+		t->rpc_status = rpc_status;
+		t->nfs_status = nfs_status;
+		t->done_ns = tc_trace_now();
+		ring->records[ring->head % TC_TRACE_RING_SIZE] = *t;
+		__atomic_store_n(&ring->head, ring->head + 1,
+				 __ATOMIC_RELEASE);
+	}
+	memset(t, 0, sizeof(*t));
+
+	if (tc_trace_dump_requested) {
+		tc_trace_dump_requested = 0;
+		snprintf(path, sizeof(path), "%s.%d", TC_TRACE_DUMP_PATH,
+			 (int)getpid());
+		tc_trace_dump(path);
+	}
+}
+
+static void tc_trace_print(FILE *fp, const struct tc_compound_trace *t)
+{
+	int i;
+	nfs_opnum4 op;
+
+	fprintf(fp, "%d %s %" PRIu32 " %d %u %u %" PRIu32 " %" PRIu32
+		    " %" PRIu32 " %" PRIu64 " %" PRIu64 " %" PRIu64
+		    " %" PRIu64 " %" PRIu64 " %d %d ",
+		(int)t->tid, t->caller ? t->caller : "-", t->xid, t->slotid,
+		t->nops, t->max_ops, t->request_bytes, t->max_request_bytes,
+		t->reply_bytes, t->reset_ns, t->slot_ns, t->send_ns,
+		t->reply_ns, t->done_ns, t->rpc_status, t->nfs_status);
+	for (i = 0; i < t->nops && i < TC_TRACE_MAX_OPS; ++i) {
+		op = t->ops[i];
+		if (i > 0)
+			fputc(',', fp);
+		if (op <= NFS4_OP_IO_ADVISE && tc_trace_op_names[op])
+			fputs(tc_trace_op_names[op], fp);
+		else
+			fprintf(fp, "%d", op);
+	}
+	if (t->nops > TC_TRACE_MAX_OPS)
+		fputs(",...", fp);
+	fputc('\n', fp);
+}
+
+int tc_trace_dump(const char *path)
+{
+	struct tc_trace_ring *ring;
+	struct tc_compound_trace t;
+	uint64_t head;
+	uint64_t i;
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return -errno;
+
+	fprintf(fp, "# tid caller xid slot nops max_ops request_bytes "
+		    "max_request_bytes reply_bytes reset_ns slot_ns send_ns "
+		    "reply_ns done_ns rpc_status nfs_status ops\n");
+	pthread_mutex_lock(&tc_trace_lock);
+	for (ring = tc_trace_rings; ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		i = head > TC_TRACE_RING_SIZE ? head - TC_TRACE_RING_SIZE : 0;
+		for (; i < head; ++i) {
+			t = ring->records[i % TC_TRACE_RING_SIZE];
+			tc_trace_print(fp, &t);
+		}
+	}
+	pthread_mutex_unlock(&tc_trace_lock);
+
+	if (fclose(fp) != 0)
+		return -errno;
+	return 0;
+}
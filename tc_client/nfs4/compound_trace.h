@@ -0,0 +1,136 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Tracing of the compounds sent by the NFS4 backend.
+ *
+ * When enabled, each thread records its last TC_TRACE_RING_SIZE compounds in
+ * its own ring buffer, so recording takes no lock.  The ring of an exited
+ * thread is kept for dumping until another thread adopts it.  A compound is
+ * traced in stages by the thread sending it:
+ *
+ *	tc_trace_reset()	tc_reset_compound() starts a new compound
+ *	tc_trace_slot()		alloc_session_slot() returned a slot
+ *	tc_trace_send()		fs_compoundv4_call() encoded and sent it
+ *	tc_trace_reply()	fs_process_reply() received the reply
+ *	tc_trace_done()		fs_compoundv4_execute() finished it
+ *
+ * The rings are dumped as text by tc_trace_dump(), or upon SIGUSR2 into
+ * TC_TRACE_DUMP_PATH.<pid> if the TC_TRACE_SIGUSR2 environment variable is
+ * set when tracing is first enabled; tc/tc_trace_stat.cpp summarizes a dump.
+ */
+
+#ifndef __TC_NFS4_COMPOUND_TRACE_H__
+#define __TC_NFS4_COMPOUND_TRACE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "nfsv41.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TC_TRACE_RING_SIZE 4096
+/* Only the first TC_TRACE_MAX_OPS ops of a compound are recorded. */
+#define TC_TRACE_MAX_OPS 32
+#define TC_TRACE_DUMP_PATH "/tmp/tc-trace"
+
+struct tc_compound_trace {
+	const char *caller;
+	pid_t tid;
+	uint32_t xid;
+	int32_t slotid;		/* -1 if the compound has no SEQUENCE */
+	uint16_t nops;
+	uint16_t max_ops;
+	uint8_t ops[TC_TRACE_MAX_OPS];
+	uint32_t request_bytes;
+	uint32_t max_request_bytes;
+	uint32_t reply_bytes;
+	int32_t rpc_status;
+	int32_t nfs_status;
+	/* CLOCK_MONOTONIC timestamps in ns; 0 if the stage did not happen */
+	uint64_t reset_ns;
+	uint64_t slot_ns;
+	uint64_t send_ns;
+	uint64_t reply_ns;
+	uint64_t done_ns;
+};
+
+extern bool tc_trace_enabled;
+
+void tc_trace_enable(bool enabled);
+
+void tc_trace_reset_impl();
+void tc_trace_slot_impl(int slotid);
+void tc_trace_send_impl(uint32_t xid, const COMPOUND4args *args,
+			uint32_t bytes, uint32_t max_bytes, int max_ops);
+void tc_trace_reply_impl(int bytes);
+void tc_trace_done_impl(const char *caller, int rpc_status, int nfs_status);
+
+static inline void tc_trace_reset()
+{
+	if (__atomic_load_n(&tc_trace_enabled, __ATOMIC_RELAXED))
+		tc_trace_reset_impl();
+}
+
+static inline void tc_trace_slot(int slotid)
+{
+	if (__atomic_load_n(&tc_trace_enabled, __ATOMIC_RELAXED))
+		tc_trace_slot_impl(slotid);
+}
+
+static inline void tc_trace_send(uint32_t xid, const COMPOUND4args *args,
+				 uint32_t bytes, uint32_t max_bytes,
+				 int max_ops)
+{
+	if (__atomic_load_n(&tc_trace_enabled, __ATOMIC_RELAXED))
+		tc_trace_send_impl(xid, args, bytes, max_bytes, max_ops);
+}
+
+static inline void tc_trace_reply(int bytes)
+{
+	if (__atomic_load_n(&tc_trace_enabled, __ATOMIC_RELAXED))
+		tc_trace_reply_impl(bytes);
+}
+
+static inline void tc_trace_done(const char *caller, int rpc_status,
+				 int nfs_status)
+{
+	if (__atomic_load_n(&tc_trace_enabled, __ATOMIC_RELAXED))
+		tc_trace_done_impl(caller, rpc_status, nfs_status);
+}
+
+/**
+ * Write the traced compounds of all threads to "path", one compound per line
+ * in the format described by the header line.  Records being overwritten
+ * during the dump may be inconsistent.
+ *
+ * Return 0 on success or -errno.
+ */
+int tc_trace_dump(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TC_NFS4_COMPOUND_TRACE_H__
@@ -0,0 +1,2159 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "fake_server.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "nfsv41.h"
+
+#define FAKE_NFS_PROGRAM 100003
+#define FAKE_NFS_VERSION 4
+/* Largest RPC record accepted or sent */
+#define FAKE_MAX_MSG (4 << 20)
+#define FAKE_MAX_IO (1 << 20)
+#define FAKE_MAX_FILE_SIZE (1ULL << 34)
+#define FAKE_MAX_OPS 1024
+#define FAKE_MAX_SLOTS 128
+#define FAKE_LEASE_TIME 60
+#define FAKE_FS_BYTES (1ULL << 40)
+#define FAKE_FS_FILES (1ULL << 32)
+#define FAKE_ATTR_BUFSIZE 1024
+#define FAKE_HASH_SIZE (1 << 16)
+#define FAKE_ROOT_ID 1
+#define FAKE_SERVER_OWNER "tc-fake-server"
+
+struct fake_dirent;
+
+struct fake_node {
+	uint64_t id;
+	nfs_ftype4 type;
+	uint32_t mode;		/* permission bits only */
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t nlink;
+	uint64_t change;
+	nfstime4 atime;
+	nfstime4 mtime;
+	nfstime4 ctime;
+	specdata4 rawdev;
+	char *data;		/* file content or symlink target */
+	size_t size;
+	size_t capacity;
+	/* directories only */
+	struct fake_node *parent;
+	struct fake_dirent *first;	/* entries in the order of cookies */
+	struct fake_dirent *last;
+	uint64_t next_cookie;
+};
+
+struct fake_dirent {
+	struct fake_node *dir;
+	struct fake_node *node;
+	char *name;		/* not NUL-terminated */
+	u_int namelen;
+	uint64_t hash;
+	uint64_t cookie;
+	struct fake_dirent *prev;
+	struct fake_dirent *next;
+	struct fake_dirent *hash_next;
+};
+
+/* A reply waiting for its injected delay, preceded by its record mark. */
+struct fake_reply {
+	struct fake_reply *next;
+	uint64_t due_ns;
+	size_t len;
+	char buf[];
+};
+
+struct fake_conn {
+	struct tc_fake_server *server;
+	int fd;
+	pthread_t reader;
+	pthread_t writer;
+	char *recvbuf;
+	size_t recvbuf_size;
+	char *sendbuf;		/* FAKE_MAX_MSG + 4 bytes */
+	uint64_t link_free_ns;	/* when the link finishes sending */
+	pthread_mutex_t lock;	/* protects the fields below */
+	pthread_cond_t cond;
+	struct fake_reply *head;
+	struct fake_reply *tail;
+	bool closing;
+	struct fake_conn *next;
+};
+
+struct tc_fake_server {
+	int listen_fd;
+	uint16_t port;
+	pthread_t acceptor;
+	bool stopping;
+	uint32_t rtt_us;
+	uint64_t bandwidth;
+	uint64_t clientid;
+	uint64_t nsessions;
+	uint32_t nopens;
+	verifier4 write_verf;
+
+	pthread_mutex_t conns_lock;
+	struct fake_conn *conns;
+
+	/* The tree and everything above are protected by "lock". */
+	pthread_mutex_t lock;
+	struct fake_node **nodes;	/* indexed by id; NULL once removed */
+	size_t nnodes;
+	size_t nodes_capacity;
+	struct fake_dirent **buckets;	/* dirents hashed by (dir, name) */
+};
+
+/*
+ * Memory freed after the reply of a compound is encoded, so that results
+ * can point into nodes removed or resized later in the same compound.
+ */
+struct fake_chunk {
+	struct fake_chunk *next;
+	void *ptr;		/* to be freed; NULL for arena chunks */
+	char data[];
+};
+
+struct fake_compound {
+	struct tc_fake_server *server;
+	uint64_t cfh;		/* id of the current filehandle; 0 if none */
+	uint64_t sfh;		/* id of the saved filehandle; 0 if none */
+	struct fake_chunk *chunks;
+};
+
+/* Attributes of GETATTR and READDIR, in the order of their numbers */
+static const int fake_attrs[] = {
+	FATTR4_SUPPORTED_ATTRS,
+	FATTR4_TYPE,
+	FATTR4_FH_EXPIRE_TYPE,
+	FATTR4_CHANGE,
+	FATTR4_SIZE,
+	FATTR4_LINK_SUPPORT,
+	FATTR4_SYMLINK_SUPPORT,
+	FATTR4_NAMED_ATTR,
+	FATTR4_FSID,
+	FATTR4_UNIQUE_HANDLES,
+	FATTR4_LEASE_TIME,
+	FATTR4_RDATTR_ERROR,
+	FATTR4_FILEHANDLE,
+	FATTR4_FILEID,
+	FATTR4_FILES_AVAIL,
+	FATTR4_FILES_FREE,
+	FATTR4_FILES_TOTAL,
+	FATTR4_MAXFILESIZE,
+	FATTR4_MAXLINK,
+	FATTR4_MAXNAME,
+	FATTR4_MAXREAD,
+	FATTR4_MAXWRITE,
+	FATTR4_MODE,
+	FATTR4_NUMLINKS,
+	FATTR4_OWNER,
+	FATTR4_OWNER_GROUP,
+	FATTR4_RAWDEV,
+	FATTR4_SPACE_AVAIL,
+	FATTR4_SPACE_FREE,
+	FATTR4_SPACE_TOTAL,
+	FATTR4_SPACE_USED,
+	FATTR4_TIME_ACCESS,
+	FATTR4_TIME_ACCESS_SET,
+	FATTR4_TIME_METADATA,
+	FATTR4_TIME_MODIFY,
+	FATTR4_TIME_MODIFY_SET,
+	FATTR4_MOUNTED_ON_FILEID,
+};
+
+static uint64_t fake_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static nfstime4 fake_now(void)
+{
+	struct timespec ts;
+	nfstime4 t;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	t.seconds = ts.tv_sec;
+	t.nseconds = ts.tv_nsec;
+	return t;
+}
+
+/*
+ * Memory of a compound
+ */
+
+static void *fake_alloc(struct fake_compound *c, size_t size)
+{
+	struct fake_chunk *chunk = malloc(sizeof(*chunk) + size);
+
+	if (!chunk)
+		return NULL;
+	chunk->ptr = NULL;
+	chunk->next = c->chunks;
+	c->chunks = chunk;
+	return chunk->data;
+}
+
+static void fake_defer_free(struct fake_compound *c, void *ptr)
+{
+	struct fake_chunk *chunk;
+
+	if (!ptr)
+		return;
+	chunk = malloc(sizeof(*chunk));
+	if (!chunk)
+		return;	/* leak rather than free memory still in use */
+	chunk->ptr = ptr;
+	chunk->next = c->chunks;
+	c->chunks = chunk;
+}
+
+/* Like xdr_free() but with a zeroed XDR, whose x_public the argop decoder
+ * would otherwise take as its lookahead. */
+static void fake_xdr_free(xdrproc_t proc, void *obj)
+{
+	XDR x;
+
+	memset(&x, 0, sizeof(x));
+	x.x_op = XDR_FREE;
+	(*proc) (&x, obj);
+}
+
+static void fake_free_chunks(struct fake_compound *c)
+{
+	struct fake_chunk *chunk;
+
+	while ((chunk = c->chunks) != NULL) {
+		c->chunks = chunk->next;
+		free(chunk->ptr);
+		free(chunk);
+	}
+}
+
+/*
+ * The tree
+ */
+
+static struct fake_node *fake_new_node(struct tc_fake_server *s,
+				       nfs_ftype4 type, uint32_t mode)
+{
+	struct fake_node *n;
+	struct fake_node **nodes;
+	size_t capacity;
+
+	if (s->nnodes == s->nodes_capacity) {
+		capacity = s->nodes_capacity ? 2 * s->nodes_capacity : 1024;
+		nodes = realloc(s->nodes, capacity * sizeof(*nodes));
+		if (!nodes)
+			return NULL;
+		s->nodes = nodes;
+		s->nodes_capacity = capacity;
+	}
+
+	n = calloc(1, sizeof(*n));
+	if (!n)
+		return NULL;
+	n->id = s->nnodes;
+	n->type = type;
+	n->mode = mode & 07777;
+	n->nlink = (type == NF4DIR) ? 1 : 0;	/* "." */
+	n->change = 1;
+	n->atime = n->mtime = n->ctime = fake_now();
+	n->next_cookie = 3;	/* 0, 1 and 2 are reserved */
+	s->nodes[s->nnodes++] = n;
+
+	return n;
+}
+
+static struct fake_node *fake_get_node(struct tc_fake_server *s, uint64_t id)
+{
+	return id < s->nnodes ? s->nodes[id] : NULL;
+}
+
+/* Remove "n" from the tree if it is no longer linked. */
+static void fake_put_node(struct fake_compound *c, struct fake_node *n)
+{
+	if (n->nlink > (n->type == NF4DIR ? 1 : 0))
+		return;
+	c->server->nodes[n->id] = NULL;
+	fake_defer_free(c, n->data);
+	fake_defer_free(c, n);
+}
+
+static void fake_touch(struct fake_node *n, bool modified)
+{
+	n->ctime = fake_now();
+	if (modified)
+		n->mtime = n->ctime;
+	n->change++;
+}
+
+/* Make "n" "size" bytes long; new bytes are zeros. */
+static nfsstat4 fake_resize(struct fake_compound *c, struct fake_node *n,
+			    uint64_t size)
+{
+	size_t capacity;
+	char *data;
+
+	if (size > FAKE_MAX_FILE_SIZE)
+		return NFS4ERR_FBIG;
+	if (size > n->capacity) {
+		capacity = n->capacity ? 2 * n->capacity : 4096;
+		if (capacity < size)
+			capacity = size;
+		data = malloc(capacity);
+		if (!data)
+			return NFS4ERR_NOSPC;
+		if (n->size)
+			memcpy(data, n->data, n->size);
+		fake_defer_free(c, n->data);
+		n->data = data;
+		n->capacity = capacity;
+	}
+	if (size > n->size)
+		memset(n->data + n->size, 0, size - n->size);
+	n->size = size;
+
+	return NFS4_OK;
+}
+
+/* FNV-1a of the name seeded with the id of the directory */
+static uint64_t fake_name_hash(uint64_t dir_id, const char *name, u_int len)
+{
+	uint64_t h = 14695981039346656037ULL ^ dir_id;
+	u_int i;
+
+	for (i = 0; i < len; ++i) {
+		h ^= (unsigned char)name[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static struct fake_dirent *fake_lookup(struct tc_fake_server *s,
+				       struct fake_node *dir, const char *name,
+				       u_int len)
+{
+	uint64_t hash = fake_name_hash(dir->id, name, len);
+	struct fake_dirent *de;
+
+	for (de = s->buckets[hash % FAKE_HASH_SIZE]; de; de = de->hash_next) {
+		if (de->hash == hash && de->dir == dir && de->namelen == len &&
+		    memcmp(de->name, name, len) == 0)
+			return de;
+	}
+	return NULL;
+}
+
+static nfsstat4 fake_add_dirent(struct tc_fake_server *s,
+				struct fake_node *dir, const char *name,
+				u_int len, struct fake_node *n)
+{
+	struct fake_dirent *de;
+	uint64_t bucket;
+
+	de = calloc(1, sizeof(*de));
+	if (!de)
+		return NFS4ERR_RESOURCE;
+	de->name = malloc(len);
+	if (!de->name) {
+		free(de);
+		return NFS4ERR_RESOURCE;
+	}
+	memcpy(de->name, name, len);
+	de->namelen = len;
+	de->dir = dir;
+	de->node = n;
+	de->hash = fake_name_hash(dir->id, name, len);
+	de->cookie = dir->next_cookie++;
+
+	bucket = de->hash % FAKE_HASH_SIZE;
+	de->hash_next = s->buckets[bucket];
+	s->buckets[bucket] = de;
+
+	de->prev = dir->last;
+	if (dir->last)
+		dir->last->next = de;
+	else
+		dir->first = de;
+	dir->last = de;
+
+	n->nlink++;
+	if (n->type == NF4DIR) {
+		n->parent = dir;
+		dir->nlink++;	/* ".." of "n" */
+	}
+
+	return NFS4_OK;
+}
+
+/* Unlink "de" without removing its node. */
+static void fake_del_dirent(struct fake_compound *c, struct fake_dirent *de)
+{
+	struct tc_fake_server *s = c->server;
+	struct fake_node *dir = de->dir;
+	struct fake_dirent **pde;
+
+	pde = &s->buckets[de->hash % FAKE_HASH_SIZE];
+	while (*pde != de)
+		pde = &(*pde)->hash_next;
+	*pde = de->hash_next;
+
+	if (de->prev)
+		de->prev->next = de->next;
+	else
+		dir->first = de->next;
+	if (de->next)
+		de->next->prev = de->prev;
+	else
+		dir->last = de->prev;
+
+	de->node->nlink--;
+	if (de->node->type == NF4DIR)
+		dir->nlink--;
+
+	fake_defer_free(c, de->name);
+	fake_defer_free(c, de);
+}
+
+static nfsstat4 fake_mkdir_p(struct tc_fake_server *s, const char *path)
+{
+	struct fake_node *dir = s->nodes[FAKE_ROOT_ID];
+	struct fake_dirent *de;
+	struct fake_node *n;
+	const char *end;
+	nfsstat4 st;
+
+	while (*path) {
+		while (*path == '/')
+			++path;
+		end = strchrnul(path, '/');
+		if (end == path)
+			break;
+		de = fake_lookup(s, dir, path, end - path);
+		if (de) {
+			dir = de->node;
+		} else {
+			n = fake_new_node(s, NF4DIR, 0755);
+			if (!n)
+				return NFS4ERR_RESOURCE;
+			st = fake_add_dirent(s, dir, path, end - path, n);
+			if (st != NFS4_OK)
+				return st;
+			dir = n;
+		}
+		if (dir->type != NF4DIR)
+			return NFS4ERR_NOTDIR;
+		path = end;
+	}
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_check_name(const component4 *name)
+{
+	const char *val = name->utf8string_val;
+	u_int len = name->utf8string_len;
+
+	if (len == 0)
+		return NFS4ERR_INVAL;
+	if (len > NAME_MAX)
+		return NFS4ERR_NAMETOOLONG;
+	if (memchr(val, '/', len) || memchr(val, 0, len) ||
+	    (len == 1 && val[0] == '.') ||
+	    (len == 2 && val[0] == '.' && val[1] == '.'))
+		return NFS4ERR_BADNAME;
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_fh(struct fake_compound *c, uint64_t id,
+			struct fake_node **n)
+{
+	if (id == 0)
+		return NFS4ERR_NOFILEHANDLE;
+	*n = fake_get_node(c->server, id);
+	return *n ? NFS4_OK : NFS4ERR_STALE;
+}
+
+static nfsstat4 fake_cfh(struct fake_compound *c, struct fake_node **n)
+{
+	return fake_fh(c, c->cfh, n);
+}
+
+static nfsstat4 fake_dir(struct fake_compound *c, uint64_t id,
+			 struct fake_node **dir)
+{
+	nfsstat4 st = fake_fh(c, id, dir);
+
+	if (st != NFS4_OK)
+		return st;
+	if ((*dir)->type == NF4LNK)
+		return NFS4ERR_SYMLINK;
+	if ((*dir)->type != NF4DIR)
+		return NFS4ERR_NOTDIR;
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_cfh_file(struct fake_compound *c, struct fake_node **n)
+{
+	nfsstat4 st = fake_cfh(c, n);
+
+	if (st != NFS4_OK)
+		return st;
+	if ((*n)->type == NF4DIR)
+		return NFS4ERR_ISDIR;
+	if ((*n)->type != NF4REG)
+		return NFS4ERR_INVAL;
+	return NFS4_OK;
+}
+
+static void fake_change_info(const struct fake_node *dir, uint64_t before,
+			     change_info4 *cinfo)
+{
+	cinfo->atomic = TRUE;
+	cinfo->before = before;
+	cinfo->after = dir->change;
+}
+
+/*
+ * Attributes
+ */
+
+static inline bool fake_attr_isset(const struct bitmap4 *bm, int attr)
+{
+	return attr / 32 < bm->bitmap4_len &&
+	       (bm->map[attr / 32] & (1U << (attr % 32)));
+}
+
+static inline void fake_attr_set(struct bitmap4 *bm, int attr)
+{
+	while (bm->bitmap4_len <= attr / 32)
+		bm->map[bm->bitmap4_len++] = 0;
+	bm->map[attr / 32] |= 1U << (attr % 32);
+}
+
+static inline int fake_bitmap_bits(const struct bitmap4 *bm)
+{
+	return 32 * (bm->bitmap4_len < 3 ? bm->bitmap4_len : 3);
+}
+
+static bool fake_encode_owner(XDR *x, uint32_t id)
+{
+	char buf[16];
+	utf8string owner;
+
+	owner.utf8string_len = snprintf(buf, sizeof(buf), "%u", id);
+	owner.utf8string_val = buf;
+	return xdr_fattr4_owner(x, &owner);
+}
+
+/*
+ * Encode attribute "attr" of "n".  Return 1 if encoded, 0 if "attr" is not
+ * supported, or -1 if "x" is full.
+ */
+static int fake_encode_attr(struct tc_fake_server *s, struct fake_node *n,
+			    int attr, XDR *x)
+{
+	struct bitmap4 bm;
+	fsid4 fsid = { .major = 0x7c, .minor = 0 };
+	nfs_fh4 fh = { .nfs_fh4_len = sizeof(n->id),
+		       .nfs_fh4_val = (char *)&n->id };
+	nfsstat4 st = NFS4_OK;
+	bool_t b;
+	uint32_t u32;
+	uint64_t u64;
+	size_t i;
+	bool ok;
+
+	switch (attr) {
+	case FATTR4_SUPPORTED_ATTRS:
+		memset(&bm, 0, sizeof(bm));
+		for (i = 0; i < sizeof(fake_attrs) / sizeof(fake_attrs[0]); ++i)
+			fake_attr_set(&bm, fake_attrs[i]);
+		ok = xdr_fattr4_supported_attrs(x, &bm);
+		break;
+	case FATTR4_TYPE:
+		ok = xdr_fattr4_type(x, &n->type);
+		break;
+	case FATTR4_FH_EXPIRE_TYPE:
+		u32 = FH4_PERSISTENT;
+		ok = xdr_fattr4_fh_expire_type(x, &u32);
+		break;
+	case FATTR4_CHANGE:
+		ok = xdr_fattr4_change(x, &n->change);
+		break;
+	case FATTR4_SIZE:
+		u64 = n->size;
+		ok = xdr_fattr4_size(x, &u64);
+		break;
+	case FATTR4_LINK_SUPPORT:
+	case FATTR4_SYMLINK_SUPPORT:
+	case FATTR4_UNIQUE_HANDLES:
+		b = TRUE;
+		ok = xdr_fattr4_link_support(x, &b);
+		break;
+	case FATTR4_NAMED_ATTR:
+		b = FALSE;
+		ok = xdr_fattr4_named_attr(x, &b);
+		break;
+	case FATTR4_FSID:
+		ok = xdr_fattr4_fsid(x, &fsid);
+		break;
+	case FATTR4_LEASE_TIME:
+		u32 = FAKE_LEASE_TIME;
+		ok = xdr_fattr4_lease_time(x, &u32);
+		break;
+	case FATTR4_RDATTR_ERROR:
+		ok = xdr_fattr4_rdattr_error(x, &st);
+		break;
+	case FATTR4_FILEHANDLE:
+		ok = xdr_fattr4_filehandle(x, &fh);
+		break;
+	case FATTR4_FILEID:
+	case FATTR4_MOUNTED_ON_FILEID:
+		ok = xdr_fattr4_fileid(x, &n->id);
+		break;
+	case FATTR4_FILES_AVAIL:
+	case FATTR4_FILES_FREE:
+		u64 = FAKE_FS_FILES - s->nnodes;
+		ok = xdr_fattr4_files_avail(x, &u64);
+		break;
+	case FATTR4_FILES_TOTAL:
+		u64 = FAKE_FS_FILES;
+		ok = xdr_fattr4_files_total(x, &u64);
+		break;
+	case FATTR4_MAXFILESIZE:
+		u64 = FAKE_MAX_FILE_SIZE;
+		ok = xdr_fattr4_maxfilesize(x, &u64);
+		break;
+	case FATTR4_MAXLINK:
+		u32 = UINT32_MAX;
+		ok = xdr_fattr4_maxlink(x, &u32);
+		break;
+	case FATTR4_MAXNAME:
+		u32 = NAME_MAX;
+		ok = xdr_fattr4_maxname(x, &u32);
+		break;
+	case FATTR4_MAXREAD:
+	case FATTR4_MAXWRITE:
+		u64 = FAKE_MAX_IO;
+		ok = xdr_fattr4_maxread(x, &u64);
+		break;
+	case FATTR4_MODE:
+		ok = xdr_fattr4_mode(x, &n->mode);
+		break;
+	case FATTR4_NUMLINKS:
+		ok = xdr_fattr4_numlinks(x, &n->nlink);
+		break;
+	case FATTR4_OWNER:
+		ok = fake_encode_owner(x, n->uid);
+		break;
+	case FATTR4_OWNER_GROUP:
+		ok = fake_encode_owner(x, n->gid);
+		break;
+	case FATTR4_RAWDEV:
+		ok = xdr_fattr4_rawdev(x, &n->rawdev);
+		break;
+	case FATTR4_SPACE_AVAIL:
+	case FATTR4_SPACE_FREE:
+	case FATTR4_SPACE_TOTAL:
+		u64 = FAKE_FS_BYTES;
+		ok = xdr_fattr4_space_avail(x, &u64);
+		break;
+	case FATTR4_SPACE_USED:
+		u64 = (n->size + 511) & ~511ULL;
+		ok = xdr_fattr4_space_used(x, &u64);
+		break;
+	case FATTR4_TIME_ACCESS:
+		ok = xdr_fattr4_time_access(x, &n->atime);
+		break;
+	case FATTR4_TIME_METADATA:
+		ok = xdr_fattr4_time_metadata(x, &n->ctime);
+		break;
+	case FATTR4_TIME_MODIFY:
+		ok = xdr_fattr4_time_modify(x, &n->mtime);
+		break;
+	default:
+		return 0;
+	}
+
+	return ok ? 1 : -1;
+}
+
+/* Encode the supported attributes of "n" among "request" into "out". */
+static nfsstat4 fake_encode_fattr(struct fake_compound *c, struct fake_node *n,
+				  const struct bitmap4 *request, fattr4 *out)
+{
+	char *buf = fake_alloc(c, FAKE_ATTR_BUFSIZE);
+	XDR x;
+	int attr;
+	int rc;
+
+	if (!buf)
+		return NFS4ERR_RESOURCE;
+	memset(&out->attrmask, 0, sizeof(out->attrmask));
+	memset(&x, 0, sizeof(x));
+	xdrmem_create(&x, buf, FAKE_ATTR_BUFSIZE, XDR_ENCODE);
+	for (attr = 0; attr < fake_bitmap_bits(request); ++attr) {
+		if (!fake_attr_isset(request, attr))
+			continue;
+		rc = fake_encode_attr(c->server, n, attr, &x);
+		if (rc < 0)
+			return NFS4ERR_RESOURCE;
+		if (rc > 0)
+			fake_attr_set(&out->attrmask, attr);
+	}
+	out->attr_vals.attrlist4_val = buf;
+	out->attr_vals.attrlist4_len = xdr_getpos(&x);
+
+	return NFS4_OK;
+}
+
+/* Attributes to set, decoded from a fattr4 */
+struct fake_sattr {
+	struct bitmap4 mask;
+	uint64_t size;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	settime4 atime;
+	settime4 mtime;
+};
+
+/* Numeric owners are used as is; all other owners are mapped to nobody. */
+static bool fake_decode_owner(XDR *x, uint32_t *id)
+{
+	utf8string owner = { 0, NULL };
+	char buf[16];
+	char *end;
+	bool ok;
+
+	ok = xdr_fattr4_owner(x, &owner);
+	if (ok) {
+		*id = 65534;
+		if (owner.utf8string_len > 0 &&
+		    owner.utf8string_len < sizeof(buf)) {
+			memcpy(buf, owner.utf8string_val, owner.utf8string_len);
+			buf[owner.utf8string_len] = 0;
+			unsigned long v = strtoul(buf, &end, 10);
+			if (*end == 0 && v <= UINT32_MAX)
+				*id = v;
+		}
+	}
+	fake_xdr_free((xdrproc_t) xdr_fattr4_owner, &owner);
+
+	return ok;
+}
+
+static nfsstat4 fake_decode_fattr(const fattr4 *in, struct fake_sattr *sa)
+{
+	XDR x;
+	int attr;
+	bool ok;
+
+	memset(sa, 0, sizeof(*sa));
+	memset(&x, 0, sizeof(x));
+	xdrmem_create(&x, in->attr_vals.attrlist4_val,
+		      in->attr_vals.attrlist4_len, XDR_DECODE);
+	for (attr = 0; attr < fake_bitmap_bits(&in->attrmask); ++attr) {
+		if (!fake_attr_isset(&in->attrmask, attr))
+			continue;
+		switch (attr) {
+		case FATTR4_SIZE:
+			ok = xdr_fattr4_size(&x, &sa->size);
+			break;
+		case FATTR4_MODE:
+			ok = xdr_fattr4_mode(&x, &sa->mode);
+			break;
+		case FATTR4_OWNER:
+			ok = fake_decode_owner(&x, &sa->uid);
+			break;
+		case FATTR4_OWNER_GROUP:
+			ok = fake_decode_owner(&x, &sa->gid);
+			break;
+		case FATTR4_TIME_ACCESS_SET:
+			ok = xdr_fattr4_time_access_set(&x, &sa->atime);
+			break;
+		case FATTR4_TIME_MODIFY_SET:
+			ok = xdr_fattr4_time_modify_set(&x, &sa->mtime);
+			break;
+		default:
+			return NFS4ERR_ATTRNOTSUPP;
+		}
+		if (!ok)
+			return NFS4ERR_BADXDR;
+		fake_attr_set(&sa->mask, attr);
+	}
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_apply_sattr(struct fake_compound *c, struct fake_node *n,
+				 const struct fake_sattr *sa,
+				 struct bitmap4 *attrsset)
+{
+	nfstime4 now = fake_now();
+	nfsstat4 st;
+
+	memset(attrsset, 0, sizeof(*attrsset));
+	if (sa->mask.bitmap4_len == 0)
+		return NFS4_OK;
+
+	if (fake_attr_isset(&sa->mask, FATTR4_SIZE)) {
+		if (n->type == NF4DIR)
+			return NFS4ERR_ISDIR;
+		if (n->type != NF4REG)
+			return NFS4ERR_INVAL;
+		st = fake_resize(c, n, sa->size);
+		if (st != NFS4_OK)
+			return st;
+		n->mtime = now;
+	}
+	if (fake_attr_isset(&sa->mask, FATTR4_MODE))
+		n->mode = sa->mode & 07777;
+	if (fake_attr_isset(&sa->mask, FATTR4_OWNER))
+		n->uid = sa->uid;
+	if (fake_attr_isset(&sa->mask, FATTR4_OWNER_GROUP))
+		n->gid = sa->gid;
+	if (fake_attr_isset(&sa->mask, FATTR4_TIME_ACCESS_SET)) {
+		n->atime = sa->atime.set_it == SET_TO_CLIENT_TIME4
+			       ? sa->atime.settime4_u.time
+			       : now;
+	}
+	if (fake_attr_isset(&sa->mask, FATTR4_TIME_MODIFY_SET)) {
+		n->mtime = sa->mtime.set_it == SET_TO_CLIENT_TIME4
+			       ? sa->mtime.settime4_u.time
+			       : now;
+	}
+	n->ctime = now;
+	n->change++;
+	*attrsset = sa->mask;
+
+	return NFS4_OK;
+}
+
+/*
+ * Operations.  Each returns the status of its result and fills the rest.
+ */
+
+typedef nfsstat4 (*fake_op_fn)(struct fake_compound *c, nfs_argop4 *arg,
+			       nfs_resop4 *res);
+
+static nfsstat4 fake_nop(struct fake_compound *c, nfs_argop4 *arg,
+			 nfs_resop4 *res)
+{
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_exchange_id(struct fake_compound *c, nfs_argop4 *arg,
+				 nfs_resop4 *res)
+{
+	EXCHANGE_ID4resok *ok =
+	    &res->nfs_resop4_u.opexchange_id.EXCHANGE_ID4res_u.eir_resok4;
+
+	ok->eir_clientid = c->server->clientid;
+	ok->eir_sequenceid = 1;
+	ok->eir_flags = EXCHGID4_FLAG_USE_NON_PNFS;
+	ok->eir_state_protect.spr_how = SP4_NONE;
+	ok->eir_server_owner.so_minor_id = 0;
+	ok->eir_server_owner.so_major_id.so_major_id_len =
+	    strlen(FAKE_SERVER_OWNER);
+	ok->eir_server_owner.so_major_id.so_major_id_val = FAKE_SERVER_OWNER;
+	ok->eir_server_scope.eir_server_scope_len = strlen(FAKE_SERVER_OWNER);
+	ok->eir_server_scope.eir_server_scope_val = FAKE_SERVER_OWNER;
+	ok->eir_server_impl_id.eir_server_impl_id_len = 0;
+
+	return NFS4_OK;
+}
+
+static void fake_channel_attrs(channel_attrs4 *attrs)
+{
+	if (attrs->ca_maxrequests > FAKE_MAX_SLOTS)
+		attrs->ca_maxrequests = FAKE_MAX_SLOTS;
+	attrs->ca_rdma_ird.ca_rdma_ird_len = 0;
+	attrs->ca_rdma_ird.ca_rdma_ird_val = NULL;
+}
+
+static nfsstat4 fake_create_session(struct fake_compound *c, nfs_argop4 *arg,
+				    nfs_resop4 *res)
+{
+	CREATE_SESSION4args *args = &arg->nfs_argop4_u.opcreate_session;
+	CREATE_SESSION4resok *ok =
+	    &res->nfs_resop4_u.opcreate_session.CREATE_SESSION4res_u.csr_resok4;
+	uint64_t n = ++c->server->nsessions;
+
+	memcpy(ok->csr_sessionid, &c->server->clientid, sizeof(uint64_t));
+	memcpy(ok->csr_sessionid + sizeof(uint64_t), &n, sizeof(n));
+	ok->csr_sequence = args->csa_sequence;
+	ok->csr_flags = 0;
+	ok->csr_fore_chan_attrs = args->csa_fore_chan_attrs;
+	fake_channel_attrs(&ok->csr_fore_chan_attrs);
+	ok->csr_back_chan_attrs = args->csa_back_chan_attrs;
+	fake_channel_attrs(&ok->csr_back_chan_attrs);
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_sequence(struct fake_compound *c, nfs_argop4 *arg,
+			      nfs_resop4 *res)
+{
+	SEQUENCE4args *args = &arg->nfs_argop4_u.opsequence;
+	SEQUENCE4resok *ok =
+	    &res->nfs_resop4_u.opsequence.SEQUENCE4res_u.sr_resok4;
+
+	memcpy(ok->sr_sessionid, args->sa_sessionid, NFS4_SESSIONID_SIZE);
+	ok->sr_sequenceid = args->sa_sequenceid;
+	ok->sr_slotid = args->sa_slotid;
+	ok->sr_highest_slotid = args->sa_highest_slotid;
+	ok->sr_target_highest_slotid = FAKE_MAX_SLOTS - 1;
+	ok->sr_status_flags = 0;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_putrootfh(struct fake_compound *c, nfs_argop4 *arg,
+			       nfs_resop4 *res)
+{
+	c->cfh = FAKE_ROOT_ID;
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_putfh(struct fake_compound *c, nfs_argop4 *arg,
+			   nfs_resop4 *res)
+{
+	const nfs_fh4 *fh = &arg->nfs_argop4_u.opputfh.object;
+	uint64_t id;
+
+	if (fh->nfs_fh4_len != sizeof(id))
+		return NFS4ERR_BADHANDLE;
+	memcpy(&id, fh->nfs_fh4_val, sizeof(id));
+	if (!fake_get_node(c->server, id))
+		return NFS4ERR_STALE;
+	c->cfh = id;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_getfh(struct fake_compound *c, nfs_argop4 *arg,
+			   nfs_resop4 *res)
+{
+	GETFH4resok *ok = &res->nfs_resop4_u.opgetfh.GETFH4res_u.resok4;
+	struct fake_node *n;
+	nfsstat4 st = fake_cfh(c, &n);
+
+	if (st != NFS4_OK)
+		return st;
+	ok->object.nfs_fh4_val = fake_alloc(c, sizeof(n->id));
+	if (!ok->object.nfs_fh4_val)
+		return NFS4ERR_RESOURCE;
+	memcpy(ok->object.nfs_fh4_val, &n->id, sizeof(n->id));
+	ok->object.nfs_fh4_len = sizeof(n->id);
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_savefh(struct fake_compound *c, nfs_argop4 *arg,
+			    nfs_resop4 *res)
+{
+	struct fake_node *n;
+	nfsstat4 st = fake_cfh(c, &n);
+
+	if (st == NFS4_OK)
+		c->sfh = c->cfh;
+	return st;
+}
+
+static nfsstat4 fake_restorefh(struct fake_compound *c, nfs_argop4 *arg,
+			       nfs_resop4 *res)
+{
+	if (c->sfh == 0)
+		return NFS4ERR_RESTOREFH;
+	c->cfh = c->sfh;
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_lookup_op(struct fake_compound *c, nfs_argop4 *arg,
+			       nfs_resop4 *res)
+{
+	const component4 *name = &arg->nfs_argop4_u.oplookup.objname;
+	struct fake_node *dir;
+	struct fake_dirent *de;
+	nfsstat4 st;
+
+	st = fake_dir(c, c->cfh, &dir);
+	if (st == NFS4_OK)
+		st = fake_check_name(name);
+	if (st != NFS4_OK)
+		return st;
+	de = fake_lookup(c->server, dir, name->utf8string_val,
+			 name->utf8string_len);
+	if (!de)
+		return NFS4ERR_NOENT;
+	c->cfh = de->node->id;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_lookupp(struct fake_compound *c, nfs_argop4 *arg,
+			     nfs_resop4 *res)
+{
+	struct fake_node *dir;
+	nfsstat4 st = fake_dir(c, c->cfh, &dir);
+
+	if (st != NFS4_OK)
+		return st;
+	if (!dir->parent)
+		return NFS4ERR_NOENT;
+	c->cfh = dir->parent->id;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_getattr(struct fake_compound *c, nfs_argop4 *arg,
+			     nfs_resop4 *res)
+{
+	GETATTR4resok *ok = &res->nfs_resop4_u.opgetattr.GETATTR4res_u.resok4;
+	struct fake_node *n;
+	nfsstat4 st = fake_cfh(c, &n);
+
+	if (st != NFS4_OK)
+		return st;
+	return fake_encode_fattr(c, n,
+				 &arg->nfs_argop4_u.opgetattr.attr_request,
+				 &ok->obj_attributes);
+}
+
+static nfsstat4 fake_setattr(struct fake_compound *c, nfs_argop4 *arg,
+			     nfs_resop4 *res)
+{
+	struct bitmap4 *attrsset = &res->nfs_resop4_u.opsetattr.attrsset;
+	struct fake_sattr sa;
+	struct fake_node *n;
+	nfsstat4 st;
+
+	memset(attrsset, 0, sizeof(*attrsset));
+	st = fake_cfh(c, &n);
+	if (st == NFS4_OK)
+		st = fake_decode_fattr(
+		    &arg->nfs_argop4_u.opsetattr.obj_attributes, &sa);
+	if (st != NFS4_OK)
+		return st;
+	return fake_apply_sattr(c, n, &sa, attrsset);
+}
+
+/* Set "*same" to whether "attrs" match the current filehandle. */
+static nfsstat4 fake_compare_fattr(struct fake_compound *c,
+				   const fattr4 *attrs, bool *same)
+{
+	struct fake_node *n;
+	fattr4 mine;
+	int attr;
+	nfsstat4 st = fake_cfh(c, &n);
+
+	if (st == NFS4_OK)
+		st = fake_encode_fattr(c, n, &attrs->attrmask, &mine);
+	if (st != NFS4_OK)
+		return st;
+	for (attr = 0; attr < fake_bitmap_bits(&attrs->attrmask); ++attr) {
+		if (fake_attr_isset(&attrs->attrmask, attr) &&
+		    !fake_attr_isset(&mine.attrmask, attr))
+			return NFS4ERR_ATTRNOTSUPP;
+	}
+	*same = attrs->attr_vals.attrlist4_len ==
+		    mine.attr_vals.attrlist4_len &&
+		memcmp(attrs->attr_vals.attrlist4_val,
+		       mine.attr_vals.attrlist4_val,
+		       mine.attr_vals.attrlist4_len) == 0;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_verify(struct fake_compound *c, nfs_argop4 *arg,
+			    nfs_resop4 *res)
+{
+	bool same;
+	nfsstat4 st = fake_compare_fattr(
+	    c, &arg->nfs_argop4_u.opverify.obj_attributes, &same);
+
+	if (st != NFS4_OK)
+		return st;
+	return same ? NFS4_OK : NFS4ERR_NOT_SAME;
+}
+
+static nfsstat4 fake_nverify(struct fake_compound *c, nfs_argop4 *arg,
+			     nfs_resop4 *res)
+{
+	bool same;
+	nfsstat4 st = fake_compare_fattr(
+	    c, &arg->nfs_argop4_u.opnverify.obj_attributes, &same);
+
+	if (st != NFS4_OK)
+		return st;
+	return same ? NFS4ERR_SAME : NFS4_OK;
+}
+
+static nfsstat4 fake_access(struct fake_compound *c, nfs_argop4 *arg,
+			    nfs_resop4 *res)
+{
+	ACCESS4resok *ok = &res->nfs_resop4_u.opaccess.ACCESS4res_u.resok4;
+	struct fake_node *n;
+	nfsstat4 st = fake_cfh(c, &n);
+
+	if (st != NFS4_OK)
+		return st;
+	ok->supported = arg->nfs_argop4_u.opaccess.access;
+	ok->access = arg->nfs_argop4_u.opaccess.access;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_open(struct fake_compound *c, nfs_argop4 *arg,
+			  nfs_resop4 *res)
+{
+	OPEN4args *args = &arg->nfs_argop4_u.opopen;
+	OPEN4resok *ok = &res->nfs_resop4_u.opopen.OPEN4res_u.resok4;
+	struct tc_fake_server *s = c->server;
+	const component4 *name = &args->claim.open_claim4_u.file;
+	createhow4 *how = &args->openhow.openflag4_u.how;
+	struct fake_node *dir = NULL;
+	struct fake_node *n;
+	struct fake_dirent *de;
+	struct fake_sattr sa;
+	fattr4 *attrs = NULL;
+	uint64_t before = 0;
+	uint32_t seq;
+	nfsstat4 st;
+
+	if (args->claim.claim == CLAIM_FH) {
+		if (args->openhow.opentype == OPEN4_CREATE)
+			return NFS4ERR_INVAL;
+		st = fake_cfh(c, &n);
+		if (st != NFS4_OK)
+			return st;
+	} else if (args->claim.claim == CLAIM_NULL) {
+		st = fake_dir(c, c->cfh, &dir);
+		if (st == NFS4_OK)
+			st = fake_check_name(name);
+		if (st != NFS4_OK)
+			return st;
+		before = dir->change;
+		de = fake_lookup(s, dir, name->utf8string_val,
+				 name->utf8string_len);
+		if (args->openhow.opentype == OPEN4_CREATE) {
+			if (how->mode == UNCHECKED4 || how->mode == GUARDED4)
+				attrs = &how->createhow4_u.createattrs;
+			else if (how->mode == EXCLUSIVE4_1)
+				attrs = &how->createhow4_u.ch_createboth
+					     .cva_attrs;
+			memset(&sa, 0, sizeof(sa));
+			if (attrs) {
+				st = fake_decode_fattr(attrs, &sa);
+				if (st != NFS4_OK)
+					return st;
+			}
+			if (de && how->mode != UNCHECKED4)
+				return NFS4ERR_EXIST;
+			if (de) {
+				n = de->node;
+			} else {
+				n = fake_new_node(s, NF4REG, 0644);
+				if (!n)
+					return NFS4ERR_RESOURCE;
+				st = fake_add_dirent(s, dir,
+						     name->utf8string_val,
+						     name->utf8string_len, n);
+				if (st != NFS4_OK)
+					return st;
+				fake_touch(dir, true);
+			}
+			if (n->type == NF4REG) {
+				st = fake_apply_sattr(c, n, &sa, &ok->attrset);
+				if (st != NFS4_OK)
+					return st;
+			}
+		} else {
+			if (!de)
+				return NFS4ERR_NOENT;
+			n = de->node;
+		}
+	} else {
+		return NFS4ERR_NOTSUPP;
+	}
+
+	if (n->type == NF4DIR)
+		return NFS4ERR_ISDIR;
+	if (n->type == NF4LNK)
+		return NFS4ERR_SYMLINK;
+	if (n->type != NF4REG)
+		return NFS4ERR_WRONG_TYPE;
+
+	seq = ++s->nopens;
+	ok->stateid.seqid = 1;
+	memcpy(ok->stateid.other, &n->id, sizeof(n->id));
+	memcpy(ok->stateid.other + sizeof(n->id), &seq, sizeof(seq));
+	if (dir)
+		fake_change_info(dir, before, &ok->cinfo);
+	ok->rflags = OPEN4_RESULT_LOCKTYPE_POSIX;
+	ok->delegation.delegation_type = OPEN_DELEGATE_NONE;
+	c->cfh = n->id;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_close(struct fake_compound *c, nfs_argop4 *arg,
+			   nfs_resop4 *res)
+{
+	stateid4 *sid = &res->nfs_resop4_u.opclose.CLOSE4res_u.open_stateid;
+	struct fake_node *n;
+	nfsstat4 st = fake_cfh(c, &n);
+
+	if (st != NFS4_OK)
+		return st;
+	*sid = arg->nfs_argop4_u.opclose.open_stateid;
+	sid->seqid++;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_read(struct fake_compound *c, nfs_argop4 *arg,
+			  nfs_resop4 *res)
+{
+	READ4args *args = &arg->nfs_argop4_u.opread;
+	READ4resok *ok = &res->nfs_resop4_u.opread.READ4res_u.resok4;
+	struct fake_node *n;
+	uint64_t len = 0;
+	nfsstat4 st = fake_cfh_file(c, &n);
+
+	if (st != NFS4_OK)
+		return st;
+	if (args->offset < n->size) {
+		len = n->size - args->offset;
+		if (len > args->count)
+			len = args->count;
+		if (len > FAKE_MAX_IO)
+			len = FAKE_MAX_IO;
+	}
+	/* "n->data" stays valid until the reply is encoded */
+	ok->data.data_val = len ? n->data + args->offset : NULL;
+	ok->data.data_len = len;
+	ok->eof = args->offset + len >= n->size;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_write(struct fake_compound *c, nfs_argop4 *arg,
+			   nfs_resop4 *res)
+{
+	WRITE4args *args = &arg->nfs_argop4_u.opwrite;
+	WRITE4resok *ok = &res->nfs_resop4_u.opwrite.WRITE4res_u.resok4;
+	uint64_t end = args->offset + args->data.data_len;
+	struct fake_node *n;
+	nfsstat4 st = fake_cfh_file(c, &n);
+
+	if (st != NFS4_OK)
+		return st;
+	if (end < args->offset)
+		return NFS4ERR_FBIG;
+	if (end > n->size) {
+		st = fake_resize(c, n, end);
+		if (st != NFS4_OK)
+			return st;
+	}
+	memcpy(n->data + args->offset, args->data.data_val,
+	       args->data.data_len);
+	fake_touch(n, true);
+
+	ok->count = args->data.data_len;
+	ok->committed = FILE_SYNC4;
+	memcpy(ok->writeverf, c->server->write_verf, NFS4_VERIFIER_SIZE);
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_commit(struct fake_compound *c, nfs_argop4 *arg,
+			    nfs_resop4 *res)
+{
+	COMMIT4resok *ok = &res->nfs_resop4_u.opcommit.COMMIT4res_u.resok4;
+	struct fake_node *n;
+	nfsstat4 st = fake_cfh_file(c, &n);
+
+	if (st != NFS4_OK)
+		return st;
+	memcpy(ok->writeverf, c->server->write_verf, NFS4_VERIFIER_SIZE);
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_readdir(struct fake_compound *c, nfs_argop4 *arg,
+			     nfs_resop4 *res)
+{
+	READDIR4args *args = &arg->nfs_argop4_u.opreaddir;
+	READDIR4resok *ok = &res->nfs_resop4_u.opreaddir.READDIR4res_u.resok4;
+	entry4 **tail = &ok->reply.entries;
+	struct fake_node *dir;
+	struct fake_dirent *de;
+	entry4 *e;
+	/* cookie verifier, "eof", and the end of the list */
+	size_t used = NFS4_VERIFIER_SIZE + 8;
+	size_t size;
+	nfsstat4 st = fake_dir(c, c->cfh, &dir);
+
+	if (st != NFS4_OK)
+		return st;
+	memset(ok->cookieverf, 0, NFS4_VERIFIER_SIZE);
+	ok->reply.entries = NULL;
+	ok->reply.eof = TRUE;
+
+	for (de = dir->first; de; de = de->next) {
+		if (de->cookie <= args->cookie)
+			continue;
+		e = fake_alloc(c, sizeof(*e));
+		if (!e)
+			return NFS4ERR_RESOURCE;
+		st = fake_encode_fattr(c, de->node, &args->attr_request,
+				       &e->attrs);
+		if (st != NFS4_OK)
+			return st;
+		size = 4 + 8 + 4 + ((de->namelen + 3) & ~3) + 4 +
+		       4 * e->attrs.attrmask.bitmap4_len + 4 +
+		       e->attrs.attr_vals.attrlist4_len;
+		if (used + size > args->maxcount) {
+			if (!ok->reply.entries)
+				return NFS4ERR_TOOSMALL;
+			ok->reply.eof = FALSE;
+			break;
+		}
+		used += size;
+		e->cookie = de->cookie;
+		e->name.utf8string_val = de->name;
+		e->name.utf8string_len = de->namelen;
+		e->nextentry = NULL;
+		*tail = e;
+		tail = &e->nextentry;
+	}
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_readlink(struct fake_compound *c, nfs_argop4 *arg,
+			      nfs_resop4 *res)
+{
+	READLINK4resok *ok = &res->nfs_resop4_u.opreadlink.READLINK4res_u.resok4;
+	struct fake_node *n;
+	nfsstat4 st = fake_cfh(c, &n);
+
+	if (st != NFS4_OK)
+		return st;
+	if (n->type != NF4LNK)
+		return NFS4ERR_INVAL;
+	ok->link.utf8string_val = n->data;
+	ok->link.utf8string_len = n->size;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_create(struct fake_compound *c, nfs_argop4 *arg,
+			    nfs_resop4 *res)
+{
+	CREATE4args *args = &arg->nfs_argop4_u.opcreate;
+	CREATE4resok *ok = &res->nfs_resop4_u.opcreate.CREATE4res_u.resok4;
+	const component4 *name = &args->objname;
+	const linktext4 *link = &args->objtype.createtype4_u.linkdata;
+	struct tc_fake_server *s = c->server;
+	struct fake_node *dir;
+	struct fake_node *n;
+	struct fake_sattr sa;
+	uint64_t before;
+	nfsstat4 st;
+
+	st = fake_dir(c, c->cfh, &dir);
+	if (st == NFS4_OK)
+		st = fake_check_name(name);
+	if (st == NFS4_OK)
+		st = fake_decode_fattr(&args->createattrs, &sa);
+	if (st != NFS4_OK)
+		return st;
+	switch (args->objtype.type) {
+	case NF4DIR:
+	case NF4LNK:
+	case NF4BLK:
+	case NF4CHR:
+	case NF4SOCK:
+	case NF4FIFO:
+		break;
+	default:
+		return NFS4ERR_BADTYPE;
+	}
+	if (fake_attr_isset(&sa.mask, FATTR4_SIZE))
+		return NFS4ERR_INVAL;
+	if (fake_lookup(s, dir, name->utf8string_val, name->utf8string_len))
+		return NFS4ERR_EXIST;
+
+	before = dir->change;
+	n = fake_new_node(s, args->objtype.type,
+			  args->objtype.type == NF4LNK ? 0777 : 0755);
+	if (!n)
+		return NFS4ERR_RESOURCE;
+	if (n->type == NF4LNK && link->utf8string_len > 0) {
+		n->data = malloc(link->utf8string_len);
+		if (!n->data)
+			return NFS4ERR_RESOURCE;
+		memcpy(n->data, link->utf8string_val, link->utf8string_len);
+		n->size = n->capacity = link->utf8string_len;
+	} else if (n->type == NF4BLK || n->type == NF4CHR) {
+		n->rawdev = args->objtype.createtype4_u.devdata;
+	}
+	st = fake_add_dirent(s, dir, name->utf8string_val,
+			     name->utf8string_len, n);
+	if (st != NFS4_OK)
+		return st;
+	fake_touch(dir, true);
+	st = fake_apply_sattr(c, n, &sa, &ok->attrset);
+	if (st != NFS4_OK)
+		return st;
+
+	fake_change_info(dir, before, &ok->cinfo);
+	c->cfh = n->id;
+
+	return NFS4_OK;
+}
+
+static nfsstat4 fake_remove(struct fake_compound *c, nfs_argop4 *arg,
+			    nfs_resop4 *res)
+{
+	REMOVE4resok *ok = &res->nfs_resop4_u.opremove.REMOVE4res_u.resok4;
+	const component4 *name = &arg->nfs_argop4_u.opremove.target;
+	struct fake_node *dir;
+	struct fake_node *n;
+	struct fake_dirent *de;
+	uint64_t before;
+	nfsstat4 st;
+
+	st = fake_dir(c, c->cfh, &dir);
+	if (st == NFS4_OK)
+		st = fake_check_name(name);
+	if (st != NFS4_OK)
+		return st;
+	de = fake_lookup(c->server, dir, name->utf8string_val,
+			 name->utf8string_len);
+	if (!de)
+		return NFS4ERR_NOENT;
+	n = de->node;
+	if (n->type == NF4DIR && n->first)
+		return NFS4ERR_NOTEMPTY;
+
+	before = dir->change;
+	fake_del_dirent(c, de);
+	fake_touch(dir, true);
+	fake_touch(n, false);
+	fake_put_node(c, n);
+	fake_change_info(dir, before, &ok->cinfo);
+
+	return NFS4_OK;
+}
+
+/* Rename from the saved filehandle to the current filehandle. */
+static nfsstat4 fake_rename(struct fake_compound *c, nfs_argop4 *arg,
+			    nfs_resop4 *res)
+{
+	RENAME4args *args = &arg->nfs_argop4_u.oprename;
+	RENAME4resok *ok = &res->nfs_resop4_u.oprename.RENAME4res_u.resok4;
+	struct tc_fake_server *s = c->server;
+	struct fake_node *src;
+	struct fake_node *dst;
+	struct fake_node *n;
+	struct fake_node *p;
+	struct fake_dirent *de;
+	struct fake_dirent *target;
+	uint64_t src_before;
+	uint64_t dst_before;
+	nfsstat4 st;
+
+	st = fake_dir(c, c->sfh, &src);
+	if (st == NFS4_OK)
+		st = fake_dir(c, c->cfh, &dst);
+	if (st == NFS4_OK)
+		st = fake_check_name(&args->oldname);
+	if (st == NFS4_OK)
+		st = fake_check_name(&args->newname);
+	if (st != NFS4_OK)
+		return st;
+
+	de = fake_lookup(s, src, args->oldname.utf8string_val,
+			 args->oldname.utf8string_len);
+	if (!de)
+		return NFS4ERR_NOENT;
+	n = de->node;
+	src_before = src->change;
+	dst_before = dst->change;
+
+	target = fake_lookup(s, dst, args->newname.utf8string_val,
+			     args->newname.utf8string_len);
+	if (target && target->node == n)
+		goto out;
+	if (target && (n->type == NF4DIR) != (target->node->type == NF4DIR))
+		return NFS4ERR_EXIST;
+	if (target && target->node->type == NF4DIR && target->node->first)
+		return NFS4ERR_EXIST;
+	if (n->type == NF4DIR) {
+		for (p = dst; p; p = p->parent) {
+			if (p == n)
+				return NFS4ERR_INVAL;
+		}
+	}
+
+	if (target) {
+		struct fake_node *old = target->node;
+
+		fake_del_dirent(c, target);
+		fake_put_node(c, old);
+	}
+	st = fake_add_dirent(s, dst, args->newname.utf8string_val,
+			     args->newname.utf8string_len, n);
+	if (st != NFS4_OK)
+		return st;
+	fake_del_dirent(c, de);
+	fake_touch(src, true);
+	if (dst != src)
+		fake_touch(dst, true);
+	fake_touch(n, false);
+
+out:
+	fake_change_info(src, src_before, &ok->source_cinfo);
+	fake_change_info(dst, dst_before, &ok->target_cinfo);
+	return NFS4_OK;
+}
+
+/* Link the saved filehandle into the current filehandle. */
+static nfsstat4 fake_link(struct fake_compound *c, nfs_argop4 *arg,
+			  nfs_resop4 *res)
+{
+	LINK4resok *ok = &res->nfs_resop4_u.oplink.LINK4res_u.resok4;
+	const component4 *name = &arg->nfs_argop4_u.oplink.newname;
+	struct fake_node *dir;
+	struct fake_node *n;
+	uint64_t before;
+	nfsstat4 st;
+
+	st = fake_fh(c, c->sfh, &n);
+	if (st == NFS4_OK)
+		st = fake_dir(c, c->cfh, &dir);
+	if (st == NFS4_OK)
+		st = fake_check_name(name);
+	if (st != NFS4_OK)
+		return st;
+	if (n->type == NF4DIR)
+		return NFS4ERR_ISDIR;
+	if (fake_lookup(c->server, dir, name->utf8string_val,
+			name->utf8string_len))
+		return NFS4ERR_EXIST;
+
+	before = dir->change;
+	st = fake_add_dirent(c->server, dir, name->utf8string_val,
+			     name->utf8string_len, n);
+	if (st != NFS4_OK)
+		return st;
+	fake_touch(dir, true);
+	fake_touch(n, false);
+	fake_change_info(dir, before, &ok->cinfo);
+
+	return NFS4_OK;
+}
+
+static const fake_op_fn fake_ops[NFS4_OP_IO_ADVISE + 1] = {
+	[NFS4_OP_ACCESS] = fake_access,
+	[NFS4_OP_CLOSE] = fake_close,
+	[NFS4_OP_COMMIT] = fake_commit,
+	[NFS4_OP_CREATE] = fake_create,
+	[NFS4_OP_GETATTR] = fake_getattr,
+	[NFS4_OP_GETFH] = fake_getfh,
+	[NFS4_OP_LINK] = fake_link,
+	[NFS4_OP_LOOKUP] = fake_lookup_op,
+	[NFS4_OP_LOOKUPP] = fake_lookupp,
+	[NFS4_OP_NVERIFY] = fake_nverify,
+	[NFS4_OP_OPEN] = fake_open,
+	[NFS4_OP_PUTFH] = fake_putfh,
+	[NFS4_OP_PUTROOTFH] = fake_putrootfh,
+	[NFS4_OP_READ] = fake_read,
+	[NFS4_OP_READDIR] = fake_readdir,
+	[NFS4_OP_READLINK] = fake_readlink,
+	[NFS4_OP_REMOVE] = fake_remove,
+	[NFS4_OP_RENAME] = fake_rename,
+	[NFS4_OP_RESTOREFH] = fake_restorefh,
+	[NFS4_OP_SAVEFH] = fake_savefh,
+	[NFS4_OP_SETATTR] = fake_setattr,
+	[NFS4_OP_VERIFY] = fake_verify,
+	[NFS4_OP_WRITE] = fake_write,
+	[NFS4_OP_EXCHANGE_ID] = fake_exchange_id,
+	[NFS4_OP_CREATE_SESSION] = fake_create_session,
+	[NFS4_OP_DESTROY_SESSION] = fake_nop,
+	[NFS4_OP_SEQUENCE] = fake_sequence,
+	[NFS4_OP_DESTROY_CLIENTID] = fake_nop,
+	[NFS4_OP_RECLAIM_COMPLETE] = fake_nop,
+};
+
+/* Every result of an operation starts with its status. */
+static inline void fake_set_op_status(nfs_resop4 *res, nfsstat4 status)
+{
+	memcpy(&res->nfs_resop4_u, &status, sizeof(status));
+}
+
+/* Process "args" into "res"; caller should hold the server lock. */
+static void fake_process_compound(struct fake_compound *c,
+				  COMPOUND4args *args, COMPOUND4res *res)
+{
+	u_int n = args->argarray.argarray_len;
+	nfsstat4 status = NFS4_OK;
+	nfs_argop4 *arg;
+	nfs_resop4 *r;
+	u_int i;
+
+	res->tag = args->tag;
+	res->resarray.resarray_len = 0;
+	res->resarray.resarray_val = NULL;
+	if (args->minorversion != 1) {
+		res->status = NFS4ERR_MINOR_VERS_MISMATCH;
+		return;
+	}
+	if (n > FAKE_MAX_OPS) {
+		res->status = NFS4ERR_TOO_MANY_OPS;
+		return;
+	}
+	if (n > 0) {
+		res->resarray.resarray_val = fake_alloc(c, n * sizeof(*r));
+		if (!res->resarray.resarray_val) {
+			res->status = NFS4ERR_RESOURCE;
+			return;
+		}
+	}
+
+	for (i = 0; i < n && status == NFS4_OK; ++i) {
+		arg = &args->argarray.argarray_val[i];
+		r = &res->resarray.resarray_val[i];
+		memset(r, 0, sizeof(*r));
+		r->resop = arg->argop;
+		if (arg->argop <= NFS4_OP_IO_ADVISE && fake_ops[arg->argop]) {
+			status = fake_ops[arg->argop](c, arg, r);
+		} else if (arg->argop >= NFS4_OP_ACCESS &&
+			   arg->argop <= NFS4_OP_IO_ADVISE) {
+			status = NFS4ERR_NOTSUPP;
+		} else {
+			r->resop = NFS4_OP_ILLEGAL;
+			status = NFS4ERR_OP_ILLEGAL;
+		}
+		fake_set_op_status(r, status);
+		res->resarray.resarray_len++;
+	}
+	res->status = status;
+}
+
+/*
+ * RPC
+ */
+
+static struct fake_reply *fake_encode_reply(struct fake_conn *conn,
+					    struct rpc_msg *reply)
+{
+	struct fake_reply *rep;
+	uint32_t recmark;
+	u_int len;
+	XDR x;
+
+	memset(&x, 0, sizeof(x));
+	xdrmem_create(&x, conn->sendbuf + 4, FAKE_MAX_MSG, XDR_ENCODE);
+	if (!xdr_replymsg(&x, reply))
+		return NULL;
+	len = xdr_getpos(&x);
+	recmark = htonl(len | (1U << 31));
+	memcpy(conn->sendbuf, &recmark, sizeof(recmark));
+	len += 4;
+
+	rep = malloc(sizeof(*rep) + len);
+	if (!rep)
+		return NULL;
+	rep->next = NULL;
+	rep->len = len;
+	memcpy(rep->buf, conn->sendbuf, len);
+
+	return rep;
+}
+
+/* Return the reply to the call in "msg", or NULL if there is none. */
+static struct fake_reply *fake_handle_call(struct fake_conn *conn, char *msg,
+					   size_t len)
+{
+	struct tc_fake_server *s = conn->server;
+	char cred[MAX_AUTH_BYTES];
+	char verf[MAX_AUTH_BYTES];
+	struct fake_compound c;
+	struct fake_reply *rep;
+	struct rpc_msg call;
+	struct rpc_msg reply;
+	COMPOUND4args args;
+	COMPOUND4res res;
+	bool decoded = false;
+	XDR x;
+
+	memset(&call, 0, sizeof(call));
+	call.rm_call.cb_cred.oa_base = cred;
+	call.rm_call.cb_verf.oa_base = verf;
+	memset(&x, 0, sizeof(x));
+	xdrmem_create(&x, msg, len, XDR_DECODE);
+	if (!xdr_callmsg(&x, &call))
+		return NULL;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.rm_xid = call.rm_xid;
+	reply.rm_direction = REPLY;
+	reply.rm_reply.rp_stat = MSG_ACCEPTED;
+	reply.acpted_rply.ar_verf = _null_auth;
+	reply.acpted_rply.ar_stat = SUCCESS;
+	reply.acpted_rply.ar_results.where = NULL;
+	reply.acpted_rply.ar_results.proc = (xdrproc_t) xdr_void;
+
+	memset(&c, 0, sizeof(c));
+	c.server = s;
+	memset(&args, 0, sizeof(args));
+	memset(&res, 0, sizeof(res));
+
+	if (call.rm_call.cb_prog != FAKE_NFS_PROGRAM) {
+		reply.acpted_rply.ar_stat = PROG_UNAVAIL;
+	} else if (call.rm_call.cb_vers != FAKE_NFS_VERSION) {
+		reply.acpted_rply.ar_stat = PROG_MISMATCH;
+		reply.acpted_rply.ar_vers.low = FAKE_NFS_VERSION;
+		reply.acpted_rply.ar_vers.high = FAKE_NFS_VERSION;
+	} else if (call.rm_call.cb_proc == NFSPROC4_COMPOUND) {
+		decoded = xdr_COMPOUND4args(&x, &args);
+		if (decoded) {
+			reply.acpted_rply.ar_results.where = (caddr_t) &res;
+			reply.acpted_rply.ar_results.proc =
+			    (xdrproc_t) xdr_COMPOUND4res;
+		} else {
+			reply.acpted_rply.ar_stat = GARBAGE_ARGS;
+		}
+	} else if (call.rm_call.cb_proc != NFSPROC4_NULL) {
+		reply.acpted_rply.ar_stat = PROC_UNAVAIL;
+	}
+
+	/* results may point into the tree until they are encoded */
+	pthread_mutex_lock(&s->lock);
+	if (decoded)
+		fake_process_compound(&c, &args, &res);
+	rep = fake_encode_reply(conn, &reply);
+	if (!rep) {
+		reply.acpted_rply.ar_stat = SYSTEM_ERR;
+		reply.acpted_rply.ar_results.where = NULL;
+		reply.acpted_rply.ar_results.proc = (xdrproc_t) xdr_void;
+		rep = fake_encode_reply(conn, &reply);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	fake_free_chunks(&c);
+	if (decoded)
+		fake_xdr_free((xdrproc_t) xdr_COMPOUND4args, &args);
+
+	return rep;
+}
+
+/* Return 1 after reading "len" bytes, 0 upon EOF, or -errno. */
+static int fake_read_full(int fd, char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		if (n == 0)
+			return 0;
+		buf += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/* Read a whole RPC record; return its length, 0 upon EOF, or -errno. */
+static ssize_t fake_read_record(struct fake_conn *conn)
+{
+	size_t len = 0;
+	uint32_t mark;
+	size_t frag;
+	char *buf;
+	bool last = false;
+	int rc;
+
+	while (!last) {
+		rc = fake_read_full(conn->fd, (char *)&mark, sizeof(mark));
+		if (rc <= 0)
+			return rc;
+		mark = ntohl(mark);
+		last = mark & (1U << 31);
+		frag = mark & ~(1U << 31);
+		if (len + frag > FAKE_MAX_MSG)
+			return -EMSGSIZE;
+		if (len + frag > conn->recvbuf_size) {
+			buf = realloc(conn->recvbuf, len + frag);
+			if (!buf)
+				return -ENOMEM;
+			conn->recvbuf = buf;
+			conn->recvbuf_size = len + frag;
+		}
+		rc = fake_read_full(conn->fd, conn->recvbuf + len, frag);
+		if (rc <= 0)
+			return rc;
+		len += frag;
+	}
+
+	return len;
+}
+
+/* Delay "rep" as if the call and "rep" went through the emulated link. */
+static void fake_queue_reply(struct fake_conn *conn, struct fake_reply *rep,
+			     uint64_t arrival_ns, size_t request_len)
+{
+	struct tc_fake_server *s = conn->server;
+	uint32_t rtt_us = __atomic_load_n(&s->rtt_us, __ATOMIC_RELAXED);
+	uint64_t bandwidth = __atomic_load_n(&s->bandwidth, __ATOMIC_RELAXED);
+	uint64_t due = arrival_ns + rtt_us * 1000ULL;
+	uint64_t xmit;
+
+	if (bandwidth) {
+		due += (request_len + rep->len) * 1000000000ULL / bandwidth;
+		xmit = rep->len * 1000000000ULL / bandwidth;
+		if (due < conn->link_free_ns + xmit)
+			due = conn->link_free_ns + xmit;
+		conn->link_free_ns = due;
+	}
+	rep->due_ns = due;
+
+	pthread_mutex_lock(&conn->lock);
+	if (conn->tail)
+		conn->tail->next = rep;
+	else
+		conn->head = rep;
+	conn->tail = rep;
+	pthread_cond_signal(&conn->cond);
+	pthread_mutex_unlock(&conn->lock);
+}
+
+static void *fake_conn_reader(void *arg)
+{
+	struct fake_conn *conn = arg;
+	struct fake_reply *rep;
+	uint64_t arrival_ns;
+	ssize_t len;
+
+	while ((len = fake_read_record(conn)) > 0) {
+		arrival_ns = fake_now_ns();
+		rep = fake_handle_call(conn, conn->recvbuf, len);
+		if (rep)
+			fake_queue_reply(conn, rep, arrival_ns, len + 4);
+	}
+
+	pthread_mutex_lock(&conn->lock);
+	conn->closing = true;
+	pthread_cond_signal(&conn->cond);
+	pthread_mutex_unlock(&conn->lock);
+
+	return NULL;
+}
+
+static void *fake_conn_writer(void *arg)
+{
+	struct fake_conn *conn = arg;
+	struct fake_reply *rep;
+	struct timespec ts;
+	size_t sent;
+	ssize_t n;
+
+	while (true) {
+		pthread_mutex_lock(&conn->lock);
+		while (!conn->head && !conn->closing)
+			pthread_cond_wait(&conn->cond, &conn->lock);
+		rep = conn->head;
+		if (rep) {
+			conn->head = rep->next;
+			if (!conn->head)
+				conn->tail = NULL;
+		}
+		pthread_mutex_unlock(&conn->lock);
+		if (!rep)
+			break;
+
+		ts.tv_sec = rep->due_ns / 1000000000ULL;
+		ts.tv_nsec = rep->due_ns % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+		for (sent = 0; sent < rep->len; sent += n) {
+			n = send(conn->fd, rep->buf + sent, rep->len - sent,
+				 MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			if (n <= 0)
+				break;
+		}
+		free(rep);
+	}
+
+	return NULL;
+}
+
+static void fake_free_conn(struct fake_conn *conn)
+{
+	struct fake_reply *rep;
+
+	while ((rep = conn->head) != NULL) {
+		conn->head = rep->next;
+		free(rep);
+	}
+	pthread_mutex_destroy(&conn->lock);
+	pthread_cond_destroy(&conn->cond);
+	free(conn->recvbuf);
+	free(conn->sendbuf);
+	free(conn);
+}
+
+static int fake_start_conn(struct tc_fake_server *s, int fd)
+{
+	struct fake_conn *conn;
+	int rc;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return -ENOMEM;
+	conn->server = s;
+	conn->fd = fd;
+	pthread_mutex_init(&conn->lock, NULL);
+	pthread_cond_init(&conn->cond, NULL);
+	conn->sendbuf = malloc(FAKE_MAX_MSG + 4);
+	if (!conn->sendbuf) {
+		fake_free_conn(conn);
+		return -ENOMEM;
+	}
+
+	rc = pthread_create(&conn->writer, NULL, fake_conn_writer, conn);
+	if (rc != 0) {
+		fake_free_conn(conn);
+		return -rc;
+	}
+	rc = pthread_create(&conn->reader, NULL, fake_conn_reader, conn);
+	if (rc != 0) {
+		pthread_mutex_lock(&conn->lock);
+		conn->closing = true;
+		pthread_cond_signal(&conn->cond);
+		pthread_mutex_unlock(&conn->lock);
+		pthread_join(conn->writer, NULL);
+		fake_free_conn(conn);
+		return -rc;
+	}
+
+	pthread_mutex_lock(&s->conns_lock);
+	conn->next = s->conns;
+	s->conns = conn;
+	pthread_mutex_unlock(&s->conns_lock);
+
+	return 0;
+}
+
+static void *fake_acceptor(void *arg)
+{
+	struct tc_fake_server *s = arg;
+	int one = 1;
+	int fd;
+
+	while (true) {
+		fd = accept(s->listen_fd, NULL, NULL);
+		if (__atomic_load_n(&s->stopping, __ATOMIC_ACQUIRE)) {
+			if (fd >= 0)
+				close(fd);
+			break;
+		}
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (fake_start_conn(s, fd) != 0)
+			close(fd);
+	}
+
+	return NULL;
+}
+
+static void fake_free_server(struct tc_fake_server *s)
+{
+	struct fake_dirent *de;
+	size_t i;
+
+	if (s->buckets) {
+		for (i = 0; i < FAKE_HASH_SIZE; ++i) {
+			while ((de = s->buckets[i]) != NULL) {
+				s->buckets[i] = de->hash_next;
+				free(de->name);
+				free(de);
+			}
+		}
+		free(s->buckets);
+	}
+	for (i = 0; i < s->nnodes; ++i) {
+		if (s->nodes[i]) {
+			free(s->nodes[i]->data);
+			free(s->nodes[i]);
+		}
+	}
+	free(s->nodes);
+	pthread_mutex_destroy(&s->lock);
+	pthread_mutex_destroy(&s->conns_lock);
+	free(s);
+}
+
+int tc_fake_server_start(const struct tc_fake_server_opts *opts,
+			 struct tc_fake_server **server)
+{
+	struct tc_fake_server *s;
+	struct fake_node *root;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	uint64_t now = fake_now_ns();
+	int one = 1;
+	int rc;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	s->listen_fd = -1;
+	s->rtt_us = opts->rtt_us;
+	s->bandwidth = opts->bandwidth;
+	s->clientid = now;
+	memcpy(s->write_verf, &now, NFS4_VERIFIER_SIZE);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_mutex_init(&s->conns_lock, NULL);
+
+	s->buckets = calloc(FAKE_HASH_SIZE, sizeof(*s->buckets));
+	/* id 0 is never used */
+	if (!s->buckets || !fake_new_node(s, NF4DIR, 0)) {
+		rc = -ENOMEM;
+		goto err;
+	}
+	s->nodes[0]->id = 0;
+	free(s->nodes[0]);
+	s->nodes[0] = NULL;
+	root = fake_new_node(s, NF4DIR, 0755);
+	if (!root) {
+		rc = -ENOMEM;
+		goto err;
+	}
+	root->nlink = 2;
+	if (opts->export_path &&
+	    fake_mkdir_p(s, opts->export_path) != NFS4_OK) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	s->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (s->listen_fd < 0) {
+		rc = -errno;
+		goto err;
+	}
+	setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(opts->port);
+	if (bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(s->listen_fd, 128) < 0 ||
+	    getsockname(s->listen_fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+		rc = -errno;
+		goto err;
+	}
+	s->port = ntohs(addr.sin_port);
+
+	rc = pthread_create(&s->acceptor, NULL, fake_acceptor, s);
+	if (rc != 0) {
+		rc = -rc;
+		goto err;
+	}
+
+	*server = s;
+	return 0;
+
+err:
+	if (s->listen_fd >= 0)
+		close(s->listen_fd);
+	fake_free_server(s);
+	return rc;
+}
+
+uint16_t tc_fake_server_port(const struct tc_fake_server *server)
+{
+	return server->port;
+}
+
+void tc_fake_server_set_delay(struct tc_fake_server *server, uint32_t rtt_us,
+			      uint64_t bandwidth)
+{
+	__atomic_store_n(&server->rtt_us, rtt_us, __ATOMIC_RELAXED);
+	__atomic_store_n(&server->bandwidth, bandwidth, __ATOMIC_RELAXED);
+}
+
+void tc_fake_server_stop(struct tc_fake_server *s)
+{
+	struct fake_conn *conn;
+
+	__atomic_store_n(&s->stopping, true, __ATOMIC_RELEASE);
+	shutdown(s->listen_fd, SHUT_RDWR);
+	pthread_join(s->acceptor, NULL);
+	close(s->listen_fd);
+
+	while ((conn = s->conns) != NULL) {
+		s->conns = conn->next;
+		shutdown(conn->fd, SHUT_RDWR);
+		pthread_join(conn->reader, NULL);
+		pthread_join(conn->writer, NULL);
+		close(conn->fd);
+		fake_free_conn(conn);
+	}
+
+	fake_free_server(s);
+}
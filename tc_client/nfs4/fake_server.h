@@ -0,0 +1,93 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * A fake NFSv4.1 server backed by an in-memory tree.
+ *
+ * It listens on a loopback TCP port and speaks just enough NFSv4.1 for the
+ * NFS4 backend of TC: session setup (EXCHANGE_ID, CREATE_SESSION, SEQUENCE,
+ * RECLAIM_COMPLETE, DESTROY_SESSION), navigation (PUTROOTFH, PUTFH, GETFH,
+ * LOOKUP, LOOKUPP, SAVEFH, RESTOREFH), data (OPEN, CLOSE, READ, WRITE,
+ * COMMIT) and metadata (GETATTR, SETATTR, VERIFY, NVERIFY, ACCESS, READDIR,
+ * CREATE, REMOVE, RENAME, LINK, READLINK).  Other operations fail with
+ * NFS4ERR_NOTSUPP.  There is no state checking: any stateid is accepted and
+ * all accesses are allowed.
+ *
+ * Because the server does almost no work, benchmarks against it measure the
+ * overhead of the client.  A round-trip time and a link bandwidth can be
+ * injected to emulate a remote server: the reply to a request of "req" bytes
+ * with "rep" bytes is sent no earlier than
+ *
+ *	arrival + rtt + (req + rep) / bandwidth
+ *
+ * and replies of a connection leave one after another at the bandwidth.
+ * Requests are processed in the order they arrive, and the injected delay
+ * does not block processing of later requests, so concurrent compounds
+ * overlap their delays as they would on a real network.
+ */
+
+#ifndef __TC_NFS4_FAKE_SERVER_H__
+#define __TC_NFS4_FAKE_SERVER_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct tc_fake_server_opts {
+	uint16_t port;			/* on 127.0.0.1; 0 picks a free port */
+	uint32_t rtt_us;		/* injected round-trip time */
+	uint64_t bandwidth;		/* bytes per second; 0 is unlimited */
+	const char *export_path;	/* created at start; NULL for none */
+};
+
+struct tc_fake_server;
+
+/**
+ * Start a fake server serving "opts" from background threads.
+ *
+ * Return 0 and set "*server" on success, or return -errno.
+ */
+int tc_fake_server_start(const struct tc_fake_server_opts *opts,
+			 struct tc_fake_server **server);
+
+/**
+ * Return the port the server listens on (in host byte order).
+ */
+uint16_t tc_fake_server_port(const struct tc_fake_server *server);
+
+/**
+ * Change the injected delays of a running server; compounds received after
+ * the call are delayed with the new values.
+ */
+void tc_fake_server_set_delay(struct tc_fake_server *server, uint32_t rtt_us,
+			      uint64_t bandwidth);
+
+/**
+ * Close all connections, stop the server and free its tree.
+ */
+void tc_fake_server_stop(struct tc_fake_server *server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TC_NFS4_FAKE_SERVER_H__
@@ -84,6 +84,8 @@ static struct config_item kern_client_params[] = {
 		       fs_client_params, srv_sendsize),
 	CONF_ITEM_UI32("NFS_RecvSize", 512, FSAL_MAXIOSIZE, 32768,
 		       fs_client_params, srv_recvsize),
+	CONF_ITEM_BOOL("Use_Hugepages", false,
+		       fs_client_params, use_hugepages),
 	CONF_ITEM_INET_PORT("NFS_Port", 0, UINT16_MAX, 2049,
 			    fs_client_params, srv_port),
 	CONF_ITEM_BOOL("Use_Privileged_Client_Port", false,
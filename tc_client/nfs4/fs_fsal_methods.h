@@ -11,6 +11,7 @@ typedef struct fs_client_params {
 	unsigned int srv_prognum;
 	unsigned int srv_sendsize;
 	unsigned int srv_recvsize;
+	bool use_hugepages;	/* for large RPC buffers */
 	unsigned int srv_timeout;
 	unsigned short srv_port;
 	unsigned int use_privileged_client_port;
@@ -118,6 +118,20 @@ do { \
 	op->nfs_argop4_u.opsetattr.obj_attributes = inattr;		\
 } while (0)
 
+#define COMPOUNDV4_ARG_ADD_OP_VERIFY(opcnt, argarray, inattr) \
+do { \
+	nfs_argop4 *op = argarray + opcnt; opcnt++;			\
+	op->argop = NFS4_OP_VERIFY;					\
+	op->nfs_argop4_u.opverify.obj_attributes = inattr;		\
+} while (0)
+
+#define COMPOUNDV4_ARG_ADD_OP_NVERIFY(opcnt, argarray, inattr) \
+do { \
+	nfs_argop4 *op = argarray + opcnt; opcnt++;			\
+	op->argop = NFS4_OP_NVERIFY;					\
+	op->nfs_argop4_u.opnverify.obj_attributes = inattr;		\
+} while (0)
+
 #define COMPOUNDV4_ARG_ADD_OP_COPY(opcnt, argarray, src_offset, dst_offset,    \
 				   count)                                      \
 	do {                                                                   \
@@ -148,6 +162,13 @@ do { \
 	op->nfs_argop4_u.opputfh.object = nfs4fh;	     \
 } while (0)
 
+#define COMPOUNDV4_ARG_ADD_OP_OPENATTR(opcnt, argarray, create) \
+do { \
+	nfs_argop4 *op = argarray + opcnt; opcnt++;	     \
+	op->argop = NFS4_OP_OPENATTR;			     \
+	op->nfs_argop4_u.opopenattr.createdir = create;	     \
+} while (0)
+
 #define COMPOUNDV4_ARG_ADD_OP_LOOKUP(opcnt, argarray, name) \
 do { \
 	nfs_argop4 *op = argarray + opcnt; opcnt++;  \
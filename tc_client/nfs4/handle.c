@@ -38,6 +38,7 @@
 #include <sys/stat.h>
 #include <sys/poll.h>
 #include <sys/types.h>
+#include <sys/xattr.h>
 #include "ganesha_list.h"
 #include "abstract_atomic.h"
 #include "fsal_types.h"
@@ -51,6 +52,9 @@
 #include "nfs4_util.h"
 #include "tc_helper.h"
 #include "session_slots.h"
+#include "compound_sched.h"
+#include "rpc_bufpool.h"
+#include "compound_trace.h"
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -81,6 +85,17 @@ static pthread_mutex_t listlock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t sockless = PTHREAD_COND_INITIALIZER;
 static pthread_cond_t need_context = PTHREAD_COND_INITIALIZER;
 
+/*
+ * RPC contexts own no buffers, so they are created on demand; there is no
+ * point having more of them than session slots.
+ */
+#define FS_MAX_IO_CONTEXTS SESSION_SLOT_TABLE_CAPACITY
+#define FS_MIN_IO_CONTEXTS 4
+static int fs_nr_contexts = 0;	/* protected by "context_lock" */
+static unsigned int fs_rpc_prognum;
+static unsigned int fs_rpc_sendsize;
+static unsigned int fs_rpc_recvsize;
+
 static struct session_slot_table *sess_slot_tbl;
 
 static pthread_once_t tc_once;
@@ -91,6 +106,8 @@ static __thread nfs_argop4 argoparray[MAX_NUM_OPS_PER_COMPOUND];
 static __thread nfs_resop4 resoparray[MAX_NUM_OPS_PER_COMPOUND];
 static __thread int opcnt = 0;
 static __thread bool slot_allocated = false;
+/* class of the compound admitted by tc_sched_enter(), or -1 */
+static __thread int tc_sched_class = -1;
 
 static __thread char tc_saved_path[PATH_MAX + 1];
 
@@ -119,7 +136,7 @@ static const bool NFS4_CHANGE_CFH[] = {
 	[NFS4_OP_LOOKUPP] = true,
 	[NFS4_OP_NVERIFY] = false,
 	[NFS4_OP_OPEN] = true,
-	[NFS4_OP_OPENATTR] = false,
+	[NFS4_OP_OPENATTR] = true,
 	[NFS4_OP_OPEN_CONFIRM] = false,
 	[NFS4_OP_OPEN_DOWNGRADE] = false,
 	[NFS4_OP_PUTFH] = true,
@@ -172,7 +189,8 @@ static const bool NFS4_CHANGE_CFH[] = {
 };
 
 /*
- * Protects the "free_contexts" list and the "need_context" condition.
+ * Protects the "free_contexts" list, "fs_nr_contexts" and the "need_context"
+ * condition.
  */
 static pthread_mutex_t context_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -186,8 +204,9 @@ struct fs_rpc_io_context {
 	int iodone;
 	int ioresult;
 	unsigned int nfs_prog;
-	unsigned int sendbuf_sz;
-	unsigned int recvbuf_sz;
+	/* buffers from the RPC buffer pool, only held during a call */
+	size_t sendbuf_sz;
+	size_t recvbuf_sz;
 	char *sendbuf;
 	char *recvbuf;
 };
@@ -298,6 +317,15 @@ static int nfsstat4_to_errno(nfsstat4 nfsstat)
 		return EDQUOT;
 	} else if (nfsstat == NFS4ERR_STALE) { /* 70 */
 		return ESTALE;
+	} else if (nfsstat == NFS4ERR_DENIED) { /* 10010 */
+		return EAGAIN;
+	} else if (nfsstat == NFS4ERR_SAME ||	  /* 10009 */
+		   nfsstat == NFS4ERR_NOT_SAME) { /* 10027 */
+		return EAGAIN;	/* the condition of VERIFY/NVERIFY is false */
+	} else if (nfsstat == NFS4ERR_SYMLINK) { /* 10029 */
+		return ELOOP;
+	} else if (nfsstat == NFS4ERR_DEADLOCK) { /* 10045 */
+		return EDEADLK;
         } else {
 		assert(nfsstat >= NFS4ERR_BADHANDLE); /* 10001 */
 		return EREMOTEIO;
@@ -441,6 +469,16 @@ static struct bitmap4 tc_bitmap_readdir = {
 	.bitmap4_len = 1
 };
 
+static struct bitmap4 tc_bitmap_size = {
+	.map[0] = PXY_ATTR_BIT(FATTR4_SIZE),
+	.bitmap4_len = 1
+};
+
+static struct bitmap4 tc_bitmap_named_attr = {
+	.map[0] = PXY_ATTR_BIT(FATTR4_NAMED_ATTR),
+	.bitmap4_len = 1
+};
+
 static struct bitmap4 fs_bitmap_fsinfo = {
 	.map[0] =
 	    (PXY_ATTR_BIT(FATTR4_FILES_AVAIL) | PXY_ATTR_BIT(FATTR4_FILES_FREE)
@@ -506,6 +544,10 @@ static void tc_attr_masks_to_bitmap(const struct tc_attrs_masks *masks,
                 bm->map[1] |= PXY_ATTR_BIT2(FATTR4_TIME_METADATA);
                 bm->bitmap4_len = MAX(bm->bitmap4_len, 2);
         }
+        if (masks->has_change) {
+                bm->map[0] |= PXY_ATTR_BIT(FATTR4_CHANGE);
+                bm->bitmap4_len = MAX(bm->bitmap4_len, 1);
+        }
 }
 
 #undef PXY_ATTR_BIT
@@ -601,6 +643,10 @@ static void tc_update_sequence(nfs_argop4 *arg, nfs_resop4 *res, bool sent)
 				  false);
 	}
 	slot_allocated = false;
+	if (tc_sched_class >= 0) {
+		tc_sched_leave(tc_sched_class);
+		tc_sched_class = -1;
+	}
 }
 
 static inline void tc_save_path(slice_t path)
@@ -641,6 +687,7 @@ static void tc_reset_compound(bool has_sequence)
         }
 
         tc_cleanup_compound(NULL);
+	tc_trace_reset();
 
 	/**
 	 * We free the slot first, in case the previous compound allocated slot
@@ -657,8 +704,10 @@ static void tc_reset_compound(bool has_sequence)
 		argoparray->argop = NFS4_OP_SEQUENCE;
 		sa = &argoparray->nfs_argop4_u.opsequence;
 		memcpy(&sa->sa_sessionid, &fs_sessionid, NFS4_SESSIONID_SIZE);
+		tc_sched_class = tc_sched_enter();
 		sa->sa_slotid = alloc_session_slot(
 		    sess_slot_tbl, &sa->sa_sequenceid, &sa->sa_highest_slotid);
+		tc_trace_slot(sa->sa_slotid);
 		slot_allocated = true;
 		sa->sa_cachethis = false;
 		++opcnt;
@@ -702,13 +751,25 @@ static inline char *tc_new_auto_str(slice_t sl)
 static int fs_got_rpc_reply(struct fs_rpc_io_context *ctx, int sock, int sz,
 			     u_int xid)
 {
-	char *repbuf = ctx->recvbuf;
+	char *repbuf;
 	int size;
 
-	if (sz > ctx->recvbuf_sz)
+	if (sz > fs_rpc_recvsize)
 		return -E2BIG;
 
 	pthread_mutex_lock(&ctx->iolock);
+	/* a reply to an earlier try may not have been consumed */
+	tc_rpcbuf_put(ctx->recvbuf, ctx->recvbuf_sz);
+	ctx->recvbuf = tc_rpcbuf_get(sz, &ctx->recvbuf_sz);
+	if (!ctx->recvbuf) {
+		/* let the caller resend once the socket is reconnected */
+		ctx->iodone = 1;
+		ctx->ioresult = -EAGAIN;
+		pthread_cond_signal(&ctx->iowait);
+		pthread_mutex_unlock(&ctx->iolock);
+		return -ENOMEM;
+	}
+	repbuf = ctx->recvbuf;
 	memcpy(repbuf, &xid, sizeof(xid));
 	/*
 	 * sz includes 4 bytes of xid which have been processed
@@ -948,6 +1009,7 @@ static enum clnt_stat fs_process_reply(struct fs_rpc_io_context *ctx,
 
 	ctx->iodone = 0;
 	pthread_mutex_unlock(&ctx->iolock);
+	tc_trace_reply(ctx->ioresult);
 
 	if (ctx->ioresult > 0) {
 		struct rpc_msg reply;
@@ -1009,6 +1071,13 @@ static enum clnt_stat fs_process_reply(struct fs_rpc_io_context *ctx,
 
 		xdr_free((xdrproc_t) xdr_replymsg, &reply);
 	}
+
+	/* the results are decoded into their own memory */
+	pthread_mutex_lock(&ctx->iolock);
+	tc_rpcbuf_put(ctx->recvbuf, ctx->recvbuf_sz);
+	ctx->recvbuf = NULL;
+	ctx->recvbuf_sz = 0;
+	pthread_mutex_unlock(&ctx->iolock);
 	return rc;
 }
 
@@ -1034,6 +1103,57 @@ static int fs_rpc_renewer_wait(int timeout)
 	return (rc == ETIMEDOUT);
 }
 
+/*
+ * Guess the encoded size of a compound: WRITE data plus a bit for everything
+ * else.  fs_encode_compound() retries with larger buffers if it is too small.
+ */
+static size_t fs_estimate_compound_size(const COMPOUND4args *args)
+{
+	size_t size = 512;	/* RPC header and credentials */
+	u_int i;
+
+	for (i = 0; i < args->argarray.argarray_len; ++i) {
+		const nfs_argop4 *op = &args->argarray.argarray_val[i];
+
+		size += 256;
+		if (op->argop == NFS4_OP_WRITE) {
+			size += op->nfs_argop4_u.opwrite.data.data_len;
+		}
+	}
+	return size;
+}
+
+struct fs_encode_args {
+	XDR *x;
+	struct rpc_msg *rmsg;
+	COMPOUND4args *args;
+};
+
+static bool fs_encode_into(char *buf, size_t len, void *arg)
+{
+	struct fs_encode_args *ea = arg;
+
+	memset(ea->x, 0, sizeof(*ea->x));
+	xdrmem_create(ea->x, buf + 4, len - 4, XDR_ENCODE);
+	return xdr_callmsg(ea->x, ea->rmsg) &&
+	       xdr_COMPOUND4args(ea->x, ea->args);
+}
+
+/*
+ * Encode the RPC into a send buffer from the pool, leaving 4 bytes for the
+ * record mark.  The buffer is put back by the caller.
+ */
+static bool fs_encode_compound(struct fs_rpc_io_context *ctx, XDR *x,
+			       struct rpc_msg *rmsg, COMPOUND4args *args)
+{
+	struct fs_encode_args ea = { .x = x, .rmsg = rmsg, .args = args };
+
+	ctx->sendbuf = tc_rpcbuf_fill(fs_estimate_compound_size(args) + 4,
+				      fs_rpc_sendsize + 4, fs_encode_into, &ea,
+				      &ctx->sendbuf_sz);
+	return ctx->sendbuf != NULL;
+}
+
 static int fs_compoundv4_call(struct fs_rpc_io_context *pcontext,
 			       const struct user_cred *cred,
 			       COMPOUND4args *args, COMPOUND4res *res)
@@ -1066,10 +1186,7 @@ static int fs_compoundv4_call(struct fs_rpc_io_context *pcontext,
 	rmsg.rm_call.cb_cred = au->ah_cred;
 	rmsg.rm_call.cb_verf = au->ah_verf;
 
-	memset(&x, 0, sizeof(x));
-	xdrmem_create(&x, pcontext->sendbuf + 4, pcontext->sendbuf_sz,
-		      XDR_ENCODE);
-	if (xdr_callmsg(&x, &rmsg) && xdr_COMPOUND4args(&x, args)) {
+	if (fs_encode_compound(pcontext, &x, &rmsg, args)) {
 		u_int pos = xdr_getpos(&x);
 		u_int recmark = ntohl(pos | (1U << 31));
 		int first_try = 1;
@@ -1078,6 +1195,8 @@ static int fs_compoundv4_call(struct fs_rpc_io_context *pcontext,
 
 		memcpy(pcontext->sendbuf, &recmark, sizeof(recmark));
 		pos += 4;
+		tc_trace_send(rmsg.rm_xid, args, pos, fs_rpc_sendsize,
+			      MAX_NUM_OPS_PER_COMPOUND);
 
 		do {
 			int bc = 0;
@@ -1113,6 +1232,8 @@ static int fs_compoundv4_call(struct fs_rpc_io_context *pcontext,
 			else
 				rc = RPC_CANTSEND;
 		} while (rc == RPC_TIMEDOUT);
+		tc_rpcbuf_put(pcontext->sendbuf, pcontext->sendbuf_sz);
+		pcontext->sendbuf = NULL;
 	} else {
 		rc = RPC_CANTENCODEARGS;
 	}
@@ -1121,6 +1242,265 @@ static int fs_compoundv4_call(struct fs_rpc_io_context *pcontext,
 	return rc;
 }
 
+static struct fs_rpc_io_context *fs_new_io_context(void)
+{
+	struct fs_rpc_io_context *c = gsh_calloc(1, sizeof(*c));
+
+	if (c) {
+		pthread_mutex_init(&c->iolock, NULL);
+		pthread_cond_init(&c->iowait, NULL);
+		c->nfs_prog = fs_rpc_prognum;
+	}
+	return c;
+}
+
+/*
+ * Take a free RPC context, or create one if there are fewer than
+ * FS_MAX_IO_CONTEXTS; wait only if that fails.
+ */
+static struct fs_rpc_io_context *fs_get_io_context(void)
+{
+	struct fs_rpc_io_context *ctx = NULL;
+
+	pthread_mutex_lock(&context_lock);
+	while (glist_empty(&free_contexts)) {
+		if (fs_nr_contexts < FS_MAX_IO_CONTEXTS) {
+			++fs_nr_contexts;
+			pthread_mutex_unlock(&context_lock);
+			ctx = fs_new_io_context();
+			pthread_mutex_lock(&context_lock);
+			if (ctx)
+				break;
+			--fs_nr_contexts;
+		}
+		pthread_cond_wait(&need_context, &context_lock);
+	}
+	if (!ctx) {
+		ctx = glist_first_entry(&free_contexts,
+					struct fs_rpc_io_context, calls);
+		glist_del(&ctx->calls);
+	}
+	pthread_mutex_unlock(&context_lock);
+	return ctx;
+}
+
+/*
+ * Per-op latency counters: the latency of an RPC is recorded once for each
+ * distinct op type in its compound, so "nfs4_op_READ" tells how long the RPCs
+ * containing READs take.
+ */
+static struct tc_func_counter tc_nfs4_op_counters[NFS4_OP_IO_ADVISE + 1] = {
+	[NFS4_OP_ACCESS] = { .name = "nfs4_op_ACCESS" },
+	[NFS4_OP_CLOSE] = { .name = "nfs4_op_CLOSE" },
+	[NFS4_OP_COMMIT] = { .name = "nfs4_op_COMMIT" },
+	[NFS4_OP_CREATE] = { .name = "nfs4_op_CREATE" },
+	[NFS4_OP_DELEGPURGE] = { .name = "nfs4_op_DELEGPURGE" },
+	[NFS4_OP_DELEGRETURN] = { .name = "nfs4_op_DELEGRETURN" },
+	[NFS4_OP_GETATTR] = { .name = "nfs4_op_GETATTR" },
+	[NFS4_OP_GETFH] = { .name = "nfs4_op_GETFH" },
+	[NFS4_OP_LINK] = { .name = "nfs4_op_LINK" },
+	[NFS4_OP_LOCK] = { .name = "nfs4_op_LOCK" },
+	[NFS4_OP_LOCKT] = { .name = "nfs4_op_LOCKT" },
+	[NFS4_OP_LOCKU] = { .name = "nfs4_op_LOCKU" },
+	[NFS4_OP_LOOKUP] = { .name = "nfs4_op_LOOKUP" },
+	[NFS4_OP_LOOKUPP] = { .name = "nfs4_op_LOOKUPP" },
+	[NFS4_OP_NVERIFY] = { .name = "nfs4_op_NVERIFY" },
+	[NFS4_OP_OPEN] = { .name = "nfs4_op_OPEN" },
+	[NFS4_OP_OPENATTR] = { .name = "nfs4_op_OPENATTR" },
+	[NFS4_OP_OPEN_CONFIRM] = { .name = "nfs4_op_OPEN_CONFIRM" },
+	[NFS4_OP_OPEN_DOWNGRADE] = { .name = "nfs4_op_OPEN_DOWNGRADE" },
+	[NFS4_OP_PUTFH] = { .name = "nfs4_op_PUTFH" },
+	[NFS4_OP_PUTPUBFH] = { .name = "nfs4_op_PUTPUBFH" },
+	[NFS4_OP_PUTROOTFH] = { .name = "nfs4_op_PUTROOTFH" },
+	[NFS4_OP_READ] = { .name = "nfs4_op_READ" },
+	[NFS4_OP_READDIR] = { .name = "nfs4_op_READDIR" },
+	[NFS4_OP_READLINK] = { .name = "nfs4_op_READLINK" },
+	[NFS4_OP_REMOVE] = { .name = "nfs4_op_REMOVE" },
+	[NFS4_OP_RENAME] = { .name = "nfs4_op_RENAME" },
+	[NFS4_OP_RENEW] = { .name = "nfs4_op_RENEW" },
+	[NFS4_OP_RESTOREFH] = { .name = "nfs4_op_RESTOREFH" },
+	[NFS4_OP_SAVEFH] = { .name = "nfs4_op_SAVEFH" },
+	[NFS4_OP_SECINFO] = { .name = "nfs4_op_SECINFO" },
+	[NFS4_OP_SETATTR] = { .name = "nfs4_op_SETATTR" },
+	[NFS4_OP_SETCLIENTID] = { .name = "nfs4_op_SETCLIENTID" },
+	[NFS4_OP_SETCLIENTID_CONFIRM] = { .name = "nfs4_op_SETCLIENTID_CONFIRM" },
+	[NFS4_OP_VERIFY] = { .name = "nfs4_op_VERIFY" },
+	[NFS4_OP_WRITE] = { .name = "nfs4_op_WRITE" },
+	[NFS4_OP_RELEASE_LOCKOWNER] = { .name = "nfs4_op_RELEASE_LOCKOWNER" },
+	[NFS4_OP_BACKCHANNEL_CTL] = { .name = "nfs4_op_BACKCHANNEL_CTL" },
+	[NFS4_OP_BIND_CONN_TO_SESSION] = { .name = "nfs4_op_BIND_CONN_TO_SESSION" },
+	[NFS4_OP_EXCHANGE_ID] = { .name = "nfs4_op_EXCHANGE_ID" },
+	[NFS4_OP_CREATE_SESSION] = { .name = "nfs4_op_CREATE_SESSION" },
+	[NFS4_OP_DESTROY_SESSION] = { .name = "nfs4_op_DESTROY_SESSION" },
+	[NFS4_OP_FREE_STATEID] = { .name = "nfs4_op_FREE_STATEID" },
+	[NFS4_OP_GET_DIR_DELEGATION] = { .name = "nfs4_op_GET_DIR_DELEGATION" },
+	[NFS4_OP_GETDEVICEINFO] = { .name = "nfs4_op_GETDEVICEINFO" },
+	[NFS4_OP_GETDEVICELIST] = { .name = "nfs4_op_GETDEVICELIST" },
+	[NFS4_OP_LAYOUTCOMMIT] = { .name = "nfs4_op_LAYOUTCOMMIT" },
+	[NFS4_OP_LAYOUTGET] = { .name = "nfs4_op_LAYOUTGET" },
+	[NFS4_OP_LAYOUTRETURN] = { .name = "nfs4_op_LAYOUTRETURN" },
+	[NFS4_OP_SECINFO_NO_NAME] = { .name = "nfs4_op_SECINFO_NO_NAME" },
+	[NFS4_OP_SEQUENCE] = { .name = "nfs4_op_SEQUENCE" },
+	[NFS4_OP_SET_SSV] = { .name = "nfs4_op_SET_SSV" },
+	[NFS4_OP_TEST_STATEID] = { .name = "nfs4_op_TEST_STATEID" },
+	[NFS4_OP_WANT_DELEGATION] = { .name = "nfs4_op_WANT_DELEGATION" },
+	[NFS4_OP_DESTROY_CLIENTID] = { .name = "nfs4_op_DESTROY_CLIENTID" },
+	[NFS4_OP_RECLAIM_COMPLETE] = { .name = "nfs4_op_RECLAIM_COMPLETE" },
+	[NFS4_OP_ALLOCATE] = { .name = "nfs4_op_ALLOCATE" },
+	[NFS4_OP_COPY] = { .name = "nfs4_op_COPY" },
+	[NFS4_OP_OFFLOAD_ABORT] = { .name = "nfs4_op_OFFLOAD_ABORT" },
+	[NFS4_OP_COPY_NOTIFY] = { .name = "nfs4_op_COPY_NOTIFY" },
+	[NFS4_OP_OFFLOAD_REVOKE] = { .name = "nfs4_op_OFFLOAD_REVOKE" },
+	[NFS4_OP_OFFLOAD_STATUS] = { .name = "nfs4_op_OFFLOAD_STATUS" },
+	[NFS4_OP_WRITE_PLUS] = { .name = "nfs4_op_WRITE_PLUS" },
+	[NFS4_OP_READ_PLUS] = { .name = "nfs4_op_READ_PLUS" },
+	[NFS4_OP_SEEK] = { .name = "nfs4_op_SEEK" },
+	[NFS4_OP_IO_ADVISE] = { .name = "nfs4_op_IO_ADVISE" },
+};
+
+static void tc_count_compound_ops(uint64_t ns, bool succeed)
+{
+	bool seen[NFS4_OP_IO_ADVISE + 1] = { false };
+	struct tc_func_counter *tfc;
+	nfs_opnum4 op;
+	int i;
+
+	for (i = 0; i < opcnt; ++i) {
+		op = argoparray[i].argop;
+		if (op > NFS4_OP_IO_ADVISE || op == NFS4_OP_SEQUENCE || seen[op])
+			continue;
+		seen[op] = true;
+		tfc = &tc_nfs4_op_counters[op];
+		tc_register_counter(tfc);
+		tc_counter_record(tfc, 1, ns, succeed);
+	}
+}
+
+/*
+ * Lazy close: CLOSEs of closed files are queued and appended to later
+ * compounds that have spare operations, so they cost no round trip of their
+ * own.  The queue is also flushed by a timer and when it is full.  A queued
+ * CLOSE carries the seqid of its stateid, so it cannot close a later OPEN of
+ * the same file, which is given the same stateid with a newer seqid; such
+ * CLOSEs are dropped from the queue by tc_nfs4_openv().
+ */
+#define TC_PENDING_CLOSES_MAX 64
+#define TC_PIGGYBACKED_CLOSES_MAX 16
+#define TC_LAZY_CLOSE_INTERVAL_MS 500
+
+struct tc_pending_close {
+	nfs_fh4 fh;
+	char fhbuf[NFS4_FHSIZE];
+	stateid4 sid;
+	seqid4 seqid;
+};
+
+static bool tc_lazy_close;
+static pthread_t tc_lazy_close_thread;
+static pthread_mutex_t tc_close_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tc_close_cond = PTHREAD_COND_INITIALIZER;
+static struct tc_pending_close tc_pending_closes[TC_PENDING_CLOSES_MAX];
+static int tc_npending_closes;
+
+/* CLOSEs appended to the compound being sent by this thread */
+static __thread struct tc_pending_close
+	tc_piggybacked_closes[TC_PIGGYBACKED_CLOSES_MAX];
+static __thread int tc_npiggybacked_closes;
+
+static void tc_copy_pending_close(struct tc_pending_close *dst,
+				  const struct tc_pending_close *src)
+{
+	*dst = *src;
+	dst->fh.nfs_fh4_val = dst->fhbuf;
+}
+
+/* Called with "tc_close_lock" held. */
+static void tc_queue_close(const struct tc_pending_close *pc)
+{
+	assert(tc_npending_closes < TC_PENDING_CLOSES_MAX);
+	tc_copy_pending_close(&tc_pending_closes[tc_npending_closes++], pc);
+}
+
+/*
+ * Append queued CLOSEs to the compound about to be sent, unless it has no
+ * SEQUENCE or it OPENs files.  Return the number of operations it had.
+ */
+static int tc_piggyback_closes(void)
+{
+	int nops = opcnt;
+	int n;
+	int i;
+
+	tc_npiggybacked_closes = 0;
+	if (opcnt == 0 || argoparray[0].argop != NFS4_OP_SEQUENCE) {
+		return nops;
+	}
+	for (i = 1; i < opcnt; ++i) {
+		if (argoparray[i].argop == NFS4_OP_OPEN) {
+			return nops;
+		}
+	}
+
+	pthread_mutex_lock(&tc_close_lock);
+	n = MIN(tc_npending_closes, TC_PIGGYBACKED_CLOSES_MAX);
+	n = MIN(n, (MAX_NUM_OPS_PER_COMPOUND - opcnt) / 2);
+	tc_npending_closes -= n;
+	for (i = 0; i < n; ++i) {
+		tc_copy_pending_close(
+		    &tc_piggybacked_closes[i],
+		    &tc_pending_closes[tc_npending_closes + i]);
+	}
+	pthread_mutex_unlock(&tc_close_lock);
+
+	for (i = 0; i < n; ++i) {
+		seqid4 seqid = tc_piggybacked_closes[i].seqid;
+
+		COMPOUNDV4_ARG_ADD_OP_PUTFH(opcnt, argoparray,
+					    tc_piggybacked_closes[i].fh);
+		COMPOUNDV4_ARG_ADD_OP_TCCLOSE(opcnt, argoparray, seqid,
+					      tc_piggybacked_closes[i].sid);
+	}
+	tc_npiggybacked_closes = n;
+
+	return nops;
+}
+
+/*
+ * Check the results of the CLOSEs appended after the first "nops"
+ * operations, and hide them from the caller.  CLOSEs that were not executed
+ * are queued again; failed ones are only logged and dropped, because
+ * retrying a CLOSE with a bad or stale stateid cannot succeed either.
+ */
+static void tc_finish_piggybacked_closes(int nops, bool sent,
+					 COMPOUND4res *res)
+{
+	int executed = 0;
+	int i;
+
+	if (tc_npiggybacked_closes == 0) {
+		return;
+	}
+	if (sent && res->resarray.resarray_len > nops) {
+		/* a failed PUTFH or CLOSE stops the compound */
+		executed = (res->resarray.resarray_len - nops + 1) / 2;
+		if (res->status != NFS4_OK) {
+			NFS4_DEBUG("lazy CLOSE failed: %d", res->status);
+		}
+		/* the caller's operations all succeeded */
+		res->status = NFS4_OK;
+	}
+
+	pthread_mutex_lock(&tc_close_lock);
+	for (i = executed; i < tc_npiggybacked_closes &&
+			   tc_npending_closes < TC_PENDING_CLOSES_MAX; ++i) {
+		tc_queue_close(&tc_piggybacked_closes[i]);
+	}
+	pthread_mutex_unlock(&tc_close_lock);
+
+	tc_npiggybacked_closes = 0;
+	opcnt = nops;
+}
+
 /**
  * Make the RPC call of the NFS request.  Note the difference of failure of RPC
  * and failure of NFS.  If "nfsstat" is NULL, the return value is the status of
@@ -1134,6 +1514,7 @@ static int fs_compoundv4_execute(const char *caller,
 {
 	enum clnt_stat rc;
 	struct fs_rpc_io_context *ctx;
+	int nops = tc_piggyback_closes();
 	COMPOUND4args arg = {
 		.minorversion = 1,
 		.argarray.argarray_val = argoparray,
@@ -1150,13 +1531,7 @@ static int fs_compoundv4_execute(const char *caller,
                 return RPC_SUCCESS;
         }
 
-	pthread_mutex_lock(&context_lock);
-	while (glist_empty(&free_contexts))
-		pthread_cond_wait(&need_context, &context_lock);
-	ctx =
-	    glist_first_entry(&free_contexts, struct fs_rpc_io_context, calls);
-	glist_del(&ctx->calls);
-	pthread_mutex_unlock(&context_lock);
+	ctx = fs_get_io_context();
 
         TC_START_COUNTER(rpc);
 
@@ -1170,12 +1545,15 @@ static int fs_compoundv4_execute(const char *caller,
 		 || (rc == RPC_CANTSEND));
 
 	TC_STOP_COUNTER(rpc, opcnt, rc == RPC_SUCCESS);
+	tc_count_compound_ops(timespec_diff(&rpc_start_tm, &rpc_stop_tm),
+			      rc == RPC_SUCCESS);
 
 	pthread_mutex_lock(&context_lock);
 	pthread_cond_signal(&need_context);
 	glist_add(&free_contexts, &ctx->calls);
 	pthread_mutex_unlock(&context_lock);
 
+	tc_finish_piggybacked_closes(nops, rc == RPC_SUCCESS, &res);
 	if (rc == RPC_SUCCESS) {
                if (nfsstat != NULL) {
                         *nfsstat = nfsstat4_to_errno(res.status);
@@ -1184,12 +1562,156 @@ static int fs_compoundv4_execute(const char *caller,
                }
         }
         tc_update_sequence(argoparray, resoparray, rc == RPC_SUCCESS);
+	tc_trace_done(caller, rc, rc == RPC_SUCCESS ? res.status : 0);
 	return rc;
 }
 
 #define fs_nfsv4_call(creds, st) \
 	fs_compoundv4_execute(__func__, creds, st)
 
+/*
+ * Send the queued CLOSEs in compounds of their own.  Return whether the
+ * queue got shorter.
+ */
+static bool tc_flush_pending_closes(void)
+{
+	int rc;
+	int n;
+	int start;
+
+	pthread_mutex_lock(&tc_close_lock);
+	n = start = tc_npending_closes;
+	pthread_mutex_unlock(&tc_close_lock);
+
+	while (n > 0) {
+		tc_reset_compound(true);
+		rc = fs_nfsv4_call(op_ctx->creds, NULL);
+		if (rc != NFS4_OK) {
+			NFS4_ERR("cannot flush lazy CLOSEs: %d", rc);
+			break;
+		}
+		pthread_mutex_lock(&tc_close_lock);
+		if (tc_npending_closes >= n) {
+			pthread_mutex_unlock(&tc_close_lock);
+			break; /* no progress */
+		}
+		n = tc_npending_closes;
+		pthread_mutex_unlock(&tc_close_lock);
+	}
+
+	return n < start;
+}
+
+static void *tc_lazy_close_flusher(void *arg)
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&tc_close_lock);
+	while (tc_lazy_close) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += TC_LAZY_CLOSE_INTERVAL_MS * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&tc_close_cond, &tc_close_lock, &ts);
+		if (tc_npending_closes > 0) {
+			pthread_mutex_unlock(&tc_close_lock);
+			tc_flush_pending_closes();
+			pthread_mutex_lock(&tc_close_lock);
+		}
+	}
+	pthread_mutex_unlock(&tc_close_lock);
+	return NULL;
+}
+
+static void tc_nfs4_set_lazy_close(bool enabled)
+{
+	int rc;
+
+	pthread_mutex_lock(&tc_close_lock);
+	if (enabled == tc_lazy_close) {
+		pthread_mutex_unlock(&tc_close_lock);
+		return;
+	}
+	tc_lazy_close = enabled;
+	pthread_cond_signal(&tc_close_cond);
+	pthread_mutex_unlock(&tc_close_lock);
+
+	if (enabled) {
+		rc = pthread_create(&tc_lazy_close_thread, NULL,
+				    tc_lazy_close_flusher, NULL);
+		if (rc) {
+			NFS4_ERR("cannot create lazy close thread: %s",
+				 strerror(rc));
+			tc_lazy_close = false;
+		}
+	} else {
+		pthread_join(tc_lazy_close_thread, NULL);
+		tc_flush_pending_closes();
+	}
+}
+
+/*
+ * Queue the CLOSEs of "fh4s" if lazy close is enabled; the queue is flushed
+ * whenever it is full, so a batch of any size can be queued.  Return the
+ * number of leading files whose CLOSEs are queued: the rest are not if lazy
+ * close is disabled or a flush makes no progress, e.g., when the server is
+ * down, and the caller then closes them itself.
+ */
+static int tc_nfs4_defer_closev(const nfs_fh4 *fh4s, int count,
+				stateid4 *sids, seqid4 *seqs)
+{
+	struct tc_pending_close pc;
+	int i;
+
+	pthread_mutex_lock(&tc_close_lock);
+	for (i = 0; i < count; ++i) {
+		// ignore stateless open
+		if (is_special_stateid(sids + i)) {
+			continue;
+		}
+		while (tc_lazy_close &&
+		       tc_npending_closes == TC_PENDING_CLOSES_MAX) {
+			pthread_mutex_unlock(&tc_close_lock);
+			if (!tc_flush_pending_closes()) {
+				return i;
+			}
+			pthread_mutex_lock(&tc_close_lock);
+		}
+		if (!tc_lazy_close) {
+			break;
+		}
+		assert(fh4s[i].nfs_fh4_len <= NFS4_FHSIZE);
+		memcpy(pc.fhbuf, fh4s[i].nfs_fh4_val, fh4s[i].nfs_fh4_len);
+		pc.fh.nfs_fh4_len = fh4s[i].nfs_fh4_len;
+		pc.sid = sids[i];
+		pc.seqid = seqs[i];
+		tc_queue_close(&pc);
+	}
+	pthread_mutex_unlock(&tc_close_lock);
+	return i;
+}
+
+/*
+ * Drop queued CLOSEs of the open state "sid", which has been opened again.
+ */
+static void tc_cancel_pending_close(const stateid4 *sid)
+{
+	int i;
+
+	pthread_mutex_lock(&tc_close_lock);
+	for (i = 0; i < tc_npending_closes; ) {
+		if (memcmp(tc_pending_closes[i].sid.other, sid->other,
+			   sizeof(sid->other)) == 0) {
+			tc_copy_pending_close(
+			    &tc_pending_closes[i],
+			    &tc_pending_closes[--tc_npending_closes]);
+		} else {
+			++i;
+		}
+	}
+	pthread_mutex_unlock(&tc_close_lock);
+}
+
 void fs_get_clientid(clientid4 *ret)
 {
 	pthread_mutex_lock(&fs_clientid_mutex);
@@ -1510,12 +2032,14 @@ void free_io_contexts(void)
 		glist_del(cur);
 		gsh_free(c);
 	}
+	fs_nr_contexts = 0;
+	tc_rpcbuf_trim();
 }
 
 int fs_init_rpc(const struct fs_fsal_module *pm)
 {
 	int rc;
-	int i = 16;
+	int i;
 
 	glist_init(&rpc_calls);
 	glist_init(&free_contexts);
@@ -1539,23 +2063,20 @@ int fs_init_rpc(const struct fs_fsal_module *pm)
 	LogEvent(COMPONENT_INIT, "RPC recv buf size: %u",
 		 pm->special.srv_recvsize);
 
-	for (i = 16; i > 0; i--) {
-		struct fs_rpc_io_context *c =
-		    gsh_calloc(1, sizeof(*c) + pm->special.srv_sendsize +
-			       pm->special.srv_recvsize);
+	fs_rpc_prognum = pm->special.srv_prognum;
+	fs_rpc_sendsize = pm->special.srv_sendsize;
+	fs_rpc_recvsize = pm->special.srv_recvsize;
+	tc_rpcbuf_use_hugepages(pm->special.use_hugepages);
+
+	/* more are created on demand */
+	for (i = FS_MIN_IO_CONTEXTS; i > 0; i--) {
+		struct fs_rpc_io_context *c = fs_new_io_context();
 		if (!c) {
 			free_io_contexts();
 			return ENOMEM;
 		}
-		pthread_mutex_init(&c->iolock, NULL);
-		pthread_cond_init(&c->iowait, NULL);
-		c->nfs_prog = pm->special.srv_prognum;
-		c->sendbuf_sz = pm->special.srv_sendsize;
-		c->recvbuf_sz = pm->special.srv_recvsize;
-		c->sendbuf = (char *)(c + 1);
-		c->recvbuf = c->sendbuf + c->sendbuf_sz;
-
 		glist_add(&free_contexts, &c->calls);
+		++fs_nr_contexts;
 	}
 
 	rc = pthread_create(&fs_recv_thread, NULL, fs_rpc_recv,
@@ -2012,9 +2533,11 @@ static slice_t tc_get_abspath_from_cwd(slice_t rel_path)
 
 static bool tc_set_cfh_from_cfh(const char *path, slice_t *leaf)
 {
-        slice_t *comps;
+        slice_t comps[TC_PATH_MAX_COMPS];
+        slice_t *heap_comps;
         slice_t p;
         int compcnt;
+        bool r;
 
         if (leaf) {
                 tc_path_dir_base(path, &p, leaf);
@@ -2022,9 +2545,17 @@ static bool tc_set_cfh_from_cfh(const char *path, slice_t *leaf)
                 p = toslice(path);
         }
 
-        compcnt = tc_path_tokenize_s(p, &comps);
+        compcnt = tc_path_tokenize_a(p, comps, TC_PATH_MAX_COMPS);
+        if (compcnt >= 0) {
+                return tc_prepare_lookups(comps, compcnt);
+        }
 
-        return tc_prepare_lookups(comps, compcnt);
+        /* too many components for the stack */
+        compcnt = tc_path_tokenize_s(p, &heap_comps);
+        if (compcnt < 0) return false;
+        r = tc_prepare_lookups(heap_comps, compcnt);
+        free(heap_comps);
+        return r;
 }
 
 static bool tc_set_cfh_from_root(slice_t *comps, int compcnt)
@@ -2064,45 +2595,43 @@ static bool tc_set_cfh_from_cwd(slice_t *comps, int compcnt)
         return r;
 }
 
-static bool tc_compress_path(slice_t path, slice_t **comps, int *comps_n,
-			     slice_t *abs_path)
+/**
+ * Tokenize "path" into "comps" and set "abs_path"; "comps" and "short_comps"
+ * have room for "max_comps" entries each.  Return true if "comps" is relative
+ * to the saved path because that takes fewer LOOKUPs.  "*comps_n" is -1 if
+ * the path has too many components and cannot be compressed.
+ */
+static bool tc_compress_path(slice_t path, slice_t *comps,
+			     slice_t *short_comps, int max_comps,
+			     int *comps_n, slice_t *abs_path)
 {
-        bool res;
         int short_comps_n;
-        slice_t *short_comps;
-        buf_t *short_path;
 
         if (path.size > 0 && path.data[0] == '/') {
                 *abs_path = path;
         } else {
                 *abs_path = tc_get_abspath_from_cwd(path);
         }
-        *comps_n = tc_path_tokenize_s(path, comps);
+        *comps_n = tc_path_tokenize_a(path, comps, max_comps);
 
         if (tc_saved_path[0] == 0) {
                 return false;
         }
 
-        short_path = tc_auto_buf(PATH_MAX);
-        if (!short_path) return false;
-	if (tc_path_rebase_s(toslice(tc_saved_path), *abs_path, short_path) < 0)
+	short_comps_n = tc_path_rebase_a(toslice(tc_saved_path), *abs_path,
+					 short_comps, max_comps);
+	if (short_comps_n < 0)
 		return false;
 
-	NFS4_DEBUG("relative path of %.*s is %.*s based on %s",
-		   abs_path->size, abs_path->data, short_path->size,
-		   short_path->data, tc_saved_path);
-	short_comps_n = tc_path_tokenize_s(asslice(short_path), &short_comps);
-        if (short_comps_n + 1 < *comps_n) {  // compressible
+	NFS4_DEBUG("%.*s is %d components away from %s", abs_path->size,
+		   abs_path->data, short_comps_n, tc_saved_path);
+        if (*comps_n < 0 || short_comps_n + 1 < *comps_n) {  // compressible
+                memcpy(comps, short_comps, sizeof(*comps) * short_comps_n);
                 *comps_n = short_comps_n;
-                free(*comps);
-                *comps = short_comps;
-                res = true;
-        } else {
-                free(short_comps);
-                res = false;
+                return true;
         }
 
-        return res;
+        return false;
 }
 
 /**
@@ -2181,10 +2710,17 @@ static inline bool tc_prepare_restorefh()
         return true;
 }
 
+/*
+ * Room for the components of the path and of its rebased form when they do
+ * not fit on the stack: either has fewer than PATH_MAX components.
+ */
+#define TC_HEAP_COMPS PATH_MAX
+
 static bool tc_set_cfh_to_path(const char *path, slice_t *leaf, bool save)
 {
         slice_t abs_path;
-        slice_t *comps;
+        slice_t stack_comps[2 * TC_PATH_MAX_COMPS];
+        slice_t *comps = stack_comps;
         int comps_n;
         bool compressed;
         slice_t p;
@@ -2197,10 +2733,21 @@ static bool tc_set_cfh_to_path(const char *path, slice_t *leaf, bool save)
                 p = toslice(path);
         }
 
-        compressed = tc_compress_path(p, &comps, &comps_n, &abs_path);
+        compressed = tc_compress_path(p, comps, comps + TC_PATH_MAX_COMPS,
+                                      TC_PATH_MAX_COMPS, &comps_n, &abs_path);
+        if (!compressed && comps_n < 0) {
+                /* too many components for the stack */
+                comps = malloc(sizeof(*comps) * 2 * TC_HEAP_COMPS);
+                if (!comps) return false;
+                compressed = tc_compress_path(p, comps, comps + TC_HEAP_COMPS,
+                                              TC_HEAP_COMPS, &comps_n,
+                                              &abs_path);
+        }
         if (compressed) {
 		r = tc_prepare_restorefh() &&
 		    tc_prepare_lookups(comps, comps_n);
+	} else if (comps_n < 0) {
+		r = false;
 	} else if (path[0] == '/') {
                 r = tc_set_cfh_from_root(comps, comps_n);
         } else {
@@ -2211,8 +2758,7 @@ static bool tc_set_cfh_to_path(const char *path, slice_t *leaf, bool save)
                 r = tc_prepare_savefh(&abs_path);
 	}
 
-	free(comps);
-
+        if (comps != stack_comps) free(comps);
         if (!r) opcnt = saved_opcnt;
         return r;
 }
@@ -2379,6 +2925,8 @@ static nfsstat4 get_nfs4_op_status(const nfs_resop4 *op_res)
                 return op_res->nfs_resop4_u.opdestroy_clientid.dcr_status;
 	case NFS4_OP_COPY: /* 60 */
 		return op_res->nfs_resop4_u.opcopy.cr_status;
+	case NFS4_OP_WRITE_PLUS: /* 65 */
+		return op_res->nfs_resop4_u.opwrite_plus.wpr_status;
 	default:
 		NFS4_ERR("not supported operation: %d", op_res->resop);
 	}
@@ -2643,6 +3191,21 @@ static inline SETATTR4res *tc_prepare_setattr(const fattr4 *fattr)
         return res;
 }
 
+/**
+ * Set up the VERIFY operation, or NVERIFY if "negated".
+ */
+static inline bool tc_prepare_verify(const fattr4 *fattr, bool negated)
+{
+	if (!tc_has_enough_ops(1))
+		return false;
+	if (negated) {
+		COMPOUNDV4_ARG_ADD_OP_NVERIFY(opcnt, argoparray, *fattr);
+	} else {
+		COMPOUNDV4_ARG_ADD_OP_VERIFY(opcnt, argoparray, *fattr);
+	}
+	return true;
+}
+
 /**
  * Set up the GETFH operation.
  */
@@ -2672,6 +3235,111 @@ static inline bool tc_prepare_close(seqid4 *seqid, stateid4 *sid)
 	return true;
 }
 
+/*
+ * All locks of a TC client belong to one lock owner, so that they do not
+ * conflict with each other as fcntl() locks of a process.
+ */
+static inline unsigned tc_lock_owner(char owner_val[64])
+{
+	return snprintf(owner_val, 64, "TC-Lock: pid=%d", getpid());
+}
+
+static inline nfs_lock_type4 tc_lock_type(short type)
+{
+	return type == F_WRLCK ? WRITE_LT : READ_LT;
+}
+
+static inline length4 tc_lock_length(size_t length)
+{
+	return length == 0 ? NFS4_UINT64_MAX : length;
+}
+
+static inline LOCK4res *tc_prepare_lock(const struct tc_lock *lock,
+					const struct tc_lock_state *st,
+					char *owner_val, unsigned owner_len)
+{
+	LOCK4args *args;
+	open_to_lock_owner4 *otlo;
+	exist_lock_owner4 *elo;
+	LOCK4res *res;
+
+	if (!tc_has_enough_ops(1))
+		return NULL;
+
+	argoparray[opcnt].argop = NFS4_OP_LOCK;
+	args = &argoparray[opcnt].nfs_argop4_u.oplock;
+	args->locktype = tc_lock_type(lock->type);
+	args->reclaim = false;
+	args->offset = lock->offset;
+	args->length = tc_lock_length(lock->length);
+	args->locker.new_lock_owner = !st->has_lock_stateid;
+	if (st->has_lock_stateid) {
+		elo = &args->locker.locker4_u.lock_owner;
+		elo->lock_stateid = st->lock_stateid;
+		/* seqid 0 means the current stateid in NFSv4.1 */
+		elo->lock_stateid.seqid = 0;
+		elo->lock_seqid = 0;
+	} else {
+		otlo = &args->locker.locker4_u.open_owner;
+		otlo->open_seqid = 0;
+		otlo->open_stateid = st->open_stateid;
+		otlo->lock_seqid = 0;
+		tc_get_clientid(&otlo->lock_owner.clientid);
+		otlo->lock_owner.owner.owner_val = owner_val;
+		otlo->lock_owner.owner.owner_len = owner_len;
+	}
+
+	res = &resoparray[opcnt].nfs_resop4_u.oplock;
+	opcnt += 1;
+
+	return res;
+}
+
+static inline bool tc_prepare_locku(const struct tc_lock *lock,
+				    const struct tc_lock_state *st)
+{
+	LOCKU4args *args;
+
+	if (!tc_has_enough_ops(1))
+		return false;
+
+	argoparray[opcnt].argop = NFS4_OP_LOCKU;
+	args = &argoparray[opcnt].nfs_argop4_u.oplocku;
+	args->locktype = READ_LT;
+	args->seqid = 0;
+	args->lock_stateid = st->lock_stateid;
+	args->lock_stateid.seqid = 0;
+	args->offset = lock->offset;
+	args->length = tc_lock_length(lock->length);
+	opcnt += 1;
+
+	return true;
+}
+
+static inline LOCKT4res *tc_prepare_lockt(const struct tc_lock *lock,
+					  char *owner_val, unsigned owner_len)
+{
+	LOCKT4args *args;
+	LOCKT4res *res;
+
+	if (!tc_has_enough_ops(1))
+		return NULL;
+
+	argoparray[opcnt].argop = NFS4_OP_LOCKT;
+	args = &argoparray[opcnt].nfs_argop4_u.oplockt;
+	args->locktype = tc_lock_type(lock->type);
+	args->offset = lock->offset;
+	args->length = tc_lock_length(lock->length);
+	tc_get_clientid(&args->owner.clientid);
+	args->owner.owner.owner_val = owner_val;
+	args->owner.owner.owner_len = owner_len;
+
+	res = &resoparray[opcnt].nfs_resop4_u.oplockt;
+	opcnt += 1;
+
+	return res;
+}
+
 /**
  * TODO: deal with opening file by handle
  * @owner_pbuf: pbuf for owner
@@ -2734,6 +3402,18 @@ static inline READDIR4resok *tc_prepare_readdir(nfs_cookie4 *cookie,
 	return rdok;
 }
 
+/*
+ * Set CFH to the named attribute directory of CFH, creating the directory if
+ * "create".
+ */
+static inline bool tc_prepare_openattr(bool create)
+{
+	if (!tc_has_enough_ops(1))
+		return false;
+	COMPOUNDV4_ARG_ADD_OP_OPENATTR(opcnt, argoparray, create);
+	return true;
+}
+
 static inline REMOVE4resok *tc_prepare_remove(char *name)
 {
         REMOVE4resok *rmok;
@@ -3665,9 +4345,49 @@ static void tc_attrs_to_fattr4(const struct tc_attrs *tca, fattr4 *attr4)
 }
 
 /**
- * Set mode bits about file type.
+ * Encode the attributes of "tca" to be compared by VERIFY or NVERIFY.
  *
- * See http://lxr.free-electrons.com/source/include/uapi/linux/stat.h
+ * Unlike tc_attrs_to_fattr4(), times are the attributes that GETATTR
+ * returns rather than the settable ones, and the file type is not compared.
+ */
+static void tc_attrs_to_fattr4_verify(const struct tc_attrs *tca,
+				      fattr4 *attr4)
+{
+	struct attrlist attrlist = {0};
+	struct bitmap4 bm;
+	struct xdr_attrs_args args;
+
+	tc_attr_masks_to_bitmap(&tca->masks, &bm);
+	bm.map[0] &= ~(1U << FATTR4_TYPE);
+
+	attrlist.mode = tca->mode;
+	attrlist.filesize = tca->size;
+	attrlist.numlinks = tca->nlink;
+	attrlist.fileid = tca->fileid;
+	attrlist.spaceused = tca->blocks * 512;
+	attrlist.owner = tca->uid;
+	attrlist.group = tca->gid;
+	attrlist.rawdev.major = major(tca->rdev);
+	attrlist.rawdev.minor = minor(tca->rdev);
+	attrlist.atime = tca->atime;
+	attrlist.mtime = tca->mtime;
+	attrlist.ctime = tca->ctime;
+	attrlist.change = tca->change;
+
+	memset(&args, 0, sizeof(args));
+	args.attrs = &attrlist;
+	args.mounted_on_fileid = tca->fileid;
+
+	if (nfs4_FSALattr_To_Fattr(&args, &bm, attr4) != 0) {
+		NFS4_ERR("cannot encode NFS attributes");
+		assert(false);
+	}
+}
+
+/**
+ * Set mode bits about file type.
+ *
+ * See http://lxr.free-electrons.com/source/include/uapi/linux/stat.h
  *     stat(2)
  */
 static void set_mode_type(mode_t *mode, object_file_type_t type)
@@ -3756,6 +4476,10 @@ void fattr4_to_tc_attrs(const fattr4 *attr4, struct tc_attrs *tca)
                 tca->masks.has_blocks = true;
                 tca->blocks = attrlist.spaceused / 512;
         }
+        if (attrlist.mask & ATTR_CHANGE) {
+                tca->masks.has_change = true;
+                tca->change = attrlist.change;
+        }
 
         set_mode_type(&tca->mode, attrlist.type);
 }
@@ -3874,6 +4598,7 @@ static tc_res tc_nfs4_openv(struct tc_attrs *attrs, int count, int *flags,
 				    .nfs_resop4_u.opopen.OPEN4res_u.resok4;
 			flags[i] = opok->rflags;
                         copy_stateid4(&sids[i], &opok->stateid);
+			tc_cancel_pending_close(&sids[i]);
 			break;
 		case NFS4_OP_GETFH:
 			tc_file_set_handle(&attrs[i].file,
@@ -3913,21 +4638,849 @@ static tc_res tc_nfs4_closev(const nfs_fh4 *fh4s, int count, stateid4 *sids,
 	int saved_opcnt;
 	tc_res tcres;
 
-	NFS4_DEBUG("tc_nfs4_closev");
+	NFS4_DEBUG("tc_nfs4_closev");
+	tc_reset_compound(true);
+
+	for (i = 0; i < count; ++i) {
+		// ignore stateless open
+		if (!is_special_stateid(sids + i)) {
+			saved_opcnt = opcnt;
+			r = tc_prepare_putfh(&fh4s[i]) &&
+			    tc_prepare_close(&seqs[i], &sids[i]);
+			if (!r) {
+				opcnt = saved_opcnt;
+				count = i;
+				break;
+			}
+		}
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status != NFS4_OK) {
+			NFS4_ERR("NFS operation (%d) failed: %d",
+				 resoparray[j].resop, op_status);
+			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
+			goto exit;
+		}
+		if (resoparray[j].resop == NFS4_OP_CLOSE) {
+			while (i < count && is_special_stateid(&sids[i]))
+				++i;
+			sids[i].seqid++;
+			++i;
+		}
+	}
+
+exit:
+	return tcres;
+}
+
+/*
+ * Whether a LOCK of "states[i]" would need the lock stateid returned by an
+ * earlier LOCK in the same compound.
+ */
+static bool tc_lock_waits_for_stateid(struct tc_lock_state *states, int i)
+{
+	int k;
+
+	if (states[i].has_lock_stateid)
+		return false;
+	for (k = 0; k < i; ++k) {
+		if (states[k].fd == states[i].fd)
+			return true;
+	}
+	return false;
+}
+
+static tc_res tc_nfs4_lockv(struct tc_lock *locks,
+			    struct tc_lock_state *states, int count)
+{
+	nfsstat4 op_status;
+	char owner_val[64];
+	unsigned owner_len;
+	LOCK4res *lockres;
+	int i = 0; /* index of "locks" */
+	int j = 0; /* index of NFS operations */
+	int rc;
+	bool r;
+	int saved_opcnt;
+	tc_res tcres;
+
+	NFS4_DEBUG("tc_nfs4_lockv");
+	tc_reset_compound(true);
+	owner_len = tc_lock_owner(owner_val);
+
+	for (i = 0; i < count; ++i) {
+		/* the remaining locks go to the next compound */
+		if (tc_lock_waits_for_stateid(states, i)) {
+			count = i;
+			break;
+		}
+		saved_opcnt = opcnt;
+		r = tc_prepare_putfh(&states[i].fh) &&
+		    tc_prepare_lock(&locks[i], &states[i], owner_val,
+				    owner_len);
+		if (!r) {
+			opcnt = saved_opcnt;
+			count = i;
+			break;
+		}
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status != NFS4_OK) {
+			NFS4_DEBUG("NFS operation (%d) failed: %d",
+				   resoparray[j].resop, op_status);
+			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
+			goto exit;
+		}
+		if (resoparray[j].resop == NFS4_OP_LOCK) {
+			lockres = &resoparray[j].nfs_resop4_u.oplock;
+			states[i].lock_stateid =
+			    lockres->LOCK4res_u.resok4.lock_stateid;
+			states[i].has_lock_stateid = true;
+			++i;
+		}
+	}
+
+exit:
+	return tcres;
+}
+
+static tc_res tc_nfs4_unlockv(struct tc_lock *locks,
+			      struct tc_lock_state *states, int count)
+{
+	nfsstat4 op_status;
+	int i = 0; /* index of "locks" */
+	int j = 0; /* index of NFS operations */
+	int rc;
+	bool r;
+	int saved_opcnt;
+	tc_res tcres;
+
+	NFS4_DEBUG("tc_nfs4_unlockv");
+	tc_reset_compound(true);
+
+	for (i = 0; i < count; ++i) {
+		// nothing is locked without a lock stateid
+		if (states[i].has_lock_stateid) {
+			saved_opcnt = opcnt;
+			r = tc_prepare_putfh(&states[i].fh) &&
+			    tc_prepare_locku(&locks[i], &states[i]);
+			if (!r) {
+				opcnt = saved_opcnt;
+				count = i;
+				break;
+			}
+		}
+	}
+
+	tcres.index = count;
+	if (opcnt == 0) {
+		tcres.err_no = 0;
+		goto exit;
+	}
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (resoparray[j].resop == NFS4_OP_PUTFH) {
+			while (i < count && !states[i].has_lock_stateid)
+				++i;
+		}
+		if (op_status != NFS4_OK) {
+			NFS4_ERR("NFS operation (%d) failed: %d",
+				 resoparray[j].resop, op_status);
+			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
+			goto exit;
+		}
+		if (resoparray[j].resop == NFS4_OP_LOCKU) {
+			++i;
+		}
+	}
+
+exit:
+	return tcres;
+}
+
+static void tc_lock_from_denied(struct tc_lock *lock,
+				const LOCK4denied *denied)
+{
+	lock->type = (denied->locktype == WRITE_LT ||
+		      denied->locktype == WRITEW_LT)
+			 ? F_WRLCK
+			 : F_RDLCK;
+	lock->offset = denied->offset;
+	lock->length =
+	    denied->length == NFS4_UINT64_MAX ? 0 : denied->length;
+}
+
+/*
+ * A compound stops at a conflicting lock, which is not an error of LOCKT.
+ * The conflict is reported in the lock as tc_testlockv() documents, and the
+ * returned "index" is right after it, so that nfs4_testlockv() tests the
+ * remaining locks in another compound.
+ */
+static tc_res tc_nfs4_testlockv(struct tc_lock *locks,
+				struct tc_lock_state *states, int count)
+{
+	nfsstat4 op_status;
+	char owner_val[64];
+	unsigned owner_len;
+	LOCKT4res *locktres;
+	int i = 0; /* index of "locks" */
+	int j = 0; /* index of NFS operations */
+	int rc;
+	bool r;
+	int saved_opcnt;
+	tc_res tcres;
+
+	NFS4_DEBUG("tc_nfs4_testlockv");
+	tc_reset_compound(true);
+	owner_len = tc_lock_owner(owner_val);
+
+	for (i = 0; i < count; ++i) {
+		saved_opcnt = opcnt;
+		r = tc_prepare_putfh(&states[i].fh) &&
+		    tc_prepare_lockt(&locks[i], owner_val, owner_len);
+		if (!r) {
+			opcnt = saved_opcnt;
+			count = i;
+			break;
+		}
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (resoparray[j].resop == NFS4_OP_LOCKT &&
+		    op_status == NFS4ERR_DENIED) {
+			locktres = &resoparray[j].nfs_resop4_u.oplockt;
+			tc_lock_from_denied(&locks[i],
+					    &locktres->LOCKT4res_u.denied);
+			tcres.index = i + 1;
+			tcres.err_no = 0;
+			goto exit;
+		}
+		if (op_status != NFS4_OK) {
+			NFS4_ERR("NFS operation (%d) failed: %d",
+				 resoparray[j].resop, op_status);
+			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
+			goto exit;
+		}
+		if (resoparray[j].resop == NFS4_OP_LOCKT) {
+			locks[i].type = F_UNLCK;
+			++i;
+		}
+	}
+
+exit:
+	return tcres;
+}
+
+/*
+ * WRITE_PLUS of a hole: an allocated hole preallocates the range as
+ * ALLOCATE does, and an unallocated one punches it as DEALLOCATE does.
+ */
+static inline bool tc_prepare_alloc(const struct tc_extent *ext,
+				    bool allocated, contents *cont)
+{
+	const stateid4 *sid = &CURSID;
+	WRITE_PLUS4args *wpargs;
+
+	if (!tc_has_enough_ops(1)) return false;
+
+	if (ext->file.type == TC_FILE_DESCRIPTOR) {
+		sid = ((struct nfs4_fd_data *)ext->file.fd_data)->stateid;
+	}
+	cont->what = NFS4_CONTENT_HOLE;
+	cont->hole.di_offset = ext->offset;
+	cont->hole.di_length = ext->length;
+	cont->hole.di_allocated = allocated;
+	wpargs = &argoparray[opcnt].nfs_argop4_u.opwrite_plus;
+	COMPOUNDV4_ARG_ADD_OP_WRITE_PLUS(opcnt, argoparray, cont);
+	wpargs->wp_stateid = *sid;
+	return true;
+}
+
+static tc_res tc_nfs4_allocv(struct tc_extent *extents, int count,
+			     bool allocated)
+{
+	tc_res tcres = { 0 };
+	nfsstat4 op_status;
+	fattr4 *input_attr;
+	contents *conts;
+	const tc_file *opened_file = NULL;
+	const tc_file *saved_file;
+	int saved_opcnt;
+	int flags;
+	int i = 0; /* index of "extents" */
+	int j = 0; /* index of NFS operations */
+	int rc;
+	bool r;
+
+	NFS4_DEBUG("tc_nfs4_allocv(allocated=%d)", allocated);
+	tc_reset_compound(true);
+
+	input_attr = calloc(count, sizeof(*input_attr));
+	conts = calloc(count, sizeof(*conts));
+	if (!input_attr || !conts) {
+		tcres = tc_failure(0, ENOMEM);
+		goto exit;
+	}
+
+	for (i = 0; i < count; ++i) {
+		saved_opcnt = opcnt;
+		saved_file = opened_file;
+		flags = O_WRONLY;
+		if (allocated && extents[i].is_creation) {
+			flags |= O_CREAT;
+		}
+		r = tc_open_file_if_necessary(&extents[i].file, flags,
+					      tc_auto_buf(64), &input_attr[i],
+					      &opened_file) &&
+		    tc_prepare_alloc(&extents[i], allocated, &conts[i]);
+		if (!r || !tc_has_enough_ops(1)) { // reserve for CLOSE
+			opcnt = saved_opcnt;
+			opened_file = saved_file;
+			count = i;
+			break;
+		}
+	}
+	if (count == 0) {
+		/* not even the first extent can be added */
+		tcres = tc_failure(0, E2BIG);
+		goto exit;
+	}
+
+	if (opened_file) {
+		COMPOUNDV4_ARG_ADD_OP_CLOSE(opcnt, argoparray, (&CURSID));
+		opened_file = NULL;
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status != NFS4_OK) {
+			NFS4_ERR("the %d-th extent failed (NFS op: %d)", i,
+				 resoparray[j].resop);
+			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
+			goto exit;
+		}
+		if (resoparray[j].resop == NFS4_OP_WRITE_PLUS) {
+			++i;
+		}
+	}
+
+exit:
+	if (input_attr) {
+		for (i = 0; i < count; ++i) {
+			nfs4_Fattr_Free(&input_attr[i]);
+		}
+	}
+	free(input_attr);
+	free(conts);
+	return tcres;
+}
+
+static tc_res tc_nfs4_fallocatev(struct tc_extent *extents, int count)
+{
+	return tc_nfs4_allocv(extents, count, true);
+}
+
+static tc_res tc_nfs4_punchholev(struct tc_extent *extents, int count)
+{
+	return tc_nfs4_allocv(extents, count, false);
+}
+
+/*
+ * Extended attributes are named attributes of files: xattrs[i].name is a file
+ * in the named attribute directory of xattrs[i].file, which OPENATTR sets CFH
+ * to.  Like getxattr(2), missing attributes fail with ENODATA.
+ */
+static int tc_xattr_errno(const nfs_resop4 *res, nfsstat4 status)
+{
+	int err = nfsstat4_to_errno(status);
+
+	if (err == ENOENT && (res->resop == NFS4_OP_OPENATTR ||
+			      res->resop == NFS4_OP_OPEN)) {
+		return ENODATA;
+	}
+	return err;
+}
+
+/* The value is read or written through the stateid of the OPEN before. */
+static inline void tc_xattr_to_iov(const struct tc_xattr *xattr,
+				   struct tc_iovec *iov)
+{
+	memset(iov, 0, sizeof(*iov));
+	iov->file.type = TC_FILE_CURRENT;
+	iov->offset = 0;
+	iov->length = xattr->size;
+	iov->data = xattr->value;
+}
+
+/**
+ * OPENATTR, OPEN, GETATTR(size), READ and CLOSE each of "xattrs" in one
+ * compound.
+ */
+static tc_res tc_nfs4_getxattrsv(struct tc_xattr *xattrs, int count)
+{
+	int rc;
+	tc_res tcres;
+	nfsstat4 op_status;
+	slice_t name;
+	char *fattr_blobs; /* an array of FATTR_BLOB_SZ-sized buffers */
+	struct tc_iovec *iovs;
+	GETATTR4resok *atok;
+	struct tc_attrs attrs;
+	int i = 0; /* index of xattrs */
+	int j = 0; /* index of NFS operations */
+	bool r;
+	int saved_opcnt;
+
+	NFS4_DEBUG("tc_nfs4_getxattrsv");
+
+	fattr_blobs = malloc(count * FATTR_BLOB_SZ);
+	iovs = malloc(count * sizeof(*iovs));
+	if (!fattr_blobs || !iovs) {
+		tcres = tc_failure(0, ENOMEM);
+		goto exit;
+	}
+
+	tc_reset_compound(true);
+	for (i = 0; i < count; ++i) {
+		saved_opcnt = opcnt;
+		tc_xattr_to_iov(&xattrs[i], &iovs[i]);
+		r = tc_set_current_fh(&xattrs[i].file, &name, true) &&
+		    tc_prepare_lookups(&name, 1) &&
+		    tc_prepare_openattr(false) &&
+		    tc_prepare_open(toslice(xattrs[i].name), O_RDONLY,
+				    tc_auto_buf(64), NULL) &&
+		    tc_prepare_getattr(fattr_blobs + i * FATTR_BLOB_SZ,
+				       &tc_bitmap_size) &&
+		    (xattrs[i].size == 0 || tc_prepare_rdwr(&iovs[i], false)) &&
+		    tc_prepare_close(NULL, NULL);
+		if (!r) {
+			opcnt = saved_opcnt;
+			count = i;
+			break;
+		}
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status != NFS4_OK) {
+			NFS4_DEBUG("NFS operation (%d) failed: %d",
+				   resoparray[j].resop, op_status);
+			tcres = tc_failure(
+			    i, tc_xattr_errno(&resoparray[j], op_status));
+			goto exit;
+		}
+		switch (resoparray[j].resop) {
+		case NFS4_OP_GETATTR:
+			atok = &resoparray[j]
+				    .nfs_resop4_u.opgetattr.GETATTR4res_u
+				    .resok4;
+			memset(&attrs, 0, sizeof(attrs));
+			fattr4_to_tc_attrs(&atok->obj_attributes, &attrs);
+			if (xattrs[i].size != 0 &&
+			    attrs.size > xattrs[i].size) {
+				tcres = tc_failure(i, ERANGE);
+				goto exit;
+			}
+			xattrs[i].size = attrs.size;
+			break;
+		case NFS4_OP_CLOSE:
+			++i;
+			break;
+		default:
+			break;
+		}
+	}
+
+exit:
+	free(fattr_blobs);
+	free(iovs);
+	return tcres;
+}
+
+/**
+ * OPENATTR, OPEN, SETATTR(size=0), WRITE and CLOSE each of "xattrs" in one
+ * compound.  XATTR_CREATE creates the attribute exclusively, and
+ * XATTR_REPLACE does not create it.
+ */
+static tc_res tc_nfs4_setxattrsv(struct tc_xattr *xattrs, int count)
+{
+	int rc;
+	tc_res tcres;
+	nfsstat4 op_status;
+	slice_t name;
+	struct tc_iovec *iovs;
+	struct tc_attrs attrs;
+	fattr4 create4;	  /* attributes of new named attributes */
+	fattr4 truncate4; /* attributes truncating old values */
+	int flags;
+	int i = 0; /* index of xattrs */
+	int j = 0; /* index of NFS operations */
+	bool r;
+	int saved_opcnt;
+
+	NFS4_DEBUG("tc_nfs4_setxattrsv");
+
+	iovs = malloc(count * sizeof(*iovs));
+	if (!iovs) {
+		return tc_failure(0, ENOMEM);
+	}
+
+	memset(&attrs.masks, 0, sizeof(attrs.masks));
+	tc_attrs_set_mode(&attrs, 0644);
+	tc_attrs_set_uid(&attrs, getuid());
+	tc_attrs_set_gid(&attrs, getgid());
+	tc_attrs_to_fattr4(&attrs, &create4);
+	memset(&attrs.masks, 0, sizeof(attrs.masks));
+	tc_attrs_set_size(&attrs, 0);
+	tc_attrs_to_fattr4(&attrs, &truncate4);
+
+	tc_reset_compound(true);
+	for (i = 0; i < count; ++i) {
+		saved_opcnt = opcnt;
+		tc_xattr_to_iov(&xattrs[i], &iovs[i]);
+		flags = O_WRONLY;
+		if (!(xattrs[i].flags & XATTR_REPLACE)) {
+			flags |= O_CREAT;
+		}
+		if (xattrs[i].flags & XATTR_CREATE) {
+			flags |= O_EXCL;
+		}
+		r = tc_set_current_fh(&xattrs[i].file, &name, true) &&
+		    tc_prepare_lookups(&name, 1) &&
+		    tc_prepare_openattr(true) &&
+		    tc_prepare_open(toslice(xattrs[i].name), flags,
+				    tc_auto_buf(64), &create4) &&
+		    tc_has_enough_ops(1) && tc_prepare_setattr(&truncate4) &&
+		    (xattrs[i].size == 0 || tc_prepare_rdwr(&iovs[i], true)) &&
+		    tc_prepare_close(NULL, NULL);
+		if (!r) {
+			opcnt = saved_opcnt;
+			count = i;
+			break;
+		}
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status != NFS4_OK) {
+			NFS4_DEBUG("NFS operation (%d) failed: %d",
+				   resoparray[j].resop, op_status);
+			tcres = tc_failure(
+			    i, tc_xattr_errno(&resoparray[j], op_status));
+			goto exit;
+		}
+		if (resoparray[j].resop == NFS4_OP_CLOSE) {
+			++i;
+		}
+	}
+
+exit:
+	nfs4_Fattr_Free(&create4);
+	nfs4_Fattr_Free(&truncate4);
+	free(iovs);
+	return tcres;
+}
+
+/*
+ * Append the names in "rdok" to the "*len" bytes in "buf" as llistxattr(2)
+ * does, or only count them if "bufsize" is 0.  "cookie" is set to that of
+ * the last name.
+ */
+static int tc_copy_xattr_names(const READDIR4resok *rdok, char *buf,
+			       size_t bufsize, size_t *len,
+			       nfs_cookie4 *cookie)
+{
+	const entry4 *e4;
+	size_t n;
+
+	for (e4 = rdok->reply.entries; e4; e4 = e4->nextentry) {
+		n = e4->name.utf8string_len;
+		if (bufsize != 0) {
+			if (*len + n + 1 > bufsize) {
+				return -ERANGE;
+			}
+			memcpy(buf + *len, e4->name.utf8string_val, n);
+			buf[*len + n] = '\0';
+		}
+		*len += n + 1;
+		*cookie = e4->cookie;
+	}
+
+	return 0;
+}
+
+/*
+ * List the named attributes of "path" after "cookie", one READDIR per
+ * compound, until EOF.
+ */
+static int tc_list_more_xattrs(const char *path, char *buf, size_t bufsize,
+			       size_t *len, nfs_cookie4 cookie,
+			       const verifier4 cookieverf)
+{
+	tc_file file = tc_file_from_path(path);
+	READDIR4resok *rdok;
+	nfsstat4 op_status;
+	verifier4 verf;
+	slice_t name;
+	bool eof = false;
+	bool r;
+	int err;
+	int rc;
+	int j;
+
+	memcpy(verf, cookieverf, NFS4_VERIFIER_SIZE);
+	while (!eof) {
+		tc_reset_compound(true);
+		r = tc_set_current_fh(&file, &name, true) &&
+		    tc_prepare_lookups(&name, 1) &&
+		    tc_prepare_openattr(false);
+		rdok = r ? tc_prepare_readdir(&cookie, &empty_bitmap) : NULL;
+		if (!rdok) {
+			return -ENAMETOOLONG;
+		}
+		memcpy(argoparray[opcnt - 1].nfs_argop4_u.opreaddir.cookieverf,
+		       verf, NFS4_VERIFIER_SIZE);
+
+		rc = fs_nfsv4_call(op_ctx->creds, &err);
+		if (rc != RPC_SUCCESS) {
+			NFS4_ERR("rpc failed: %d", rc);
+			return -rc;
+		}
+		for (j = 0; j < opcnt; ++j) {
+			op_status = get_nfs4_op_status(&resoparray[j]);
+			if (op_status != NFS4_OK) {
+				NFS4_DEBUG("NFS operation (%d) failed: %d",
+					   resoparray[j].resop, op_status);
+				return -nfsstat4_to_errno(op_status);
+			}
+		}
+
+		/* READDIR is the last operation */
+		eof = rdok->reply.eof;
+		if (!eof && !rdok->reply.entries) {
+			rc = -EIO;	/* no progress */
+		} else {
+			rc = tc_copy_xattr_names(rdok, buf, bufsize, len,
+						 &cookie);
+		}
+		memcpy(verf, rdok->cookieverf, NFS4_VERIFIER_SIZE);
+		xdr_free((xdrproc_t)xdr_nfs_resop4, &resoparray[opcnt - 1]);
+		if (rc < 0) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Whether the file of "atok", whose GETATTR asked for FATTR4_NAMED_ATTR only,
+ * may have named attributes.  It may if the server does not say.
+ */
+static bool tc_may_have_xattrs(const GETATTR4resok *atok)
+{
+	const fattr4 *f4 = &atok->obj_attributes;
+	uint32_t b;
+
+	if (f4->attrmask.bitmap4_len < 1 ||
+	    !(f4->attrmask.map[0] & PXY_ATTR_BIT(FATTR4_NAMED_ATTR)) ||
+	    f4->attr_vals.attrlist4_len < sizeof(b)) {
+		return true;
+	}
+	memcpy(&b, f4->attr_vals.attrlist4_val, sizeof(b));
+	return ntohl(b) != 0;
+}
+
+/*
+ * GETATTR FATTR4_NAMED_ATTR of each of "paths" in one compound, and set
+ * has[i] if paths[i] may have named attributes.  tc_res.index is the number
+ * of files checked.
+ */
+static tc_res tc_check_xattrs(const char **paths, bool *has, int count)
+{
+	int rc;
+	tc_res tcres;
+	nfsstat4 op_status;
+	GETATTR4resok *atok;
+	char *fattr_blobs; /* an array of FATTR_BLOB_SZ-sized buffers */
+	tc_file file;
+	slice_t name;
+	int i = 0; /* index of paths */
+	int j = 0; /* index of NFS operations */
+	bool r;
+	int saved_opcnt;
+
+	fattr_blobs = malloc(count * FATTR_BLOB_SZ);
+	if (!fattr_blobs) {
+		return tc_failure(0, ENOMEM);
+	}
+
+	tc_reset_compound(true);
+	for (i = 0; i < count; ++i) {
+		saved_opcnt = opcnt;
+		file = tc_file_from_path(paths[i]);
+		r = tc_set_current_fh(&file, &name, true) &&
+		    tc_prepare_lookups(&name, 1) &&
+		    tc_prepare_getattr(fattr_blobs + i * FATTR_BLOB_SZ,
+				       &tc_bitmap_named_attr);
+		if (!r) {
+			opcnt = saved_opcnt;
+			count = i;
+			break;
+		}
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	tcres.err_no = 0;
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status != NFS4_OK) {
+			NFS4_DEBUG("NFS operation (%d) failed: %d",
+				   resoparray[j].resop, op_status);
+			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
+			goto exit;
+		}
+		if (resoparray[j].resop == NFS4_OP_GETATTR) {
+			atok = &resoparray[j]
+				    .nfs_resop4_u.opgetattr.GETATTR4res_u
+				    .resok4;
+			has[i++] = tc_may_have_xattrs(atok);
+		}
+	}
+
+exit:
+	free(fattr_blobs);
+	return tcres;
+}
+
+/**
+ * OPENATTR and READDIR each of "paths" where "has" is set in one compound;
+ * the others have no names.  A file without a named attribute directory
+ * stops the compound at its OPENATTR; tc_res.index is then the number of
+ * files listed including it, so that the rest are sent again.  The same goes
+ * for a file with more names than one READDIR reply holds, whose listing is
+ * finished with more compounds.
+ */
+static tc_res tc_list_xattrs(const char **paths, const bool *has,
+			     char **bufs, size_t *bufsizes, int count)
+{
+	int rc;
+	tc_res tcres;
+	nfsstat4 op_status;
+	tc_file file;
+	slice_t name;
+	nfs_cookie4 cookie = 0;
+	READDIR4resok *rdok;
+	int *idx; /* the files in the compound */
+	int i = 0; /* index of paths */
+	int j = 0; /* index of NFS operations */
+	int k = 0; /* index of idx */
+	bool r;
+	int saved_opcnt;
+	int more = -1; /* the file whose listing is not finished */
+	nfs_cookie4 more_cookie = 0;
+	verifier4 more_verf;
+	size_t len;
+	size_t more_len = 0;
+
+	idx = malloc(count * sizeof(*idx));
+	if (!idx) {
+		return tc_failure(0, ENOMEM);
+	}
+
 	tc_reset_compound(true);
-
 	for (i = 0; i < count; ++i) {
-		// ignore stateless open
-		if (!is_special_stateid(sids + i)) {
-			saved_opcnt = opcnt;
-			r = tc_prepare_putfh(&fh4s[i]) &&
-			    tc_prepare_close(&seqs[i], &sids[i]);
-			if (!r) {
-				opcnt = saved_opcnt;
-				count = i;
-				break;
-			}
+		if (!has[i]) {
+			bufsizes[i] = 0;
+			continue;
+		}
+		saved_opcnt = opcnt;
+		file = tc_file_from_path(paths[i]);
+		r = tc_set_current_fh(&file, &name, true) &&
+		    tc_prepare_lookups(&name, 1) &&
+		    tc_prepare_openattr(false) &&
+		    tc_prepare_readdir(&cookie, &empty_bitmap);
+		if (!r) {
+			opcnt = saved_opcnt;
+			count = i;
+			break;
 		}
+		idx[k++] = i;
 	}
 
 	tcres.index = count;
@@ -3938,28 +5491,171 @@ static tc_res tc_nfs4_closev(const nfs_fh4 *fh4s, int count, stateid4 *sids,
 		goto exit;
 	}
 
-	i = 0;
+	/*
+	 * The failed operation is found below.  READDIR results after a
+	 * failure or an unfinished listing are released but not copied.
+	 */
+	tcres.err_no = 0;
+	k = 0;
 	for (j = 0; j < opcnt; ++j) {
+		i = idx[k];
 		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status == NFS4ERR_NOENT && tc_okay(tcres) &&
+		    more < 0 && resoparray[j].resop == NFS4_OP_OPENATTR) {
+			bufsizes[i] = 0;
+			tcres.index = i + 1;
+			break;
+		}
 		if (op_status != NFS4_OK) {
-			NFS4_ERR("NFS operation (%d) failed: %d",
-				 resoparray[j].resop, op_status);
-			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
+			NFS4_DEBUG("NFS operation (%d) failed: %d",
+				   resoparray[j].resop, op_status);
+			if (tc_okay(tcres) && more < 0) {
+				tcres = tc_failure(
+				    i, nfsstat4_to_errno(op_status));
+			}
+			break;
+		}
+		if (resoparray[j].resop == NFS4_OP_READDIR) {
+			rdok = &resoparray[j]
+				    .nfs_resop4_u.opreaddir.READDIR4res_u
+				    .resok4;
+			if (tc_okay(tcres) && more < 0) {
+				len = 0;
+				rc = tc_copy_xattr_names(rdok, bufs[i],
+							 bufsizes[i], &len,
+							 &more_cookie);
+				if (rc < 0) {
+					tcres = tc_failure(i, -rc);
+				} else if (rdok->reply.eof) {
+					bufsizes[i] = len;
+				} else {
+					more = i;
+					more_len = len;
+					memcpy(more_verf, rdok->cookieverf,
+					       NFS4_VERIFIER_SIZE);
+				}
+			}
+			xdr_free((xdrproc_t)xdr_nfs_resop4, &resoparray[j]);
+			++k;
+		}
+	}
+
+	if (more >= 0) {
+		rc = tc_list_more_xattrs(paths[more], bufs[more],
+					 bufsizes[more], &more_len,
+					 more_cookie, more_verf);
+		if (rc < 0) {
+			tcres = tc_failure(more, -rc);
 			goto exit;
 		}
-		if (resoparray[j].resop == NFS4_OP_CLOSE) {
-			while (i < count && is_special_stateid(&sids[i]))
-				++i;
-			sids[i].seqid++;
-			++i;
+		bufsizes[more] = more_len;
+		tcres.index = more + 1;
+	}
+
+exit:
+	free(idx);
+	return tcres;
+}
+
+/**
+ * List the named attributes of "paths".  Which of them have any is found
+ * out first with tc_check_xattrs(), so that a file without named attributes
+ * costs no round trip of its own in tc_list_xattrs().  tc_res.index is the
+ * number of files listed.
+ */
+static tc_res tc_nfs4_listxattrsv(const char **paths, char **bufs,
+				  size_t *bufsizes, int count)
+{
+	tc_res tcres;
+	bool *has;
+	int finished;
+
+	NFS4_DEBUG("tc_nfs4_listxattrsv");
+	has = malloc(count * sizeof(*has));
+	if (!has) {
+		return tc_failure(0, ENOMEM);
+	}
+
+	tcres = tc_check_xattrs(paths, has, count);
+	if (!tc_okay(tcres)) {
+		goto exit;
+	}
+	count = tcres.index;
+
+	for (finished = 0; finished < count; finished += tcres.index) {
+		tcres = tc_list_xattrs(paths + finished, has + finished,
+				       bufs + finished, bufsizes + finished,
+				       count - finished);
+		if (!tc_okay(tcres)) {
+			tcres.index += finished;
+			goto exit;
+		}
+		if (tcres.index == 0) {
+			tcres = tc_failure(finished, E2BIG);
+			goto exit;
 		}
 	}
+	tcres.index = count;
 
 exit:
+	free(has);
 	return tcres;
 }
 
-static tc_res tc_nfs4_lgetattrsv(struct tc_attrs *attrs, int count)
+/**
+ * Verify that "link" is (still) the symlink whose fileid is "*fileid", and
+ * read its content into "buf", which should have PATH_MAX bytes.  This lets a
+ * compound operate on a symlink target known from an earlier READLINK without
+ * an extra round trip: the content of a symlink never changes in place, so
+ * the compound stops at the VERIFY, before the target is touched, if "link"
+ * has been replaced.  "fattr" holds the encoded fileid until the compound is
+ * sent.  Without "fileid", "link" is only read, and the caller compares "buf"
+ * with the target it used.
+ */
+static bool tc_prepare_verify_link(const char *link, const uint64_t *fileid,
+				   fattr4 *fattr, char *buf)
+{
+	struct tc_attrs tca;
+	slice_t name;
+
+	if (!tc_set_cfh_to_path(link, &name, true) ||
+	    !tc_prepare_lookups(&name, 1)) {
+		return false;
+	}
+	if (fileid) {
+		memset(&tca, 0, sizeof(tca));
+		tca.masks.has_fileid = true;
+		tca.fileid = *fileid;
+		tc_attrs_to_fattr4_verify(&tca, fattr);
+		if (!tc_prepare_verify(fattr, false)) {
+			return false;
+		}
+	}
+	return tc_prepare_readlink(buf, PATH_MAX) != NULL;
+}
+
+/*
+ * Fix up the replies of READLINKs added by tc_prepare_verify_link().
+ */
+static void tc_process_verify_link(nfs_resop4 *res)
+{
+	READLINK4resok *rlok = &res->nfs_resop4_u.opreadlink.READLINK4res_u.resok4;
+
+	if (rlok->link.utf8string_len < PATH_MAX) {
+		rlok->link.utf8string_val[rlok->link.utf8string_len] = '\0';
+	}
+}
+
+/**
+ * Get attributes of "attrs".  For each i where "links" and links[i] are not
+ * NULL, links[i] is first verified in the same compound with
+ * tc_prepare_verify_link() using linkids[i] (if "linkids" is not NULL) and
+ * linkbufs[i].
+ */
+static tc_res tc_nfs4_lgetattrsv_links(struct tc_attrs *attrs, int count,
+				       const char **links,
+				       const uint64_t *linkids,
+				       char **linkbufs)
 {
 	int rc;
 	tc_res tcres;
@@ -3970,6 +5666,7 @@ static tc_res tc_nfs4_lgetattrsv(struct tc_attrs *attrs, int count)
 	int j = 0;	 /* index of NFS operations */
 	char *fattr_blobs; /* an array of FATTR_BLOB_SZ-sized buffers */
 	struct bitmap4 *bitmaps;
+	fattr4 *linkattrs;
 	bool r;
 	int saved_opcnt;
 
@@ -3979,11 +5676,17 @@ static tc_res tc_nfs4_lgetattrsv(struct tc_attrs *attrs, int count)
 	fattr_blobs = (char *)malloc(count * FATTR_BLOB_SZ);
 	assert(fattr_blobs);
 	bitmaps = calloc(count, sizeof(*bitmaps));
+	linkattrs = calloc(count, sizeof(*linkattrs));
+	assert(linkattrs);
 
 	for (i = 0; i < count; ++i) {
                 saved_opcnt = opcnt;
 		tc_attr_masks_to_bitmap(&attrs[i].masks, bitmaps + i);
-		r = tc_set_current_fh(&attrs[i].file, &name, true) &&
+		r = (!links || !links[i] ||
+		     tc_prepare_verify_link(links[i],
+					    linkids ? &linkids[i] : NULL,
+					    &linkattrs[i], linkbufs[i])) &&
+		    tc_set_current_fh(&attrs[i].file, &name, true) &&
 		    tc_prepare_lookups(&name, 1) &&
 		    tc_prepare_getattr(fattr_blobs + i * FATTR_BLOB_SZ,
 				       bitmaps + i);
@@ -4011,6 +5714,10 @@ static tc_res tc_nfs4_lgetattrsv(struct tc_attrs *attrs, int count)
 			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
                         goto exit;
                 }
+                if (resoparray[j].resop == NFS4_OP_READLINK) {
+                        tc_process_verify_link(&resoparray[j]);
+                        continue;
+                }
                 if (resoparray[j].resop != NFS4_OP_GETATTR)
                         continue;
 		atok =
@@ -4020,11 +5727,20 @@ static tc_res tc_nfs4_lgetattrsv(struct tc_attrs *attrs, int count)
 	}
 
 exit:
+	for (i = 0; i < count; ++i) {
+		nfs4_Fattr_Free(&linkattrs[i]);
+	}
+	free(linkattrs);
 	free(bitmaps);
 	free(fattr_blobs);
 	return tcres;
 }
 
+static tc_res tc_nfs4_lgetattrsv(struct tc_attrs *attrs, int count)
+{
+	return tc_nfs4_lgetattrsv_links(attrs, count, NULL, NULL, NULL);
+}
+
 static tc_res tc_nfs4_lsetattrsv(struct tc_attrs *attrs, int count)
 {
 	int rc;
@@ -4592,7 +6308,14 @@ exit:
 	return tcres;
 }
 
-static tc_res tc_nfs4_lcopyv(struct tc_extent_pair *pairs, int count)
+/**
+ * Copy "pairs".  For each i where "links" and links[i] are not NULL, links[i]
+ * is first verified in the same compound with tc_prepare_verify_link() using
+ * linkids[i] (if "linkids" is not NULL) and linkbufs[i].
+ */
+static tc_res tc_nfs4_lcopyv_links(struct tc_extent_pair *pairs, int count,
+				   const char **links, const uint64_t *linkids,
+				   char **linkbufs)
 {
 	int rc;
 	tc_res tcres = { .err_no = 0 };
@@ -4603,17 +6326,24 @@ static tc_res tc_nfs4_lcopyv(struct tc_extent_pair *pairs, int count)
 	slice_t dstname;
         struct tc_attrs tca;
         fattr4 *attrs4;
+	fattr4 *linkattrs;
         bool r;
         int saved_opcnt;
 
 	NFS4_DEBUG("tc_nfs4_copyv");
         attrs4 = calloc(count, sizeof(*attrs4));
         assert(attrs4);
+	linkattrs = calloc(count, sizeof(*linkattrs));
+	assert(linkattrs);
 
         tc_reset_compound(true);
 	for (i = 0; i < count; ++i) {
                 saved_opcnt = opcnt;
-		r = tc_set_cfh_to_path(pairs[i].src_path, &srcname, false) &&
+		r = (!links || !links[i] ||
+		     tc_prepare_verify_link(links[i],
+					    linkids ? &linkids[i] : NULL,
+					    &linkattrs[i], linkbufs[i])) &&
+		    tc_set_cfh_to_path(pairs[i].src_path, &srcname, false) &&
 		    tc_prepare_open(srcname, O_RDONLY, tc_auto_buf(64),
 				    NULL) &&
 		    tc_prepare_savefh(NULL) &&
@@ -4652,7 +6382,9 @@ static tc_res tc_nfs4_lcopyv(struct tc_extent_pair *pairs, int count)
 			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
 			goto exit;
 		}
-		if (resoparray[j].resop == NFS4_OP_COPY) {
+		if (resoparray[j].resop == NFS4_OP_READLINK) {
+			tc_process_verify_link(&resoparray[j]);
+		} else if (resoparray[j].resop == NFS4_OP_COPY) {
 			pairs[i].length =
 			    resoparray[j]
 				.nfs_resop4_u.opcopy.COPY4res_u.cr_bytes_copied;
@@ -4663,11 +6395,18 @@ static tc_res tc_nfs4_lcopyv(struct tc_extent_pair *pairs, int count)
 exit:
 	for (i = 0; i < count; ++i) {
 		nfs4_Fattr_Free(&attrs4[i]);
+		nfs4_Fattr_Free(&linkattrs[i]);
 	}
 	free(attrs4);
+	free(linkattrs);
 	return tcres;
 }
 
+static tc_res tc_nfs4_lcopyv(struct tc_extent_pair *pairs, int count)
+{
+	return tc_nfs4_lcopyv_links(pairs, count, NULL, NULL, NULL);
+}
+
 static tc_res tc_nfs4_hardlinkv(const char **oldpaths, const char **newpaths,
 			        int count)
 {
@@ -4849,6 +6588,307 @@ exit:
 	return tcres;
 }
 
+/**
+ * OPEN, GETATTR(size), READ and CLOSE each file of "reads" in one compound.
+ * Like tc_nfs4_readv(), tc_res.index is the number of files in the compound
+ * on success.
+ */
+static tc_res tc_nfs4_read_files(struct tc_iovec *reads, size_t *sizes,
+				 int count)
+{
+	int rc;
+	tc_res tcres;
+	nfsstat4 op_status;
+	slice_t name;
+	char *fattr_blobs; /* an array of FATTR_BLOB_SZ-sized buffers */
+	GETATTR4resok *atok;
+	READ4resok *rdok;
+	struct tc_attrs attrs;
+	int i = 0; /* index of files */
+	int j = 0; /* index of NFS operations */
+	bool r;
+	int saved_opcnt;
+
+	NFS4_DEBUG("tc_nfs4_read_files");
+
+	fattr_blobs = malloc(count * FATTR_BLOB_SZ);
+	if (!fattr_blobs) {
+		return tc_failure(0, ENOMEM);
+	}
+
+	tc_reset_compound(true);
+	for (i = 0; i < count; ++i) {
+		saved_opcnt = opcnt;
+		r = tc_set_current_fh(&reads[i].file, &name, true) &&
+		    tc_prepare_open(name, O_RDONLY, tc_auto_buf(64), NULL) &&
+		    tc_prepare_getattr(fattr_blobs + i * FATTR_BLOB_SZ,
+				       &tc_bitmap_size) &&
+		    tc_prepare_rdwr(&reads[i], false) &&
+		    tc_prepare_close(NULL, NULL);
+		if (!r) {
+			opcnt = saved_opcnt;
+			count = i;
+			break;
+		}
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status != NFS4_OK) {
+			NFS4_ERR("NFS operation (%d) failed: %d",
+				 resoparray[j].resop, op_status);
+			reads[i].is_failure = 1;
+			tcres = tc_failure(i, nfsstat4_to_errno(op_status));
+			goto exit;
+		}
+		switch (resoparray[j].resop) {
+		case NFS4_OP_GETATTR:
+			atok = &resoparray[j]
+				    .nfs_resop4_u.opgetattr.GETATTR4res_u
+				    .resok4;
+			memset(&attrs, 0, sizeof(attrs));
+			fattr4_to_tc_attrs(&atok->obj_attributes, &attrs);
+			sizes[i] = attrs.size;
+			break;
+		case NFS4_OP_READ:
+			rdok = &resoparray[j]
+				    .nfs_resop4_u.opread.READ4res_u.resok4;
+			reads[i].length = rdok->data.data_len;
+			reads[i].is_eof = rdok->eof;
+			break;
+		case NFS4_OP_CLOSE:
+			++i;
+			break;
+		default:
+			break;
+		}
+	}
+
+exit:
+	free(fattr_blobs);
+	return tcres;
+}
+
+/**
+ * Add the NFS operations of "op" other than READ and WRITE; "fattr",
+ * "fattr_blob" and "bitmap" are its buffers.
+ */
+static bool tc_prepare_cpd_op(struct tc_cpd_op *op, fattr4 *fattr,
+			      char *fattr_blob, struct bitmap4 *bitmap)
+{
+	slice_t name;
+	slice_t dstname;
+
+	switch (op->type) {
+	case TC_CPD_GETATTRS:
+		tc_attr_masks_to_bitmap(&op->attrs.masks, bitmap);
+		return tc_set_current_fh(&op->attrs.file, &name, true) &&
+		       tc_prepare_lookups(&name, 1) &&
+		       tc_prepare_getattr(fattr_blob, bitmap);
+	case TC_CPD_SETATTRS:
+		tc_attrs_to_fattr4(&op->attrs, fattr);
+		tc_attr_masks_to_bitmap(&op->attrs.masks, bitmap);
+		return tc_set_current_fh(&op->attrs.file, &name, true) &&
+		       tc_prepare_lookups(&name, 1) &&
+		       tc_has_enough_ops(2) && tc_prepare_setattr(fattr) &&
+		       tc_prepare_getattr(fattr_blob, bitmap);
+	case TC_CPD_MKDIR:
+		tc_attrs_to_fattr4(&op->attrs, fattr);
+		return tc_set_current_fh(&op->attrs.file, &name, true) &&
+		       tc_prepare_mkdir(name, fattr) &&
+		       tc_prepare_getattr(fattr_blob, &fs_bitmap_getattr);
+	case TC_CPD_REMOVE:
+		return tc_set_current_fh(&op->file, &name, true) &&
+		       tc_prepare_remove(tc_new_auto_str(name));
+	case TC_CPD_RENAME:
+		return tc_set_saved_fh(&op->pair.src_file, &name) &&
+		       tc_set_current_fh(&op->pair.dst_file, &dstname,
+					 false) &&
+		       tc_prepare_rename(&name, &dstname);
+	case TC_CPD_VERIFY:
+	case TC_CPD_NVERIFY:
+		tc_attrs_to_fattr4_verify(&op->attrs, fattr);
+		return tc_set_current_fh(&op->attrs.file, &name, true) &&
+		       tc_prepare_lookups(&name, 1) &&
+		       tc_prepare_verify(fattr, op->type == TC_CPD_NVERIFY);
+	default:
+		NFS4_ERR("unsupported compound operation: %d", op->type);
+		assert(false);
+		return false;
+	}
+}
+
+static inline bool tc_cpd_is_rdwr(const struct tc_cpd_op *op)
+{
+	return op->type == TC_CPD_READ || op->type == TC_CPD_WRITE;
+}
+
+/**
+ * Send the operations of a user-composed compound in one compound.
+ *
+ * A file opened for READ or WRITE is kept open while the following
+ * operations read or write it with the same access, and is closed before
+ * any other operation.  "ends[i]" is the number of NFS operations once
+ * ops[i] is added, so that the results of each NFS operation can be
+ * matched with its op.
+ */
+static tc_res tc_nfs4_cpdv(struct tc_cpd_op *ops, int count)
+{
+	int rc;
+	tc_res tcres;
+	nfsstat4 op_status;
+	int i = 0; /* index of ops */
+	int j = 0; /* index of NFS operations */
+	int nops = count;
+	int *ends;
+	fattr4 *fattrs;
+	char *fattr_blobs; /* an array of FATTR_BLOB_SZ-sized buffers */
+	struct bitmap4 *bitmaps;
+	struct tc_cpd_op *op;
+	const tc_file *opened_file = NULL;
+	const tc_file *saved_file;
+	bool opened_write = false;
+	bool write;
+	int opener = 0;	/* the op that opened the file of a CLOSE */
+	GETATTR4resok *atok;
+	READ4resok *rdok;
+	WRITE4resok *wrok;
+	bool r;
+	int saved_opcnt;
+
+	NFS4_DEBUG("tc_nfs4_cpdv");
+	assert(count >= 1);
+	ends = malloc(count * sizeof(*ends));
+	fattrs = calloc(count, sizeof(fattr4));
+	fattr_blobs = malloc(count * FATTR_BLOB_SZ);
+	bitmaps = calloc(count, sizeof(*bitmaps));
+	if (!ends || !fattrs || !fattr_blobs || !bitmaps) {
+		tcres = tc_failure(0, ENOMEM);
+		nops = 0;
+		goto exit;
+	}
+
+	tc_reset_compound(true);
+	for (i = 0; i < count; ++i) {
+		op = ops + i;
+		saved_opcnt = opcnt;
+		saved_file = opened_file;
+		write = op->type == TC_CPD_WRITE;
+		r = true;
+		if (opened_file &&
+		    (!tc_cpd_is_rdwr(op) || write != opened_write)) {
+			r = tc_prepare_close(NULL, NULL);
+			opened_file = NULL;
+		}
+		if (tc_cpd_is_rdwr(op)) {
+			r = r &&
+			    tc_open_file_if_necessary(
+				&op->iov.file,
+				write ? (O_WRONLY |
+					 (op->iov.is_creation ? O_CREAT : 0))
+				      : O_RDONLY,
+				tc_auto_buf(64), &fattrs[i], &opened_file) &&
+			    tc_prepare_rdwr(&op->iov, write);
+		} else {
+			r = r && tc_prepare_cpd_op(op, &fattrs[i],
+						   fattr_blobs +
+						       i * FATTR_BLOB_SZ,
+						   bitmaps + i);
+		}
+		if (!r || !tc_has_enough_ops(1)) { // reserve for CLOSE
+			opcnt = saved_opcnt;
+			opened_file = saved_file;
+			count = i;
+			break;
+		}
+		opened_write = write;
+		ends[i] = opcnt;
+	}
+
+	if (opened_file) {
+		COMPOUNDV4_ARG_ADD_OP_CLOSE_NOSTATE(opcnt, argoparray);
+		opened_file = NULL;
+		ends[count - 1] = opcnt;
+	}
+
+	tcres.index = count;
+	rc = fs_nfsv4_call(op_ctx->creds, &tcres.err_no);
+	if (rc != RPC_SUCCESS) {
+		NFS4_ERR("rpc failed: %d", rc);
+		tcres = tc_failure(0, rc);
+		goto exit;
+	}
+
+	i = 0;
+	for (j = 0; j < opcnt; ++j) {
+		while (j >= ends[i]) {
+			ops[i++].err_no = 0;
+		}
+		if (resoparray[j].resop == NFS4_OP_OPEN) {
+			opener = i;
+		}
+		/* a CLOSE is sent with the op after the file's last user */
+		op = ops + (resoparray[j].resop == NFS4_OP_CLOSE ? opener : i);
+		op_status = get_nfs4_op_status(&resoparray[j]);
+		if (op_status != NFS4_OK) {
+			NFS4_ERR("NFS operation (%d) of op %d failed: %d",
+				 resoparray[j].resop, (int)(op - ops),
+				 op_status);
+			op->err_no = nfsstat4_to_errno(op_status);
+			if (tc_cpd_is_rdwr(op)) {
+				op->iov.is_failure = 1;
+			}
+			tcres = tc_failure(op - ops, op->err_no);
+			goto exit;
+		}
+		switch (resoparray[j].resop) {
+		case NFS4_OP_READ:
+			rdok = &resoparray[j]
+				    .nfs_resop4_u.opread.READ4res_u.resok4;
+			op->iov.length = rdok->data.data_len;
+			op->iov.is_eof = rdok->eof;
+			break;
+		case NFS4_OP_WRITE:
+			wrok = &resoparray[j]
+				    .nfs_resop4_u.opwrite.WRITE4res_u.resok4;
+			op->iov.length = wrok->count;
+			op->iov.is_write_stable =
+			    (wrok->committed != UNSTABLE4);
+			break;
+		case NFS4_OP_GETATTR:
+			atok = &resoparray[j]
+				    .nfs_resop4_u.opgetattr.GETATTR4res_u
+				    .resok4;
+			fattr4_to_tc_attrs(&atok->obj_attributes, &op->attrs);
+			break;
+		default:
+			break;
+		}
+	}
+	for (; i < count; ++i) {
+		ops[i].err_no = 0;
+	}
+
+exit:
+	for (i = 0; i < nops; ++i) {
+		nfs4_Fattr_Free(&fattrs[i]);
+	}
+	free(bitmaps);
+	free(fattr_blobs);
+	free(fattrs);
+	free(ends);
+	return tcres;
+}
+
 static int tc_nfs4_chdir(const char *path)
 {
 	int rc;
@@ -4930,21 +6970,35 @@ void fs_handle_ops_init(struct fsal_obj_ops *ops)
 	ops->tc_readv = tc_nfs4_readv;
 	ops->tc_writev = tc_nfs4_writev;
         ops->tc_lgetattrsv = tc_nfs4_lgetattrsv;
+        ops->tc_lgetattrsv_links = tc_nfs4_lgetattrsv_links;
         ops->tc_lsetattrsv = tc_nfs4_lsetattrsv;
         ops->tc_mkdirv = tc_nfs4_mkdirv;
         ops->tc_listdirv = tc_nfs4_listdirv;
         ops->tc_renamev = tc_nfs4_renamev;
         ops->tc_removev = tc_nfs4_removev;
         ops->tc_lcopyv = tc_nfs4_lcopyv;
+        ops->tc_lcopyv_links = tc_nfs4_lcopyv_links;
         ops->tc_hardlinkv = tc_nfs4_hardlinkv;
         ops->tc_symlinkv = tc_nfs4_symlinkv;
         ops->tc_readlinkv = tc_nfs4_readlinkv;
+        ops->tc_read_files = tc_nfs4_read_files;
+        ops->tc_cpdv = tc_nfs4_cpdv;
         ops->tc_chdir = tc_nfs4_chdir;
         ops->tc_getcwd = tc_nfs4_getcwd;
 	ops->tc_destroysession = fs_destroy_session;
 	ops->root_lookup = fs_root_lookup;
         ops->tc_openv = tc_nfs4_openv;
         ops->tc_closev = tc_nfs4_closev;
+	ops->tc_defer_closev = tc_nfs4_defer_closev;
+	ops->tc_set_lazy_close = tc_nfs4_set_lazy_close;
+        ops->tc_lockv = tc_nfs4_lockv;
+        ops->tc_unlockv = tc_nfs4_unlockv;
+        ops->tc_testlockv = tc_nfs4_testlockv;
+        ops->tc_fallocatev = tc_nfs4_fallocatev;
+        ops->tc_punchholev = tc_nfs4_punchholev;
+        ops->tc_getxattrsv = tc_nfs4_getxattrsv;
+        ops->tc_setxattrsv = tc_nfs4_setxattrsv;
+        ops->tc_listxattrsv = tc_nfs4_listxattrsv;
 }
 
 #ifdef PROXY_HANDLE_MAPPING
@@ -99,6 +99,7 @@ int tc_alloc_fd(stateid4 *stateid, nfs_fh4 *object)
 	fd_list[cur_fd].fh.nfs_fh4_len = object->nfs_fh4_len;
 
 	fd_list[cur_fd].seqid = 0;
+	fd_list[cur_fd].has_lock_stateid = false;
 	fd_list[cur_fd].offset = 0;
 
         pthread_mutex_unlock(&fd_list_lock);
@@ -157,6 +158,7 @@ int tc_free_fd(int fd)
 	/* We have a valid fd that needs to be closed */
 	tcfd->fd = -1; /* set to "not in use" */
 	tcfd->seqid = 0;
+	tcfd->has_lock_stateid = false;
 	tcfd->offset = 0;
 	free(tcfd->fh.nfs_fh4_val);
         tcfd->fh.nfs_fh4_val = NULL;
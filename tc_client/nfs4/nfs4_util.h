@@ -80,6 +80,9 @@ struct tc_kfd
 	/* seqid is per lock owner, ktcopen creates a new owner for every open,
 	 * so start with 1 */
 	seqid4 seqid;
+	/* stateid of the locks of this open; valid after the first LOCK */
+	stateid4 lock_stateid;
+	bool has_lock_stateid;
 	size_t offset;
 	size_t filesize;
 };
@@ -124,6 +127,11 @@ int tc_for_each_fd(tcfd_processor p, void *args);
 
 bool readdir_reply(const char *name, void *dir_state, fsal_cookie_t cookie);
 
+/**
+ * Convert attributes in an NFSv4 reply to "tca".
+ */
+void fattr4_to_tc_attrs(const fattr4 *attr4, struct tc_attrs *tca);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,223 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include "rpc_bufpool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define TC_RPCBUF_NCLASSES (TC_RPCBUF_MAX_SHIFT - TC_RPCBUF_MIN_SHIFT + 1)
+
+/* A cached buffer links to the next one with its first bytes. */
+struct tc_rpcbuf {
+	struct tc_rpcbuf *next;
+};
+
+struct tc_rpcbuf_class {
+	pthread_mutex_t lock;
+	struct tc_rpcbuf *free;
+	int nfree;
+	int max_free;
+};
+
+static struct tc_rpcbuf_class tc_rpcbuf_classes[TC_RPCBUF_NCLASSES];
+static pthread_once_t tc_rpcbuf_once = PTHREAD_ONCE_INIT;
+static bool tc_rpcbuf_hugepages = false;
+
+static void tc_rpcbuf_init(void)
+{
+	int i;
+	int n;
+
+	for (i = 0; i < TC_RPCBUF_NCLASSES; ++i) {
+		pthread_mutex_init(&tc_rpcbuf_classes[i].lock, NULL);
+		n = TC_RPCBUF_CACHE_BYTES >> (TC_RPCBUF_MIN_SHIFT + i);
+		tc_rpcbuf_classes[i].max_free = n > 2 ? n : 2;
+	}
+}
+
+void tc_rpcbuf_use_hugepages(bool enabled)
+{
+	tc_rpcbuf_hugepages = enabled;
+}
+
+static char *tc_rpcbuf_alloc(size_t size)
+{
+	void *p;
+
+	if (size < (1UL << TC_RPCBUF_HUGE_SHIFT)) {
+		return malloc(size);
+	}
+
+	size = tc_rpcbuf_map_size(size);
+	if (tc_rpcbuf_hugepages) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			return p;
+		}
+	}
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+	if (tc_rpcbuf_hugepages) {
+		/* transparent hugepages then */
+		madvise(p, size, MADV_HUGEPAGE);
+	}
+	return p;
+}
+
+static void tc_rpcbuf_free(char *buf, size_t size)
+{
+	if (size < (1UL << TC_RPCBUF_HUGE_SHIFT)) {
+		free(buf);
+	} else {
+		munmap(buf, tc_rpcbuf_map_size(size));
+	}
+}
+
+/* Return the index of the class of "size", or -1 if it is too large. */
+static int tc_rpcbuf_class_of(size_t size)
+{
+	int i = 0;
+
+	while ((1UL << (TC_RPCBUF_MIN_SHIFT + i)) < size) {
+		if (++i == TC_RPCBUF_NCLASSES) {
+			return -1;
+		}
+	}
+	return i;
+}
+
+char *tc_rpcbuf_get(size_t size, size_t *capacity)
+{
+	struct tc_rpcbuf_class *cls;
+	struct tc_rpcbuf *b = NULL;
+	char *buf;
+	int i;
+
+	pthread_once(&tc_rpcbuf_once, tc_rpcbuf_init);
+
+	i = tc_rpcbuf_class_of(size);
+	if (i < 0) {
+		buf = tc_rpcbuf_alloc(size);
+		*capacity = size;
+		return buf;
+	}
+
+	cls = &tc_rpcbuf_classes[i];
+	*capacity = 1UL << (TC_RPCBUF_MIN_SHIFT + i);
+	pthread_mutex_lock(&cls->lock);
+	if (cls->free) {
+		b = cls->free;
+		cls->free = b->next;
+		--cls->nfree;
+	}
+	pthread_mutex_unlock(&cls->lock);
+
+	return b ? (char *)b : tc_rpcbuf_alloc(*capacity);
+}
+
+void tc_rpcbuf_put(char *buf, size_t capacity)
+{
+	struct tc_rpcbuf_class *cls;
+	struct tc_rpcbuf *b = (struct tc_rpcbuf *)buf;
+	int i;
+
+	if (!buf) {
+		return;
+	}
+
+	i = tc_rpcbuf_class_of(capacity);
+	if (i < 0) {
+		tc_rpcbuf_free(buf, capacity);
+		return;
+	}
+
+	cls = &tc_rpcbuf_classes[i];
+	pthread_mutex_lock(&cls->lock);
+	if (cls->nfree < cls->max_free) {
+		b->next = cls->free;
+		cls->free = b;
+		++cls->nfree;
+		b = NULL;
+	}
+	pthread_mutex_unlock(&cls->lock);
+
+	if (b) {
+		tc_rpcbuf_free(buf, capacity);
+	}
+}
+
+char *tc_rpcbuf_fill(size_t size, size_t limit, tc_rpcbuf_filler fill,
+		     void *arg, size_t *capacity)
+{
+	char *buf;
+	size_t len;
+
+	for (;;) {
+		if (size > limit) {
+			size = limit;
+		}
+		buf = tc_rpcbuf_get(size, capacity);
+		if (!buf) {
+			return NULL;
+		}
+		len = *capacity < limit ? *capacity : limit;
+		if (fill(buf, len, arg)) {
+			return buf;
+		}
+		tc_rpcbuf_put(buf, *capacity);
+		if (len == limit) {
+			return NULL;
+		}
+		size = len * 2;
+	}
+}
+
+void tc_rpcbuf_trim(void)
+{
+	struct tc_rpcbuf_class *cls;
+	struct tc_rpcbuf *b;
+	int i;
+
+	pthread_once(&tc_rpcbuf_once, tc_rpcbuf_init);
+
+	for (i = 0; i < TC_RPCBUF_NCLASSES; ++i) {
+		cls = &tc_rpcbuf_classes[i];
+		pthread_mutex_lock(&cls->lock);
+		b = cls->free;
+		cls->free = NULL;
+		cls->nfree = 0;
+		pthread_mutex_unlock(&cls->lock);
+
+		while (b) {
+			struct tc_rpcbuf *next = b->next;
+
+			tc_rpcbuf_free((char *)b,
+				       1UL << (TC_RPCBUF_MIN_SHIFT + i));
+			b = next;
+		}
+	}
+}
@@ -0,0 +1,102 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * Size-classed pool of the send and receive buffers of RPCs.
+ *
+ * Most compounds are small metadata RPCs, so instead of giving each RPC
+ * context buffers of the configured maximum sizes, buffers are taken from
+ * the pool when an RPC is encoded or its reply arrives, and put back right
+ * after.  Buffers of each power-of-two class from 4KB to 16MB are cached,
+ * TC_RPCBUF_CACHE_BYTES of them per class but at least two buffers, so the
+ * classes of 1MB and more can cache 62MB in total; larger buffers are never
+ * cached.  Buffers of 2MB or more are mmap()ed in multiples of 2MB, backed
+ * by hugepages if enabled.
+ */
+
+#ifndef __TC_NFS4_RPC_BUFPOOL_H__
+#define __TC_NFS4_RPC_BUFPOOL_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TC_RPCBUF_MIN_SHIFT 12
+#define TC_RPCBUF_MAX_SHIFT 24
+#define TC_RPCBUF_HUGE_SHIFT 21
+#define TC_RPCBUF_CACHE_BYTES (1 << 20)
+
+/**
+ * Length of the mapping of a buffer of "size" bytes, which is at least 2MB:
+ * a multiple of the hugepage size, which MAP_HUGETLB mappings need for
+ * munmap() to succeed.
+ */
+static inline size_t tc_rpcbuf_map_size(size_t size)
+{
+	size_t huge = 1UL << TC_RPCBUF_HUGE_SHIFT;
+
+	return (size + huge - 1) & ~(huge - 1);
+}
+
+/**
+ * Whether to back buffers of 2MB or more with hugepages; falls back to
+ * normal pages when no hugepage is available.
+ */
+void tc_rpcbuf_use_hugepages(bool enabled);
+
+/**
+ * Get a buffer of at least "size" bytes; its actual size is returned in
+ * "capacity" and has to be passed to tc_rpcbuf_put().  It is thread-safe.
+ *
+ * Return NULL if out of memory.
+ */
+char *tc_rpcbuf_get(size_t size, size_t *capacity);
+
+void tc_rpcbuf_put(char *buf, size_t capacity);
+
+/**
+ * Fill "len" bytes of "buf"; return false if they are not enough.
+ */
+typedef bool (*tc_rpcbuf_filler)(char *buf, size_t len, void *arg);
+
+/**
+ * Get a buffer of at least "size" bytes and fill it with "fill".  If it does
+ * not fit, the buffer is put back and one of twice the size is tried, up to
+ * "limit" bytes, which is also the most "fill" is given.
+ *
+ * Return the filled buffer, or NULL if out of memory or "limit" bytes are not
+ * enough.
+ */
+char *tc_rpcbuf_fill(size_t size, size_t limit, tc_rpcbuf_filler fill,
+		     void *arg, size_t *capacity);
+
+/**
+ * Release all cached buffers.
+ */
+void tc_rpcbuf_trim(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __TC_NFS4_RPC_BUFPOOL_H__ */
@@ -0,0 +1,184 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include "rpc_bufpool.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using std::vector;
+
+namespace
+{
+const size_t KB = 1UL << 10;
+const size_t MB = 1UL << 20;
+
+// Fill buffers of at least "need" bytes, recording the lengths given.
+struct Filler {
+	size_t need;
+	vector<size_t> lens;
+};
+
+bool FillIfBigEnough(char *buf, size_t len, void *arg)
+{
+	Filler *f = static_cast<Filler *>(arg);
+
+	f->lens.push_back(len);
+	if (len < f->need) {
+		return false;
+	}
+	memset(buf, 'x', len);
+	return true;
+}
+} // namespace
+
+TEST(RpcBufPool, SizeIsRoundedUpToItsClass)
+{
+	size_t capacity;
+	char *buf;
+
+	buf = tc_rpcbuf_get(1, &capacity);
+	EXPECT_EQ(4 * KB, capacity);
+	tc_rpcbuf_put(buf, capacity);
+
+	buf = tc_rpcbuf_get(4 * KB + 1, &capacity);
+	EXPECT_EQ(8 * KB, capacity);
+	tc_rpcbuf_put(buf, capacity);
+
+	buf = tc_rpcbuf_get(16 * MB, &capacity);
+	EXPECT_EQ(16 * MB, capacity);
+	tc_rpcbuf_put(buf, capacity);
+
+	// larger than all classes
+	buf = tc_rpcbuf_get(16 * MB + 1, &capacity);
+	EXPECT_EQ(16 * MB + 1, capacity);
+	tc_rpcbuf_put(buf, capacity);
+
+	tc_rpcbuf_trim();
+}
+
+TEST(RpcBufPool, BuffersAreReusedWithinAClass)
+{
+	size_t capacity;
+	size_t capacity2;
+	char *buf;
+
+	tc_rpcbuf_trim();
+	buf = tc_rpcbuf_get(100, &capacity);
+	tc_rpcbuf_put(buf, capacity);
+	EXPECT_EQ(buf, tc_rpcbuf_get(4000, &capacity2));
+	EXPECT_EQ(capacity, capacity2);
+	tc_rpcbuf_put(buf, capacity2);
+
+	tc_rpcbuf_trim();
+}
+
+TEST(RpcBufPool, CacheOfAClassIsCapped)
+{
+	const int nbufs = TC_RPCBUF_CACHE_BYTES / (64 * KB);
+	vector<char *> bufs;
+	size_t capacity;
+	int i;
+
+	tc_rpcbuf_trim();
+	for (i = 0; i <= nbufs; ++i) {
+		bufs.push_back(tc_rpcbuf_get(64 * KB, &capacity));
+	}
+	for (i = 0; i <= nbufs; ++i) {
+		tc_rpcbuf_put(bufs[i], capacity);
+	}
+	// the last buffer put back was freed instead of cached
+	for (i = nbufs - 1; i >= 0; --i) {
+		EXPECT_EQ(bufs[i], tc_rpcbuf_get(64 * KB, &capacity));
+	}
+	for (i = 0; i < nbufs; ++i) {
+		tc_rpcbuf_put(bufs[i], capacity);
+	}
+
+	tc_rpcbuf_trim();
+}
+
+TEST(RpcBufPool, FillGrowsTheBufferAndRetries)
+{
+	Filler f;
+	size_t capacity;
+	char *buf;
+
+	f.need = 20 * KB;
+	buf = tc_rpcbuf_fill(1 * KB, 1 * MB, FillIfBigEnough, &f, &capacity);
+	ASSERT_TRUE(buf != NULL);
+	EXPECT_EQ(32 * KB, capacity);
+	ASSERT_EQ(4U, f.lens.size());
+	EXPECT_EQ(4 * KB, f.lens[0]);
+	EXPECT_EQ(8 * KB, f.lens[1]);
+	EXPECT_EQ(16 * KB, f.lens[2]);
+	EXPECT_EQ(32 * KB, f.lens[3]);
+	EXPECT_EQ('x', buf[f.need - 1]);
+	tc_rpcbuf_put(buf, capacity);
+
+	tc_rpcbuf_trim();
+}
+
+TEST(RpcBufPool, FillStopsAtTheLimit)
+{
+	Filler f;
+	size_t capacity;
+
+	f.need = 20 * KB;
+	EXPECT_TRUE(tc_rpcbuf_fill(1 * KB, 10 * KB, FillIfBigEnough, &f,
+				   &capacity) == NULL);
+	ASSERT_EQ(3U, f.lens.size());
+	EXPECT_EQ(4 * KB, f.lens[0]);
+	EXPECT_EQ(8 * KB, f.lens[1]);
+	// the buffer of the last try is of 16KB, but only 10KB are used
+	EXPECT_EQ(10 * KB, f.lens[2]);
+
+	tc_rpcbuf_trim();
+}
+
+TEST(RpcBufPool, MappingsAreRoundedToHugepages)
+{
+	EXPECT_EQ(2 * MB, tc_rpcbuf_map_size(2 * MB));
+	EXPECT_EQ(4 * MB, tc_rpcbuf_map_size(2 * MB + 1));
+	EXPECT_EQ(18 * MB, tc_rpcbuf_map_size(16 * MB + 1));
+	EXPECT_EQ(64 * MB, tc_rpcbuf_map_size(64 * MB));
+}
+
+TEST(RpcBufPool, HugepageBuffersAreUsable)
+{
+	size_t sizes[] = { 2 * MB, 3 * MB, 16 * MB + 1 };
+	size_t capacity;
+	char *buf;
+
+	// falls back to normal pages when no hugepage is available
+	tc_rpcbuf_use_hugepages(true);
+	for (size_t size : sizes) {
+		buf = tc_rpcbuf_get(size, &capacity);
+		ASSERT_TRUE(buf != NULL);
+		EXPECT_LE(size, capacity);
+		memset(buf, 'x', capacity);
+		tc_rpcbuf_put(buf, capacity);
+	}
+	tc_rpcbuf_trim();
+	tc_rpcbuf_use_hugepages(false);
+}
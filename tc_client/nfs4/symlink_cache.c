@@ -0,0 +1,174 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "symlink_cache.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct symlink_entry {
+	char *link;	/* NULL if the entry is unused */
+	char *content;
+	uint64_t fileid;
+	uint64_t hash;
+	uint64_t last_used;
+};
+
+static struct symlink_entry
+    symlink_cache[TC_SYMLINK_CACHE_SETS][TC_SYMLINK_CACHE_WAYS];
+static uint64_t symlink_cache_clock = 0;
+static pthread_mutex_t symlink_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a */
+static uint64_t symlink_hash(const char *s)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *s; ++s) {
+		h ^= (unsigned char)*s;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static struct symlink_entry *symlink_set(uint64_t hash)
+{
+	return symlink_cache[hash % TC_SYMLINK_CACHE_SETS];
+}
+
+/* Caller should hold symlink_cache_lock. */
+static struct symlink_entry *symlink_find(const char *link, uint64_t hash)
+{
+	struct symlink_entry *set = symlink_set(hash);
+	int i;
+
+	for (i = 0; i < TC_SYMLINK_CACHE_WAYS; ++i) {
+		if (set[i].link && set[i].hash == hash &&
+		    strcmp(set[i].link, link) == 0)
+			return &set[i];
+	}
+	return NULL;
+}
+
+static void symlink_entry_free(struct symlink_entry *e)
+{
+	free(e->link);
+	free(e->content);
+	e->link = NULL;
+	e->content = NULL;
+}
+
+bool tc_symlink_cache_get(const char *link, char *buf, size_t bufsize,
+			  uint64_t *fileid)
+{
+	uint64_t hash = symlink_hash(link);
+	struct symlink_entry *e;
+	bool found = false;
+
+	pthread_mutex_lock(&symlink_cache_lock);
+	e = symlink_find(link, hash);
+	if (e && strlen(e->content) < bufsize) {
+		strcpy(buf, e->content);
+		*fileid = e->fileid;
+		e->last_used = ++symlink_cache_clock;
+		found = true;
+	}
+	pthread_mutex_unlock(&symlink_cache_lock);
+
+	return found;
+}
+
+void tc_symlink_cache_put(const char *link, const char *content,
+			  uint64_t fileid)
+{
+	uint64_t hash = symlink_hash(link);
+	struct symlink_entry *set;
+	struct symlink_entry *e;
+	char *newlink;
+	char *newcontent;
+	int i;
+
+	newcontent = strdup(content);
+	if (!newcontent)
+		return;
+
+	pthread_mutex_lock(&symlink_cache_lock);
+	e = symlink_find(link, hash);
+	if (e) {
+		free(e->content);
+		e->content = newcontent;
+		e->fileid = fileid;
+		e->last_used = ++symlink_cache_clock;
+		pthread_mutex_unlock(&symlink_cache_lock);
+		return;
+	}
+
+	newlink = strdup(link);
+	if (!newlink) {
+		pthread_mutex_unlock(&symlink_cache_lock);
+		free(newcontent);
+		return;
+	}
+
+	set = symlink_set(hash);
+	e = &set[0];
+	for (i = 0; i < TC_SYMLINK_CACHE_WAYS; ++i) {
+		if (!set[i].link) {
+			e = &set[i];
+			break;
+		}
+		if (set[i].last_used < e->last_used)
+			e = &set[i];
+	}
+	symlink_entry_free(e);
+	e->link = newlink;
+	e->content = newcontent;
+	e->fileid = fileid;
+	e->hash = hash;
+	e->last_used = ++symlink_cache_clock;
+	pthread_mutex_unlock(&symlink_cache_lock);
+}
+
+void tc_symlink_cache_remove(const char *link)
+{
+	uint64_t hash = symlink_hash(link);
+	struct symlink_entry *e;
+
+	pthread_mutex_lock(&symlink_cache_lock);
+	e = symlink_find(link, hash);
+	if (e)
+		symlink_entry_free(e);
+	pthread_mutex_unlock(&symlink_cache_lock);
+}
+
+void tc_symlink_cache_clear()
+{
+	int i;
+	int j;
+
+	pthread_mutex_lock(&symlink_cache_lock);
+	for (i = 0; i < TC_SYMLINK_CACHE_SETS; ++i) {
+		for (j = 0; j < TC_SYMLINK_CACHE_WAYS; ++j)
+			symlink_entry_free(&symlink_cache[i][j]);
+	}
+	pthread_mutex_unlock(&symlink_cache_lock);
+}
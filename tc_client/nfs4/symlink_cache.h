@@ -0,0 +1,62 @@
+/*
+ * vim:expandtab:shiftwidth=8:tabstop=8:
+ *
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * A bounded client-side cache of symlink contents, keyed by the path of the
+ * symlink.
+ *
+ * Entries are only hints: a compound using a cached target first VERIFYs the
+ * fileid of the symlink and reads it again with READLINK (see
+ * tc_prepare_verify_link() in handle.c), and the entry is updated or removed
+ * when the server disagrees.  The content of a symlink never changes in
+ * place, so an unchanged fileid means an unchanged target.
+ */
+
+#ifndef __TC_NFS4_SYMLINK_CACHE_H__
+#define __TC_NFS4_SYMLINK_CACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TC_SYMLINK_CACHE_SETS 1024
+#define TC_SYMLINK_CACHE_WAYS 4
+
+/**
+ * Look up the content of symlink "link".
+ *
+ * Return whether "link" is cached; its content is copied into "buf" of
+ * "bufsize" bytes, and its fileid into "fileid".
+ */
+bool tc_symlink_cache_get(const char *link, char *buf, size_t bufsize,
+			  uint64_t *fileid);
+
+/**
+ * Add or update the content and fileid of symlink "link".  The least
+ * recently used entry of the same set is evicted when the set is full.
+ */
+void tc_symlink_cache_put(const char *link, const char *content,
+			  uint64_t fileid);
+
+void tc_symlink_cache_remove(const char *link);
+
+void tc_symlink_cache_clear();
+
+#endif // __TC_NFS4_SYMLINK_CACHE_H__
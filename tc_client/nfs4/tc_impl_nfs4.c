@@ -26,38 +26,18 @@
 #include "../MainNFSD/nfs_init.h"
 #include "path_utils.h"
 #include "iovec_utils.h"
+#include "symlink_cache.h"
+#include "compound_sched.h"
+#include "compound_trace.h"
 
 /*
- * Initialize tc_client
- * log_path - Location of the log file
- * config_path - Location of the config file
- * export_id - Export id of the export configured in the conf file
- *
- * This returns fsal_module pointer to tc_client module
- * If tc_client module does not exist, it will return NULL
- *
- * Caller of this function should call tc_deinit() after use
+ * Block the signals the signal handler will handle.
  */
-void *nfs4_init(const char *config_path, const char *log_path,
-		uint16_t export_id)
+static int nfs4_block_signals(void)
 {
-	char *exec_name = "nfs-ganesha";
-	char *host_name = "localhost";
-	struct fsal_module *new_module = NULL;
 	sigset_t signals_to_block;
-	struct config_error_type err_type;
-	struct gsh_export *exp = NULL;
 	int rc;
-	fsal_status_t st;
-	config_file_t config_struct;
-	nfs_start_info_t my_nfs_start_info = { .dump_default_config = false,
-					       .lw_mark_trigger = false };
 
-	nfs_prereq_init(exec_name, host_name, -1, log_path);
-
-	/* Set up for the signal handler.
-         * Blocks the signals the signal handler will handle.
-         */
         sigemptyset(&signals_to_block);
         sigaddset(&signals_to_block, SIGHUP);
         sigaddset(&signals_to_block, SIGPIPE);
@@ -67,10 +47,20 @@ void *nfs4_init(const char *config_path, const char *log_path,
 		    stderr,
 		    "Could not start nfs daemon, pthread_sigmask failed: %s",
 		    strerror(errno));
-		return NULL;
 	}
+	return rc;
+}
 
-	/* Parse the configuration file so we all know what is going on. */
+/*
+ * Parse the configuration file so we all know what is going on.
+ *
+ * Returns NULL if the file is not accessible.
+ */
+static config_file_t nfs4_parse_config(const char *config_path)
+{
+	struct config_error_type err_type;
+	config_file_t config_struct;
+	int rc;
 
 	rc = access(config_path, R_OK);
 	if (rc != 0) {
@@ -98,25 +88,19 @@ void *nfs4_init(const char *config_path, const char *log_path,
 			gsh_free(errstr);
 	}
 
-	if (read_log_config(config_struct) < 0)
-		LogFatal(COMPONENT_INIT,
-			 "Error while parsing log configuration");
-	/* We need all the fsal modules loaded so we can have
-	 * the list available at exports parsing time.
-	 */
-	start_fsals();
-
-	/* parse configuration file */
-
-	if (nfs_set_param_from_conf(config_struct, &my_nfs_start_info)) {
-                LogFatal(COMPONENT_INIT,
-                         "Error setting parameters from configuration file.");
-        }
+	return config_struct;
+}
 
-	/* initialize core subsystems and data structures */
-        if (init_server_pkgs() != 0)
-                LogFatal(COMPONENT_INIT,
-                         "Failed to initialize server packages");
+/*
+ * Load the TCNFS module configuration, which connects to the server and
+ * creates the session, and then the export entries.
+ */
+static struct fsal_module *nfs4_load_module(config_file_t config_struct,
+					    bool lite)
+{
+	struct fsal_module *new_module = NULL;
+	fsal_status_t st;
+	int rc;
 
 	new_module = lookup_fsal("TCNFS");
 	if (new_module == NULL) {
@@ -132,7 +116,8 @@ void *nfs4_init(const char *config_path, const char *log_path,
         /* Load export entries from parsed file
          * returns the number of export entries.
          */
-        rc = ReadExports(config_struct);
+        rc = lite ? ReadClientExports(config_struct)
+                  : ReadExports(config_struct);
         if (rc < 0)
                 LogFatal(COMPONENT_INIT,
                           "Error while parsing export entries");
@@ -140,8 +125,17 @@ void *nfs4_init(const char *config_path, const char *log_path,
                 LogWarn(COMPONENT_INIT,
                         "No export entries found in configuration file !!!");
 
-        /* freeing syntax tree : */
-        config_Free(config_struct);
+	return new_module;
+}
+
+/*
+ * Set up "op_ctx" for the export and change into its root.
+ */
+static void *nfs4_start_export(struct fsal_module *new_module,
+			       uint16_t export_id)
+{
+	struct gsh_export *exp = NULL;
+	int rc;
 
 	exp = get_gsh_export(export_id);
 	if (exp == NULL) {
@@ -172,6 +166,109 @@ void *nfs4_init(const char *config_path, const char *log_path,
 	return (void*)new_module;
 }
 
+/*
+ * Initialize tc_client
+ * log_path - Location of the log file
+ * config_path - Location of the config file
+ * export_id - Export id of the export configured in the conf file
+ *
+ * This returns fsal_module pointer to tc_client module
+ * If tc_client module does not exist, it will return NULL
+ *
+ * Caller of this function should call tc_deinit() after use
+ */
+void *nfs4_init(const char *config_path, const char *log_path,
+		uint16_t export_id)
+{
+	char *exec_name = "nfs-ganesha";
+	char *host_name = "localhost";
+	struct fsal_module *new_module = NULL;
+	config_file_t config_struct;
+	nfs_start_info_t my_nfs_start_info = { .dump_default_config = false,
+					       .lw_mark_trigger = false };
+
+	nfs_prereq_init(exec_name, host_name, -1, log_path);
+
+	if (nfs4_block_signals() != 0) {
+		return NULL;
+	}
+
+	config_struct = nfs4_parse_config(config_path);
+	if (config_struct == NULL) {
+		return NULL;
+	}
+
+	if (read_log_config(config_struct) < 0)
+		LogFatal(COMPONENT_INIT,
+			 "Error while parsing log configuration");
+	/* We need all the fsal modules loaded so we can have
+	 * the list available at exports parsing time.
+	 */
+	start_fsals();
+
+	/* parse configuration file */
+
+	if (nfs_set_param_from_conf(config_struct, &my_nfs_start_info)) {
+                LogFatal(COMPONENT_INIT,
+                         "Error setting parameters from configuration file.");
+        }
+
+	/* initialize core subsystems and data structures */
+        if (init_server_pkgs() != 0)
+                LogFatal(COMPONENT_INIT,
+                         "Failed to initialize server packages");
+
+	new_module = nfs4_load_module(config_struct, false);
+
+        /* freeing syntax tree : */
+        config_Free(config_struct);
+
+	if (new_module == NULL) {
+		return NULL;
+	}
+	return nfs4_start_export(new_module, export_id);
+}
+
+/*
+ * Same as nfs4_init(), but only what is needed to send compounds is set up:
+ * the client and export parameters, FSAL_TC, the transport and the session.
+ * There is no pseudo root, no cache inode or state layer, and the ID mapper
+ * is initialized on first use.
+ */
+void *nfs4_init_lite(const char *config_path, const char *log_path,
+		     uint16_t export_id)
+{
+	char *exec_name = "nfs-ganesha";
+	char *host_name = "localhost";
+	struct fsal_module *new_module = NULL;
+	config_file_t config_struct;
+
+	nfs_prereq_init(exec_name, host_name, -1, log_path);
+
+	if (nfs4_block_signals() != 0) {
+		return NULL;
+	}
+
+	config_struct = nfs4_parse_config(config_path);
+	if (config_struct == NULL) {
+		return NULL;
+	}
+
+	if (nfs_set_client_param_from_conf(config_struct)) {
+		LogFatal(COMPONENT_INIT,
+			 "Error setting parameters from configuration file.");
+	}
+
+	start_tc_fsal();
+	new_module = nfs4_load_module(config_struct, true);
+	config_Free(config_struct);
+
+	if (new_module == NULL) {
+		return NULL;
+	}
+	return nfs4_start_export(new_module, export_id);
+}
+
 /*
  * Free the reference to module and op_ctx
  * Should be called if nfs4_init() was called previously
@@ -184,6 +281,8 @@ void nfs4_deinit(void *arg)
 
 	/* Close all open fds, client might have forgot to close them */
 	nfs4_close_all();
+	export->fsal_export->obj_ops->tc_set_lazy_close(false);
+	tc_symlink_cache_clear();
 
 	fsal_status = export->fsal_export->obj_ops->tc_destroysession();
 
@@ -203,6 +302,38 @@ void nfs4_deinit(void *arg)
 	}
 }
 
+void nfs4_enable_tracing(bool enabled)
+{
+	tc_trace_enable(enabled);
+}
+
+int nfs4_dump_trace(const char *path)
+{
+	return tc_trace_dump(path);
+}
+
+int nfs4_set_thread_priority(int prio)
+{
+	return tc_sched_set_thread_class(prio);
+}
+
+int nfs4_set_priority_limits(int prio, int max_inflight, int weight)
+{
+	return tc_sched_set_class_limits(prio, max_inflight, weight);
+}
+
+int nfs4_get_priority_stats(int prio, struct tc_sched_stats *stats)
+{
+	return tc_sched_get_stats(prio, stats);
+}
+
+void nfs4_enable_lazy_close(bool enabled)
+{
+	struct gsh_export *export = op_ctx->export;
+
+	export->fsal_export->obj_ops->tc_set_lazy_close(enabled);
+}
+
 /*
  * iovs - Array of reads for one or more files
  *       Contains file-path, read length, offset, etc.
@@ -238,29 +369,56 @@ tc_res nfs4_do_readv(struct tc_iovec *iovs, int read_count, bool istxn)
 	return tcres;
 }
 
-static void nfs4_decompress_paths(struct tc_iovec *iovs, int count,
-				  tc_file *saved_tcfs);
 /**
- * Use relative paths to shorten path lookups.
- *
- * Returns the saved tc_files if the iovs has been changed, or NULL if we
- * cannot compress the paths.
+ * Join "comps" into a path in "arena"; return NULL if it does not fit.
  */
-static tc_file *nfs4_compress_paths(struct tc_iovec *iovs, int count)
+static const char *nfs4_put_path(buf_t *arena, const slice_t *comps, int n)
+{
+	char *path = buf_end(arena);
+	int i;
+
+	if (n == 0 && buf_append_char(arena, '.') < 0) {
+		return NULL;
+	}
+	for (i = 0; i < n; ++i) {
+		if ((i > 0 && buf_append_char(arena, '/') < 0) ||
+		    buf_append_slice(arena, comps[i]) < 0) {
+			return NULL;
+		}
+	}
+	/* unlike buf_append_null(), keep the '\0' for the next path */
+	return buf_append_char(arena, '\0') < 0 ? NULL : path;
+}
+
+tc_file *nfs4_compress_paths(struct tc_iovec *iovs, int count)
 {
 	tc_file *saved_tcfs = NULL;
-	char *buf;
+	slice_t comps[TC_PATH_MAX_COMPS];
+	buf_t arena;
+	size_t arena_size = 0;
+	slice_t path;
+	const char *short_path;
 	int i;
+	int n;
 	bool compressed = false;
 
 	if (iovs == NULL || count <= 1) {
 		return NULL;
 	}
 
-	saved_tcfs = calloc(count, sizeof(*saved_tcfs));
+	/* A compressed path is less than 3/2 as long as the original. */
+	for (i = 1; i < count; ++i) {
+		if (iovs[i].file.type == TC_FILE_PATH) {
+			arena_size += 2 * strlen(iovs[i].file.path) + 2;
+		}
+	}
+
+	/* The compressed paths are kept right after "saved_tcfs". */
+	saved_tcfs = malloc(sizeof(*saved_tcfs) * count + arena_size);
 	if (!saved_tcfs) {
 		return NULL;
 	}
+	arena = mkbuf((char *)(saved_tcfs + count), arena_size);
 
 	saved_tcfs[0] = iovs[0].file;
 	for (i = 1; i < count; ++i) {
@@ -269,24 +427,18 @@ static tc_file *nfs4_compress_paths(struct tc_iovec *iovs, int count)
 		    saved_tcfs[i - 1].type != TC_FILE_PATH) {
 			continue;
 		}
-		buf = malloc(PATH_MAX);
-		if (!buf) {
-			nfs4_decompress_paths(iovs, i, saved_tcfs);
-			return NULL;
-		}
-		if (tc_path_rebase(saved_tcfs[i - 1].path, iovs[i].file.path,
-				   buf, PATH_MAX) < 0) {
-			free(buf);
-			nfs4_decompress_paths(iovs, i, saved_tcfs);
-			return NULL;
+		path = toslice(iovs[i].file.path);
+		n = tc_path_rebase_a(toslice(saved_tcfs[i - 1].path), path,
+				     comps, TC_PATH_MAX_COMPS);
+		if (n < 0 || n >= tc_path_count_s(path)) {
+			continue;
 		}
-		if (tc_path_tokenize(buf, NULL) >=
-		    tc_path_tokenize(iovs[i].file.path, NULL)) {
-			free(buf);
+		short_path = nfs4_put_path(&arena, comps, n);
+		if (!short_path) {
 			continue;
 		}
 		iovs[i].file.type = TC_FILE_CURRENT;
-		iovs[i].file.path = buf;
+		iovs[i].file.path = short_path;
 		compressed = true;
 	}
 
@@ -298,8 +450,8 @@ static tc_file *nfs4_compress_paths(struct tc_iovec *iovs, int count)
 	return saved_tcfs;
 }
 
-static void nfs4_decompress_paths(struct tc_iovec *iovs, int count,
-				  tc_file *saved_tcfs)
+void nfs4_decompress_paths(struct tc_iovec *iovs, int count,
+			   tc_file *saved_tcfs)
 {
 	int i;
 
@@ -308,10 +460,7 @@ static void nfs4_decompress_paths(struct tc_iovec *iovs, int count,
 	}
 
 	for (i = 0; i < count; ++i) {
-		if (!tc_cmp_file(&iovs[i].file, saved_tcfs + i)) {
-			free((char *)iovs[i].file.path);
-			iovs[i].file = saved_tcfs[i];
-		}
+		iovs[i].file = saved_tcfs[i];
 	}
 	free(saved_tcfs);
 }
@@ -383,14 +532,17 @@ static int nfs4_fill_fd_iovecs(struct tc_iovec *iovs, int count)
 	return 0;
 }
 
-tc_res nfs4_do_iovec(struct tc_iovec *iovs, int count, bool istxn,
+tc_res nfs4_do_iovec(struct tc_iovec *iovs, int count, bool istxn, bool write,
 		     tc_res (*fn)(struct tc_iovec *iovs, int count, bool istxn))
 {
 	static const int CPD_LIMIT = (1 << 20);
 	int i;
 	int nparts;
 	struct tc_iov_array iova = TC_IOV_ARRAY_INITIALIZER(iovs, count);
+	struct tc_iov_array *merged;
 	struct tc_iov_array *parts;
+	struct fsal_export *exp = op_ctx->fsal_export;
+	size_t max_io;
 	tc_res tcres;
 
 	for (i = 0; i < count; ++i) {
@@ -405,7 +557,18 @@ tc_res nfs4_do_iovec(struct tc_iovec *iovs, int count, bool istxn,
 		return tcres;
 	}
 
-	parts = tc_split_iov_array(&iova, CPD_LIMIT, &nparts);
+	/* send adjacent and overlapping iovecs as one READ or WRITE */
+	max_io = write ? exp->ops->fs_maxwrite(exp) : exp->ops->fs_maxread(exp);
+	merged = tc_merge_iov_array(&iova, max_io, write);
+
+	parts = tc_split_iov_array(merged ? merged : &iova, CPD_LIMIT, &nparts);
+	if (!parts) {
+		if (merged) {
+			tc_unmerge_iov_array(&iova, &merged, write);
+		}
+		nfs4_clear_fd_iovecs(iovs, count);
+		return tc_failure(0, ENOMEM);
+	}
 
 	for (i = 0; i < nparts; ++i) {
 		tcres = fn(parts[i].iovs, parts[i].size, istxn);
@@ -416,13 +579,22 @@ tc_res nfs4_do_iovec(struct tc_iovec *iovs, int count, bool istxn,
 	}
 
 exit:
-	tc_restore_iov_array(&iova, &parts, nparts);
+	tc_restore_iov_array(merged ? merged : &iova, &parts, nparts);
+	if (merged) {
+		tc_unmerge_iov_array(&iova, &merged, write);
+		if (!tc_okay(tcres)) {
+			/* point at the caller's iovec instead of the merged */
+			for (i = 0; i < count && !iovs[i].is_failure; ++i)
+				;
+			tcres.index = i < count ? i : 0;
+		}
+	}
 	nfs4_clear_fd_iovecs(iovs, count);
 	return tcres;
 }
 
 tc_res nfs4_readv(struct tc_iovec *iovs, int count, bool istxn) {
-	return nfs4_do_iovec(iovs, count, istxn, nfs4_do_readv);
+	return nfs4_do_iovec(iovs, count, istxn, false, nfs4_do_readv);
 }
 
 /*
@@ -462,7 +634,7 @@ tc_res nfs4_do_writev(struct tc_iovec *iovs, int write_count, bool istxn)
 
 tc_res nfs4_writev(struct tc_iovec *iovs, int count, bool istxn)
 {
-	return nfs4_do_iovec(iovs, count, istxn, nfs4_do_writev);
+	return nfs4_do_iovec(iovs, count, istxn, true, nfs4_do_writev);
 }
 
 tc_file *nfs4_openv(const char **paths, int count, int *flags, mode_t *modes)
@@ -529,56 +701,361 @@ exit:
 	return tcfs;
 }
 
-static int nfs4_close_impl(struct tc_kfd *tcfd, void *args)
+/*
+ * Fill "states" with the NFS state of the files of "locks".
+ *
+ * Return 0 on success, or -errno with "*index" set to the bad lock.
+ */
+static int nfs4_fill_lock_states(const struct tc_lock *locks,
+				 struct tc_lock_state *states, int count,
+				 int *index)
 {
-	struct gsh_export *export = op_ctx->export;
-	tc_res tcres;
+	struct tc_kfd *tcfd;
+	int i;
 
-	tcres = export->fsal_export->obj_ops->tc_closev(
-	    &tcfd->fh, 1, &tcfd->stateid, &tcfd->seqid);
-	if (!tc_okay(tcres)) {
-		return (int)EAGAIN;
+	for (i = 0; i < count; ++i) {
+		*index = i;
+		if (locks[i].file.type != TC_FILE_DESCRIPTOR) {
+			return -EINVAL;
+		}
+		tcfd = tc_get_fd_struct(locks[i].file.fd, false);
+		if (!tcfd) {
+			return -EBADF;
+		}
+		states[i].fd = tcfd->fd;
+		states[i].fh = tcfd->fh;
+		states[i].open_stateid = tcfd->stateid;
+		states[i].lock_stateid = tcfd->lock_stateid;
+		states[i].has_lock_stateid = tcfd->has_lock_stateid;
+		tc_put_fd_struct(&tcfd);
 	}
 
-	tc_free_fd(tcfd->fd);
 	return 0;
 }
 
-tc_res nfs4_closev(tc_file *files, int count)
+/*
+ * Remember lock stateids returned by LOCK in "states[0..n)" in the fd table,
+ * and pass them on to "states[n..count)" of the same files.
+ */
+static void nfs4_save_lock_states(struct tc_lock_state *states, int n,
+				  int count)
 {
-	struct gsh_export *export = op_ctx->export;
-	tc_res tcres = { .index = count, .err_no = 0 };
-	nfs_fh4 *fh4s;
-	stateid4 *sids;
-	seqid4 *seqs;
-	int i;
-	int n;
 	struct tc_kfd *tcfd;
-	int finished;
-
-	fh4s = calloc(count, sizeof(*fh4s));
-	sids = calloc(count, sizeof(*sids));
-	seqs = calloc(count, sizeof(*seqs));
+	int i;
+	int k;
 
-	n = 0;
-	for (i = 0; i < count; ++i) {
-		if (files[i].type != TC_FILE_NULL) {
-			assert(files[i].type == TC_FILE_DESCRIPTOR);
-			tcfd = tc_get_fd_struct(files[i].fd, false);
-			fh4s[n] = tcfd->fh;
-			sids[n] = tcfd->stateid;
-			seqs[n++] = tcfd->seqid;
-			tc_put_fd_struct(&tcfd);
+	for (i = 0; i < n; ++i) {
+		if (!states[i].has_lock_stateid) {
+			continue;
+		}
+		tcfd = tc_get_fd_struct(states[i].fd, true);
+		if (!tcfd) {
+			continue;
+		}
+		if (!tcfd->has_lock_stateid) {
+			tcfd->lock_stateid = states[i].lock_stateid;
+			tcfd->has_lock_stateid = true;
+			for (k = n; k < count; ++k) {
+				if (states[k].fd == states[i].fd) {
+					states[k].lock_stateid =
+					    states[i].lock_stateid;
+					states[k].has_lock_stateid = true;
+				}
+			}
 		}
+		tc_put_fd_struct(&tcfd);
 	}
+}
 
-	for (finished = 0; finished < n; ) {
-		tcres = export->fsal_export->obj_ops->tc_closev(
-		    fh4s + finished, n - finished, sids + finished,
-		    seqs + finished);
-		if (!tc_okay(tcres)) {
-			tcres.index += finished;
-			break;
+static tc_res nfs4_do_lockv(struct tc_lock *locks, int count,
+			    tc_res (*fn)(struct tc_lock *locks,
+					 struct tc_lock_state *states,
+					 int count))
+{
+	tc_res tcres = { .index = count, .err_no = 0 };
+	struct tc_lock_state *states;
+	int finished;
+	int rc;
+
+	states = calloc(count, sizeof(*states));
+	if (!states) {
+		return tc_failure(0, ENOMEM);
+	}
+	rc = nfs4_fill_lock_states(locks, states, count, &tcres.index);
+	if (rc < 0) {
+		tcres.err_no = -rc;
+		goto exit;
+	}
+
+	for (finished = 0; finished < count; finished += tcres.index) {
+		tcres = fn(locks + finished, states + finished,
+			   count - finished);
+		nfs4_save_lock_states(states + finished, tcres.index,
+				      count - finished);
+		if (!tc_okay(tcres)) {
+			tcres.index += finished;
+			break;
+		}
+	}
+
+exit:
+	free(states);
+	return tcres;
+}
+
+tc_res nfs4_lockv(struct tc_lock *locks, int count, bool istxn)
+{
+	struct gsh_export *exp = op_ctx->export;
+
+	return nfs4_do_lockv(locks, count, exp->fsal_export->obj_ops->tc_lockv);
+}
+
+tc_res nfs4_unlockv(struct tc_lock *locks, int count, bool istxn)
+{
+	struct gsh_export *exp = op_ctx->export;
+
+	return nfs4_do_lockv(locks, count,
+			     exp->fsal_export->obj_ops->tc_unlockv);
+}
+
+tc_res nfs4_testlockv(struct tc_lock *locks, int count, bool istxn)
+{
+	struct gsh_export *exp = op_ctx->export;
+
+	return nfs4_do_lockv(locks, count,
+			     exp->fsal_export->obj_ops->tc_testlockv);
+}
+
+static tc_res nfs4_do_allocv(struct tc_extent *extents, int count,
+			     tc_res (*fn)(struct tc_extent *extents,
+					  int count))
+{
+	tc_res tcres = { .index = count, .err_no = 0 };
+	int finished;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (extents[i].length == 0) {
+			tcres = tc_failure(i, EINVAL);
+			break;
+		}
+		if (extents[i].file.type == TC_FILE_DESCRIPTOR &&
+		    nfs4_fill_fd_data(&extents[i].file) != 0) {
+			tcres = tc_failure(i, EBADF);
+			break;
+		}
+	}
+	if (!tc_okay(tcres)) {
+		count = tcres.index;
+		goto exit;
+	}
+
+	for (finished = 0; finished < count; finished += tcres.index) {
+		tcres = fn(extents + finished, count - finished);
+		if (!tc_okay(tcres)) {
+			tcres.index += finished;
+			break;
+		}
+	}
+
+exit:
+	for (i = 0; i < count; ++i) {
+		if (extents[i].file.type == TC_FILE_DESCRIPTOR) {
+			nfs4_clear_fd_data(&extents[i].file);
+		}
+	}
+	return tcres;
+}
+
+tc_res nfs4_fallocatev(struct tc_extent *extents, int count, bool istxn)
+{
+	struct gsh_export *exp = op_ctx->export;
+
+	return nfs4_do_allocv(extents, count,
+			      exp->fsal_export->obj_ops->tc_fallocatev);
+}
+
+tc_res nfs4_punchholev(struct tc_extent *extents, int count, bool istxn)
+{
+	struct gsh_export *exp = op_ctx->export;
+
+	return nfs4_do_allocv(extents, count,
+			      exp->fsal_export->obj_ops->tc_punchholev);
+}
+
+static tc_res nfs4_do_xattrsv(struct tc_xattr *xattrs, int count,
+			      tc_res (*fn)(struct tc_xattr *xattrs,
+					   int count))
+{
+	tc_res tcres = { .index = count, .err_no = 0 };
+	int finished;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (xattrs[i].file.type == TC_FILE_DESCRIPTOR &&
+		    nfs4_fill_fd_data(&xattrs[i].file) != 0) {
+			tcres = tc_failure(i, EBADF);
+			count = i;
+			goto exit;
+		}
+	}
+
+	for (finished = 0; finished < count; finished += tcres.index) {
+		tcres = fn(xattrs + finished, count - finished);
+		if (!tc_okay(tcres)) {
+			tcres.index += finished;
+			break;
+		}
+	}
+
+exit:
+	for (i = 0; i < count; ++i) {
+		if (xattrs[i].file.type == TC_FILE_DESCRIPTOR) {
+			nfs4_clear_fd_data(&xattrs[i].file);
+		}
+	}
+	return tcres;
+}
+
+tc_res nfs4_getxattrsv(struct tc_xattr *xattrs, int count, bool istxn)
+{
+	struct gsh_export *exp = op_ctx->export;
+
+	return nfs4_do_xattrsv(xattrs, count,
+			       exp->fsal_export->obj_ops->tc_getxattrsv);
+}
+
+tc_res nfs4_setxattrsv(struct tc_xattr *xattrs, int count, bool istxn)
+{
+	struct gsh_export *exp = op_ctx->export;
+
+	return nfs4_do_xattrsv(xattrs, count,
+			       exp->fsal_export->obj_ops->tc_setxattrsv);
+}
+
+tc_res nfs4_listxattrsv(const char **paths, char **bufs, size_t *bufsizes,
+			int count, bool istxn)
+{
+	struct gsh_export *exp = op_ctx->export;
+	tc_res tcres = { .index = count, .err_no = 0 };
+	int finished;
+
+	for (finished = 0; finished < count; finished += tcres.index) {
+		tcres = exp->fsal_export->obj_ops->tc_listxattrsv(
+		    paths + finished, bufs + finished, bufsizes + finished,
+		    count - finished);
+		if (!tc_okay(tcres)) {
+			tcres.index += finished;
+			break;
+		}
+	}
+
+	return tcres;
+}
+
+/*
+ * Release all locks of the "files" to be closed, as close(2) does.  The
+ * server refuses to CLOSE a file with locks held.
+ */
+static void nfs4_unlock_files(tc_file *files, int count)
+{
+	struct tc_lock *locks;
+	struct tc_kfd *tcfd;
+	int n = 0;
+	int i;
+
+	locks = calloc(count, sizeof(*locks));
+	if (!locks) {
+		return;
+	}
+	for (i = 0; i < count; ++i) {
+		if (files[i].type != TC_FILE_DESCRIPTOR) {
+			continue;
+		}
+		/* skip files never locked, which need no round trip */
+		tcfd = tc_get_fd_struct(files[i].fd, false);
+		if (!tcfd) {
+			continue;
+		}
+		if (tcfd->has_lock_stateid) {
+			tc_fill_lock(&locks[n++], files[i], F_UNLCK, 0, 0);
+		}
+		tc_put_fd_struct(&tcfd);
+	}
+	if (n > 0) {
+		nfs4_unlockv(locks, n, false);
+	}
+	free(locks);
+}
+
+static int nfs4_close_impl(struct tc_kfd *tcfd, void *args)
+{
+	struct gsh_export *export = op_ctx->export;
+	struct tc_lock lock;
+	struct tc_lock_state state;
+	tc_res tcres;
+
+	/* called with "tcfd->fd_lock" held, so unlock without the fd table */
+	if (tcfd->has_lock_stateid) {
+		tc_fill_lock(&lock, tc_file_from_fd(tcfd->fd), F_UNLCK, 0, 0);
+		state.fd = tcfd->fd;
+		state.fh = tcfd->fh;
+		state.open_stateid = tcfd->stateid;
+		state.lock_stateid = tcfd->lock_stateid;
+		state.has_lock_stateid = true;
+		export->fsal_export->obj_ops->tc_unlockv(&lock, &state, 1);
+	}
+
+	tcres = export->fsal_export->obj_ops->tc_closev(
+	    &tcfd->fh, 1, &tcfd->stateid, &tcfd->seqid);
+	if (!tc_okay(tcres)) {
+		return (int)EAGAIN;
+	}
+
+	tc_free_fd(tcfd->fd);
+	return 0;
+}
+
+tc_res nfs4_closev(tc_file *files, int count)
+{
+	struct gsh_export *export = op_ctx->export;
+	tc_res tcres = { .index = count, .err_no = 0 };
+	nfs_fh4 *fh4s;
+	stateid4 *sids;
+	seqid4 *seqs;
+	int i;
+	int n;
+	struct tc_kfd *tcfd;
+	int finished;
+
+	nfs4_unlock_files(files, count);
+
+	fh4s = calloc(count, sizeof(*fh4s));
+	sids = calloc(count, sizeof(*sids));
+	seqs = calloc(count, sizeof(*seqs));
+
+	n = 0;
+	for (i = 0; i < count; ++i) {
+		if (files[i].type != TC_FILE_NULL) {
+			assert(files[i].type == TC_FILE_DESCRIPTOR);
+			tcfd = tc_get_fd_struct(files[i].fd, false);
+			fh4s[n] = tcfd->fh;
+			sids[n] = tcfd->stateid;
+			seqs[n++] = tcfd->seqid;
+			tc_put_fd_struct(&tcfd);
+		}
+	}
+
+	/* the fds of deferred CLOSEs are freed below */
+	finished = export->fsal_export->obj_ops->tc_defer_closev(fh4s, n, sids,
+								 seqs);
+	while (finished < n) {
+		tcres = export->fsal_export->obj_ops->tc_closev(
+		    fh4s + finished, n - finished, sids + finished,
+		    seqs + finished);
+		if (!tc_okay(tcres)) {
+			tcres.index += finished;
+			break;
 		}
 		for (i = finished; i < tcres.index + finished; ++i) {
 			tc_free_fd(files[i].fd);
@@ -713,6 +1190,426 @@ tc_res nfs4_lgetattrsv(struct tc_attrs *attrs, int count, bool is_transaction)
 	return tcres;
 }
 
+#define NFS4_MAX_SYMLINK_HOPS 40
+
+/*
+ * State of following symlinks from one path.
+ *
+ * When "has_link" is set, "path" is the target of the symlink "link"
+ * according to its (cached) content "content".  The compound operating on
+ * "path" first verifies that "link" still has "fileid", and reads its current
+ * content into "linkbuf".
+ */
+struct nfs4_symlink_walk {
+	char *path;
+	char *link;
+	char *content;
+	char *linkbuf;
+	uint64_t fileid;	/* of "link" */
+	bool has_link;
+	bool from_cache;	/* whether "content" was taken from the cache */
+	int hops;
+};
+
+/*
+ * The key of "path" in the symlink cache: its normalized absolute path, so
+ * that a symlink reached through a relative path, which is resolved against
+ * the TC cwd, or through another spelling of its path shares the entry.
+ */
+static bool nfs4_symlink_key(const char *path, char *key)
+{
+	char *cwd;
+	char *joined;
+	int rc;
+
+	if (path[0] == '/') {
+		return tc_path_normalize(path, key, PATH_MAX) >= 0;
+	}
+	cwd = nfs4_getcwd();
+	if (!cwd) {
+		return false;
+	}
+	joined = alloca(PATH_MAX);
+	rc = tc_path_join(cwd, path, joined, PATH_MAX);
+	free(cwd);
+	return rc >= 0 && tc_path_normalize(joined, key, PATH_MAX) >= 0;
+}
+
+static bool nfs4_get_cached_symlink(const char *link, char *content,
+				    uint64_t *fileid)
+{
+	char *key = alloca(PATH_MAX);
+
+	return nfs4_symlink_key(link, key) &&
+	       tc_symlink_cache_get(key, content, PATH_MAX, fileid);
+}
+
+static void nfs4_cache_symlink(const char *link, const char *content,
+			       uint64_t fileid)
+{
+	char *key = alloca(PATH_MAX);
+
+	if (nfs4_symlink_key(link, key)) {
+		tc_symlink_cache_put(key, content, fileid);
+	}
+}
+
+static void nfs4_uncache_symlink(const char *link)
+{
+	char *key = alloca(PATH_MAX);
+
+	if (nfs4_symlink_key(link, key)) {
+		tc_symlink_cache_remove(key);
+	}
+}
+
+/*
+ * Where symlink "link" with "content" points to.
+ */
+static int nfs4_symlink_target(const char *link, const char *content,
+			       char *target)
+{
+	char *joined;
+	int rc;
+
+	if (content[0] == '/') {
+		return tc_path_normalize(content, target, PATH_MAX);
+	}
+	joined = alloca(PATH_MAX);
+	rc = tc_path_joinall(joined, PATH_MAX, link, "..", content);
+	if (rc < 0) {
+		return rc;
+	}
+	return tc_path_normalize(joined, target, PATH_MAX);
+}
+
+/*
+ * Follow symlink "w->path" whose content is "w->content".
+ */
+static int nfs4_walk_follow(struct nfs4_symlink_walk *w)
+{
+	char *target = alloca(PATH_MAX);
+	int rc;
+
+	if (w->hops >= NFS4_MAX_SYMLINK_HOPS) {
+		return -ELOOP;
+	}
+	rc = nfs4_symlink_target(w->path, w->content, target);
+	if (rc < 0) {
+		return rc;
+	}
+	w->hops++;
+	strcpy(w->link, w->path);
+	strcpy(w->path, target);
+	w->has_link = true;
+	w->from_cache = false;
+	return 0;
+}
+
+/*
+ * Take one hop from the symlink cache, if "w->path" is a known symlink.
+ */
+static bool nfs4_walk_use_cache(struct nfs4_symlink_walk *w)
+{
+	uint64_t fileid;
+
+	if (!nfs4_get_cached_symlink(w->path, w->content, &fileid) ||
+	    nfs4_walk_follow(w) < 0) {
+		return false;
+	}
+	w->fileid = fileid;
+	w->from_cache = true;
+	return true;
+}
+
+/*
+ * Give up the speculation that "w->link" still points to "w->path" after
+ * failing to operate on "w->path" with "err".  The speculation is wrong if
+ * "w->link" has been replaced (its VERIFY fails with EAGAIN), or may be wrong
+ * if "w->path" came from the cache.  Return false if the failure is genuine.
+ */
+static bool nfs4_walk_reset(struct nfs4_symlink_walk *w, int err)
+{
+	if (!w->has_link || (!w->from_cache && err != EAGAIN)) {
+		return false;
+	}
+	nfs4_uncache_symlink(w->link);
+	strcpy(w->path, w->link);
+	w->has_link = false;
+	w->from_cache = false;
+	w->hops--;
+	return true;
+}
+
+/*
+ * Whether the content of "w->link" read by the compound differs from the one
+ * used to get "w->path"; if so, follow the new content.
+ */
+static int nfs4_walk_check_link(struct nfs4_symlink_walk *w, bool *changed)
+{
+	*changed = false;
+	if (!w->has_link || strcmp(w->linkbuf, w->content) == 0) {
+		return 0;
+	}
+	*changed = true;
+	nfs4_cache_symlink(w->link, w->linkbuf, w->fileid);
+	strcpy(w->content, w->linkbuf);
+	w->from_cache = false;
+	return nfs4_symlink_target(w->link, w->content, w->path);
+}
+
+static struct nfs4_symlink_walk *nfs4_new_walks(const char **paths, int count)
+{
+	struct nfs4_symlink_walk *walks;
+	char *bufs;
+	int i;
+
+	walks = calloc(count, sizeof(*walks));
+	bufs = malloc((size_t)count * 4 * PATH_MAX);
+	if (!walks || !bufs) {
+		free(walks);
+		free(bufs);
+		return NULL;
+	}
+
+	for (i = 0; i < count; ++i) {
+		walks[i].path = bufs + (size_t)i * 4 * PATH_MAX;
+		walks[i].link = walks[i].path + PATH_MAX;
+		walks[i].content = walks[i].link + PATH_MAX;
+		walks[i].linkbuf = walks[i].content + PATH_MAX;
+		if (paths[i] == NULL) {
+			continue;
+		}
+		strncpy(walks[i].path, paths[i], PATH_MAX - 1);
+		walks[i].path[PATH_MAX - 1] = '\0';
+		nfs4_walk_use_cache(&walks[i]);
+	}
+
+	return walks;
+}
+
+static void nfs4_free_walks(struct nfs4_symlink_walk *walks)
+{
+	if (walks) {
+		free(walks[0].path);
+		free(walks);
+	}
+}
+
+/*
+ * Read the symlinks walks[idx[k]].path and their fileids, cache them, and
+ * follow them.
+ */
+static tc_res nfs4_walk_readlinks(struct nfs4_symlink_walk *walks, int *idx,
+				  int n)
+{
+	struct gsh_export *exp = op_ctx->export;
+	tc_res tcres = { .index = n, .err_no = 0 };
+	struct nfs4_symlink_walk *w;
+	struct tc_attrs *attrs;
+	const char **links;
+	char **bufs;
+	int finished;
+	int k;
+	int rc;
+
+	attrs = calloc(n, sizeof(*attrs));
+	if (!attrs) {
+		return tc_failure(idx[0], ENOMEM);
+	}
+	links = alloca(n * sizeof(*links));
+	bufs = alloca(n * sizeof(*bufs));
+	for (k = 0; k < n; ++k) {
+		links[k] = walks[idx[k]].path;
+		bufs[k] = walks[idx[k]].content;
+		attrs[k].file = tc_file_from_path(links[k]);
+		attrs[k].masks.has_fileid = true;
+	}
+
+	for (finished = 0; finished < n; finished += tcres.index) {
+		tcres = exp->fsal_export->obj_ops->tc_lgetattrsv_links(
+		    attrs + finished, n - finished, links + finished, NULL,
+		    bufs + finished);
+		if (!tc_okay(tcres)) {
+			tcres.index = idx[finished + tcres.index];
+			goto exit;
+		}
+	}
+
+	for (k = 0; k < n; ++k) {
+		w = &walks[idx[k]];
+		nfs4_cache_symlink(w->path, w->content, attrs[k].fileid);
+		rc = nfs4_walk_follow(w);
+		if (rc < 0) {
+			tcres = tc_failure(idx[k], -rc);
+			goto exit;
+		}
+		w->fileid = attrs[k].fileid;
+	}
+
+exit:
+	free(attrs);
+	return tcres;
+}
+
+/*
+ * Like nfs4_lgetattrsv(), but follow symlinks.
+ *
+ * Known symlinks are replaced by their cached targets, and verified with
+ * READLINK in the same compound, so that getting attributes through a
+ * symlink is a single RPC in the common case.  Symlinks not in the cache are
+ * read and followed in later compounds.
+ */
+tc_res nfs4_getattrsv(struct tc_attrs *attrs, int count, bool is_transaction)
+{
+	struct gsh_export *exp = op_ctx->export;
+	tc_res tcres = { .index = count, .err_no = 0 };
+	struct nfs4_symlink_walk *walks;
+	struct nfs4_symlink_walk *w;
+	struct tc_attrs *todo;
+	const char **paths;
+	const char **links;
+	uint64_t *linkids;
+	char **linkbufs;
+	tc_file *saved_tcfs;
+	int *pending;
+	int *next;
+	int *readlinks;
+	int npending = count;
+	int nnext;
+	int nreadlinks;
+	int ndone;
+	int finished;
+	bool changed;
+	int i;
+	int k;
+	int rc;
+
+	paths = alloca(count * sizeof(*paths));
+	for (i = 0; i < count; ++i) {
+		paths[i] = attrs[i].file.type == TC_FILE_PATH
+			       ? attrs[i].file.path
+			       : NULL;
+	}
+	walks = nfs4_new_walks(paths, count);
+	todo = calloc(count, sizeof(*todo));
+	pending = calloc(3 * count, sizeof(int));
+	links = calloc(count, sizeof(*links));
+	linkids = calloc(count, sizeof(*linkids));
+	linkbufs = calloc(count, sizeof(*linkbufs));
+	if (!walks || !todo || !pending || !links || !linkids || !linkbufs) {
+		tcres = tc_failure(0, ENOMEM);
+		goto exit;
+	}
+	next = pending + count;
+	readlinks = next + count;
+	for (i = 0; i < count; ++i) {
+		pending[i] = i;
+	}
+
+	while (npending > 0) {
+		for (k = 0; k < npending; ++k) {
+			i = pending[k];
+			w = &walks[i];
+			todo[k] = attrs[i];
+			todo[k].masks.has_mode = true;
+			if (paths[i]) {
+				todo[k].file.path = w->path;
+			}
+			links[k] = w->has_link ? w->link : NULL;
+			linkids[k] = w->fileid;
+			linkbufs[k] = w->linkbuf;
+		}
+
+		saved_tcfs = nfs4_process_tc_files(todo, npending);
+		if (!saved_tcfs) {
+			tcres = tc_failure(pending[0], ENOMEM);
+			goto exit;
+		}
+		for (finished = 0; finished < npending;
+		     finished += tcres.index) {
+			tcres = exp->fsal_export->obj_ops->tc_lgetattrsv_links(
+			    todo + finished, npending - finished,
+			    links + finished, linkids + finished,
+			    linkbufs + finished);
+			if (!tc_okay(tcres)) {
+				tcres.index += finished;
+				break;
+			}
+		}
+		nfs4_restore_tc_files(todo, npending, saved_tcfs);
+
+		ndone = tc_okay(tcres) ? npending : tcres.index;
+		if (!tc_okay(tcres) &&
+		    !nfs4_walk_reset(&walks[pending[ndone]], tcres.err_no)) {
+			tcres.index = pending[ndone];
+			goto exit;
+		}
+
+		nnext = 0;
+		nreadlinks = 0;
+		for (k = 0; k < npending; ++k) {
+			i = pending[k];
+			w = &walks[i];
+			if (k > ndone) {
+				next[nnext++] = i;
+				continue;
+			}
+			if (k == ndone) {
+				/* reset above; try again without the cache */
+				next[nnext++] = i;
+				continue;
+			}
+			rc = nfs4_walk_check_link(w, &changed);
+			if (rc < 0) {
+				tcres = tc_failure(i, -rc);
+				goto exit;
+			}
+			if (changed) {
+				next[nnext++] = i;
+			} else if (paths[i] && S_ISLNK(todo[k].mode)) {
+				if (nfs4_walk_use_cache(w)) {
+					next[nnext++] = i;
+				} else {
+					readlinks[nreadlinks++] = i;
+				}
+			} else {
+				todo[k].file = attrs[i].file;
+				todo[k].masks = attrs[i].masks;
+				/* mode was added only to detect symlinks */
+				if (!attrs[i].masks.has_mode) {
+					todo[k].mode = attrs[i].mode;
+				}
+				attrs[i] = todo[k];
+			}
+		}
+
+		if (nreadlinks > 0) {
+			tcres = nfs4_walk_readlinks(walks, readlinks,
+						    nreadlinks);
+			if (!tc_okay(tcres)) {
+				goto exit;
+			}
+			memcpy(next + nnext, readlinks, nreadlinks * sizeof(int));
+			nnext += nreadlinks;
+		}
+
+		memcpy(pending, next, nnext * sizeof(int));
+		npending = nnext;
+	}
+	tcres.index = count;
+	tcres.err_no = 0;
+
+exit:
+	nfs4_free_walks(walks);
+	free(todo);
+	free(pending);
+	free(links);
+	free(linkids);
+	free(linkbufs);
+	return tcres;
+}
+
 tc_res nfs4_lsetattrsv(struct tc_attrs *attrs, int count, bool is_transaction)
 {
 	struct gsh_export *exp = op_ctx->export;
@@ -777,11 +1674,27 @@ tc_res nfs4_listdirv(const char **dirs, int count, struct tc_attrs_masks masks,
 	return res;
 }
 
+/*
+ * Drop "file" from the symlink cache before it is removed or replaced.
+ */
+static void nfs4_forget_symlink(const tc_file *file)
+{
+	if (file->type == TC_FILE_PATH && file->path) {
+		nfs4_uncache_symlink(file->path);
+	}
+}
+
 tc_res nfs4_renamev(tc_file_pair *pairs, int count, bool is_transaction)
 {
 	struct gsh_export *exp = op_ctx->export;
 	tc_res tcres;
 	int finished;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		nfs4_forget_symlink(&pairs[i].src_file);
+		nfs4_forget_symlink(&pairs[i].dst_file);
+	}
 
 	for (finished = 0; finished < count; finished += tcres.index) {
 		tcres = exp->fsal_export->obj_ops->tc_renamev(pairs + finished,
@@ -800,6 +1713,11 @@ tc_res nfs4_removev(tc_file *files, int count, bool is_transaction)
 	struct gsh_export *exp = op_ctx->export;
 	tc_res tcres = { .err_no = 0 };
 	int finished;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		nfs4_forget_symlink(&files[i]);
+	}
 
 	for (finished = 0; finished < count; finished += tcres.index) {
 		tcres = exp->fsal_export->obj_ops->tc_removev(files + finished,
@@ -831,6 +1749,136 @@ tc_res nfs4_lcopyv(struct tc_extent_pair *pairs, int count, bool is_transaction)
 	return tcres;
 }
 
+/*
+ * Like nfs4_lcopyv(), but follow symlinks in source paths in the same way as
+ * nfs4_getattrsv().
+ */
+tc_res nfs4_copyv(struct tc_extent_pair *pairs, int count, bool is_transaction)
+{
+	struct gsh_export *exp = op_ctx->export;
+	tc_res tcres = { .index = count, .err_no = 0 };
+	struct nfs4_symlink_walk *walks;
+	struct nfs4_symlink_walk *w;
+	struct tc_extent_pair *todo;
+	const char **paths;
+	const char **links;
+	uint64_t *linkids;
+	char **linkbufs;
+	int *pending;
+	int *next;
+	int npending = count;
+	int nnext;
+	int ndone;
+	int finished;
+	bool changed;
+	int i;
+	int k;
+	int rc;
+
+	paths = alloca(count * sizeof(*paths));
+	for (i = 0; i < count; ++i) {
+		paths[i] = pairs[i].src_path;
+	}
+	walks = nfs4_new_walks(paths, count);
+	todo = calloc(count, sizeof(*todo));
+	pending = calloc(2 * count, sizeof(int));
+	links = calloc(count, sizeof(*links));
+	linkids = calloc(count, sizeof(*linkids));
+	linkbufs = calloc(count, sizeof(*linkbufs));
+	if (!walks || !todo || !pending || !links || !linkids || !linkbufs) {
+		tcres = tc_failure(0, ENOMEM);
+		goto exit;
+	}
+	next = pending + count;
+	for (i = 0; i < count; ++i) {
+		pending[i] = i;
+	}
+
+	while (npending > 0) {
+		for (k = 0; k < npending; ++k) {
+			i = pending[k];
+			w = &walks[i];
+			todo[k] = pairs[i];
+			todo[k].src_path = w->path;
+			links[k] = w->has_link ? w->link : NULL;
+			linkids[k] = w->fileid;
+			linkbufs[k] = w->linkbuf;
+		}
+
+		for (finished = 0; finished < npending;
+		     finished += tcres.index) {
+			tcres = exp->fsal_export->obj_ops->tc_lcopyv_links(
+			    todo + finished, npending - finished,
+			    links + finished, linkids + finished,
+			    linkbufs + finished);
+			if (!tc_okay(tcres)) {
+				tcres.index += finished;
+				break;
+			}
+		}
+
+		ndone = tc_okay(tcres) ? npending : tcres.index;
+		nnext = 0;
+		for (k = 0; k < npending; ++k) {
+			i = pending[k];
+			w = &walks[i];
+			if (k > ndone) {
+				next[nnext++] = i;
+				continue;
+			}
+			if (k == ndone) {
+				/*
+				 * OPEN fails with ELOOP if the source is a
+				 * symlink; otherwise, try again without the
+				 * speculated target.
+				 */
+				if (tcres.err_no == ELOOP) {
+					if (!nfs4_walk_use_cache(w)) {
+						tcres = nfs4_walk_readlinks(
+						    walks, &i, 1);
+						if (!tc_okay(tcres)) {
+							goto exit;
+						}
+					}
+				} else if (!nfs4_walk_reset(w, tcres.err_no)) {
+					tcres.index = i;
+					goto exit;
+				}
+				next[nnext++] = i;
+				continue;
+			}
+			/*
+			 * The link was VERIFYed before the COPY, so "changed"
+			 * only if its fileid has been reused.
+			 */
+			rc = nfs4_walk_check_link(w, &changed);
+			if (rc < 0) {
+				tcres = tc_failure(i, -rc);
+				goto exit;
+			}
+			if (changed) {
+				next[nnext++] = i;
+			} else {
+				pairs[i].length = todo[k].length;
+			}
+		}
+
+		memcpy(pending, next, nnext * sizeof(int));
+		npending = nnext;
+	}
+	tcres.index = count;
+	tcres.err_no = 0;
+
+exit:
+	nfs4_free_walks(walks);
+	free(todo);
+	free(pending);
+	free(links);
+	free(linkids);
+	free(linkbufs);
+	return tcres;
+}
+
 tc_res nfs4_hardlinkv(const char **oldpaths, const char **newpaths, int count,
 		      bool istxn)
 {
@@ -856,6 +1904,11 @@ tc_res nfs4_symlinkv(const char **oldpaths, const char **newpaths, int count,
 	struct gsh_export *exp = op_ctx->export;
 	tc_res tcres;
 	int finished;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		nfs4_uncache_symlink(newpaths[i]);
+	}
 
 	for (finished = 0; finished < count; finished += tcres.index) {
 		tcres = exp->fsal_export->obj_ops->tc_symlinkv(
@@ -889,6 +1942,213 @@ tc_res nfs4_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
 	return tcres;
 }
 
+tc_res nfs4_read_files(const char **paths, char **bufs, size_t *sizes,
+		       int count, size_t cap)
+{
+	static const size_t CPD_LIMIT = (1 << 20);
+	struct gsh_export *exp = op_ctx->export;
+	struct fsal_export *fexp = op_ctx->fsal_export;
+	struct tc_iovec *iovs;
+	int *large; /* files larger than "cap" */
+	int nlarge = 0;
+	int batch;
+	int finished;
+	int i;
+	char *buf;
+	tc_res tcres = { .index = count, .err_no = 0 };
+
+	cap = MIN(MAX(cap, 1), fexp->ops->fs_maxread(fexp));
+	/* keep the data of a compound within CPD_LIMIT */
+	batch = MAX(CPD_LIMIT / cap, 1);
+
+	iovs = calloc(count, sizeof(*iovs));
+	large = malloc(count * sizeof(*large));
+	for (i = 0; i < count; ++i) {
+		bufs[i] = NULL;
+	}
+	if (!iovs || !large) {
+		tcres = tc_failure(0, ENOMEM);
+		goto exit;
+	}
+	for (i = 0; i < count; ++i) {
+		bufs[i] = malloc(cap);
+		if (!bufs[i]) {
+			tcres = tc_failure(i, ENOMEM);
+			goto exit;
+		}
+		tc_iov2path(&iovs[i], paths[i], 0, cap, bufs[i]);
+	}
+
+	for (finished = 0; finished < count; finished += tcres.index) {
+		tcres = exp->fsal_export->obj_ops->tc_read_files(
+		    iovs + finished, sizes + finished,
+		    MIN(count - finished, batch));
+		if (!tc_okay(tcres)) {
+			tcres.index += finished;
+			goto exit;
+		}
+		if (tcres.index == 0) {
+			/* the file does not fit in a compound */
+			tcres = tc_failure(finished, E2BIG);
+			goto exit;
+		}
+	}
+	tcres.index = count;
+
+	for (i = 0; i < count; ++i) {
+		if (iovs[i].is_eof || sizes[i] <= iovs[i].length) {
+			/* the file may have grown after GETATTR */
+			sizes[i] = iovs[i].length;
+		} else {
+			large[nlarge] = i;
+			tc_iov2path(&iovs[nlarge++], paths[i], iovs[i].length,
+				    sizes[i] - iovs[i].length, NULL);
+		}
+		buf = realloc(bufs[i], MAX(sizes[i], 1));
+		if (!buf) {
+			tcres = tc_failure(i, ENOMEM);
+			goto exit;
+		}
+		bufs[i] = buf;
+	}
+
+	if (nlarge == 0) {
+		goto exit;
+	}
+	for (i = 0; i < nlarge; ++i) {
+		iovs[i].data = bufs[large[i]] + iovs[i].offset;
+	}
+	tcres = nfs4_readv(iovs, nlarge, false);
+	if (!tc_okay(tcres)) {
+		tcres.index = large[tcres.index];
+		goto exit;
+	}
+	for (i = 0; i < nlarge; ++i) {
+		/* the file may have shrunk after GETATTR */
+		sizes[large[i]] = iovs[i].offset + iovs[i].length;
+	}
+	tcres.index = count;
+
+exit:
+	if (!tc_okay(tcres)) {
+		for (i = 0; i < count; ++i) {
+			free(bufs[i]);
+			bufs[i] = NULL;
+		}
+	}
+	free(large);
+	free(iovs);
+	return tcres;
+}
+
+static inline bool nfs4_is_guard_cpd_op(const struct tc_cpd_op *op)
+{
+	return op->type == TC_CPD_VERIFY || op->type == TC_CPD_NVERIFY;
+}
+
+/*
+ * Return the file of "op" if it is a TC_FILE_DESCRIPTOR, or NULL.
+ */
+static tc_file *nfs4_cpd_op_fd_file(struct tc_cpd_op *op)
+{
+	tc_file *tcf;
+
+	switch (op->type) {
+	case TC_CPD_READ:
+	case TC_CPD_WRITE:
+		tcf = &op->iov.file;
+		break;
+	case TC_CPD_GETATTRS:
+	case TC_CPD_SETATTRS:
+	case TC_CPD_VERIFY:
+	case TC_CPD_NVERIFY:
+		tcf = &op->attrs.file;
+		break;
+	default:
+		return NULL;
+	}
+	return tcf->type == TC_FILE_DESCRIPTOR ? tcf : NULL;
+}
+
+/*
+ * Release the fd data of "ops"; cursors are advanced by the executed reads
+ * and writes.
+ */
+static void nfs4_clear_fd_cpd_ops(struct tc_cpd_op *ops, int count)
+{
+	tc_file *tcf;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (!(tcf = nfs4_cpd_op_fd_file(ops + i))) {
+			continue;
+		}
+		if (ops[i].err_no == 0 && tcf == &ops[i].iov.file) {
+			nfs4_clear_fd_iovecs(&ops[i].iov, 1);
+		} else {
+			nfs4_clear_fd_data(tcf);
+		}
+	}
+}
+
+tc_res nfs4_cpdv(struct tc_cpd_op *ops, int count, bool istxn)
+{
+	static const size_t CPD_LIMIT = (1 << 20);
+	struct gsh_export *exp = op_ctx->export;
+	tc_res tcres = { .index = count, .err_no = 0 };
+	tc_file *tcf;
+	size_t bytes;
+	int finished;
+	int n;
+	int i;
+	int r;
+
+	/* deal with TC_FILE_DESCRIPTOR files */
+	for (i = 0; i < count; ++i) {
+		if ((tcf = nfs4_cpd_op_fd_file(ops + i)) &&
+		    (r = nfs4_fill_fd_data(tcf)) != 0) {
+			nfs4_clear_fd_cpd_ops(ops, i);
+			ops[i].err_no = -r;
+			return tc_failure(i, -r);
+		}
+	}
+
+	for (finished = 0; finished < count; finished += tcres.index) {
+		/* keep the data of a compound within CPD_LIMIT */
+		bytes = 0;
+		for (n = 0; finished + n < count; ++n) {
+			if (ops[finished + n].type == TC_CPD_READ ||
+			    ops[finished + n].type == TC_CPD_WRITE) {
+				bytes += ops[finished + n].iov.length;
+				if (n > 0 && bytes > CPD_LIMIT)
+					break;
+			}
+		}
+		/* keep a guard in the compound of the operation it guards */
+		if (finished + n < count && n > 1 &&
+		    nfs4_is_guard_cpd_op(ops + finished + n - 1)) {
+			--n;
+		}
+		tcres = exp->fsal_export->obj_ops->tc_cpdv(ops + finished, n);
+		if (!tc_okay(tcres)) {
+			tcres.index += finished;
+			break;
+		}
+		if (tcres.index == 0) {
+			/* the operation does not fit in a compound */
+			ops[finished].err_no = E2BIG;
+			tcres = tc_failure(finished, E2BIG);
+			break;
+		}
+	}
+	if (tc_okay(tcres)) {
+		tcres.index = count;
+	}
+
+	nfs4_clear_fd_cpd_ops(ops, count);
+	return tcres;
+}
+
 int nfs4_chdir(const char *path)
 {
 	struct gsh_export *exp = op_ctx->export;
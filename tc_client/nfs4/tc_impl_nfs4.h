@@ -37,8 +37,37 @@ extern "C" {
 void *nfs4_init(const char *config_path, const char *log_path,
 		uint16_t exprot_id);
 
+void *nfs4_init_lite(const char *config_path, const char *log_path,
+		     uint16_t export_id);
+
 void nfs4_deinit(void *arg);
 
+void nfs4_enable_tracing(bool enabled);
+
+int nfs4_dump_trace(const char *path);
+
+void nfs4_enable_lazy_close(bool enabled);
+
+int nfs4_set_thread_priority(int prio);
+
+int nfs4_set_priority_limits(int prio, int max_inflight, int weight);
+
+int nfs4_get_priority_stats(int prio, struct tc_sched_stats *stats);
+
+/**
+ * Use relative paths to shorten path lookups.
+ *
+ * Returns the saved tc_files if the iovs has been changed, or NULL if we
+ * cannot compress the paths.
+ */
+tc_file *nfs4_compress_paths(struct tc_iovec *iovs, int count);
+
+/**
+ * Undo nfs4_compress_paths() with the "saved_tcfs" it returned.
+ */
+void nfs4_decompress_paths(struct tc_iovec *iovs, int count,
+			   tc_file *saved_tcfs);
+
 /**
  * @reads - Array of reads for one or more files
  *         Contains file-path, read length, offset, etc.
@@ -86,6 +115,14 @@ void nfs4_close_all();
  */
 tc_res nfs4_lgetattrsv(struct tc_attrs *attrs, int count, bool is_transaction);
 
+/**
+ * Get attributes of files, following symlinks.
+ *
+ * Symlinks are resolved in the same compound when their targets are in the
+ * client-side symlink cache.
+ */
+tc_res nfs4_getattrsv(struct tc_attrs *attrs, int count, bool is_transaction);
+
 /**
  * Set attributes of files.
  *
@@ -121,6 +158,11 @@ tc_res nfs4_listdirv(const char **dirs, int count, struct tc_attrs_masks masks,
 
 tc_res nfs4_lcopyv(struct tc_extent_pair *pairs, int count, bool is_transaction);
 
+/**
+ * Copy files like nfs4_lcopyv(), but follow symlinks in source paths.
+ */
+tc_res nfs4_copyv(struct tc_extent_pair *pairs, int count, bool is_transaction);
+
 tc_res nfs4_hardlinkv(const char **oldpaths, const char **newpaths, int count,
 		      bool istxn);
 
@@ -130,6 +172,43 @@ tc_res nfs4_symlinkv(const char **oldpaths, const char **newpaths, int count,
 tc_res nfs4_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
 		      int count, bool istxn);
 
+tc_res nfs4_read_files(const char **paths, char **bufs, size_t *sizes,
+		       int count, size_t cap);
+
+/**
+ * Execute the operations of a compound; see tc_cpd_execute() in tc_api.h.
+ */
+tc_res nfs4_cpdv(struct tc_cpd_op *ops, int count, bool istxn);
+
+/**
+ * Acquire, release, or test byte-range locks of open files; see tc_lockv()
+ * and friends in tc_api.h.
+ */
+tc_res nfs4_lockv(struct tc_lock *locks, int count, bool istxn);
+
+tc_res nfs4_unlockv(struct tc_lock *locks, int count, bool istxn);
+
+tc_res nfs4_testlockv(struct tc_lock *locks, int count, bool istxn);
+
+/**
+ * Allocate or deallocate extents of files; see tc_fallocatev() and
+ * tc_punchholev() in tc_api.h.
+ */
+tc_res nfs4_fallocatev(struct tc_extent *extents, int count, bool istxn);
+
+tc_res nfs4_punchholev(struct tc_extent *extents, int count, bool istxn);
+
+/**
+ * Get, set, or list extended attributes of files; see tc_getxattrsv() and
+ * friends in tc_api.h.
+ */
+tc_res nfs4_getxattrsv(struct tc_xattr *xattrs, int count, bool istxn);
+
+tc_res nfs4_setxattrsv(struct tc_xattr *xattrs, int count, bool istxn);
+
+tc_res nfs4_listxattrsv(const char **paths, char **bufs, size_t *bufsizes,
+			int count, bool istxn);
+
 int nfs4_chdir(const char *path);
 
 char *nfs4_getcwd();
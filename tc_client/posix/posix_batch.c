@@ -0,0 +1,703 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "posix_batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_IO_URING_DIRECT_FD
+#include <linux/io_uring.h>
+#endif
+
+/*
+ * I/Os of a vector are executed in windows of at most this many; each
+ * path-based I/O occupies one registered file slot for its OPENAT -> READ ->
+ * CLOSE chain, and three SQEs.
+ */
+#define POSIX_BATCH_WINDOW 64
+#define POSIX_URING_ENTRIES (POSIX_BATCH_WINDOW * 4)
+
+#define POSIX_POOL_MAX_THREADS 16
+
+/* Kinds of SQEs; encoded in the low bits of user_data. */
+enum posix_sqe_kind {
+	PSK_OPEN = 0,
+	PSK_RW = 1,
+	PSK_CLOSE = 2,
+	PSK_STATX = 3,
+};
+
+#define PSK_BITS 2
+#define PSK_MASK ((1 << PSK_BITS) - 1)
+
+/*
+ * Per-I/O results collected from completions.
+ */
+struct posix_iov_status {
+	int open_err;
+	int close_err;
+	ssize_t rw_res;
+	bool need_size;
+};
+
+static int cmp_iov_file(const void *a, const void *b)
+{
+	const struct tc_iovec *ia = *(const struct tc_iovec **)a;
+	const struct tc_iovec *ib = *(const struct tc_iovec **)b;
+
+	if (ia->file.type != ib->file.type)
+		return ia->file.type - ib->file.type;
+	if (ia->file.type == TC_FILE_PATH)
+		return strcmp(ia->file.path, ib->file.path);
+	return ia->file.fd - ib->file.fd;
+}
+
+/**
+ * Whether "iovs" can be executed in any order.
+ */
+static bool posix_batchable(struct tc_iovec *iovs, int count, bool is_write)
+{
+	struct tc_iovec **sorted;
+	bool batchable = true;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (iovs[i].file.type == TC_FILE_PATH)
+			continue;
+		if (iovs[i].file.type != TC_FILE_DESCRIPTOR)
+			return false;
+		if (iovs[i].offset == TC_OFFSET_CUR ||
+		    iovs[i].offset == TC_OFFSET_END)
+			return false;
+	}
+
+	if (!is_write)
+		return true;
+
+	/* Keep the last-writer-wins order of writes to the same file. */
+	sorted = malloc(count * sizeof(*sorted));
+	if (!sorted)
+		return false;
+	for (i = 0; i < count; ++i)
+		sorted[i] = iovs + i;
+	qsort(sorted, count, sizeof(*sorted), cmp_iov_file);
+	for (i = 1; i < count && batchable; ++i)
+		batchable = cmp_iov_file(&sorted[i - 1], &sorted[i]) != 0;
+	free(sorted);
+
+	return batchable;
+}
+
+static int posix_write_flags(const struct tc_iovec *iov)
+{
+	int flags = O_WRONLY;
+
+	if (iov->is_creation)
+		flags |= O_CREAT;
+	if (iov->offset == TC_OFFSET_END)
+		flags |= O_APPEND;
+	if (iov->is_write_stable)
+		flags |= O_SYNC;
+
+	return flags;
+}
+
+/*
+ * Offset of a path-based I/O on the freshly opened file.  Appends are
+ * positioned by O_APPEND.
+ */
+static off_t posix_path_offset(const struct tc_iovec *iov)
+{
+	if (iov->offset == TC_OFFSET_CUR || iov->offset == TC_OFFSET_END)
+		return 0;
+	return iov->offset;
+}
+
+/*
+ * Turn collected statuses into the result of the vector and the lengths (and
+ * EOF flags) of the iovecs.  "sizes" are only valid where need_size is set.
+ */
+static tc_res posix_batch_result(struct tc_iovec *iovs, int count,
+				 struct posix_iov_status *st,
+				 const off_t *sizes, bool is_write)
+{
+	tc_res tcres = { .index = -1, .err_no = 0 };
+	struct tc_iovec *iov;
+	int err;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		iov = iovs + i;
+		err = st[i].open_err;
+		if (err == 0 && st[i].rw_res < 0)
+			err = (int)st[i].rw_res;
+		if (err == 0)
+			err = st[i].close_err;
+		if (err != 0) {
+			if (tc_okay(tcres))
+				tcres = tc_failure(i, -err);
+			continue;
+		}
+		iov->length = st[i].rw_res;
+		if (is_write)
+			continue;
+		if (st[i].need_size) {
+			iov->is_eof =
+			    posix_path_offset(iov) + iov->length == sizes[i];
+		} else {
+			iov->is_eof = true;
+		}
+	}
+
+	return tcres;
+}
+
+/*
+ * A short, non-empty read stops at the end of the file; otherwise we need
+ * the file size to tell whether the read reached EOF.
+ */
+static bool posix_need_size(const struct tc_iovec *iov, ssize_t res)
+{
+	return !(res > 0 && (size_t)res < iov->length);
+}
+
+#ifdef HAVE_IO_URING_DIRECT_FD
+
+struct posix_uring {
+	int ring_fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *ring_ptr;
+	size_t ring_sz;
+	size_t sqes_sz;
+	unsigned pending;	/* SQEs queued but not yet submitted */
+};
+
+static bool uring_unavailable = false;
+static pthread_key_t uring_key;
+static pthread_once_t uring_key_once = PTHREAD_ONCE_INIT;
+static __thread struct posix_uring *tls_ring = NULL;
+
+static void posix_uring_destroy(struct posix_uring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_sz);
+	if (ring->ring_ptr)
+		munmap(ring->ring_ptr, ring->ring_sz);
+	close(ring->ring_fd);
+	free(ring);
+}
+
+static void posix_uring_key_destructor(void *arg)
+{
+	posix_uring_destroy((struct posix_uring *)arg);
+}
+
+static void posix_uring_make_key(void)
+{
+	pthread_key_create(&uring_key, posix_uring_key_destructor);
+}
+
+static bool posix_uring_probe(int ring_fd)
+{
+	static const int needed_ops[] = {
+		IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE,
+		IORING_OP_CLOSE, IORING_OP_STATX,
+	};
+	struct io_uring_probe *probe;
+	size_t sz = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	bool ok = true;
+	int i;
+
+	probe = calloc(1, sz);
+	if (!probe)
+		return false;
+	if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE,
+		    probe, 256) < 0) {
+		free(probe);
+		return false;
+	}
+	for (i = 0; i < sizeof(needed_ops) / sizeof(needed_ops[0]); ++i) {
+		if (needed_ops[i] > probe->last_op ||
+		    !(probe->ops[needed_ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+			ok = false;
+			break;
+		}
+	}
+	free(probe);
+	return ok;
+}
+
+static struct posix_uring *posix_uring_create(void)
+{
+	struct io_uring_params p;
+	struct posix_uring *ring;
+	int files[POSIX_BATCH_WINDOW];
+	char *ptr;
+	int i;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	ring->ring_fd = syscall(__NR_io_uring_setup, POSIX_URING_ENTRIES, &p);
+	if (ring->ring_fd < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	/*
+	 * Direct descriptors of OPENAT/CLOSE need 5.15; IORING_FEAT_CQE_SKIP
+	 * (5.17) is the closest feature bit implying them.
+	 */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !(p.features & IORING_FEAT_CQE_SKIP) ||
+	    !posix_uring_probe(ring->ring_fd)) {
+		goto err;
+	}
+
+	ring->ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	if (ring->ring_sz < p.cq_off.cqes +
+				p.cq_entries * sizeof(struct io_uring_cqe)) {
+		ring->ring_sz =
+		    p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	}
+	ring->ring_ptr = mmap(NULL, ring->ring_sz, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+			      IORING_OFF_SQ_RING);
+	if (ring->ring_ptr == MAP_FAILED) {
+		ring->ring_ptr = NULL;
+		goto err;
+	}
+	ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto err;
+	}
+
+	ptr = ring->ring_ptr;
+	ring->sq_head = (unsigned *)(ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned *)(ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)(ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(ptr + p.sq_off.array);
+	ring->cq_head = (unsigned *)(ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *)(ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)(ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(ptr + p.cq_off.cqes);
+
+	/* A sparse table of direct descriptors, one slot per chain. */
+	for (i = 0; i < POSIX_BATCH_WINDOW; ++i)
+		files[i] = -1;
+	if (syscall(__NR_io_uring_register, ring->ring_fd,
+		    IORING_REGISTER_FILES, files, POSIX_BATCH_WINDOW) < 0) {
+		goto err;
+	}
+
+	return ring;
+
+err:
+	posix_uring_destroy(ring);
+	return NULL;
+}
+
+static struct posix_uring *posix_uring_get(void)
+{
+	if (tls_ring || uring_unavailable)
+		return tls_ring;
+
+	pthread_once(&uring_key_once, posix_uring_make_key);
+	tls_ring = posix_uring_create();
+	if (!tls_ring) {
+		uring_unavailable = true;
+		return NULL;
+	}
+	pthread_setspecific(uring_key, tls_ring);
+
+	return tls_ring;
+}
+
+static struct io_uring_sqe *posix_uring_sqe(struct posix_uring *ring,
+					    int op, int idx,
+					    enum posix_sqe_kind kind)
+{
+	unsigned tail = *ring->sq_tail + ring->pending;
+	unsigned i = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[i];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->user_data = ((__u64)idx << PSK_BITS) | kind;
+	ring->sq_array[i] = i;
+	ring->pending++;
+
+	return sqe;
+}
+
+/*
+ * Submit all queued SQEs and reap exactly as many CQEs.
+ */
+static int posix_uring_run(struct posix_uring *ring,
+			   struct posix_iov_status *st)
+{
+	unsigned nsqes = ring->pending;
+	unsigned to_submit = nsqes;
+	unsigned reaped = 0;
+	unsigned head;
+	struct io_uring_cqe *cqe;
+	int idx;
+	int rc;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + nsqes,
+			 __ATOMIC_RELEASE);
+	ring->pending = 0;
+
+	while (reaped < nsqes) {
+		rc = syscall(__NR_io_uring_enter, ring->ring_fd, to_submit,
+			     nsqes - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rc < 0 && errno != EINTR)
+			return -errno;
+		if (rc > 0)
+			to_submit -= rc < to_submit ? rc : to_submit;
+
+		head = *ring->cq_head;
+		while (head != __atomic_load_n(ring->cq_tail,
+					       __ATOMIC_ACQUIRE)) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			idx = cqe->user_data >> PSK_BITS;
+			switch (cqe->user_data & PSK_MASK) {
+			case PSK_OPEN:
+				st[idx].open_err = cqe->res < 0 ? cqe->res : 0;
+				break;
+			case PSK_RW:
+				st[idx].rw_res = cqe->res;
+				break;
+			case PSK_CLOSE:
+				/* the CLOSE is cancelled if OPEN failed */
+				if (cqe->res < 0 && cqe->res != -ECANCELED)
+					st[idx].close_err = cqe->res;
+				break;
+			case PSK_STATX:
+				if (cqe->res < 0)
+					st[idx].rw_res = cqe->res;
+				break;
+			}
+			++head;
+			++reaped;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+/*
+ * Queue the SQEs of one I/O; "slot" is the direct descriptor used by
+ * path-based I/Os.
+ */
+static void posix_uring_queue_iov(struct posix_uring *ring,
+				  struct tc_iovec *iov, int idx, int slot,
+				  bool is_write)
+{
+	struct io_uring_sqe *sqe;
+	bool has_rw = !is_write || iov->length > 0;
+	int op = is_write ? IORING_OP_WRITE : IORING_OP_READ;
+
+	if (iov->file.type == TC_FILE_DESCRIPTOR) {
+		if (!has_rw)
+			return;
+		sqe = posix_uring_sqe(ring, op, idx, PSK_RW);
+		sqe->fd = iov->file.fd;
+		sqe->addr = (unsigned long)iov->data;
+		sqe->len = iov->length;
+		sqe->off = iov->offset;
+		return;
+	}
+
+	sqe = posix_uring_sqe(ring, IORING_OP_OPENAT, idx, PSK_OPEN);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)iov->file.path;
+	sqe->open_flags = is_write ? posix_write_flags(iov) : O_RDONLY;
+	sqe->len = 0666;
+	sqe->file_index = slot + 1;
+	sqe->flags = IOSQE_IO_LINK;
+
+	if (has_rw) {
+		sqe = posix_uring_sqe(ring, op, idx, PSK_RW);
+		sqe->fd = slot;
+		sqe->addr = (unsigned long)iov->data;
+		sqe->len = iov->length;
+		sqe->off = posix_path_offset(iov);
+		/* A short read breaks a normal link; close the file anyway. */
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	}
+
+	sqe = posix_uring_sqe(ring, IORING_OP_CLOSE, idx, PSK_CLOSE);
+	sqe->file_index = slot + 1;
+}
+
+static bool posix_uring_iov(struct tc_iovec *iovs, int count, bool is_write,
+			    tc_res *res)
+{
+	struct posix_uring *ring = posix_uring_get();
+	struct posix_iov_status *st;
+	struct io_uring_sqe *sqe;
+	struct statx *stx;
+	off_t *sizes;
+	struct stat fst;
+	struct tc_iovec *iov;
+	int start;
+	int end;
+	int i;
+	int rc = 0;
+
+	if (!ring)
+		return false;
+
+	st = calloc(count, sizeof(*st));
+	sizes = is_write ? NULL : calloc(count, sizeof(*sizes));
+	stx = is_write ? NULL : calloc(POSIX_BATCH_WINDOW, sizeof(*stx));
+	if (!st || (!is_write && (!sizes || !stx))) {
+		free(st);
+		free(sizes);
+		free(stx);
+		return false;
+	}
+
+	for (start = 0; start < count && rc == 0; start = end) {
+		end = start + POSIX_BATCH_WINDOW;
+		if (end > count)
+			end = count;
+		for (i = start; i < end; ++i)
+			posix_uring_queue_iov(ring, iovs + i, i, i - start,
+					      is_write);
+		rc = posix_uring_run(ring, st);
+		if (rc != 0 || is_write)
+			continue;
+
+		/* Only stat files whose EOF cannot be told from the read. */
+		for (i = start; i < end; ++i) {
+			iov = iovs + i;
+			if (st[i].open_err || st[i].rw_res < 0 ||
+			    !posix_need_size(iov, st[i].rw_res))
+				continue;
+			st[i].need_size = true;
+			if (iov->file.type == TC_FILE_DESCRIPTOR) {
+				if (fstat(iov->file.fd, &fst) < 0)
+					st[i].rw_res = -errno;
+				else
+					sizes[i] = fst.st_size;
+				continue;
+			}
+			sqe = posix_uring_sqe(ring, IORING_OP_STATX, i,
+					      PSK_STATX);
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (unsigned long)iov->file.path;
+			sqe->len = STATX_SIZE;
+			sqe->off = (unsigned long)&stx[i - start];
+		}
+		if (ring->pending > 0)
+			rc = posix_uring_run(ring, st);
+		for (i = start; i < end && rc == 0; ++i) {
+			if (st[i].need_size &&
+			    iovs[i].file.type == TC_FILE_PATH &&
+			    st[i].rw_res >= 0)
+				sizes[i] = stx[i - start].stx_size;
+		}
+	}
+
+	if (rc == 0) {
+		*res = posix_batch_result(iovs, count, st, sizes, is_write);
+	} else {
+		*res = tc_failure(0, -rc);
+	}
+
+	free(st);
+	free(sizes);
+	free(stx);
+	return true;
+}
+
+#else
+
+static bool posix_uring_iov(struct tc_iovec *iovs, int count, bool is_write,
+			    tc_res *res)
+{
+	return false;
+}
+
+#endif  // HAVE_IO_URING_DIRECT_FD
+
+/*
+ * Thread-pool fallback: workers and the calling thread grab I/Os of the
+ * current job until all of them are done.
+ */
+struct posix_pool_job {
+	struct tc_iovec *iovs;
+	int count;
+	posix_iov_fn fn;
+	int *errs;
+	int next;
+	int done;
+	int active;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_mutex_t submit_lock;
+	struct posix_pool_job *job;
+	int nthreads;
+} posix_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.submit_lock = PTHREAD_MUTEX_INITIALIZER,
+	.job = NULL,
+	.nthreads = 0,
+};
+
+static pthread_once_t posix_pool_once = PTHREAD_ONCE_INIT;
+
+static void posix_pool_run(struct posix_pool_job *job)
+{
+	int i;
+
+	while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+		job->errs[i] = job->fn(job->iovs + i);
+		__sync_fetch_and_add(&job->done, 1);
+	}
+}
+
+static void *posix_pool_worker(void *arg)
+{
+	struct posix_pool_job *job;
+
+	pthread_mutex_lock(&posix_pool.lock);
+	for (;;) {
+		job = posix_pool.job;
+		if (!job || job->next >= job->count) {
+			pthread_cond_wait(&posix_pool.work, &posix_pool.lock);
+			continue;
+		}
+		job->active++;
+		pthread_mutex_unlock(&posix_pool.lock);
+
+		posix_pool_run(job);
+
+		pthread_mutex_lock(&posix_pool.lock);
+		if (--job->active == 0)
+			pthread_cond_broadcast(&posix_pool.done);
+	}
+	pthread_mutex_unlock(&posix_pool.lock);
+
+	return NULL;
+}
+
+static void posix_pool_start(void)
+{
+	pthread_attr_t attr;
+	pthread_t tid;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	if (ncpus > POSIX_POOL_MAX_THREADS)
+		ncpus = POSIX_POOL_MAX_THREADS;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0; i < ncpus - 1; ++i) {
+		if (pthread_create(&tid, &attr, posix_pool_worker, NULL) != 0)
+			break;
+		posix_pool.nthreads++;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+static bool posix_pool_iov(struct tc_iovec *iovs, int count, posix_iov_fn fn,
+			   tc_res *res)
+{
+	struct posix_pool_job job = {
+		.iovs = iovs, .count = count, .fn = fn,
+	};
+	int i;
+
+	pthread_once(&posix_pool_once, posix_pool_start);
+	if (posix_pool.nthreads == 0)
+		return false;
+
+	job.errs = calloc(count, sizeof(int));
+	if (!job.errs)
+		return false;
+
+	pthread_mutex_lock(&posix_pool.submit_lock);
+	pthread_mutex_lock(&posix_pool.lock);
+	posix_pool.job = &job;
+	pthread_cond_broadcast(&posix_pool.work);
+	pthread_mutex_unlock(&posix_pool.lock);
+
+	posix_pool_run(&job);
+
+	pthread_mutex_lock(&posix_pool.lock);
+	while (job.done < job.count || job.active > 0)
+		pthread_cond_wait(&posix_pool.done, &posix_pool.lock);
+	posix_pool.job = NULL;
+	pthread_mutex_unlock(&posix_pool.lock);
+	pthread_mutex_unlock(&posix_pool.submit_lock);
+
+	res->index = -1;
+	res->err_no = 0;
+	for (i = 0; i < count; ++i) {
+		if (job.errs[i] != 0) {
+			*res = tc_failure(i, -job.errs[i]);
+			break;
+		}
+	}
+	free(job.errs);
+
+	return true;
+}
+
+bool posix_batch_iov(struct tc_iovec *iovs, int count, bool is_write,
+		     posix_iov_fn fn, tc_res *res)
+{
+	if (count < 2 || !posix_batchable(iovs, count, is_write))
+		return false;
+
+	return posix_uring_iov(iovs, count, is_write, res) ||
+	       posix_pool_iov(iovs, count, fn, res);
+}
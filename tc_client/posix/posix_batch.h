@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Batched execution of POSIX reads and writes.
+ *
+ * A vector of tc_iovec is executed concurrently instead of one syscall after
+ * another.  When the kernel supports it, each path-based I/O becomes a linked
+ * OPENAT -> READ/WRITE -> CLOSE chain on a per-thread io_uring, using direct
+ * (registered) descriptors so that the chain needs no round trip to user
+ * space.  Without io_uring, the same vector is spread over a small pool of
+ * worker threads.
+ */
+#ifndef __TC_POSIX_BATCH_H__
+#define __TC_POSIX_BATCH_H__
+
+#include <stdbool.h>
+#include "tc_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Execute a single read or write; return 0 on success or -errno.
+ */
+typedef int (*posix_iov_fn)(struct tc_iovec *iov);
+
+/**
+ * Execute "iovs" out of order.
+ *
+ * @iovs: reads or writes, in the same format as posix_readv/posix_writev
+ * @count: number of elements in "iovs"
+ * @is_write: whether "iovs" are writes
+ * @fn: single-item executor used by the thread-pool fallback
+ * @res: set to the result of the whole vector; the index of a failure is the
+ * smallest failed index, but unlike the sequential loop, I/Os after the
+ * failed one may still have been executed.
+ *
+ * Return false (without executing anything) when the vector depends on the
+ * order of execution, e.g., I/Os relative to the current offset of a file
+ * descriptor or multiple writes to the same file.  The caller should then
+ * execute it sequentially.
+ */
+bool posix_batch_iov(struct tc_iovec *iovs, int count, bool is_write,
+		     posix_iov_fn fn, tc_res *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __TC_POSIX_BATCH_H__
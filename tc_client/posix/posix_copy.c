@@ -0,0 +1,307 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "posix_copy.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "splice_copy.h"
+
+/* Extents at least this large are copied by several threads. */
+#define POSIX_COPY_PARALLEL_MIN (64ULL << 20)
+#define POSIX_COPY_CHUNK_MIN (16ULL << 20)
+#define POSIX_COPY_MAX_THREADS 8
+/* Size of the first copy_file_range(), which tells whether it works. */
+#define POSIX_COPY_PROBE_SIZE (1ULL << 20)
+
+const char *posix_copy_method_name(enum posix_copy_method method)
+{
+	switch (method) {
+	case POSIX_COPY_CLONE:
+		return "clone";
+	case POSIX_COPY_RANGE:
+		return "copy_file_range";
+	case POSIX_COPY_SPLICE:
+		return "splice";
+	default:
+		return "none";
+	}
+}
+
+/*
+ * Errors meaning that a method does not apply to these files, as opposed to
+ * a real I/O failure.
+ */
+static bool posix_copy_unsupported(int err)
+{
+	return err == EOPNOTSUPP || err == ENOTTY || err == EXDEV ||
+	       err == EINVAL || err == ENOSYS || err == ETXTBSY ||
+	       err == EBADF;
+}
+
+/*
+ * Return 0 on success, or -errno.
+ */
+static int posix_clone(int srcfd, size_t src_offset, int dstfd,
+		       size_t dst_offset, size_t count, size_t src_size)
+{
+	struct file_clone_range fcr;
+	struct stat st;
+
+	/* A whole-file clone replaces the destination, so it must be empty. */
+	if (src_offset == 0 && dst_offset == 0 && count == src_size &&
+	    fstat(dstfd, &st) == 0 && st.st_size == 0) {
+		if (ioctl(dstfd, FICLONE, srcfd) == 0)
+			return 0;
+		return -errno;
+	}
+
+	fcr.src_fd = srcfd;
+	fcr.src_offset = src_offset;
+	fcr.src_length = count;
+	fcr.dest_offset = dst_offset;
+	if (ioctl(dstfd, FICLONERANGE, &fcr) == 0)
+		return 0;
+	return -errno;
+}
+
+/*
+ * Copy with copy_file_range() until "count" bytes are copied or the source
+ * ends; return the number of bytes copied, or -errno if nothing was.
+ */
+static ssize_t posix_copy_range(int srcfd, loff_t src_offset, int dstfd,
+				loff_t dst_offset, size_t count)
+{
+	size_t copied = 0;
+	ssize_t n;
+
+	while (copied < count) {
+		n = copy_file_range(srcfd, &src_offset, dstfd, &dst_offset,
+				    count - copied, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return copied > 0 ? (ssize_t)copied : -errno;
+		}
+		if (n == 0)
+			break;
+		copied += n;
+	}
+
+	return copied;
+}
+
+struct posix_copy_chunk {
+	int srcfd;
+	int dstfd;
+	loff_t src_offset;
+	loff_t dst_offset;
+	size_t count;
+	ssize_t copied;
+};
+
+static void *posix_copy_chunk_main(void *arg)
+{
+	struct posix_copy_chunk *chunk = arg;
+
+	chunk->copied = posix_copy_range(chunk->srcfd, chunk->src_offset,
+					 chunk->dstfd, chunk->dst_offset,
+					 chunk->count);
+	return NULL;
+}
+
+/*
+ * Copy a large extent with one copy_file_range() stream per chunk.  Return
+ * the number of bytes copied, or -errno.
+ */
+static ssize_t posix_copy_range_parallel(int srcfd, size_t src_offset,
+					 int dstfd, size_t dst_offset,
+					 size_t count)
+{
+	struct posix_copy_chunk chunks[POSIX_COPY_MAX_THREADS];
+	pthread_t tids[POSIX_COPY_MAX_THREADS];
+	bool started[POSIX_COPY_MAX_THREADS] = { false };
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t chunk_size;
+	ssize_t copied = 0;
+	int nchunks;
+	int i;
+
+	if (nthreads > POSIX_COPY_MAX_THREADS)
+		nthreads = POSIX_COPY_MAX_THREADS;
+	if (nthreads < 1)
+		nthreads = 1;
+	chunk_size = (count + nthreads - 1) / nthreads;
+	if (chunk_size < POSIX_COPY_CHUNK_MIN)
+		chunk_size = POSIX_COPY_CHUNK_MIN;
+	chunk_size = (chunk_size + (1 << 20) - 1) & ~((size_t)(1 << 20) - 1);
+	nchunks = (count + chunk_size - 1) / chunk_size;
+
+	for (i = 0; i < nchunks; ++i) {
+		chunks[i].srcfd = srcfd;
+		chunks[i].dstfd = dstfd;
+		chunks[i].src_offset = src_offset + i * chunk_size;
+		chunks[i].dst_offset = dst_offset + i * chunk_size;
+		chunks[i].count = i == nchunks - 1
+				      ? count - i * chunk_size
+				      : chunk_size;
+		/* The calling thread copies the first chunk. */
+		if (i > 0 && pthread_create(&tids[i], NULL,
+					    posix_copy_chunk_main,
+					    &chunks[i]) == 0) {
+			started[i] = true;
+		}
+	}
+
+	for (i = 0; i < nchunks; ++i) {
+		if (started[i])
+			pthread_join(tids[i], NULL);
+		else
+			posix_copy_chunk_main(&chunks[i]);
+	}
+
+	for (i = 0; i < nchunks; ++i) {
+		if (chunks[i].copied < 0)
+			return chunks[i].copied;
+		copied += chunks[i].copied;
+		if (chunks[i].copied < chunks[i].count)
+			break;
+	}
+
+	return copied;
+}
+
+ssize_t posix_copy_fd(int srcfd, size_t src_offset, int dstfd,
+		      size_t dst_offset, size_t count, int allowed,
+		      enum posix_copy_method *method)
+{
+	struct stat st;
+	ssize_t copied = 0;
+	ssize_t n;
+	int rc;
+
+	*method = POSIX_COPY_NONE;
+	if (fstat(srcfd, &st) < 0)
+		return -errno;
+	if (src_offset >= st.st_size)
+		return 0;
+	/* Also covers count == UINT64_MAX, i.e., "up to the end". */
+	if (count > st.st_size - src_offset)
+		count = st.st_size - src_offset;
+
+	if (allowed & POSIX_COPY_CLONE) {
+		rc = posix_clone(srcfd, src_offset, dstfd, dst_offset, count,
+				 st.st_size);
+		if (rc == 0) {
+			*method = POSIX_COPY_CLONE;
+			return count;
+		}
+		if (!posix_copy_unsupported(-rc))
+			return rc;
+	}
+
+	if (allowed & POSIX_COPY_RANGE) {
+		n = posix_copy_range(srcfd, src_offset, dstfd, dst_offset,
+				     count < POSIX_COPY_PROBE_SIZE
+					 ? count
+					 : POSIX_COPY_PROBE_SIZE);
+		if (n > 0) {
+			copied = n;
+			if (count - copied >= POSIX_COPY_PARALLEL_MIN) {
+				n = posix_copy_range_parallel(
+				    srcfd, src_offset + copied, dstfd,
+				    dst_offset + copied, count - copied);
+			} else if (copied < count) {
+				n = posix_copy_range(
+				    srcfd, src_offset + copied, dstfd,
+				    dst_offset + copied, count - copied);
+			} else {
+				n = 0;
+			}
+			if (n < 0 && !posix_copy_unsupported(-n))
+				return n;
+			if (n > 0)
+				copied += n;
+			*method = POSIX_COPY_RANGE;
+			if (copied == count)
+				return copied;
+		} else if (n < 0 && !posix_copy_unsupported(-n)) {
+			return n;
+		}
+	}
+
+	if (!(allowed & POSIX_COPY_SPLICE))
+		return copied > 0 ? copied : -EOPNOTSUPP;
+
+	n = splice_fcopy(srcfd, src_offset + copied, dstfd,
+			 dst_offset + copied, count - copied);
+	if (n < 0)
+		return n;
+	*method = POSIX_COPY_SPLICE;
+	return copied + n;
+}
+
+tc_res posix_copy_pairs(struct tc_extent_pair *pairs, int count, int allowed,
+			enum posix_copy_method *methods)
+{
+	enum posix_copy_method method;
+	tc_res tcres = { .index = -1, .err_no = 0 };
+	ssize_t ret;
+	int srcfd;
+	int dstfd;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		srcfd = open(pairs[i].src_path, O_RDONLY);
+		if (srcfd < 0) {
+			tcres = tc_failure(i, errno);
+			break;
+		}
+		dstfd = open(pairs[i].dst_path, O_WRONLY | O_CREAT, 0755);
+		if (dstfd < 0) {
+			tcres = tc_failure(i, errno);
+			close(srcfd);
+			break;
+		}
+
+		ret = posix_copy_fd(srcfd, pairs[i].src_offset, dstfd,
+				    pairs[i].dst_offset, pairs[i].length,
+				    allowed, &method);
+		close(dstfd);
+		close(srcfd);
+		if (methods) {
+			methods[i] = method;
+		}
+		if (ret < 0) {
+			tcres = tc_failure(i, -ret);
+			break;
+		}
+		pairs[i].length = ret;
+	}
+
+	return tcres;
+}
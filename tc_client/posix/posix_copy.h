@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Local file copy of the POSIX backend.
+ *
+ * Each extent is copied with the cheapest method the file systems support:
+ * reflink (FICLONE/FICLONERANGE), then in-kernel copy_file_range() (split
+ * into parallel chunks for large extents), and finally splice through a pipe.
+ */
+#ifndef __TC_POSIX_COPY_H__
+#define __TC_POSIX_COPY_H__
+
+#include <sys/types.h>
+#include "tc_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum posix_copy_method {
+	POSIX_COPY_NONE = 0,
+	POSIX_COPY_CLONE = 1,
+	POSIX_COPY_RANGE = 2,
+	POSIX_COPY_SPLICE = 4,
+};
+
+#define POSIX_COPY_ANY                                                         \
+	(POSIX_COPY_CLONE | POSIX_COPY_RANGE | POSIX_COPY_SPLICE)
+
+const char *posix_copy_method_name(enum posix_copy_method method);
+
+/**
+ * Copy an extent between two open files.
+ *
+ * @allowed: bitwise OR of the methods that may be tried
+ * @method: set to the method that finished the copy; a copy_file_range()
+ * interrupted by an unsupported case and finished by splice counts as splice
+ *
+ * Return the number of bytes copied or -errno.
+ */
+ssize_t posix_copy_fd(int srcfd, size_t src_offset, int dstfd,
+		      size_t dst_offset, size_t count, int allowed,
+		      enum posix_copy_method *method);
+
+/**
+ * Copy "pairs" like posix_lcopyv().
+ *
+ * @allowed: bitwise OR of the methods that may be tried
+ * @methods: if not NULL, an array of "count" elements set to the method used
+ * for each pair
+ */
+tc_res posix_copy_pairs(struct tc_extent_pair *pairs, int count, int allowed,
+			enum posix_copy_method *methods);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __TC_POSIX_COPY_H__
@@ -0,0 +1,518 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "posix_walk.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+#include "path_utils.h"
+
+#define WALK_MAX_THREADS 16
+#define WALK_DENTS_BUFSIZE (256 * 1024)
+
+struct linux_dirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct walk_dir {
+	char *path;
+	int origin_index;
+	bool own_path;
+};
+
+/*
+ * A deque of directories to list.  The owner pushes and pops at the tail;
+ * thieves take from the head, i.e., the oldest and likely largest subtrees.
+ */
+struct walk_deque {
+	pthread_mutex_t lock;
+	struct walk_dir *dirs;
+	int capacity;
+	int head;
+	int size;
+};
+
+struct walk_state {
+	struct tc_attrs_masks masks;
+	bool recursive;
+	bool need_stat;
+	unsigned int statx_mask;
+	tc_listdirv_cb cb;
+	void *cbarg;
+
+	pthread_mutex_t lock;	/* protects everything below, and "cb" */
+	pthread_cond_t idle;
+	int limit;		/* -1 means no limit */
+	int pending;		/* directories queued or being listed */
+	unsigned int posted;	/* bumped on every successful enqueue */
+	bool stop;
+	tc_res tcres;
+
+	int nworkers;
+	struct walk_deque *deques;
+};
+
+struct walk_worker {
+	struct walk_state *ws;
+	int id;
+	char *dents;
+	char path[PATH_MAX];
+};
+
+static bool walk_push(struct walk_deque *dq, struct walk_dir *wd)
+{
+	struct walk_dir *dirs;
+	int newcap;
+	int i;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->size == dq->capacity) {
+		newcap = dq->capacity ? dq->capacity * 2 : 64;
+		dirs = malloc(newcap * sizeof(*dirs));
+		if (!dirs) {
+			pthread_mutex_unlock(&dq->lock);
+			return false;
+		}
+		for (i = 0; i < dq->size; ++i)
+			dirs[i] = dq->dirs[(dq->head + i) % dq->capacity];
+		free(dq->dirs);
+		dq->dirs = dirs;
+		dq->capacity = newcap;
+		dq->head = 0;
+	}
+	dq->dirs[(dq->head + dq->size) % dq->capacity] = *wd;
+	dq->size++;
+	pthread_mutex_unlock(&dq->lock);
+
+	return true;
+}
+
+static bool walk_pop(struct walk_deque *dq, struct walk_dir *wd, bool steal)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->size > 0) {
+		if (steal) {
+			*wd = dq->dirs[dq->head];
+			dq->head = (dq->head + 1) % dq->capacity;
+		} else {
+			*wd = dq->dirs[(dq->head + dq->size - 1) %
+				       dq->capacity];
+		}
+		dq->size--;
+		found = true;
+	}
+	pthread_mutex_unlock(&dq->lock);
+
+	return found;
+}
+
+static void walk_fail(struct walk_state *ws, int index, int err)
+{
+	pthread_mutex_lock(&ws->lock);
+	if (tc_okay(ws->tcres))
+		ws->tcres = tc_failure(index, err);
+	ws->stop = true;
+	pthread_cond_broadcast(&ws->idle);
+	pthread_mutex_unlock(&ws->lock);
+}
+
+static bool walk_enqueue(struct walk_worker *ww, char *path, int index,
+			 bool own_path)
+{
+	struct walk_state *ws = ww->ws;
+	struct walk_dir wd = {
+		.path = path, .origin_index = index, .own_path = own_path,
+	};
+
+	pthread_mutex_lock(&ws->lock);
+	ws->pending++;
+	pthread_mutex_unlock(&ws->lock);
+
+	if (!walk_push(&ws->deques[ww->id], &wd)) {
+		pthread_mutex_lock(&ws->lock);
+		ws->pending--;
+		pthread_mutex_unlock(&ws->lock);
+		return false;
+	}
+
+	/*
+	 * Always signal under the lock: a worker that found every deque empty
+	 * may not be waiting yet, and it compares "posted" before waiting so
+	 * this push cannot be missed.
+	 */
+	pthread_mutex_lock(&ws->lock);
+	ws->posted++;
+	pthread_cond_signal(&ws->idle);
+	pthread_mutex_unlock(&ws->lock);
+
+	return true;
+}
+
+static unsigned int walk_statx_mask(struct tc_attrs_masks masks, bool recursive)
+{
+	unsigned int mask = 0;
+
+	if (masks.has_mode)
+		mask |= STATX_TYPE | STATX_MODE;
+	if (masks.has_size)
+		mask |= STATX_SIZE;
+	if (masks.has_nlink)
+		mask |= STATX_NLINK;
+	if (masks.has_fileid)
+		mask |= STATX_INO;
+	if (masks.has_uid)
+		mask |= STATX_UID;
+	if (masks.has_gid)
+		mask |= STATX_GID;
+	if (masks.has_blocks)
+		mask |= STATX_BLOCKS;
+	if (masks.has_atime)
+		mask |= STATX_ATIME;
+	if (masks.has_mtime)
+		mask |= STATX_MTIME;
+	if (masks.has_ctime || masks.has_change)
+		mask |= STATX_CTIME;
+	if (recursive)
+		mask |= STATX_TYPE;
+
+	return mask;
+}
+
+/*
+ * d_type and d_ino answer requests for nothing but the file type and the
+ * file ID.  "rdev" is always returned by statx, and does not need a bit.
+ */
+static bool walk_need_stat(struct tc_attrs_masks masks)
+{
+	struct tc_attrs_masks m = masks;
+
+	m.has_fileid = false;
+	return memcmp(&m, &TC_ATTRS_MASK_NONE, sizeof(m)) != 0;
+}
+
+/* The same conversion as tc_stat2attrs(), timestamps in whole seconds. */
+static void walk_statx2attrs(const struct statx *stx, struct tc_attrs *attrs)
+{
+	if (attrs->masks.has_mode)
+		attrs->mode = stx->stx_mode;
+	if (attrs->masks.has_size)
+		attrs->size = stx->stx_size;
+	if (attrs->masks.has_nlink)
+		attrs->nlink = stx->stx_nlink;
+	if (attrs->masks.has_fileid)
+		attrs->fileid = stx->stx_ino;
+	if (attrs->masks.has_uid)
+		attrs->uid = stx->stx_uid;
+	if (attrs->masks.has_gid)
+		attrs->gid = stx->stx_gid;
+	if (attrs->masks.has_rdev)
+		attrs->rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	if (attrs->masks.has_blocks)
+		attrs->blocks = stx->stx_blocks;
+	if (attrs->masks.has_atime) {
+		attrs->atime.tv_sec = stx->stx_atime.tv_sec;
+		attrs->atime.tv_nsec = 0;
+	}
+	if (attrs->masks.has_mtime) {
+		attrs->mtime.tv_sec = stx->stx_mtime.tv_sec;
+		attrs->mtime.tv_nsec = 0;
+	}
+	if (attrs->masks.has_ctime) {
+		attrs->ctime.tv_sec = stx->stx_ctime.tv_sec;
+		attrs->ctime.tv_nsec = 0;
+	}
+	if (attrs->masks.has_change) {
+		attrs->change = (uint64_t)stx->stx_ctime.tv_sec * 1000000000 +
+				stx->stx_ctime.tv_nsec;
+	}
+}
+
+/*
+ * Report one entry; return false when the walk should stop.
+ */
+static bool walk_report(struct walk_state *ws, struct tc_attrs *attrs,
+			const char *path)
+{
+	bool more;
+
+	pthread_mutex_lock(&ws->lock);
+	if (ws->stop || ws->limit == 0) {
+		pthread_mutex_unlock(&ws->lock);
+		return false;
+	}
+	more = ws->cb(attrs, path, ws->cbarg);
+	if (ws->limit > 0)
+		--ws->limit;
+	if (!more || ws->limit == 0) {
+		ws->stop = true;
+		pthread_cond_broadcast(&ws->idle);
+		more = false;
+	}
+	pthread_mutex_unlock(&ws->lock);
+
+	return more;
+}
+
+static int walk_one_dir(struct walk_worker *ww, const struct walk_dir *wd)
+{
+	struct walk_state *ws = ww->ws;
+	struct linux_dirent64 *de;
+	struct tc_attrs attrs;
+	struct statx stx;
+	bool is_dir;
+	long nread;
+	long pos;
+	char *subdir;
+	int dirfd;
+	int ret = 0;
+
+	dirfd = open(wd->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0)
+		return -errno;
+
+	while (ret == 0 && !ws->stop) {
+		nread = syscall(SYS_getdents64, dirfd, ww->dents,
+				WALK_DENTS_BUFSIZE);
+		if (nread < 0) {
+			ret = -errno;
+			break;
+		}
+		if (nread == 0)
+			break;
+
+		for (pos = 0; pos < nread && ret == 0; pos += de->d_reclen) {
+			de = (struct linux_dirent64 *)(ww->dents + pos);
+			if (strcmp(de->d_name, ".") == 0 ||
+			    strcmp(de->d_name, "..") == 0)
+				continue;
+
+			tc_path_join(wd->path, de->d_name, ww->path,
+				     sizeof(ww->path));
+			memset(&attrs, 0, sizeof(attrs));
+			attrs.file = tc_file_from_path(ww->path);
+			attrs.masks = ws->masks;
+
+			if (ws->need_stat ||
+			    (ws->recursive && de->d_type == DT_UNKNOWN)) {
+				if (statx(dirfd, de->d_name,
+					  AT_SYMLINK_NOFOLLOW, ws->statx_mask,
+					  &stx) < 0) {
+					ret = -errno;
+					break;
+				}
+				walk_statx2attrs(&stx, &attrs);
+				is_dir = S_ISDIR(stx.stx_mode);
+			} else {
+				if (attrs.masks.has_fileid)
+					attrs.fileid = de->d_ino;
+				is_dir = de->d_type == DT_DIR;
+			}
+
+			if (!walk_report(ws, &attrs, ww->path)) {
+				break;
+			}
+
+			if (ws->recursive && is_dir) {
+				subdir = strdup(ww->path);
+				if (!subdir ||
+				    !walk_enqueue(ww, subdir, wd->origin_index,
+						  true)) {
+					free(subdir);
+					ret = -ENOMEM;
+				}
+			}
+		}
+	}
+
+	close(dirfd);
+	return ret;
+}
+
+static bool walk_next(struct walk_worker *ww, struct walk_dir *wd)
+{
+	struct walk_state *ws = ww->ws;
+	unsigned int posted;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&ws->lock);
+		posted = ws->posted;
+		pthread_mutex_unlock(&ws->lock);
+
+		if (walk_pop(&ws->deques[ww->id], wd, false))
+			return true;
+		for (i = 1; i < ws->nworkers; ++i) {
+			if (walk_pop(&ws->deques[(ww->id + i) % ws->nworkers],
+				     wd, true))
+				return true;
+		}
+
+		pthread_mutex_lock(&ws->lock);
+		if (ws->pending == 0 || ws->stop) {
+			pthread_cond_broadcast(&ws->idle);
+			pthread_mutex_unlock(&ws->lock);
+			return false;
+		}
+		if (ws->posted == posted) {
+			pthread_cond_wait(&ws->idle, &ws->lock);
+		}
+		pthread_mutex_unlock(&ws->lock);
+	}
+}
+
+static void *walk_worker_main(void *arg)
+{
+	struct walk_worker *ww = arg;
+	struct walk_state *ws = ww->ws;
+	struct walk_dir wd;
+	int ret;
+
+	while (walk_next(ww, &wd)) {
+		if (!ws->stop) {
+			ret = walk_one_dir(ww, &wd);
+			if (ret < 0)
+				walk_fail(ws, wd.origin_index, -ret);
+		}
+		if (wd.own_path)
+			free(wd.path);
+		pthread_mutex_lock(&ws->lock);
+		if (--ws->pending == 0)
+			pthread_cond_broadcast(&ws->idle);
+		pthread_mutex_unlock(&ws->lock);
+	}
+
+	return NULL;
+}
+
+static int walk_nthreads(int count, bool recursive)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n < 1)
+		n = 1;
+	if (n > WALK_MAX_THREADS)
+		n = WALK_MAX_THREADS;
+	if (!recursive && n > count)
+		n = count;
+	return n < 1 ? 1 : n;
+}
+
+tc_res posix_walk_dirs(const char **dirs, int count,
+		       struct tc_attrs_masks masks, int max_entries,
+		       bool recursive, tc_listdirv_cb cb, void *cbarg)
+{
+	struct walk_state ws;
+	struct walk_worker *workers;
+	struct walk_dir wd;
+	pthread_t *tids;
+	int nstarted = 0;
+	int i;
+
+	if (count <= 0)
+		return (tc_res){ .index = -1, .err_no = 0 };
+
+	memset(&ws, 0, sizeof(ws));
+	ws.masks = masks;
+	ws.recursive = recursive;
+	ws.need_stat = walk_need_stat(masks);
+	ws.statx_mask = walk_statx_mask(masks, recursive);
+	ws.cb = cb;
+	ws.cbarg = cbarg;
+	ws.limit = max_entries == 0 ? -1 : max_entries;
+	ws.tcres.index = -1;
+	ws.tcres.err_no = 0;
+	pthread_mutex_init(&ws.lock, NULL);
+	pthread_cond_init(&ws.idle, NULL);
+	ws.nworkers = walk_nthreads(count, recursive);
+
+	ws.deques = calloc(ws.nworkers, sizeof(*ws.deques));
+	workers = calloc(ws.nworkers, sizeof(*workers));
+	tids = calloc(ws.nworkers, sizeof(*tids));
+	if (!ws.deques || !workers || !tids) {
+		ws.tcres = tc_failure(0, ENOMEM);
+		goto exit;
+	}
+
+	for (i = 0; i < ws.nworkers; ++i) {
+		pthread_mutex_init(&ws.deques[i].lock, NULL);
+		workers[i].ws = &ws;
+		workers[i].id = i;
+		workers[i].dents = malloc(WALK_DENTS_BUFSIZE);
+		if (!workers[i].dents) {
+			ws.tcres = tc_failure(0, ENOMEM);
+			goto exit;
+		}
+	}
+
+	/* Spread the top-level directories over the workers. */
+	for (i = 0; i < count; ++i) {
+		if (!walk_enqueue(&workers[i % ws.nworkers], (char *)dirs[i],
+				  i, false)) {
+			ws.tcres = tc_failure(i, ENOMEM);
+			goto exit;
+		}
+	}
+
+	/* The calling thread is worker 0. */
+	for (i = 1; i < ws.nworkers; ++i) {
+		if (pthread_create(&tids[i], NULL, walk_worker_main,
+				   &workers[i]) != 0)
+			break;
+		++nstarted;
+	}
+	walk_worker_main(&workers[0]);
+	for (i = 1; i <= nstarted; ++i)
+		pthread_join(tids[i], NULL);
+
+exit:
+	/* Directories left behind by an early stop. */
+	for (i = 0; ws.deques && workers && i < ws.nworkers; ++i) {
+		while (walk_pop(&ws.deques[i], &wd, false)) {
+			if (wd.own_path)
+				free(wd.path);
+		}
+		free(ws.deques[i].dirs);
+		pthread_mutex_destroy(&ws.deques[i].lock);
+		free(workers[i].dents);
+	}
+	free(tids);
+	free(workers);
+	free(ws.deques);
+	pthread_cond_destroy(&ws.idle);
+	pthread_mutex_destroy(&ws.lock);
+
+	return ws.tcres;
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Parallel directory walker of the POSIX backend.
+ *
+ * Directories are read with getdents64 into large buffers by a group of
+ * threads; each thread owns a deque of directories to list and steals from
+ * the others when its own deque runs dry.  Entries are only stat-ed (with
+ * statx and a field mask derived from the requested tc_attrs_masks) when
+ * d_type and d_ino cannot answer the request.
+ */
+#ifndef __TC_POSIX_WALK_H__
+#define __TC_POSIX_WALK_H__
+
+#include "tc_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * List "dirs" with the same semantics as posix_listdirv(), except that
+ * entries of different directories are reported in no particular order.
+ * "cb" is never called concurrently.
+ */
+tc_res posix_walk_dirs(const char **dirs, int count,
+		       struct tc_attrs_masks masks, int max_entries,
+		       bool recursive, tc_listdirv_cb cb, void *cbarg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __TC_POSIX_WALK_H__
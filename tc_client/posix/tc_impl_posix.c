@@ -26,12 +26,15 @@
 #include <dirent.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/xattr.h>
 
-#include "ganesha_list.h"
 #include "tc_impl_posix.h"
 #include "tc_helper.h"
 #include "log.h"
 #include "splice_copy.h"
+#include "posix_copy.h"
+#include "posix_batch.h"
+#include "posix_walk.h"
 
 /*
  * open routine for POSIX files
@@ -134,73 +137,90 @@ static int posix_stat(const tc_file *tcf, struct stat *st)
 }
 
 /*
- * arg - Array of reads for one or more files
- *       Contains file-path, read length, offset, etc.
- * read_count - Length of the above array
- *              (Or number of reads)
+ * Read one iovec; return 0 on success or -errno.
  */
-tc_res posix_readv(struct tc_iovec *arg, int read_count, bool is_transaction)
+static int posix_read_one(struct tc_iovec *iov)
 {
-	int fd, i = 0;
+	int fd;
+	int rc = 0;
 	ssize_t amount_read;
-	tc_file file = { 0 };
-	struct tc_iovec *iov = NULL;
-	tc_res result = { .index = -1, .err_no = 0 };
 	struct stat st;
 
-	for (i = 0; i < read_count; ++i) {
-		iov = arg + i;
-		/*
-		 * if the user specified the path and not file descriptor
-		 * then call open to obtain the file descriptor else
-		 * go ahead with the file descriptor specified by the user
-		 */
-		if (iov->file.type == TC_FILE_PATH) {
-			fd = open(iov->file.path, O_RDONLY);
-		} else if (iov->file.type == TC_FILE_DESCRIPTOR) {
-			fd = iov->file.fd;
-		} else {
-			POSIX_ERR("unsupported type: %d", iov->file.type);
-		}
+	/*
+	 * if the user specified the path and not file descriptor
+	 * then call open to obtain the file descriptor else
+	 * go ahead with the file descriptor specified by the user
+	 */
+	if (iov->file.type == TC_FILE_PATH) {
+		fd = open(iov->file.path, O_RDONLY);
+	} else if (iov->file.type == TC_FILE_DESCRIPTOR) {
+		fd = iov->file.fd;
+	} else {
+		POSIX_ERR("unsupported type: %d", iov->file.type);
+		return -EINVAL;
+	}
 
-		if (fd < 0) {
-			result = tc_failure(i, errno);
-			POSIX_ERR("failed in readv: %s\n", strerror(errno));
-			break;
-		}
+	if (fd < 0) {
+		rc = -errno;
+		POSIX_ERR("failed in readv: %s\n", strerror(errno));
+		return rc;
+	}
 
-		/* Read data */
-		if (iov->offset == TC_OFFSET_CUR) {
-			amount_read = read(fd, iov->data, iov->length);
-		} else {
-			amount_read =
-			    pread(fd, iov->data, iov->length, iov->offset);
-		}
-		if (amount_read < 0) {
-			if (iov->file.type == TC_FILE_PATH) {
-				close(fd);
-			}
-			result = tc_failure(i, errno);
-			break;
-		}
+	/* Read data */
+	if (iov->offset == TC_OFFSET_CUR) {
+		amount_read = read(fd, iov->data, iov->length);
+	} else {
+		amount_read = pread(fd, iov->data, iov->length, iov->offset);
+	}
+	if (amount_read < 0) {
+		rc = -errno;
+		goto exit;
+	}
 
-		/* set the length to number of bytes successfully read */
-		iov->length = amount_read;
+	/* set the length to number of bytes successfully read */
+	iov->length = amount_read;
 
-		if (fstat(fd, &st) != 0) {
-			POSIX_ERR("failed to stat file");
-			result = tc_failure(i, errno);
-			break;
-		}
+	if (fstat(fd, &st) != 0) {
+		rc = -errno;
+		POSIX_ERR("failed to stat file");
+		goto exit;
+	}
 
-		if (iov->offset == TC_OFFSET_CUR) {
-			iov->is_eof = lseek(fd, 0, SEEK_CUR) == st.st_size;
-		} else {
-			iov->is_eof = (iov->offset + iov->length) == st.st_size;
-		}
+	if (iov->offset == TC_OFFSET_CUR) {
+		iov->is_eof = lseek(fd, 0, SEEK_CUR) == st.st_size;
+	} else {
+		iov->is_eof = (iov->offset + iov->length) == st.st_size;
+	}
 
-		if (iov->file.type == TC_FILE_PATH && close(fd) < 0) {
-			result = tc_failure(i, errno);
+exit:
+	if (iov->file.type == TC_FILE_PATH && close(fd) < 0 && rc == 0) {
+		rc = -errno;
+	}
+	return rc;
+}
+
+/*
+ * arg - Array of reads for one or more files
+ *       Contains file-path, read length, offset, etc.
+ * read_count - Length of the above array
+ *              (Or number of reads)
+ *
+ * Independent reads are executed concurrently (see posix_batch.h).
+ */
+tc_res posix_readv(struct tc_iovec *arg, int read_count, bool is_transaction)
+{
+	int i;
+	int rc;
+	tc_res result = { .index = -1, .err_no = 0 };
+
+	if (posix_batch_iov(arg, read_count, false, posix_read_one, &result)) {
+		return result;
+	}
+
+	for (i = 0; i < read_count; ++i) {
+		rc = posix_read_one(arg + i);
+		if (rc < 0) {
+			result = tc_failure(i, -rc);
 			break;
 		}
 	}
@@ -209,85 +229,104 @@ tc_res posix_readv(struct tc_iovec *arg, int read_count, bool is_transaction)
 }
 
 /*
- * arg - Array of writes for one or more files
- *       Contains file-path, write length, offset, etc.
- * read_count - Length of the above array
- *              (Or number of reads)
+ * Write one iovec; return 0 on success or -errno.
  */
-tc_res posix_writev(struct tc_iovec *arg, int write_count, bool is_transaction)
+static int posix_write_one(struct tc_iovec *iov)
 {
-	int fd, i = 0;
+	int fd;
+	int rc = 0;
 	ssize_t written = 0;
-	struct tc_iovec *iov = NULL;
-	tc_res result = { .index = -1, .err_no = 0 };
 	int flags;
 	off_t offset;
 
-	for (i = 0; i < write_count; ++i) {
-		iov = arg + i;
+	/* open the requested file */
+	flags = O_WRONLY;
+	if (iov->is_creation) {	/* create */
+		flags |= O_CREAT;
+	}
+	if (iov->offset == TC_OFFSET_END) {  /* append */
+		flags |= O_APPEND;
+	}
+	if (iov->is_write_stable) {
+		flags |= O_SYNC;
+	}
 
-		/* open the requested file */
-		flags = O_WRONLY;
-		if (iov->is_creation) {	/* create */
-			flags |= O_CREAT;
-		}
-		if (iov->offset == TC_OFFSET_END) {  /* append */
-			flags |= O_APPEND;
-		}
-		if (iov->is_write_stable) {
-			flags |= O_SYNC;
-		}
+	if (iov->file.type == TC_FILE_PATH) {
+		fd = open(iov->file.path, flags, 0666);
+	} else if (iov->file.type == TC_FILE_DESCRIPTOR) {
+		fd = iov->file.fd;
+	} else {
+		POSIX_ERR("unsupported type: %d", iov->file.type);
+		return -EINVAL;
+	}
 
+	if (fd < 0) {
+		return -errno;
+	}
+
+	offset = iov->offset;
+	/* When appending to file we did not open, we need to use lseek
+	 * to set the offset to file size. */
+	if (offset == TC_OFFSET_END) {
 		if (iov->file.type == TC_FILE_PATH) {
-			fd = open(iov->file.path, flags);
-		} else if (iov->file.type == TC_FILE_DESCRIPTOR) {
-			fd = iov->file.fd;
+			/* Will be ignored because the file was opened
+			 * with O_APPEND, but it cannot be
+			 * TC_OFFSET_END which is negative when
+			 * casted to off_t. */
+			offset = 0;
 		} else {
-			POSIX_ERR("unsupported type: %d", iov->file.type);
+			offset = lseek(fd, 0, SEEK_END);
 		}
+	}
 
-		if (fd < 0) {
-			result = tc_failure(i, errno);
-			break;
+	/* Write data */
+	if (iov->length > 0) {
+		if (offset == TC_OFFSET_CUR) {
+			written = write(fd, iov->data, iov->length);
+		} else {
+			written = pwrite(fd, iov->data, iov->length, offset);
 		}
 
-		offset = iov->offset;
-		/* When appending to file we did not open, we need to use lseek
-		 * to set the offset to file size. */
-		if (offset == TC_OFFSET_END) {
+		if (written < 0) {
+			rc = -errno;
 			if (iov->file.type == TC_FILE_PATH) {
-				/* Will be ignored because the file was opened
-				 * with O_APPEND, but it cannot be
-				 * TC_OFFSET_END which is negative when
-				 * casted to off_t. */
-				offset = 0;
-			} else {
-				offset = lseek(fd, 0, SEEK_END);
+				close(fd);
 			}
+			return rc;
 		}
+	}
 
-		/* Write data */
-		if (iov->length > 0) {
-			if (offset == TC_OFFSET_CUR) {
-				written = write(fd, iov->data, iov->length);
-			} else {
-				written =
-				    pwrite(fd, iov->data, iov->length, offset);
-			}
+	/* set the length to number of bytes successfully written */
+	iov->length = written;
+	if (iov->file.type == TC_FILE_PATH && close(fd) < 0) {
+		return -errno;
+	}
 
-			if (written < 0) {
-				if (iov->file.type == TC_FILE_PATH) {
-					close(fd);
-				}
-				result = tc_failure(i, errno);
-				break;
-			}
-		}
+	return 0;
+}
 
-		/* set the length to number of bytes successfully written */
-		iov->length = written;
-		if (iov->file.type == TC_FILE_PATH && close(fd) < 0) {
-			result = tc_failure(i, errno);
+/*
+ * arg - Array of writes for one or more files
+ *       Contains file-path, write length, offset, etc.
+ * read_count - Length of the above array
+ *              (Or number of reads)
+ *
+ * Writes to distinct files are executed concurrently (see posix_batch.h).
+ */
+tc_res posix_writev(struct tc_iovec *arg, int write_count, bool is_transaction)
+{
+	int i;
+	int rc;
+	tc_res result = { .index = -1, .err_no = 0 };
+
+	if (posix_batch_iov(arg, write_count, true, posix_write_one, &result)) {
+		return result;
+	}
+
+	for (i = 0; i < write_count; ++i) {
+		rc = posix_write_one(arg + i);
+		if (rc < 0) {
+			result = tc_failure(i, -rc);
 			break;
 		}
 	}
@@ -594,170 +633,360 @@ tc_res posix_mkdirv(struct tc_attrs *dirs, int count, bool is_transaction)
 	return result;
 }
 
-struct tc_posix_dir_to_list {
-	struct glist_head list;
-	const char *path;
-	int origin_index;
-	bool need_free_path;
-};
+/*
+ * Directories are listed in parallel by posix_walk_dirs(), so entries of
+ * different directories may be reported in any order.
+ */
+tc_res posix_listdirv(const char **dirs, int count, struct tc_attrs_masks masks,
+		      int max_entries, bool recursive, tc_listdirv_cb cb,
+		      void *cbarg, bool istxn)
+{
+	return posix_walk_dirs(dirs, count, masks, max_entries, recursive, cb,
+			       cbarg);
+}
 
-static inline struct tc_posix_dir_to_list *
-enqueue_dir_to_list(struct glist_head *dir_queue, const char *path,
-		    bool own_path, int index)
+/*
+ * Each pair is copied with the cheapest method available: reflink, then
+ * copy_file_range(), then splice (see posix_copy.h).
+ */
+tc_res posix_lcopyv(struct tc_extent_pair *pairs, int count, bool is_transaction)
 {
-	struct tc_posix_dir_to_list *dle;
+	int i;
+	enum posix_copy_method *methods;
+	tc_res tcres;
 
-	dle = malloc(sizeof(*dle));
-	if (!dle) {
-		return NULL;
+	methods = calloc(count, sizeof(*methods));
+	tcres = posix_copy_pairs(pairs, count, POSIX_COPY_ANY, methods);
+	for (i = 0; methods && i < count; ++i) {
+		if (!tc_okay(tcres) && i > tcres.index) {
+			break;
+		}
+		POSIX_DEBUG("copied %s to %s with %s", pairs[i].src_path,
+			    pairs[i].dst_path,
+			    posix_copy_method_name(methods[i]));
 	}
-	dle->path = path;
-	dle->need_free_path = own_path;
-	dle->origin_index = index;
-	glist_add_tail(dir_queue, &dle->list);
+	free(methods);
 
-	return dle;
+	return tcres;
 }
 
-static int posix_listdir(struct glist_head *dir_queue, const char *dir,
-			 struct tc_attrs_masks masks, int index, int *limit,
-			 bool recursive, tc_listdirv_cb cb, void *cbarg)
+tc_res posix_hardlinkv(const char **oldpaths, const char **newpaths, int count,
+		       bool istxn)
 {
-	DIR *dir_fd;
-	struct tc_attrs cur_attr;
-	struct dirent *dp;
-	int path_len;
-	char *path;
-	struct stat st;
-	struct tc_posix_dir_to_list *dle;
-	int ret = 0;
-
-	assert(dir != NULL);
+	int i;
+	tc_res tcres = { .err_no = 0 };
 
-	dir_fd = opendir(dir);
-	if (!dir_fd) {
-		return -errno;
+	for (i = 0; i < count; ++i) {
+		if (link(oldpaths[i], newpaths[i]) < 0) {
+			tcres = tc_failure(i, errno);
+			POSIX_ERR("posix_hardlinkv-%d hardlink %s to %s: %s", i,
+				  oldpaths[i], newpaths[i], strerror(errno));
+			break;
+		}
 	}
 
-	while ((dp = readdir(dir_fd)) != NULL && (*limit == -1 || *limit > 0)) {
-		POSIX_DEBUG("DirEntry  : %s\n", dp->d_name);
-		/* Skip the current and parent directory entry */
-		if (!strncmp(dp->d_name, ".", strlen(dp->d_name)) ||
-		    !strncmp(dp->d_name, "..", strlen(dp->d_name)))
-			continue;
+	return tcres;
+}
+
+tc_res posix_symlinkv(const char **oldpaths, const char **newpaths, int count,
+		      bool istxn)
+{
+	int i;
+	tc_res tcres = { .err_no = 0 };
 
-		path_len = strlen(dp->d_name) + strlen(dir) + 2;
-		char *path = (char *)malloc(path_len);
-		tc_path_join(dir, dp->d_name, path, path_len);
+	for (i = 0; i < count; ++i) {
+		if (symlink(oldpaths[i], newpaths[i]) < 0) {
+			tcres = tc_failure(i, errno);
+			POSIX_ERR("posix_symlinkv-%d symlink %s to %s: %s", i,
+				  oldpaths[i], newpaths[i], strerror(errno));
+			break;
+		}
+	}
 
-		cur_attr.file = tc_file_from_path(path);
-		cur_attr.masks = masks;
+	return tcres;
+}
 
-		if (lstat(path, &st) < 0) {
-			POSIX_WARN("stat failed for file : %s/%s", dir,
-				   dp->d_name);
-			ret = -errno;
-			goto exit;
+tc_res posix_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
+		       int count, bool istxn)
+{
+	int i;
+	ssize_t sz;
+	tc_res tcres = { .err_no = 0 };
+
+	for (i = 0; i < count; ++i) {
+		if ((sz = readlink(paths[i], bufs[i], bufsizes[i])) < 0) {
+			tcres = tc_failure(i, errno);
+			POSIX_ERR("posix_readlinkv-%d readlink at %s: %s",
+				  i, paths[i], strerror(errno));
+			break;
+		}
+		if (sz < bufsizes[i]) {
+			bufs[i][sz] = '\0';
 		}
+		bufsizes[i] = sz;
+	}
+
+	return tcres;
+}
 
-		/* copy the attributes */
-		tc_stat2attrs(&st, &cur_attr);
-		if (!cb(&cur_attr, path, cbarg)) {
-			ret = 0;
+/*
+ * Read the whole file at "path" into a new buffer; return 0 on success or
+ * -errno.
+ */
+static int posix_read_file(const char *path, char **buf, size_t *size)
+{
+	int fd;
+	int rc = 0;
+	struct stat st;
+	ssize_t n;
+	size_t amount_read = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		rc = -errno;
+		goto exit;
+	}
+
+	*buf = malloc(st.st_size > 0 ? st.st_size : 1);
+	if (!*buf) {
+		rc = -ENOMEM;
+		goto exit;
+	}
+	while (amount_read < (size_t)st.st_size) {
+		n = pread(fd, *buf + amount_read, st.st_size - amount_read,
+			  amount_read);
+		if (n < 0) {
+			rc = -errno;
+			free(*buf);
+			*buf = NULL;
 			goto exit;
 		}
+		if (n == 0) {
+			break;	/* the file has shrunk */
+		}
+		amount_read += n;
+	}
+	*size = amount_read;
 
-		if (recursive && S_ISDIR(st.st_mode)) {
-			if (!enqueue_dir_to_list(dir_queue, path, true,
-						 index)) {
-				free(path);
-				ret = -ENOMEM;
-				goto exit;
-			}
-		} else {
-			free(path);
+exit:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return rc;
+}
+
+tc_res posix_read_files(const char **paths, char **bufs, size_t *sizes,
+			int count)
+{
+	int i;
+	int rc;
+	tc_res tcres = { .index = count, .err_no = 0 };
+
+	for (i = 0; i < count; ++i) {
+		bufs[i] = NULL;
+	}
+	for (i = 0; i < count; ++i) {
+		rc = posix_read_file(paths[i], &bufs[i], &sizes[i]);
+		if (rc < 0) {
+			tcres = tc_failure(i, -rc);
+			POSIX_ERR("posix_read_files-%d read %s: %s", i,
+				  paths[i], strerror(-rc));
+			break;
 		}
+	}
 
-		if (*limit != -1) {
-			--(*limit);
+	if (!tc_okay(tcres)) {
+		for (i = 0; i < count; ++i) {
+			free(bufs[i]);
+			bufs[i] = NULL;
 		}
 	}
+	return tcres;
+}
 
-exit:
-	closedir(dir_fd);
-	return ret;
+static inline bool posix_timespec_eq(struct timespec a, struct timespec b)
+{
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
 }
 
-tc_res posix_listdirv(const char **dirs, int count, struct tc_attrs_masks masks,
-		      int max_entries, bool recursive, tc_listdirv_cb cb,
-		      void *cbarg, bool istxn)
+/*
+ * Whether the attributes of "a" selected by its masks are those of "b";
+ * only permission bits of mode are compared, as is done by NFS VERIFY.
+ */
+static bool posix_attrs_match(const struct tc_attrs *a,
+			      const struct tc_attrs *b)
 {
-	tc_res tcres = { .err_no = 0 };
-	GLIST_HEAD(dir_queue);
-	struct tc_posix_dir_to_list *dle;
-	int i;
-	int ret = 0;
+	const struct tc_attrs_masks *m = &a->masks;
+
+	return (!m->has_mode || ((a->mode ^ b->mode) & 07777) == 0) &&
+	       (!m->has_size || a->size == b->size) &&
+	       (!m->has_nlink || a->nlink == b->nlink) &&
+	       (!m->has_fileid || a->fileid == b->fileid) &&
+	       (!m->has_blocks || a->blocks == b->blocks) &&
+	       (!m->has_uid || a->uid == b->uid) &&
+	       (!m->has_gid || a->gid == b->gid) &&
+	       (!m->has_rdev || a->rdev == b->rdev) &&
+	       (!m->has_atime || posix_timespec_eq(a->atime, b->atime)) &&
+	       (!m->has_mtime || posix_timespec_eq(a->mtime, b->mtime)) &&
+	       (!m->has_ctime || posix_timespec_eq(a->ctime, b->ctime)) &&
+	       (!m->has_change || a->change == b->change);
+}
 
-	if (max_entries == 0) {  /* no limit */
-		max_entries = -1;
+static tc_res posix_verify(const struct tc_attrs *attrs, bool negated)
+{
+	struct tc_attrs cur;
+	tc_res tcres;
+
+	cur.file = attrs->file;
+	cur.masks = attrs->masks;
+	tcres = posix_lgetattrsv(&cur, 1, false);
+	if (tc_okay(tcres) && posix_attrs_match(attrs, &cur) == negated) {
+		tcres = tc_failure(0, EAGAIN);
 	}
+	return tcres;
+}
+
+tc_res posix_cpdv(struct tc_cpd_op *ops, int count, bool istxn)
+{
+	int i;
+	tc_res tcres = { .index = count, .err_no = 0 };
+	tc_res r;
 
 	for (i = 0; i < count; ++i) {
-		enqueue_dir_to_list(&dir_queue, dirs[i], false, i);
-	}
-
-	while (!glist_empty(&dir_queue)) {
-		dle = glist_first_entry(&dir_queue, struct tc_posix_dir_to_list,
-					list);
-		if (ret == 0 && (max_entries == -1 || max_entries > 0)) {
-			ret = posix_listdir(&dir_queue, dle->path, masks,
-					    dle->origin_index, &max_entries,
-					    recursive, cb, cbarg);
-			if (ret < 0) {
-				tcres = tc_failure(dle->origin_index, ret);
-			}
+		switch (ops[i].type) {
+		case TC_CPD_READ:
+			r = posix_readv(&ops[i].iov, 1, false);
+			break;
+		case TC_CPD_WRITE:
+			r = posix_writev(&ops[i].iov, 1, false);
+			break;
+		case TC_CPD_GETATTRS:
+			r = posix_lgetattrsv(&ops[i].attrs, 1, false);
+			break;
+		case TC_CPD_SETATTRS:
+			r = posix_lsetattrsv(&ops[i].attrs, 1, false);
+			break;
+		case TC_CPD_MKDIR:
+			r = posix_mkdirv(&ops[i].attrs, 1, false);
+			break;
+		case TC_CPD_REMOVE:
+			r = posix_removev(&ops[i].file, 1, false);
+			break;
+		case TC_CPD_RENAME:
+			r = posix_renamev(&ops[i].pair, 1, false);
+			break;
+		case TC_CPD_VERIFY:
+		case TC_CPD_NVERIFY:
+			r = posix_verify(&ops[i].attrs,
+					 ops[i].type == TC_CPD_NVERIFY);
+			break;
+		default:
+			r = tc_failure(0, EINVAL);
 		}
-		if (dle->need_free_path) {
-			free((char *)dle->path);
+		ops[i].err_no = r.err_no;
+		if (!tc_okay(r)) {
+			POSIX_ERR("posix_cpdv-%d failed: %s", i,
+				  strerror(r.err_no));
+			tcres = tc_failure(i, r.err_no);
+			break;
 		}
-		glist_del(&dle->list);
-		free(dle);
 	}
 
 	return tcres;
 }
 
-tc_res posix_lcopyv(struct tc_extent_pair *pairs, int count, bool is_transaction)
+/*
+ * fcntl() "cmd" on each of "locks".
+ */
+static tc_res posix_fcntl_locks(struct tc_lock *locks, int count, int cmd,
+				short type)
 {
+	struct flock fl;
+	tc_res tcres = { .index = count, .err_no = 0 };
 	int i;
-	ssize_t ret;
-	tc_res tcres = { .err_no = 0 };
 
 	for (i = 0; i < count; ++i) {
-		ret = splice_copy(pairs[i].src_path, pairs[i].src_offset,
-				  pairs[i].dst_path, pairs[i].dst_offset,
-				  pairs[i].length);
-		if (ret < 0) {
-			tcres = tc_failure(i, -ret);
-			return tcres;
+		if (locks[i].file.type != TC_FILE_DESCRIPTOR) {
+			tcres = tc_failure(i, EINVAL);
+			break;
+		}
+		fl.l_type = type ? type : locks[i].type;
+		fl.l_whence = SEEK_SET;
+		fl.l_start = locks[i].offset;
+		fl.l_len = locks[i].length;
+		fl.l_pid = 0;
+		if (fcntl(locks[i].file.fd, cmd, &fl) < 0) {
+			tcres = tc_failure(i, errno);
+			POSIX_DEBUG("posix_fcntl_locks-%d fcntl(%d): %s", i,
+				    cmd, strerror(errno));
+			break;
+		}
+		if (cmd == F_GETLK) {
+			locks[i].type = fl.l_type;
+			if (fl.l_type != F_UNLCK) {
+				locks[i].offset = fl.l_start;
+				locks[i].length = fl.l_len;
+			}
 		}
-		pairs[i].length = ret;
 	}
 
 	return tcres;
 }
 
-tc_res posix_hardlinkv(const char **oldpaths, const char **newpaths, int count,
-		       bool istxn)
+tc_res posix_lockv(struct tc_lock *locks, int count, bool istxn)
+{
+	return posix_fcntl_locks(locks, count, F_SETLK, 0);
+}
+
+tc_res posix_unlockv(struct tc_lock *locks, int count, bool istxn)
+{
+	return posix_fcntl_locks(locks, count, F_SETLK, F_UNLCK);
+}
+
+tc_res posix_testlockv(struct tc_lock *locks, int count, bool istxn)
+{
+	return posix_fcntl_locks(locks, count, F_GETLK, 0);
+}
+
+/*
+ * fallocate() each of "extents" with "mode".
+ */
+static tc_res posix_fallocate_extents(struct tc_extent *extents, int count,
+				      int mode)
 {
+	tc_res tcres = { .index = count, .err_no = 0 };
+	int flags;
+	int fd;
+	int rc;
 	int i;
-	tc_res tcres = { .err_no = 0 };
 
 	for (i = 0; i < count; ++i) {
-		if (link(oldpaths[i], newpaths[i]) < 0) {
+		if (extents[i].file.type == TC_FILE_PATH) {
+			flags = O_WRONLY;
+			if (mode == 0 && extents[i].is_creation) {
+				flags |= O_CREAT;
+			}
+			fd = open(extents[i].file.path, flags, 0666);
+		} else if (extents[i].file.type == TC_FILE_DESCRIPTOR) {
+			fd = extents[i].file.fd;
+		} else {
+			tcres = tc_failure(i, EINVAL);
+			break;
+		}
+		if (fd < 0) {
 			tcres = tc_failure(i, errno);
-			POSIX_ERR("posix_hardlinkv-%d hardlink %s to %s: %s", i,
-				  oldpaths[i], newpaths[i], strerror(errno));
+			break;
+		}
+		rc = fallocate(fd, mode, extents[i].offset, extents[i].length);
+		if (rc < 0) {
+			tcres = tc_failure(i, errno);
+			POSIX_DEBUG("posix_fallocate_extents-%d fallocate(%d): "
+				    "%s", i, mode, strerror(errno));
+		}
+		if (extents[i].file.type == TC_FILE_PATH) {
+			close(fd);
+		}
+		if (rc < 0) {
 			break;
 		}
 	}
@@ -765,40 +994,91 @@ tc_res posix_hardlinkv(const char **oldpaths, const char **newpaths, int count,
 	return tcres;
 }
 
-tc_res posix_symlinkv(const char **oldpaths, const char **newpaths, int count,
-		      bool istxn)
+tc_res posix_fallocatev(struct tc_extent *extents, int count, bool istxn)
+{
+	return posix_fallocate_extents(extents, count, 0);
+}
+
+tc_res posix_punchholev(struct tc_extent *extents, int count, bool istxn)
+{
+	return posix_fallocate_extents(
+	    extents, count, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE);
+}
+
+tc_res posix_getxattrsv(struct tc_xattr *xattrs, int count, bool istxn)
 {
+	tc_res tcres = { .index = count, .err_no = 0 };
+	struct tc_xattr *x;
+	ssize_t sz;
 	int i;
-	tc_res tcres = { .err_no = 0 };
 
 	for (i = 0; i < count; ++i) {
-		if (symlink(oldpaths[i], newpaths[i]) < 0) {
+		x = &xattrs[i];
+		if (x->file.type == TC_FILE_PATH) {
+			sz = lgetxattr(x->file.path, x->name, x->value,
+				       x->size);
+		} else if (x->file.type == TC_FILE_DESCRIPTOR) {
+			sz = fgetxattr(x->file.fd, x->name, x->value, x->size);
+		} else {
+			tcres = tc_failure(i, EINVAL);
+			break;
+		}
+		if (sz < 0) {
 			tcres = tc_failure(i, errno);
-			POSIX_ERR("posix_symlinkv-%d symlink %s to %s: %s", i,
-				  oldpaths[i], newpaths[i], strerror(errno));
+			POSIX_DEBUG("posix_getxattrsv-%d getxattr(%s): %s", i,
+				    x->name, strerror(errno));
 			break;
 		}
+		x->size = sz;
 	}
 
 	return tcres;
 }
 
-tc_res posix_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
-		       int count, bool istxn)
+tc_res posix_setxattrsv(struct tc_xattr *xattrs, int count, bool istxn)
 {
+	tc_res tcres = { .index = count, .err_no = 0 };
+	struct tc_xattr *x;
+	int rc;
 	int i;
-	ssize_t sz;
-	tc_res tcres = { .err_no = 0 };
 
 	for (i = 0; i < count; ++i) {
-		if ((sz = readlink(paths[i], bufs[i], bufsizes[i])) < 0) {
+		x = &xattrs[i];
+		if (x->file.type == TC_FILE_PATH) {
+			rc = lsetxattr(x->file.path, x->name, x->value,
+				       x->size, x->flags);
+		} else if (x->file.type == TC_FILE_DESCRIPTOR) {
+			rc = fsetxattr(x->file.fd, x->name, x->value, x->size,
+				       x->flags);
+		} else {
+			tcres = tc_failure(i, EINVAL);
+			break;
+		}
+		if (rc < 0) {
 			tcres = tc_failure(i, errno);
-			POSIX_ERR("posix_readlinkv-%d readlink at %s: %s",
-				  i, paths[i], strerror(errno));
+			POSIX_DEBUG("posix_setxattrsv-%d setxattr(%s): %s", i,
+				    x->name, strerror(errno));
 			break;
 		}
-		if (sz < bufsizes[i]) {
-			bufs[i][sz] = '\0';
+	}
+
+	return tcres;
+}
+
+tc_res posix_listxattrsv(const char **paths, char **bufs, size_t *bufsizes,
+			 int count, bool istxn)
+{
+	tc_res tcres = { .index = count, .err_no = 0 };
+	ssize_t sz;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		sz = llistxattr(paths[i], bufs[i], bufsizes[i]);
+		if (sz < 0) {
+			tcres = tc_failure(i, errno);
+			POSIX_DEBUG("posix_listxattrsv-%d listxattr(%s): %s",
+				    i, paths[i], strerror(errno));
+			break;
 		}
 		bufsizes[i] = sz;
 	}
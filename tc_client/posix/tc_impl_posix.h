@@ -118,6 +118,28 @@ tc_res posix_symlinkv(const char **oldpaths, const char **newpaths, int count,
 tc_res posix_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
 		       int count, bool istxn);
 
+tc_res posix_read_files(const char **paths, char **bufs, size_t *sizes,
+			int count);
+
+tc_res posix_cpdv(struct tc_cpd_op *ops, int count, bool istxn);
+
+tc_res posix_lockv(struct tc_lock *locks, int count, bool istxn);
+
+tc_res posix_unlockv(struct tc_lock *locks, int count, bool istxn);
+
+tc_res posix_testlockv(struct tc_lock *locks, int count, bool istxn);
+
+tc_res posix_fallocatev(struct tc_extent *extents, int count, bool istxn);
+
+tc_res posix_punchholev(struct tc_extent *extents, int count, bool istxn);
+
+tc_res posix_getxattrsv(struct tc_xattr *xattrs, int count, bool istxn);
+
+tc_res posix_setxattrsv(struct tc_xattr *xattrs, int count, bool istxn);
+
+tc_res posix_listxattrsv(const char **paths, char **bufs, size_t *bufsizes,
+			 int count, bool istxn);
+
 int posix_chdir(const char *path);
 
 char *posix_getcwd();
@@ -1378,6 +1378,41 @@ int ReadExports(config_file_t in_config)
 	return rc + ret;
 }
 
+/**
+ * @brief Read the export entries of a TC client
+ *
+ * Same as ReadExports() except that no pseudo root is built, so only
+ * FSAL_TC needs to be loaded.
+ *
+ * @param[in]  in_config    The file that contains the export list
+ *
+ * @return A negative value on error,
+ *         the number of export entries else.
+ */
+
+int ReadClientExports(config_file_t in_config)
+{
+	struct config_error_type err_type;
+	int rc;
+
+	(void) load_config_from_parse(in_config,
+				      &export_defaults_param,
+				      NULL,
+				      false,
+				      &err_type);
+	if (!config_error_is_harmless(&err_type))
+		return -1;
+
+	rc = load_config_from_parse(in_config,
+				    &export_param,
+				    NULL,
+				    false,
+				    &err_type);
+	if (!config_error_is_harmless(&err_type))
+		return -1;
+	return rc;
+}
+
 static void FreeClientList(struct glist_head *clients)
 {
 	struct glist_head *glist;
@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include "tc_api.h"
 
 static struct tc_func_counter *tc_all_counters = NULL;
@@ -57,6 +58,126 @@ void tc_iterate_counters(bool (*tfc_reader)(struct tc_func_counter *tfc,
 	pthread_mutex_unlock(&tc_counter_lock);
 }
 
+__thread int tc_counter_shard_id = -1;
+
+int tc_new_counter_shard()
+{
+	static int next_shard = 0;
+
+	return __sync_fetch_and_add(&next_shard, 1) % TC_COUNTER_SHARDS;
+}
+
+void tc_read_counter(struct tc_func_counter *tfc,
+		     struct tc_counter_stats *stats)
+{
+	struct tc_counter_shard *shard;
+	int i;
+	int b;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->name = tfc->name;
+	for (i = 0; i < TC_COUNTER_SHARDS; ++i) {
+		shard = &tfc->shards[i];
+		stats->calls += __atomic_load_n(&shard->calls, __ATOMIC_RELAXED);
+		stats->failures +=
+		    __atomic_load_n(&shard->failures, __ATOMIC_RELAXED);
+		stats->micro_ops +=
+		    __atomic_load_n(&shard->micro_ops, __ATOMIC_RELAXED);
+		stats->time_ns +=
+		    __atomic_load_n(&shard->time_ns, __ATOMIC_RELAXED);
+		for (b = 0; b < TC_HIST_BUCKETS; ++b) {
+			stats->hist[b] += __atomic_load_n(&shard->hist[b],
+							  __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/*
+ * The smallest latency falling into "bucket"; the inverse of tc_hist_bucket().
+ */
+static uint64_t tc_hist_bucket_floor(int bucket)
+{
+	int group = bucket >> TC_HIST_SUB_BITS;
+	uint64_t sub = bucket & ((1 << TC_HIST_SUB_BITS) - 1);
+
+	if (group == 0) {
+		return sub;
+	}
+	return ((1ULL << TC_HIST_SUB_BITS) + sub) << (group - 1);
+}
+
+uint64_t tc_counter_percentile(const struct tc_counter_stats *stats, double p)
+{
+	uint64_t total = 0;
+	uint64_t rank;
+	uint64_t seen = 0;
+	uint64_t lo;
+	uint64_t hi;
+	int b;
+
+	for (b = 0; b < TC_HIST_BUCKETS; ++b) {
+		total += stats->hist[b];
+	}
+	if (total == 0) {
+		return 0;
+	}
+
+	rank = (uint64_t)(p * total);
+	if (rank >= total) {
+		rank = total - 1;
+	}
+	for (b = 0; b < TC_HIST_BUCKETS; ++b) {
+		seen += stats->hist[b];
+		if (seen > rank) {
+			break;
+		}
+	}
+
+	/* the middle of the bucket */
+	lo = tc_hist_bucket_floor(b);
+	hi = b + 1 < TC_HIST_BUCKETS ? tc_hist_bucket_floor(b + 1) : lo + 1;
+	return lo + (hi - lo) / 2;
+}
+
+static bool tc_counter_to_json(struct tc_func_counter *tfc, void *arg)
+{
+	buf_t *pbuf = (buf_t *)arg;
+	struct tc_counter_stats *stats;
+
+	stats = malloc(sizeof(*stats));
+	if (!stats) {
+		return false;
+	}
+	tc_read_counter(tfc, stats);
+	if (pbuf->data[pbuf->size - 1] != '[') {
+		buf_append_char(pbuf, ',');
+	}
+	buf_appendf(pbuf,
+		    "{\"name\":\"%s\",\"calls\":%" PRIu64
+		    ",\"failures\":%" PRIu64 ",\"micro_ops\":%" PRIu64
+		    ",\"time_ns\":%" PRIu64 ",\"p50_ns\":%" PRIu64
+		    ",\"p99_ns\":%" PRIu64 ",\"p999_ns\":%" PRIu64 "}",
+		    stats->name, stats->calls, stats->failures,
+		    stats->micro_ops, stats->time_ns,
+		    tc_counter_percentile(stats, 0.5),
+		    tc_counter_percentile(stats, 0.99),
+		    tc_counter_percentile(stats, 0.999));
+	free(stats);
+
+	return true;
+}
+
+void tc_counters_to_json(buf_t *pbuf)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	buf_appendf(pbuf, "{\"time\":%ld.%03ld,\"counters\":[",
+		    (long)ts.tv_sec, ts.tv_nsec / 1000000);
+	tc_iterate_counters(tc_counter_to_json, pbuf);
+	buf_append_str(pbuf, "]}");
+}
+
 void free_iovec(struct tc_iovec *iovec, int count)
 {
 	int i = 0;
@@ -132,6 +253,8 @@ void tc_copy_attrs(const struct tc_attrs *src, struct tc_attrs *dst)
 		tc_attrs_set_mtime(dst, src->mtime);
 	if (src->masks.has_ctime)
 		tc_attrs_set_ctime(dst, src->ctime);
+	if (src->masks.has_change)
+		tc_attrs_set_change(dst, src->change);
 }
 
 bool tc_cmp_file(const tc_file *tcf1, const tc_file *tcf2)
@@ -153,7 +276,7 @@ bool tc_cmp_file(const tc_file *tcf1, const tc_file *tcf2)
 			return false;
 		return memcmp(tcf1->handle->f_handle,
 			      tcf2->handle->f_handle,
-			      tcf1->handle->handle_bytes);
+			      tcf1->handle->handle_bytes) == 0;
 	default:
 		return true;
 	}
@@ -26,6 +26,7 @@
 
 #include "tc_api.h"
 #include "tc_helper.h"
+#include "nfs4/fake_server.h"
 
 #include <string>
 #include <vector>
@@ -100,11 +101,12 @@ static void BM_CreateEmpty(benchmark::State &state)
 }
 BENCHMARK(BM_CreateEmpty)->RangeMultiplier(2)->Range(1, 256);
 
-static void BM_OpenClose(benchmark::State &state)
+static void OpenClose(benchmark::State &state, bool lazy)
 {
 	size_t nfiles = state.range(0);
 	vector<const char *> paths = NewPaths("file-%d", nfiles);
 
+	tc_enable_lazy_close(lazy);
 	while (state.KeepRunning()) {
 		tc_file *files =
 		    tc_openv_simple(paths.data(), nfiles, O_RDONLY, 0);
@@ -112,11 +114,23 @@ static void BM_OpenClose(benchmark::State &state)
 		tc_res tcres = tc_closev(files, nfiles);
 		assert(tc_okay(tcres));
 	}
+	tc_enable_lazy_close(false);
 
 	FreePaths(&paths);
 }
+
+static void BM_OpenClose(benchmark::State &state)
+{
+	OpenClose(state, false);
+}
 BENCHMARK(BM_OpenClose)->RangeMultiplier(2)->Range(1, 256);
 
+static void BM_OpenLazyClose(benchmark::State &state)
+{
+	OpenClose(state, true);
+}
+BENCHMARK(BM_OpenLazyClose)->RangeMultiplier(2)->Range(1, 256);
+
 static void ReadWrite(benchmark::State &state, int flags, bool read)
 {
 	size_t nfiles = state.range(0);
@@ -566,14 +580,117 @@ static void BM_Listdir(benchmark::State &state)
 }
 BENCHMARK(BM_Listdir)->RangeMultiplier(2)->Range(1, 256);
 
+static vector<tc_lock> NewLocks(tc_file *files, int nfiles, int nrecords)
+{
+	vector<tc_lock> locks(nfiles * nrecords);
+	for (int i = 0; i < nfiles; ++i) {
+		for (int j = 0; j < nrecords; ++j) {
+			tc_fill_lock(&locks[i * nrecords + j], files[i],
+				     F_WRLCK, j * BUFSIZE, BUFSIZE);
+		}
+	}
+	return locks;
+}
+
+static void LockUnlock(benchmark::State &state, int nfiles, int nrecords)
+{
+	vector<const char *> paths = NewPaths("file-%d", nfiles);
+	tc_file *files =
+	    tc_openv_simple(paths.data(), nfiles, O_RDWR | O_CREAT, 0644);
+	assert(files);
+	vector<tc_lock> locks = NewLocks(files, nfiles, nrecords);
+
+	while (state.KeepRunning()) {
+		tc_res tcres = tc_lockv(locks.data(), locks.size(), false);
+		assert(tc_okay(tcres));
+		tcres = tc_unlockv(locks.data(), locks.size(), false);
+		assert(tc_okay(tcres));
+	}
+	state.SetItemsProcessed(state.iterations() * locks.size());
+
+	tc_closev(files, nfiles);
+	FreePaths(&paths);
+}
+
+// Lock and then unlock one 4KB record of each of many files.
+static void BM_LockFiles(benchmark::State &state)
+{
+	LockUnlock(state, state.range(0), 1);
+}
+BENCHMARK(BM_LockFiles)->RangeMultiplier(2)->Range(1, 256);
+
+// Lock and then unlock many 4KB records of one file.
+static void BM_LockRecords(benchmark::State &state)
+{
+	LockUnlock(state, 1, state.range(0));
+}
+BENCHMARK(BM_LockRecords)->RangeMultiplier(2)->Range(1, 256);
 
-static void* SetUp(bool istc)
+static void BM_TestLock(benchmark::State &state)
+{
+	size_t nrecords = state.range(0);
+	vector<const char *> paths = NewPaths("file-%d", 1);
+	tc_file *files = tc_openv_simple(paths.data(), 1, O_RDWR | O_CREAT, 0644);
+	assert(files);
+	vector<tc_lock> locks = NewLocks(files, 1, nrecords);
+
+	while (state.KeepRunning()) {
+		state.PauseTiming();
+		for (auto &lock : locks)
+			lock.type = F_WRLCK;
+		state.ResumeTiming();
+		tc_res tcres = tc_testlockv(locks.data(), nrecords, false);
+		assert(tc_okay(tcres));
+	}
+	state.SetItemsProcessed(state.iterations() * nrecords);
+
+	tc_closev(files, 1);
+	FreePaths(&paths);
+}
+BENCHMARK(BM_TestLock)->RangeMultiplier(2)->Range(1, 256);
+
+
+static const uint16_t kFakeServerPort = 20490;
+
+static struct tc_fake_server *fake_server;
+
+/* Start an in-process fake server for the "fake" mode. */
+static void StartFakeServer(uint32_t rtt_us, uint64_t bandwidth)
+{
+	struct tc_fake_server_opts opts;
+	opts.port = kFakeServerPort;
+	opts.rtt_us = rtt_us;
+	opts.bandwidth = bandwidth;
+	opts.export_path = "/vfs0";
+	int ret = tc_fake_server_start(&opts, &fake_server);
+	if (ret != 0) {
+		error(1, -ret, "cannot start fake server on port %d",
+		      kFakeServerPort);
+	}
+	fprintf(stderr, "Fake server with RTT of %uus and bandwidth of "
+			"%lluB/s\n",
+		rtt_us, (unsigned long long)bandwidth);
+}
+
+/* tc.fake.conf lives next to the default tc.ganesha.conf. */
+static char *GetFakeConfigFile(char *buf, int buf_size)
+{
+	get_tc_config_file(buf, buf_size);
+	char *slash = strrchr(buf, '/');
+	snprintf(slash + 1, buf_size - (slash + 1 - buf), "tc.fake.conf");
+	return buf;
+}
+
+static void* SetUp(bool istc, bool isfake)
 {
 	void *context;
-	if (istc) {
+	if (istc || isfake) {
 		char buf[PATH_MAX];
-		context = tc_init(get_tc_config_file(buf, PATH_MAX),
-				  "/tmp/tc-bench-tc.log", 77);
+		if (isfake)
+			GetFakeConfigFile(buf, PATH_MAX);
+		else
+			get_tc_config_file(buf, PATH_MAX);
+		context = tc_init(buf, "/tmp/tc-bench-tc.log", 77);
 		fprintf(stderr, "Using config file at %s\n", buf);
 	} else {
 		context = tc_init(NULL, "/tmp/tc-bench-posix.log", 0);
@@ -584,13 +701,28 @@ static void* SetUp(bool istc)
 static void TearDown(void *context)
 {
 	tc_deinit(context);
+	if (fake_server)
+		tc_fake_server_stop(fake_server);
 }
 
+/**
+ * Usage: tc_bench [posix | tc | fake [rtt_us [bandwidth_MBps]]]
+ *
+ * The "fake" mode runs TC against an in-process fake NFS server, which
+ * measures the overhead of the client alone, or emulates a remote server
+ * with the given RTT and bandwidth.
+ */
 int main(int argc, char **argv)
 {
 	benchmark::Initialize(&argc, argv);
 	bool istc = argc > 1 && !strcmp("tc", argv[1]);
-	void *context = SetUp(istc);
+	bool isfake = argc > 1 && !strcmp("fake", argv[1]);
+	if (isfake) {
+		uint32_t rtt_us = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+		uint64_t mbps = argc > 3 ? strtoull(argv[3], NULL, 10) : 0;
+		StartFakeServer(rtt_us, mbps << 20);
+	}
+	void *context = SetUp(istc, isfake);
 	benchmark::RunSpecifiedBenchmarks();
 	TearDown(context);
 
@@ -0,0 +1,155 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Benchmark of the local copy methods of the POSIX backend across file sizes.
+ *
+ * Usage: tc_bench_copy [--dir=DIR] [benchmark flags]
+ *
+ * DIR should be on the file system of interest, e.g., XFS or btrfs for
+ * reflink.  Each benchmark is labelled with the method that actually did the
+ * copy, which tells what BM_CopyAuto picked; a benchmark whose method is not
+ * supported on DIR is reported as an error and skipped.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gflags/gflags.h>
+#include <benchmark/benchmark.h>
+
+#include "tc_api.h"
+#include "tc_helper.h"
+#include "posix/posix_copy.h"
+
+#include <string>
+#include <vector>
+
+DEFINE_string(dir, "/tmp/tc_bench_copy", "Directory to create files in");
+
+using std::string;
+using std::vector;
+
+static string SourceFile(size_t size)
+{
+	char buf[PATH_MAX];
+	snprintf(buf, PATH_MAX, "%s/src-%zu", FLAGS_dir.c_str(), size);
+	return buf;
+}
+
+/* Return 0 or errno. */
+static int CreateSourceFile(size_t size)
+{
+	const size_t BUFSIZE = 1 << 20;
+	vector<char> buf(BUFSIZE);
+	string path = SourceFile(size);
+	int err = 0;
+	int fd;
+
+	if (access(path.c_str(), F_OK) == 0)
+		return 0;
+	for (size_t i = 0; i < BUFSIZE; ++i)
+		buf[i] = (char)(i * 7 + 13);
+	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return errno;
+	for (size_t done = 0; done < size; done += BUFSIZE) {
+		size_t n = std::min(BUFSIZE, size - done);
+		if (write(fd, buf.data(), n) != (ssize_t)n) {
+			err = errno ? errno : EIO;
+			break;
+		}
+	}
+	close(fd);
+	if (err)
+		unlink(path.c_str());
+	return err;
+}
+
+static void CopyWith(benchmark::State &state, int allowed)
+{
+	size_t size = state.range(0);
+	string src = SourceFile(size);
+	string dst = FLAGS_dir + "/dst";
+	enum posix_copy_method method = POSIX_COPY_NONE;
+	int err;
+
+	err = CreateSourceFile(size);
+	if (err) {
+		state.SkipWithError(("cannot create " + src + ": " +
+				     strerror(err)).c_str());
+		return;
+	}
+	while (state.KeepRunning()) {
+		state.PauseTiming();
+		unlink(dst.c_str());
+		state.ResumeTiming();
+
+		struct tc_extent_pair pair;
+		tc_fill_extent_pair(&pair, src.c_str(), 0, dst.c_str(), 0,
+				    UINT64_MAX);
+		tc_res tcres = posix_copy_pairs(&pair, 1, allowed, &method);
+		/* e.g., BM_CopyClone where reflink is not supported */
+		if (!tc_okay(tcres)) {
+			state.SkipWithError(strerror(tcres.err_no));
+			break;
+		}
+	}
+
+	state.SetBytesProcessed(state.iterations() * size);
+	state.SetLabel(posix_copy_method_name(method));
+}
+
+static void BM_CopyAuto(benchmark::State &state)
+{
+	CopyWith(state, POSIX_COPY_ANY);
+}
+BENCHMARK(BM_CopyAuto)->RangeMultiplier(8)->Range(4 << 10, 1 << 30);
+
+static void BM_CopyClone(benchmark::State &state)
+{
+	CopyWith(state, POSIX_COPY_CLONE);
+}
+BENCHMARK(BM_CopyClone)->RangeMultiplier(8)->Range(4 << 10, 1 << 30);
+
+static void BM_CopyRange(benchmark::State &state)
+{
+	CopyWith(state, POSIX_COPY_RANGE);
+}
+BENCHMARK(BM_CopyRange)->RangeMultiplier(8)->Range(4 << 10, 1 << 30);
+
+static void BM_CopySplice(benchmark::State &state)
+{
+	CopyWith(state, POSIX_COPY_SPLICE);
+}
+BENCHMARK(BM_CopySplice)->RangeMultiplier(8)->Range(4 << 10, 1 << 30);
+
+int main(int argc, char **argv)
+{
+	benchmark::Initialize(&argc, argv);
+	gflags::ParseCommandLineFlags(&argc, &argv, true);
+	tc_ensure_dir(FLAGS_dir.c_str(), 0755, NULL);
+	void *context = tc_init(NULL, "/tmp/tc-bench-copy.log", 0);
+	benchmark::RunSpecifiedBenchmarks();
+	tc_deinit(context);
+
+	return 0;
+}
@@ -0,0 +1,454 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Multi-threaded benchmark of a mixed workload.
+ *
+ * Each of --threads threads repeatedly picks an operation by the weights in
+ * --mix, applies it to --batch files picked by a Zipf distribution of
+ * popularity (--zipf), and sleeps for an exponentially distributed think
+ * time (--think_us).  File sizes follow --sizes.  After --duration seconds,
+ * it reports the throughput, latency percentiles of each operation, and how
+ * fairly the threads were served.
+ *
+ * Usage: tc_bench_mix [--tc] [--threads=8] [--mix=read:60,write:20,stat:20]
+ */
+
+#include <error.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tc_api.h"
+#include "tc_helper.h"
+#include "tc_bench_util.h"
+#include "util/zipf.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+DEFINE_bool(tc, true, "Use TC implementation");
+
+DEFINE_string(dir, "Bench-Mix", "Directory of the test files");
+
+DEFINE_bool(setup, true, "Create the test files before running");
+
+DEFINE_int32(threads, 4, "Number of application threads");
+
+DEFINE_int32(nfiles, 1000, "Number of files");
+
+DEFINE_int32(files_per_dir, 100, "Number of files in each directory");
+
+DEFINE_int32(batch, 1, "Number of files accessed by each operation");
+
+DEFINE_string(mix, "read:50,write:20,stat:20,setattr:5,listdir:5",
+	      "Weights of operations among read, write, stat, setattr, "
+	      "listdir, create, and remove");
+
+DEFINE_string(sizes, "4K:50,64K:30,1M:20",
+	      "Distribution of file sizes as size:weight pairs");
+
+DEFINE_double(zipf, 1.0, "Exponent of Zipf file popularity; 0 is uniform");
+
+DEFINE_int32(think_us, 0, "Mean think time between operations in us");
+
+DEFINE_int32(duration, 10, "Seconds to run");
+
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+enum OpType {
+	OP_READ = 0,
+	OP_WRITE,
+	OP_STAT,
+	OP_SETATTR,
+	OP_LISTDIR,
+	OP_CREATE,
+	OP_REMOVE,
+	OP_COUNT,
+};
+
+static const char *kOpNames[OP_COUNT] = {
+	"read", "write", "stat", "setattr", "listdir", "create", "remove",
+};
+
+struct Workload {
+	vector<double> op_weights;
+	vector<size_t> file_sizes;
+	vector<string> files;
+	vector<string> dirs;
+	size_t max_size;
+};
+
+struct ThreadStats {
+	size_t ops[OP_COUNT] = {0};
+	size_t failures[OP_COUNT] = {0};
+	size_t bytes = 0;
+	vector<double> latency_us[OP_COUNT];
+};
+
+static std::atomic<bool> running(true);
+
+/*
+ * Parse a list of "key:weight" pairs; "keys" and "weights" are appended.
+ */
+static void ParseWeights(const string &spec, vector<string> *keys,
+			 vector<double> *weights)
+{
+	size_t start = 0;
+	while (start < spec.size()) {
+		size_t end = spec.find(',', start);
+		if (end == string::npos) {
+			end = spec.size();
+		}
+		string item = spec.substr(start, end - start);
+		size_t colon = item.find(':');
+		if (colon == string::npos) {
+			error(1, EINVAL, "invalid weight '%s'", item.c_str());
+		}
+		keys->push_back(item.substr(0, colon));
+		weights->push_back(atof(item.c_str() + colon + 1));
+		start = end + 1;
+	}
+}
+
+static Workload MakeWorkload()
+{
+	Workload wl;
+	vector<string> names;
+	vector<double> weights;
+
+	wl.op_weights.assign(OP_COUNT, 0);
+	ParseWeights(FLAGS_mix, &names, &weights);
+	for (size_t i = 0; i < names.size(); ++i) {
+		auto it = std::find(kOpNames, kOpNames + OP_COUNT, names[i]);
+		if (it == kOpNames + OP_COUNT) {
+			error(1, EINVAL, "unknown operation '%s'",
+			      names[i].c_str());
+		}
+		wl.op_weights[it - kOpNames] = weights[i];
+	}
+
+	names.clear();
+	weights.clear();
+	ParseWeights(FLAGS_sizes, &names, &weights);
+	std::mt19937 gen(FLAGS_nfiles);
+	std::discrete_distribution<int> size_dist(weights.begin(),
+						  weights.end());
+	wl.max_size = 0;
+	for (int i = 0; i < FLAGS_nfiles; ++i) {
+		size_t size = ConvertSize(names[size_dist(gen)].c_str());
+		wl.file_sizes.push_back(size);
+		wl.max_size = std::max(wl.max_size, size);
+	}
+
+	int ndirs = (FLAGS_nfiles + FLAGS_files_per_dir - 1) /
+		    FLAGS_files_per_dir;
+	for (int d = 0; d < ndirs; ++d) {
+		wl.dirs.push_back(strprintf("%s/d%04d", FLAGS_dir.c_str(), d));
+	}
+	for (int i = 0; i < FLAGS_nfiles; ++i) {
+		wl.files.push_back(strprintf("%s/f%06d",
+			wl.dirs[i / FLAGS_files_per_dir].c_str(), i));
+	}
+	return wl;
+}
+
+static void CreateWorkloadFiles(const Workload &wl)
+{
+	const size_t kBatchBytes = 16 << 20;
+	vector<char> data(wl.max_size, 'a');
+
+	ResetTestDirectory(FLAGS_dir.c_str());
+	vector<tc_attrs> dirs(wl.dirs.size());
+	for (size_t d = 0; d < wl.dirs.size(); ++d) {
+		tc_set_up_creation(&dirs[d], wl.dirs[d].c_str(), 0755);
+	}
+	tc_res tcres = tc_mkdirv(dirs.data(), dirs.size(), false);
+	if (!tc_okay(tcres)) {
+		error(1, tcres.err_no, "failed to create %s",
+		      wl.dirs[tcres.index].c_str());
+	}
+
+	size_t i = 0;
+	while (i < wl.files.size()) {
+		vector<tc_iovec> iovs;
+		size_t bytes = 0;
+		for (; i < wl.files.size() && bytes < kBatchBytes; ++i) {
+			iovs.emplace_back();
+			tc_iov4creation(&iovs.back(), wl.files[i].c_str(),
+					wl.file_sizes[i], data.data());
+			bytes += wl.file_sizes[i];
+		}
+		tcres = tc_writev(iovs.data(), iovs.size(), false);
+		if (!tc_okay(tcres)) {
+			error(1, tcres.err_no, "failed to create %s",
+			      iovs[tcres.index].file.path);
+		}
+	}
+}
+
+static void Worker(int id, const Workload &wl, ThreadStats *stats)
+{
+	std::mt19937 gen(id * 7919 + 17);
+	std::discrete_distribution<int> op_dist(wl.op_weights.begin(),
+						wl.op_weights.end());
+	std::unique_ptr<zipf_distribution<>> zipf;
+	std::uniform_int_distribution<int> uniform(0, wl.files.size() - 1);
+	std::exponential_distribution<double> think(
+	    FLAGS_think_us > 0 ? 1.0 / FLAGS_think_us : 1.0);
+	vector<char> buf(wl.max_size * FLAGS_batch);
+	vector<string> created;
+	int ncreated = 0;
+
+	if (FLAGS_zipf > 0) {
+		zipf.reset(new zipf_distribution<>(wl.files.size(), FLAGS_zipf,
+						   id + 1));
+	}
+	auto pick = [&]() {
+		return zipf ? (int)(*zipf)() : uniform(gen);
+	};
+
+	while (running.load(std::memory_order_relaxed)) {
+		int op = op_dist(gen);
+		vector<int> picked(FLAGS_batch);
+		for (int &f : picked) {
+			f = pick();
+		}
+		if (op == OP_REMOVE && created.empty()) {
+			op = OP_CREATE;
+		}
+
+		tc_res tcres = { -1, 0 };
+		size_t bytes = 0;
+		auto start = Clock::now();
+		switch (op) {
+		case OP_READ:
+		case OP_WRITE: {
+			vector<tc_iovec> iovs(picked.size());
+			for (size_t i = 0; i < picked.size(); ++i) {
+				size_t size = wl.file_sizes[picked[i]];
+				tc_iov2path(&iovs[i], wl.files[picked[i]].c_str(),
+					    0, size, buf.data() + i * wl.max_size);
+				bytes += size;
+			}
+			tcres = op == OP_READ
+				    ? tc_readv(iovs.data(), iovs.size(), false)
+				    : tc_writev(iovs.data(), iovs.size(), false);
+			break;
+		}
+		case OP_STAT:
+		case OP_SETATTR: {
+			vector<tc_attrs> attrs(picked.size());
+			for (size_t i = 0; i < picked.size(); ++i) {
+				attrs[i].file = tc_file_from_path(
+				    wl.files[picked[i]].c_str());
+				if (op == OP_STAT) {
+					attrs[i].masks = TC_ATTRS_MASK_ALL;
+				} else {
+					attrs[i].masks = TC_ATTRS_MASK_NONE;
+					tc_attrs_set_mode(&attrs[i], 0644);
+				}
+			}
+			tcres = op == OP_STAT
+				    ? tc_getattrsv(attrs.data(), attrs.size(),
+						   false)
+				    : tc_setattrsv(attrs.data(), attrs.size(),
+						   false);
+			break;
+		}
+		case OP_LISTDIR: {
+			vector<const char *> dirs(picked.size());
+			for (size_t i = 0; i < picked.size(); ++i) {
+				dirs[i] = wl.dirs[picked[i] /
+						  FLAGS_files_per_dir].c_str();
+			}
+			tcres = tc_listdirv(dirs.data(), dirs.size(),
+					    TC_ATTRS_MASK_ALL, 0, false,
+					    DummyListDirCb, NULL, false);
+			break;
+		}
+		case OP_CREATE: {
+			vector<tc_iovec> iovs(picked.size());
+			size_t first = created.size();
+			for (size_t i = 0; i < picked.size(); ++i) {
+				size_t size = wl.file_sizes[picked[i]];
+				created.push_back(strprintf(
+				    "%s/t%02d-%08d",
+				    wl.dirs[picked[i] / FLAGS_files_per_dir]
+					.c_str(),
+				    id, ncreated++));
+				tc_iov4creation(&iovs[i], created.back().c_str(),
+						size, buf.data());
+				bytes += size;
+			}
+			tcres = tc_writev(iovs.data(), iovs.size(), false);
+			if (!tc_okay(tcres)) {
+				created.resize(first + tcres.index);
+			}
+			break;
+		}
+		case OP_REMOVE: {
+			size_t n = std::min(created.size(), picked.size());
+			vector<tc_file> files(n);
+			for (size_t i = 0; i < n; ++i) {
+				files[i] = tc_file_from_path(
+				    created[created.size() - n + i].c_str());
+			}
+			tcres = tc_removev(files.data(), n, false);
+			created.resize(created.size() - n);
+			break;
+		}
+		}
+		auto end = Clock::now();
+
+		stats->ops[op]++;
+		if (tc_okay(tcres)) {
+			stats->bytes += bytes;
+			stats->latency_us[op].push_back(
+			    std::chrono::duration<double, std::micro>(end - start)
+				.count());
+		} else {
+			stats->failures[op]++;
+		}
+
+		if (FLAGS_think_us > 0) {
+			std::this_thread::sleep_for(std::chrono::microseconds(
+			    (long)think(gen)));
+		}
+	}
+
+	if (!created.empty()) {
+		vector<tc_file> files;
+		for (const string &p : created) {
+			files.push_back(tc_file_from_path(p.c_str()));
+		}
+		tc_removev(files.data(), files.size(), false);
+	}
+}
+
+static double Percentile(const vector<double> &sorted, double p)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+static void Report(const vector<ThreadStats> &stats, double seconds)
+{
+	size_t total_ops = 0;
+	size_t total_bytes = 0;
+	vector<double> per_thread;
+
+	printf("%-8s %10s %8s %10s %10s %10s %10s %10s\n", "op", "count",
+	       "failed", "ops/s", "p50(us)", "p90(us)", "p99(us)",
+	       "p999(us)");
+	for (int op = 0; op < OP_COUNT; ++op) {
+		vector<double> lat;
+		size_t count = 0;
+		size_t failures = 0;
+		for (const ThreadStats &ts : stats) {
+			lat.insert(lat.end(), ts.latency_us[op].begin(),
+				   ts.latency_us[op].end());
+			count += ts.ops[op];
+			failures += ts.failures[op];
+		}
+		if (count == 0) {
+			continue;
+		}
+		std::sort(lat.begin(), lat.end());
+		printf("%-8s %10zu %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		       kOpNames[op], count, failures, count / seconds,
+		       Percentile(lat, 0.5), Percentile(lat, 0.9),
+		       Percentile(lat, 0.99), Percentile(lat, 0.999));
+	}
+
+	for (const ThreadStats &ts : stats) {
+		size_t ops = 0;
+		for (int op = 0; op < OP_COUNT; ++op) {
+			ops += ts.ops[op];
+		}
+		per_thread.push_back(ops);
+		total_ops += ops;
+		total_bytes += ts.bytes;
+	}
+
+	// Jain's fairness index: 1 when all threads did the same number of
+	// operations, and 1/n when a single thread did them all.
+	double sum = 0, sum_sq = 0;
+	for (double x : per_thread) {
+		sum += x;
+		sum_sq += x * x;
+	}
+	double jain = sum_sq > 0 ? sum * sum / (per_thread.size() * sum_sq) : 1;
+	auto minmax = std::minmax_element(per_thread.begin(), per_thread.end());
+
+	printf("\n%s backend, %d threads, batch %d, %.1f seconds\n",
+	       FLAGS_tc ? "TC_NFS4" : "TC_POSIX", FLAGS_threads, FLAGS_batch,
+	       seconds);
+	printf("throughput: %.1f ops/s, %.1f files/s, %.2f MB/s\n",
+	       total_ops / seconds, total_ops * FLAGS_batch / seconds,
+	       total_bytes / seconds / (1 << 20));
+	printf("fairness: Jain index %.3f, per-thread ops min %.0f max %.0f\n",
+	       jain, *minmax.first, *minmax.second);
+}
+
+int main(int argc, char *argv[])
+{
+	std::string usage(
+	    "This program runs a multi-threaded mixed workload.\nUsage: ");
+	usage += argv[0];
+	gflags::SetUsageMessage(usage);
+	gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+	void *tcdata = SetUp(FLAGS_tc);
+	Workload wl = MakeWorkload();
+	if (FLAGS_setup) {
+		CreateWorkloadFiles(wl);
+	}
+
+	vector<ThreadStats> stats(FLAGS_threads);
+	vector<std::thread> threads;
+	auto start = Clock::now();
+	for (int i = 0; i < FLAGS_threads; ++i) {
+		threads.emplace_back(Worker, i, std::cref(wl), &stats[i]);
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(FLAGS_duration));
+	running = false;
+	for (auto &t : threads) {
+		t.join();
+	}
+	double seconds =
+	    std::chrono::duration<double>(Clock::now() - start).count();
+
+	Report(stats, seconds);
+	TearDown(tcdata);
+	return 0;
+}
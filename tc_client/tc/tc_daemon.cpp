@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * A local TC client shared by many processes, so that they use one session
+ * and one set of connections instead of one each:
+ *
+ *	tc_daemon --name=tc --slots=64 --workers=16 &
+ *	TC_DAEMON=tc ./app
+ *
+ * Applications linked with tc_impl forward path-based operations to the
+ * daemon when TC_DAEMON is set; see tc_shm.h.  The daemon exits on SIGINT
+ * or SIGTERM.
+ */
+
+#include <error.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "tc_api.h"
+#include "tc_helper.h"
+#include "tc_shm.h"
+
+#include <gflags/gflags.h>
+
+DEFINE_bool(tc, true, "Use TC implementation");
+
+DEFINE_bool(lite, false, "Use tc_init_lite() instead of tc_init()");
+
+DEFINE_string(name, "tc", "Name of the shared-memory region");
+
+DEFINE_int32(slots, 64, "Number of requests that can be outstanding");
+
+DEFINE_int32(slot_size, 4 << 20, "Bytes of paths and data per request");
+
+DEFINE_int32(workers, 16, "Number of threads executing requests");
+
+static tc_res RunCompound(struct tc_cpd_op *ops, int count,
+			  bool is_transaction)
+{
+	struct tc_compound cpd;
+
+	cpd.ops = ops;
+	cpd.count = count;
+	cpd.capacity = count;
+	return tc_cpd_execute(&cpd, is_transaction);
+}
+
+int main(int argc, char *argv[])
+{
+	char buf[PATH_MAX];
+	struct tc_shm *shm;
+	sigset_t sigs;
+	void *tcdata;
+	char *cwd;
+	int sig;
+	int ret;
+
+	gflags::SetUsageMessage("Serve TC to local processes.");
+	gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+	/* we are the daemon, not a client of it */
+	unsetenv("TC_DAEMON");
+
+	/* blocked in all threads, including the workers */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	const char *config = FLAGS_tc ? get_tc_config_file(buf, PATH_MAX)
+				      : NULL;
+	tcdata = FLAGS_lite ? tc_init_lite(config, "/tmp/tc-daemon.log", 77)
+			    : tc_init(config, "/tmp/tc-daemon.log", 77);
+	if (!tcdata) {
+		error(1, 0, "failed to initialize TC");
+	}
+
+	cwd = tc_getcwd();
+	shm = tc_shm_create(FLAGS_name.c_str(), FLAGS_slots, FLAGS_slot_size,
+			    cwd);
+	free(cwd);
+	if (!shm) {
+		error(1, errno, "failed to create %s", FLAGS_name.c_str());
+	}
+	ret = tc_shm_serve(shm, FLAGS_workers, RunCompound);
+	if (ret < 0) {
+		error(1, -ret, "failed to start workers");
+	}
+
+	sigwait(&sigs, &sig);
+
+	tc_shm_destroy(shm);
+	tc_deinit(tcdata);
+	return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Run a fake NFSv4.1 server with an in-memory tree until interrupted, so
+ * that TC tools can be pointed at it with config/tc.fake.conf.
+ *
+ * Usage: tc_fake_server [--port=20490] [--rtt_us=N] [--bandwidth_mbps=N]
+ */
+
+#include <error.h>
+#include <signal.h>
+#include <stdio.h>
+
+#include <gflags/gflags.h>
+
+#include <string>
+
+#include "nfs4/fake_server.h"
+
+DEFINE_int32(port, 20490, "TCP port on 127.0.0.1 to listen on");
+
+DEFINE_int32(rtt_us, 0, "Round-trip time injected into every compound");
+
+DEFINE_int32(bandwidth_mbps, 0,
+	     "Emulated link bandwidth in MB/s; 0 is unlimited");
+
+DEFINE_string(export_path, "/vfs0", "Directory created for the export");
+
+int main(int argc, char *argv[])
+{
+	std::string usage("Run a fake NFSv4.1 server in memory.\nUsage: ");
+	usage += argv[0];
+	gflags::SetUsageMessage(usage);
+	gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	/* block before the server threads inherit the mask */
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	struct tc_fake_server_opts opts;
+	opts.port = FLAGS_port;
+	opts.rtt_us = FLAGS_rtt_us;
+	opts.bandwidth = (uint64_t)FLAGS_bandwidth_mbps << 20;
+	opts.export_path = FLAGS_export_path.c_str();
+
+	struct tc_fake_server *server;
+	int ret = tc_fake_server_start(&opts, &server);
+	if (ret != 0) {
+		error(1, -ret, "cannot start fake server on port %d",
+		      FLAGS_port);
+	}
+	fprintf(stderr, "Listening on 127.0.0.1:%u\n",
+		tc_fake_server_port(server));
+
+	int sig;
+	sigwait(&signals, &sig);
+	tc_fake_server_stop(server);
+
+	return 0;
+}
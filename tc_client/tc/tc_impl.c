@@ -17,6 +17,7 @@
  * 02110-1301 USA
  */
 
+#include <endian.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -31,56 +32,104 @@
 #include "common_types.h"
 #include "sys/stat.h"
 #include "tc_helper.h"
+#include "tc_shm.h"
 
 static tc_res TC_OKAY = { .index = -1, .err_no = 0, };
 
 static bool TC_IMPL_IS_NFS4 = false;
 
+/*
+ * Set when the environment variable TC_DAEMON names the region of a running
+ * tc_daemon; path-based operations are then forwarded to it.
+ */
+static struct tc_shm *tc_daemon;
+
+/*
+ * The class of tc_set_thread_priority() with the POSIX backend, which does
+ * not schedule compounds but keeps the class as the NFS4 backend does.
+ */
+static __thread int tc_thread_priority = TC_PRIO_NORMAL;
+
 static pthread_t tc_counter_thread;
-static const char *tc_counter_path = "/tmp/tc-counters.txt";
+/* One JSON object per line; see tc_counters_to_json(). */
+static const char *tc_counter_path = "/tmp/tc-counters.json";
 static int tc_counter_running = 1;
+/* whether tc_init_lite() was used, i.e., counters are not output */
+static bool tc_lite = false;
+
+#define TC_COUNTER_BUFSIZE (64 << 10)
+
+/* destinations smaller than this are not worth preallocating */
+#define TC_PREALLOC_MIN (1 << 20)
+
+/* bytes of blocks written at a time by tc_write_adb() */
+#define TC_ADB_BATCH (4 << 20)
 
 const struct tc_attrs_masks TC_ATTRS_MASK_ALL = TC_MASK_INIT_ALL;
 const struct tc_attrs_masks TC_ATTRS_MASK_NONE = TC_MASK_INIT_NONE;
 
-bool tc_counter_printer(struct tc_func_counter *tfc, void *arg)
-{
-	buf_t *pbuf = (buf_t *)arg;
-	buf_appendf(pbuf, "%s %u %u %llu %llu ",
-		    tfc->name,
-		    __sync_fetch_and_or(&tfc->calls, 0),
-		    __sync_fetch_and_or(&tfc->failures, 0),
-		    __sync_fetch_and_or(&tfc->micro_ops, 0),
-		    __sync_fetch_and_or(&tfc->time_ns, 0));
-	return true;
-}
-
 static void *output_tc_counters(void *arg)
 {
-	char buf[4096];
-	buf_t bf = BUF_INITIALIZER(buf, 4096);
+	buf_t *pbuf = init_buf(malloc(TC_COUNTER_BUFSIZE + sizeof(buf_t)),
+			       TC_COUNTER_BUFSIZE);
 
 	FILE *pfile = fopen(tc_counter_path, "w");
 	while (__sync_fetch_and_or(&tc_counter_running, 0)) {
-		buf_reset(&bf);
-		tc_iterate_counters(tc_counter_printer, &bf);
-		buf_append_char(&bf, '\n');
-		fwrite(bf.data, 1, bf.size, pfile);
+		buf_reset(pbuf);
+		tc_counters_to_json(pbuf);
+		buf_append_char(pbuf, '\n');
+		fwrite(pbuf->data, 1, pbuf->size, pfile);
 		fflush(pfile);
 		sleep(TC_COUNTER_OUTPUT_INTERVAL);
 	}
 	fclose(pfile);
+	free(pbuf);
 	return NULL;
 }
 
+/*
+ * Execute "count" vectorized operations of "type" as compounds of the
+ * daemon.  "args" has the arguments of each operation in "size" bytes, laid
+ * out as the member of "struct tc_cpd_op" for "type".
+ */
+static tc_res tc_daemon_vec(int type, void *args, size_t size, int count,
+			    bool is_transaction)
+{
+	struct tc_cpd_op *ops;
+	tc_res tcres;
+	int i;
+
+	ops = calloc(count, sizeof(*ops));
+	if (!ops) {
+		return tc_failure(0, ENOMEM);
+	}
+	for (i = 0; i < count; ++i) {
+		ops[i].type = type;
+		ops[i].err_no = ECANCELED;
+		memcpy(&ops[i].iov, (char *)args + i * size, size);
+	}
+
+	tcres = tc_shm_cpdv(tc_daemon, ops, count, is_transaction);
+	for (i = 0; i < count; ++i) {
+		memcpy((char *)args + i * size, &ops[i].iov, size);
+	}
+
+	free(ops);
+	return tcres;
+}
+
 /* Not thread-safe */
 void *tc_init(const char *config_path, const char *log_path, uint16_t export_id)
 {
+	const char *daemon_name = getenv("TC_DAEMON");
 	void *context;
 	int retval;
 
 	TC_IMPL_IS_NFS4 = (config_path !=  NULL);
-	if (TC_IMPL_IS_NFS4) {
+	tc_lite = false;
+	if (daemon_name) {
+		context = tc_daemon = tc_shm_attach(daemon_name);
+	} else if (TC_IMPL_IS_NFS4) {
 		context = nfs4_init(config_path, log_path, export_id);
 	} else {
 		context = posix_init(config_path, log_path);
@@ -103,30 +152,120 @@ void *tc_init(const char *config_path, const char *log_path, uint16_t export_id)
 	return context;
 }
 
-void tc_deinit(void *module)
+/* Not thread-safe */
+void *tc_init_lite(const char *config_path, const char *log_path,
+		   uint16_t export_id)
+{
+	const char *daemon_name = getenv("TC_DAEMON");
+
+	TC_IMPL_IS_NFS4 = (config_path !=  NULL);
+	tc_lite = true;
+	if (daemon_name) {
+		return tc_daemon = tc_shm_attach(daemon_name);
+	} else if (TC_IMPL_IS_NFS4) {
+		return nfs4_init_lite(config_path, log_path, export_id);
+	}
+	return posix_init(config_path, log_path);
+}
+
+static void tc_stop_counters()
 {
-	buf_t *pbuf = new_auto_buf(4096);
+	buf_t *pbuf = init_buf(malloc(TC_COUNTER_BUFSIZE + sizeof(buf_t)),
+			       TC_COUNTER_BUFSIZE);
 	FILE *pfile;
 
 	__sync_fetch_and_sub(&tc_counter_running, 1);
-	tc_iterate_counters(tc_counter_printer, pbuf);
+	tc_counters_to_json(pbuf);
 	buf_append_char(pbuf, '\n');
 
 	pfile = fopen(tc_counter_path, "a+");
 	assert(pfile);
 	fwrite(pbuf->data, 1, pbuf->size, pfile);
 	fclose(pfile);
+	free(pbuf);
+}
 
-	if (TC_IMPL_IS_NFS4) {
+void tc_deinit(void *module)
+{
+	if (!tc_lite) {
+		tc_stop_counters();
+	}
+
+	if (tc_daemon) {
+		tc_shm_detach(tc_daemon);
+		tc_daemon = NULL;
+	} else if (TC_IMPL_IS_NFS4) {
 		nfs4_deinit(module);
 	}
 }
 
+void tc_enable_tracing(bool enabled)
+{
+	if (TC_IMPL_IS_NFS4) {
+		nfs4_enable_tracing(enabled);
+	}
+}
+
+void tc_enable_lazy_close(bool enabled)
+{
+	if (TC_IMPL_IS_NFS4) {
+		nfs4_enable_lazy_close(enabled);
+	}
+}
+
+int tc_set_thread_priority(int prio)
+{
+	int old = tc_thread_priority;
+
+	if (TC_IMPL_IS_NFS4) {
+		return nfs4_set_thread_priority(prio);
+	}
+	if (prio < 0 || prio >= TC_PRIO_COUNT) {
+		return -EINVAL;
+	}
+	tc_thread_priority = prio;
+	return old;
+}
+
+int tc_set_priority_limits(int prio, int max_inflight, int weight)
+{
+	if (TC_IMPL_IS_NFS4) {
+		return nfs4_set_priority_limits(prio, max_inflight, weight);
+	}
+	if (prio < 0 || prio >= TC_PRIO_COUNT || max_inflight < 1 ||
+	    weight < 1) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int tc_get_priority_stats(int prio, struct tc_sched_stats *stats)
+{
+	if (TC_IMPL_IS_NFS4) {
+		return nfs4_get_priority_stats(prio, stats);
+	}
+	return -ENOTSUP;
+}
+
+int tc_dump_trace(const char *path)
+{
+	if (TC_IMPL_IS_NFS4) {
+		return nfs4_dump_trace(path);
+	}
+	return -ENOTSUP;
+}
+
 tc_file *tc_openv(const char **paths, int count, int *flags, mode_t *modes)
 {
 	tc_file *tcfs;
 	TC_DECLARE_COUNTER(open);
 
+	/* descriptors cannot be shared with the daemon */
+	if (tc_daemon) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
 	TC_START_COUNTER(open);
 	if (TC_IMPL_IS_NFS4) {
 		tcfs = nfs4_openv(paths, count, flags, modes);
@@ -161,6 +300,10 @@ tc_res tc_closev(tc_file *tcfs, int count)
 	tc_res tcres;
 	TC_DECLARE_COUNTER(close);
 
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
 	TC_START_COUNTER(close);
 	if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_closev(tcfs, count);
@@ -177,6 +320,11 @@ off_t tc_fseek(tc_file *tcf, off_t offset, int whence)
 	off_t res;
 	TC_DECLARE_COUNTER(seek);
 
+	if (tc_daemon) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
 	TC_START_COUNTER(seek);
 	if (TC_IMPL_IS_NFS4) {
 		res = nfs4_fseek(tcf, offset, whence);
@@ -215,7 +363,10 @@ tc_res tc_readv(struct tc_iovec *reads, int count, bool is_transaction)
 	 * TODO: check if the functions should use posix or TC depending on the
 	 * back-end file system.
 	 */
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		tcres = tc_daemon_vec(TC_CPD_READ, reads, sizeof(*reads), count,
+				      is_transaction);
+	} else if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_readv(reads, count, is_transaction);
 	} else {
 		tcres = posix_readv(reads, count, is_transaction);
@@ -231,7 +382,10 @@ tc_res tc_writev(struct tc_iovec *writes, int count, bool is_transaction)
 	TC_DECLARE_COUNTER(write);
 
 	TC_START_COUNTER(write);
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		tcres = tc_daemon_vec(TC_CPD_WRITE, writes, sizeof(*writes),
+				      count, is_transaction);
+	} else if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_writev(writes, count, is_transaction);
 	} else {
 		tcres = posix_writev(writes, count, is_transaction);
@@ -241,6 +395,27 @@ tc_res tc_writev(struct tc_iovec *writes, int count, bool is_transaction)
 	return tcres;
 }
 
+tc_res tc_read_files(const char **paths, char **bufs, size_t *sizes,
+		     int count, size_t cap)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(read_files);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(read_files);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_read_files(paths, bufs, sizes, count, cap);
+	} else {
+		tcres = posix_read_files(paths, bufs, sizes, count);
+	}
+	TC_STOP_COUNTER(read_files, count, tc_okay(tcres));
+
+	return tcres;
+}
+
 
 struct syminfo {
 	const char *src_path; // path of file to be checked for symlink; can be
@@ -370,6 +545,19 @@ tc_res tc_getattrsv(struct tc_attrs *attrs, int count, bool is_transaction)
 	int old_mode_count = 0;
 	int link_count = 0;
 	int i;
+	TC_DECLARE_COUNTER(getattrs);
+
+	/* compounds of the daemon do not follow symlinks */
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	if (TC_IMPL_IS_NFS4) {
+		TC_START_COUNTER(getattrs);
+		res = nfs4_getattrsv(attrs, count, is_transaction);
+		TC_STOP_COUNTER(getattrs, count, tc_okay(res));
+		return res;
+	}
 
 	for (i = 0; i < count; i++) {
 		// if caller doesn't want to get a mode, save old mode before
@@ -450,7 +638,10 @@ tc_res tc_lgetattrsv(struct tc_attrs *attrs, int count, bool is_transaction)
 	TC_DECLARE_COUNTER(lgetattrs);
 
 	TC_START_COUNTER(lgetattrs);
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		tcres = tc_daemon_vec(TC_CPD_GETATTRS, attrs, sizeof(*attrs),
+				      count, is_transaction);
+	} else if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_lgetattrsv(attrs, count, is_transaction);
 	} else {
 		tcres = posix_lgetattrsv(attrs, count, is_transaction);
@@ -472,7 +663,12 @@ static int tc_stat_impl(tc_file tcf, struct stat *buf, bool readlink)
 		.masks = TC_ATTRS_MASK_ALL,
 	};
 
-	tcres = tc_lgetattrsv(&tca, 1, false);
+	/* NFS4 follows symlinks within the compound when it can. */
+	if (readlink && TC_IMPL_IS_NFS4) {
+		tcres = tc_getattrsv(&tca, 1, false);
+	} else {
+		tcres = tc_lgetattrsv(&tca, 1, false);
+	}
 	if (!tc_okay(tcres)) {
 		return tcres.err_no;
 	}
@@ -529,6 +725,11 @@ tc_res tc_setattrsv(struct tc_attrs *attrs, int count, bool is_transaction)
 	int i;
 	bool had_link;
 
+	/* compounds of the daemon do not follow symlinks */
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
 	for(i = 0; i < count; i++) {
 		if (attrs[i].file.type == TC_FILE_PATH) {
 			syminfo[i].src_path = attrs[i].file.path;
@@ -571,7 +772,10 @@ tc_res tc_lsetattrsv(struct tc_attrs *attrs, int count, bool is_transaction)
 	TC_DECLARE_COUNTER(lsetattrs);
 
 	TC_START_COUNTER(lsetattrs);
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		tcres = tc_daemon_vec(TC_CPD_SETATTRS, attrs, sizeof(*attrs),
+				      count, is_transaction);
+	} else if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_lsetattrsv(attrs, count, is_transaction);
 	} else {
 		tcres = posix_lsetattrsv(attrs, count, is_transaction);
@@ -652,6 +856,9 @@ tc_res tc_listdirv(const char **dirs, int count, struct tc_attrs_masks masks,
 	TC_DECLARE_COUNTER(listdir);
 
 	if (count == 0) return TC_OKAY;
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
 
 	TC_START_COUNTER(listdir);
 	if (TC_IMPL_IS_NFS4) {
@@ -672,7 +879,10 @@ tc_res tc_renamev(tc_file_pair *pairs, int count, bool is_transaction)
 	TC_DECLARE_COUNTER(rename);
 
 	TC_START_COUNTER(rename);
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		tcres = tc_daemon_vec(TC_CPD_RENAME, pairs, sizeof(*pairs),
+				      count, is_transaction);
+	} else if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_renamev(pairs, count, is_transaction);
 	} else {
 		tcres = posix_renamev(pairs, count, is_transaction);
@@ -688,7 +898,10 @@ tc_res tc_removev(tc_file *files, int count, bool is_transaction)
 	TC_DECLARE_COUNTER(remove);
 
 	TC_START_COUNTER(remove);
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		tcres = tc_daemon_vec(TC_CPD_REMOVE, files, sizeof(*files),
+				      count, is_transaction);
+	} else if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_removev(files, count, is_transaction);
 	} else {
 		tcres = posix_removev(files, count, is_transaction);
@@ -731,7 +944,10 @@ tc_res tc_mkdirv(struct tc_attrs *dirs, int count, bool is_transaction)
 	for (i = 0; i < count; ++i) {
 		assert(dirs[i].masks.has_mode);
 	}
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		tcres = tc_daemon_vec(TC_CPD_MKDIR, dirs, sizeof(*dirs), count,
+				      is_transaction);
+	} else if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_mkdirv(dirs, count, is_transaction);
 	} else {
 		tcres = posix_mkdirv(dirs, count, is_transaction);
@@ -820,6 +1036,41 @@ exit:
 	return tcres;
 }
 
+static tc_res daemon_ensure_dir(slice_t *comps, int n, mode_t mode)
+{
+	struct tc_attrs *dirs;
+	buf_t *path;
+	tc_res tcres;
+	int i;
+
+	dirs = calloc(n, sizeof(*dirs));
+	if (!dirs) {
+		return tc_failure(0, ENOMEM);
+	}
+	path = new_auto_buf(PATH_MAX + 1);
+	for (i = 0; i < n; ++i) {
+		tc_path_append(path, comps[i]);
+		tc_set_up_creation(&dirs[i], strdupa(asstr(path)), mode);
+	}
+
+	/* one compound; directories that exist are skipped */
+	tcres = tc_mkdirv(dirs, n, false);
+	while (!tc_okay(tcres) && tcres.err_no == EEXIST &&
+	       tcres.index + 1 < n) {
+		i = tcres.index + 1;
+		tcres = tc_mkdirv(dirs + i, n - i, false);
+		if (!tc_okay(tcres)) {
+			tcres.index += i;
+		}
+	}
+	if (!tc_okay(tcres) && tcres.err_no == EEXIST) {
+		tcres = TC_OKAY;
+	}
+
+	free(dirs);
+	return tcres;
+}
+
 tc_res tc_ensure_dir(const char *dir, mode_t mode, slice_t *leaf)
 {
 	tc_res tcres = TC_OKAY;
@@ -839,7 +1090,9 @@ tc_res tc_ensure_dir(const char *dir, mode_t mode, slice_t *leaf)
 		goto exit;
 	}
 
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		tcres = daemon_ensure_dir(comps, n, mode);
+	} else if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_ensure_dir(comps, n, mode);
 	} else {
 		tcres = posix_ensure_dir(comps, n, mode);
@@ -855,6 +1108,10 @@ tc_res tc_lcopyv(struct tc_extent_pair *pairs, int count, bool is_transaction)
 	tc_res tcres;
 	TC_DECLARE_COUNTER(lcopy);
 
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
 	TC_START_COUNTER(lcopy);
 
 	if (TC_IMPL_IS_NFS4) {
@@ -911,7 +1168,47 @@ tc_pair(struct tc_extent_pair *pairs, int count, bool is_transaction,
 
 tc_res tc_copyv(struct tc_extent_pair *pairs, int count, bool is_transaction)
 {
-	return tc_pair(pairs, count, is_transaction, tc_lcopyv);
+	tc_res tcres;
+	TC_DECLARE_COUNTER(copy);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+	if (!TC_IMPL_IS_NFS4) {
+		return tc_pair(pairs, count, is_transaction, tc_lcopyv);
+	}
+
+	TC_START_COUNTER(copy);
+	tcres = nfs4_copyv(pairs, count, is_transaction);
+	TC_STOP_COUNTER(copy, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+/*
+ * Preallocate the destinations of "iovs" that are large enough to benefit,
+ * in one compound.  It is only a hint, so failures are ignored.
+ */
+static void tc_preallocate(const struct tc_iovec *iovs, int count)
+{
+	struct tc_extent *exts;
+	int n = 0;
+	int i;
+
+	exts = malloc(count * sizeof(*exts));
+	if (!exts) {
+		return;
+	}
+	for (i = 0; i < count; ++i) {
+		if (iovs[i].length >= TC_PREALLOC_MIN) {
+			tc_fill_extent(&exts[n++], iovs[i].file,
+				       iovs[i].offset, iovs[i].length, true);
+		}
+	}
+	if (n > 0) {
+		tc_fallocatev(exts, n, false);
+	}
+	free(exts);
 }
 
 /**
@@ -949,6 +1246,7 @@ tc_res tc_ldupv(struct tc_extent_pair *pairs, int count, bool is_transaction)
 		iovs[i].is_write_stable = true;
 		iovs[i].is_failure = false;
 	}
+	tc_preallocate(iovs, count);
 	tcres = tc_writev(iovs, count, is_transaction);
 	if (!tc_okay(tcres)) {
 		fprintf(stderr,
@@ -968,6 +1266,9 @@ exit:
 
 tc_res tc_dupv(struct tc_extent_pair *pairs, int count, bool is_transaction)
 {
+	if (tc_daemon) {
+		return tc_ldupv(pairs, count, is_transaction);
+	}
 	return tc_pair(pairs, count, is_transaction, tc_ldupv);
 }
 
@@ -977,6 +1278,10 @@ tc_res tc_hardlinkv(const char **oldpaths, const char **newpaths, int count,
 	tc_res tcres = TC_OKAY;
 	TC_DECLARE_COUNTER(hardlink);
 
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
 	TC_START_COUNTER(hardlink);
 	if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_hardlinkv(oldpaths, newpaths, count, istxn);
@@ -994,6 +1299,10 @@ tc_res tc_symlinkv(const char **oldpaths, const char **newpaths, int count,
 	tc_res tcres = TC_OKAY;
 	TC_DECLARE_COUNTER(symlink);
 
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
 	TC_START_COUNTER(symlink);
 	if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_symlinkv(oldpaths, newpaths, count, istxn);
@@ -1011,6 +1320,10 @@ tc_res tc_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
 	tc_res tcres;
 	TC_DECLARE_COUNTER(readlink);
 
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
 	TC_START_COUNTER(readlink);
 	if (TC_IMPL_IS_NFS4) {
 		tcres = nfs4_readlinkv(paths, bufs, bufsizes, count, istxn);
@@ -1022,15 +1335,603 @@ tc_res tc_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
 	return tcres;
 }
 
+tc_res tc_lockv(struct tc_lock *locks, int count, bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(lock);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(lock);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_lockv(locks, count, is_transaction);
+	} else {
+		tcres = posix_lockv(locks, count, is_transaction);
+	}
+	TC_STOP_COUNTER(lock, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+tc_res tc_unlockv(struct tc_lock *locks, int count, bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(unlock);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(unlock);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_unlockv(locks, count, is_transaction);
+	} else {
+		tcres = posix_unlockv(locks, count, is_transaction);
+	}
+	TC_STOP_COUNTER(unlock, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+tc_res tc_testlockv(struct tc_lock *locks, int count, bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(testlock);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(testlock);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_testlockv(locks, count, is_transaction);
+	} else {
+		tcres = posix_testlockv(locks, count, is_transaction);
+	}
+	TC_STOP_COUNTER(testlock, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+tc_res tc_fallocatev(struct tc_extent *extents, int count,
+		     bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(fallocate);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(fallocate);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_fallocatev(extents, count, is_transaction);
+	} else {
+		tcres = posix_fallocatev(extents, count, is_transaction);
+	}
+	TC_STOP_COUNTER(fallocate, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+tc_res tc_punchholev(struct tc_extent *extents, int count,
+		     bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(punchhole);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(punchhole);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_punchholev(extents, count, is_transaction);
+	} else {
+		tcres = posix_punchholev(extents, count, is_transaction);
+	}
+	TC_STOP_COUNTER(punchhole, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+tc_res tc_getxattrsv(struct tc_xattr *xattrs, int count,
+		     bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(getxattr);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(getxattr);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_getxattrsv(xattrs, count, is_transaction);
+	} else {
+		tcres = posix_getxattrsv(xattrs, count, is_transaction);
+	}
+	TC_STOP_COUNTER(getxattr, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+tc_res tc_setxattrsv(struct tc_xattr *xattrs, int count,
+		     bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(setxattr);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(setxattr);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_setxattrsv(xattrs, count, is_transaction);
+	} else {
+		tcres = posix_setxattrsv(xattrs, count, is_transaction);
+	}
+	TC_STOP_COUNTER(setxattr, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+tc_res tc_listxattrsv(const char **paths, char **bufs, size_t *bufsizes,
+		      int count, bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(listxattr);
+
+	if (tc_daemon) {
+		return tc_failure(0, ENOTSUP);
+	}
+
+	TC_START_COUNTER(listxattr);
+	if (TC_IMPL_IS_NFS4) {
+		tcres = nfs4_listxattrsv(paths, bufs, bufsizes, count,
+					 is_transaction);
+	} else {
+		tcres = posix_listxattrsv(paths, bufs, bufsizes, count,
+					  is_transaction);
+	}
+	TC_STOP_COUNTER(listxattr, count, tc_okay(tcres));
+
+	return tcres;
+}
+
+void tc_cpd_destroy(struct tc_compound *cpd)
+{
+	free(cpd->ops);
+	cpd->ops = NULL;
+	cpd->count = 0;
+	cpd->capacity = 0;
+}
+
+struct tc_cpd_op *tc_cpd_add(struct tc_compound *cpd, int type)
+{
+	struct tc_cpd_op *ops;
+	struct tc_cpd_op *op;
+	int capacity;
+
+	if (cpd->count == cpd->capacity) {
+		capacity = cpd->capacity ? cpd->capacity * 2 : 8;
+		ops = realloc(cpd->ops, capacity * sizeof(*ops));
+		if (!ops) {
+			return NULL;
+		}
+		cpd->ops = ops;
+		cpd->capacity = capacity;
+	}
+
+	op = cpd->ops + cpd->count++;
+	memset(op, 0, sizeof(*op));
+	op->type = type;
+	op->err_no = ECANCELED;
+	return op;
+}
+
+static inline int tc_cpd_index(const struct tc_compound *cpd,
+			       const struct tc_cpd_op *op)
+{
+	return op ? op - cpd->ops : -ENOMEM;
+}
+
+int tc_cpd_read(struct tc_compound *cpd, tc_file file, size_t offset,
+		size_t length, char *buf)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_READ);
+
+	if (op) {
+		tc_iov2file(&op->iov, &file, offset, length, buf);
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+int tc_cpd_write(struct tc_compound *cpd, tc_file file, size_t offset,
+		 size_t length, char *data, bool is_creation)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_WRITE);
+
+	if (op) {
+		tc_iov2file(&op->iov, &file, offset, length, data);
+		op->iov.is_creation = is_creation;
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+int tc_cpd_getattrs(struct tc_compound *cpd, tc_file file,
+		    struct tc_attrs_masks masks)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_GETATTRS);
+
+	if (op) {
+		op->attrs.file = file;
+		op->attrs.masks = masks;
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+int tc_cpd_setattrs(struct tc_compound *cpd, const struct tc_attrs *attrs)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_SETATTRS);
+
+	if (op) {
+		op->attrs = *attrs;
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+int tc_cpd_mkdir(struct tc_compound *cpd, const char *path, mode_t mode)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_MKDIR);
+
+	if (op) {
+		tc_set_up_creation(&op->attrs, path, mode);
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+int tc_cpd_remove(struct tc_compound *cpd, tc_file file)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_REMOVE);
+
+	if (op) {
+		op->file = file;
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+int tc_cpd_rename(struct tc_compound *cpd, tc_file src, tc_file dst)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_RENAME);
+
+	if (op) {
+		op->pair.src_file = src;
+		op->pair.dst_file = dst;
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+int tc_cpd_verify(struct tc_compound *cpd, const struct tc_attrs *attrs)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_VERIFY);
+
+	if (op) {
+		op->attrs = *attrs;
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+int tc_cpd_nverify(struct tc_compound *cpd, const struct tc_attrs *attrs)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_NVERIFY);
+
+	if (op) {
+		op->attrs = *attrs;
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+static tc_res tc_cpd_run(struct tc_cpd_op *ops, int count, bool is_transaction)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		ops[i].err_no = ECANCELED;
+		if (ops[i].type < TC_CPD_READ || ops[i].type > TC_CPD_NVERIFY ||
+		    (ops[i].type == TC_CPD_READ && ops[i].iov.is_creation)) {
+			ops[i].err_no = EINVAL;
+			return tc_failure(i, EINVAL);
+		}
+	}
+	if (tc_daemon) {
+		return tc_shm_cpdv(tc_daemon, ops, count, is_transaction);
+	} else if (TC_IMPL_IS_NFS4) {
+		return nfs4_cpdv(ops, count, is_transaction);
+	} else {
+		return posix_cpdv(ops, count, is_transaction);
+	}
+}
+
+tc_res tc_cpd_execute(struct tc_compound *cpd, bool is_transaction)
+{
+	tc_res tcres;
+	TC_DECLARE_COUNTER(compound);
+
+	TC_START_COUNTER(compound);
+	tcres = tc_cpd_run(cpd->ops, cpd->count, is_transaction);
+	TC_STOP_COUNTER(compound, cpd->count, tc_okay(tcres));
+
+	return tcres;
+}
+
+/*
+ * Add the guard of a conditional operation on "file", which is used unless
+ * "cond" has a file of its own.
+ */
+static int tc_cpd_guard(struct tc_compound *cpd, const struct tc_attrs *cond,
+			const tc_file *file)
+{
+	struct tc_cpd_op *op = tc_cpd_add(cpd, TC_CPD_VERIFY);
+
+	if (op) {
+		op->attrs = *cond;
+		if (cond->file.type == TC_FILE_NULL) {
+			op->attrs.file = *file;
+		}
+	}
+	return tc_cpd_index(cpd, op);
+}
+
+/*
+ * Execute "cpd" made of (guard, operation) pairs.  The compound stops at a
+ * false guard, so execution is resumed after the operation it guards; every
+ * pair is thus tried, and there is one round trip unless there is conflict.
+ */
+static tc_res tc_cpd_execute_guarded(struct tc_compound *cpd, bool *conflicts)
+{
+	int npairs = cpd->count / 2;
+	int from = 0;
+	int i;
+	tc_res tcres;
+
+	memset(conflicts, 0, npairs * sizeof(*conflicts));
+	while (from < npairs) {
+		tcres = tc_cpd_run(cpd->ops + from * 2, (npairs - from) * 2,
+				   false);
+		if (tc_okay(tcres)) {
+			break;
+		}
+		i = from + tcres.index / 2;
+		if (tcres.index % 2 != 0 || tcres.err_no != EAGAIN) {
+			return tc_failure(i, tcres.err_no);
+		}
+		conflicts[i] = true;
+		from = i + 1;
+	}
+
+	return tc_failure(npairs, 0);
+}
+
+tc_res tc_writev_if(struct tc_iovec *writes, const struct tc_attrs *conds,
+		    bool *conflicts, int count)
+{
+	struct tc_compound cpd = TC_COMPOUND_INITIALIZER;
+	struct tc_cpd_op *op;
+	tc_res tcres;
+	int i;
+	TC_DECLARE_COUNTER(write_if);
+
+	TC_START_COUNTER(write_if);
+	for (i = 0; i < count; ++i) {
+		if (tc_cpd_guard(&cpd, &conds[i], &writes[i].file) < 0 ||
+		    !(op = tc_cpd_add(&cpd, TC_CPD_WRITE))) {
+			tcres = tc_failure(i, ENOMEM);
+			goto exit;
+		}
+		op->iov = writes[i];
+	}
+
+	tcres = tc_cpd_execute_guarded(&cpd, conflicts);
+	for (i = 0; i < count; ++i) {
+		if (cpd.ops[i * 2 + 1].err_no == 0) {
+			writes[i] = cpd.ops[i * 2 + 1].iov;
+		}
+	}
+
+exit:
+	tc_cpd_destroy(&cpd);
+	TC_STOP_COUNTER(write_if, count, tc_okay(tcres));
+	return tcres;
+}
+
+tc_res tc_renamev_if(struct tc_file_pair *pairs, const struct tc_attrs *conds,
+		     bool *conflicts, int count)
+{
+	struct tc_compound cpd = TC_COMPOUND_INITIALIZER;
+	tc_res tcres;
+	int i;
+	TC_DECLARE_COUNTER(rename_if);
+
+	TC_START_COUNTER(rename_if);
+	for (i = 0; i < count; ++i) {
+		if (tc_cpd_guard(&cpd, &conds[i], &pairs[i].src_file) < 0 ||
+		    tc_cpd_rename(&cpd, pairs[i].src_file,
+				  pairs[i].dst_file) < 0) {
+			tcres = tc_failure(i, ENOMEM);
+			goto exit;
+		}
+	}
+
+	tcres = tc_cpd_execute_guarded(&cpd, conflicts);
+
+exit:
+	tc_cpd_destroy(&cpd);
+	TC_STOP_COUNTER(rename_if, count, tc_okay(tcres));
+	return tcres;
+}
+
+static bool tc_adb_valid(const struct tc_adb *adb)
+{
+	size_t bs = adb->adb_block_size;
+
+	if (bs == 0) {
+		return false;
+	}
+	if (adb->adb_reloff_pattern != UINT64_MAX &&
+	    (adb->adb_reloff_pattern > bs ||
+	     adb->adb_pattern_size > bs - adb->adb_reloff_pattern)) {
+		return false;
+	}
+	if (adb->adb_reloff_blocknum != UINT64_MAX &&
+	    (adb->adb_reloff_blocknum > bs ||
+	     sizeof(uint64_t) > bs - adb->adb_reloff_blocknum)) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Fill "block" with the "k"-th block of "adb": zeros, the pattern, and the
+ * ADBN as an XDR (big-endian) uint64.
+ */
+static void tc_adb_fill(const struct tc_adb *adb, size_t k, char *block)
+{
+	uint64_t adbn;
+
+	memset(block, 0, adb->adb_block_size);
+	if (adb->adb_reloff_pattern != UINT64_MAX) {
+		memcpy(block + adb->adb_reloff_pattern, adb->adb_pattern_data,
+		       adb->adb_pattern_size);
+	}
+	if (adb->adb_reloff_blocknum != UINT64_MAX) {
+		adbn = htobe64(adb->adb_block_num + k);
+		memcpy(block + adb->adb_reloff_blocknum, &adbn, sizeof(adbn));
+	}
+}
+
+/**
+ * The server does not support WRITE_SAME, so the blocks are built here and
+ * written with tc_writev(), TC_ADB_BATCH bytes at a time, after the ranges
+ * are preallocated in one compound.  A transaction is thus only atomic
+ * within a batch.
+ */
 tc_res tc_write_adb(struct tc_adb *patterns, int count, bool is_transaction)
 {
-	return TC_OKAY;
+	tc_res tcres = { .index = count, .err_no = 0 };
+	struct tc_adb *adb;
+	struct tc_iovec *iovs = NULL;
+	size_t *firsts = NULL;	/* first block of each iovec */
+	int *owners = NULL;	/* pattern of each iovec */
+	char *buf = NULL;
+	size_t bufsize = TC_ADB_BATCH;
+	size_t used;
+	size_t nblocks;
+	size_t bs;
+	size_t b;
+	size_t k = 0;
+	int p = 0;
+	int unwritten = 0;	/* first pattern not written at all */
+	int n;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (!tc_adb_valid(&patterns[i])) {
+			tcres = tc_failure(i, EINVAL);
+			goto exit;
+		}
+		if (patterns[i].adb_block_size > bufsize) {
+			bufsize = patterns[i].adb_block_size;
+		}
+	}
+
+	iovs = calloc(count, sizeof(*iovs));
+	firsts = calloc(count, sizeof(*firsts));
+	owners = calloc(count, sizeof(*owners));
+	buf = malloc(bufsize);
+	if (!iovs || !firsts || !owners || !buf) {
+		tcres = tc_failure(0, ENOMEM);
+		goto exit;
+	}
+
+	for (i = 0; i < count; ++i) {
+		tc_iov4creation(&iovs[i], patterns[i].path,
+				patterns[i].adb_block_size *
+				    patterns[i].adb_block_count,
+				NULL);
+		iovs[i].offset = patterns[i].adb_offset;
+	}
+	tc_preallocate(iovs, count);
+
+	/* each batch has at most one iovec per pattern */
+	while (p < count) {
+		n = 0;
+		used = 0;
+		while (p < count) {
+			adb = &patterns[p];
+			if (k == adb->adb_block_count) {
+				++p;
+				k = 0;
+				continue;
+			}
+			bs = adb->adb_block_size;
+			nblocks = (bufsize - used) / bs;
+			if (nblocks == 0) {
+				break;
+			}
+			if (nblocks > adb->adb_block_count - k) {
+				nblocks = adb->adb_block_count - k;
+			}
+			for (b = 0; b < nblocks; ++b) {
+				tc_adb_fill(adb, k + b, buf + used + b * bs);
+			}
+			tc_iov4creation(&iovs[n], adb->path, nblocks * bs,
+					buf + used);
+			iovs[n].offset = adb->adb_offset + k * bs;
+			owners[n] = p;
+			firsts[n++] = k;
+			used += nblocks * bs;
+			k += nblocks;
+		}
+		if (n == 0) {
+			break;
+		}
+
+		tcres = tc_writev(iovs, n, is_transaction);
+		if (!tc_okay(tcres)) {
+			/* a failed transaction writes none of the batch */
+			for (i = is_transaction ? 0 : tcres.index; i < n; ++i) {
+				patterns[owners[i]].adb_block_count = firsts[i];
+			}
+			unwritten = owners[n - 1] + 1;
+			tcres.index = owners[tcres.index];
+			goto exit;
+		}
+	}
+	tcres.index = count;
+
+exit:
+	if (!tc_okay(tcres)) {
+		for (i = unwritten; i < count; ++i) {
+			patterns[i].adb_block_count = 0;
+		}
+	}
+	free(buf);
+	free(owners);
+	free(firsts);
+	free(iovs);
+	return tcres;
 }
 
 
 int tc_chdir(const char *path)
 {
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		return tc_shm_chdir(tc_daemon, path);
+	} else if (TC_IMPL_IS_NFS4) {
 		return nfs4_chdir(path);
 	} else {
 		return posix_chdir(path);
@@ -1039,7 +1940,9 @@ int tc_chdir(const char *path)
 
 char *tc_getcwd()
 {
-	if (TC_IMPL_IS_NFS4) {
+	if (tc_daemon) {
+		return strdup(tc_shm_getcwd(tc_daemon));
+	} else if (TC_IMPL_IS_NFS4) {
 		return nfs4_getcwd();
 	} else {
 		return posix_getcwd();
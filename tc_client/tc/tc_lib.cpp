@@ -334,6 +334,8 @@ tc_res tc_cp_recursive(const char *src_dir, const char *dst, bool symlink,
 	cbargs.dirs = &dirs;
 	cbargs.files = &files_to_copy;
 	cbargs.symlinks = &symlinks;
+	// a recursive copy should not slow down interactive requests
+	int old_prio = tc_set_thread_priority(TC_PRIO_BULK);
 
 	dirs.push_back(strdup(src_dir));
 
@@ -389,6 +391,7 @@ tc_res tc_cp_recursive(const char *src_dir, const char *dst, bool symlink,
 	free_paths(&dirs);
 	free_attrs(&files_to_copy);
 	free_paths(&symlinks);
+	tc_set_thread_priority(old_prio);
 
 	return tcres;
 }
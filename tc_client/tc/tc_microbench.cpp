@@ -0,0 +1,289 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Microbenchmarks of the CPU-bound parts of the client: XDR of compounds,
+ * attribute conversion, splitting of iovec arrays and path manipulation.
+ * They need no server, so they can be run on every commit; "items_per_second"
+ * is in operations (or iovecs, or paths) so the cost per op can be compared
+ * across sizes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include "tc_api.h"
+#include "tc_helper.h"
+#include "iovec_utils.h"
+#include "path_utils.h"
+#include "nfs4/compound_bench.h"
+#include "nfs4/tc_impl_nfs4.h"
+
+using std::string;
+using std::vector;
+
+/* Items of a compound are its ops, or its entries for READDIR. */
+static int64_t BenchItems(const benchmark::State &state,
+			  enum nfs4_bench_kind kind,
+			  const struct nfs4_compound_bench *b)
+{
+	return kind == NFS4_BENCH_READDIR ? state.range(0)
+					  : nfs4_compound_bench_nops(b);
+}
+
+static void BM_EncodeCompound(benchmark::State &state,
+			      enum nfs4_bench_kind kind)
+{
+	struct nfs4_compound_bench *b =
+	    nfs4_compound_bench_new(kind, state.range(0), 4096);
+	if (!b) {
+		state.SkipWithError("cannot build the compound");
+		return;
+	}
+	int64_t bytes = 0;
+
+	while (state.KeepRunning()) {
+		int n = nfs4_compound_bench_encode(b);
+		if (n <= 0) {
+			state.SkipWithError("encoding failed");
+			break;
+		}
+		bytes += n;
+	}
+
+	state.SetItemsProcessed(state.iterations() *
+				BenchItems(state, kind, b));
+	state.SetBytesProcessed(bytes);
+	nfs4_compound_bench_free(b);
+}
+
+static void BM_DecodeCompound(benchmark::State &state,
+			      enum nfs4_bench_kind kind)
+{
+	struct nfs4_compound_bench *b =
+	    nfs4_compound_bench_new(kind, state.range(0), 4096);
+	if (!b) {
+		state.SkipWithError("cannot build the compound");
+		return;
+	}
+	int64_t bytes = 0;
+
+	while (state.KeepRunning()) {
+		int n = nfs4_compound_bench_decode(b);
+		if (n <= 0) {
+			state.SkipWithError("decoding failed");
+			break;
+		}
+		bytes += n;
+	}
+
+	state.SetItemsProcessed(state.iterations() *
+				BenchItems(state, kind, b));
+	state.SetBytesProcessed(bytes);
+	nfs4_compound_bench_free(b);
+}
+
+BENCHMARK_CAPTURE(BM_EncodeCompound, Read, NFS4_BENCH_READ)
+    ->RangeMultiplier(2)->Range(1, 32);
+BENCHMARK_CAPTURE(BM_EncodeCompound, Write, NFS4_BENCH_WRITE)
+    ->RangeMultiplier(2)->Range(1, 32);
+BENCHMARK_CAPTURE(BM_EncodeCompound, Getattr, NFS4_BENCH_GETATTR)
+    ->RangeMultiplier(2)->Range(1, 32);
+BENCHMARK_CAPTURE(BM_DecodeCompound, Read, NFS4_BENCH_READ)
+    ->RangeMultiplier(2)->Range(1, 32);
+BENCHMARK_CAPTURE(BM_DecodeCompound, Write, NFS4_BENCH_WRITE)
+    ->RangeMultiplier(2)->Range(1, 32);
+BENCHMARK_CAPTURE(BM_DecodeCompound, Getattr, NFS4_BENCH_GETATTR)
+    ->RangeMultiplier(2)->Range(1, 32);
+BENCHMARK_CAPTURE(BM_DecodeCompound, Readdir, NFS4_BENCH_READDIR)
+    ->RangeMultiplier(4)->Range(16, 1024);
+
+static void BM_Fattr4ToTcAttrs(benchmark::State &state)
+{
+	int nfiles = state.range(0);
+	struct nfs4_compound_bench *b =
+	    nfs4_compound_bench_new(NFS4_BENCH_GETATTR, nfiles, 0);
+	if (!b) {
+		state.SkipWithError("cannot build the compound");
+		return;
+	}
+	vector<struct tc_attrs> attrs(nfiles);
+
+	while (state.KeepRunning()) {
+		int n = nfs4_compound_bench_convert_attrs(b, attrs.data());
+		if (n != nfiles) {
+			state.SkipWithError("conversion failed");
+			break;
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations() * nfiles);
+	nfs4_compound_bench_free(b);
+}
+BENCHMARK(BM_Fattr4ToTcAttrs)->Arg(32);
+
+static void BM_SplitIovArray(benchmark::State &state)
+{
+	int count = state.range(0);
+	size_t iosize = state.range(1);
+	vector<struct tc_iovec> iovs(count);
+	char *data = (char *)malloc(iosize);
+	vector<string> paths(count);
+
+	for (int i = 0; i < count; ++i) {
+		paths[i] = "/vfs0/tc_bench/file-" + std::to_string(i);
+		iovs[i].file = tc_file_from_path(paths[i].c_str());
+		iovs[i].offset = 0;
+		iovs[i].length = iosize;
+		iovs[i].data = data;
+	}
+	struct tc_iov_array iova = tc_iovs2array(iovs.data(), count);
+
+	while (state.KeepRunning()) {
+		int nparts;
+		struct tc_iov_array *parts =
+		    tc_split_iov_array(&iova, 1 << 20, &nparts);
+		if (!parts) {
+			state.SkipWithError("splitting failed");
+			break;
+		}
+		if (!tc_restore_iov_array(&iova, &parts, nparts)) {
+			state.SkipWithError("restoring failed");
+			break;
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations() * count);
+	free(data);
+}
+BENCHMARK(BM_SplitIovArray)
+    ->ArgPair(64, 4096)
+    ->ArgPair(64, 64 << 10)
+    ->ArgPair(256, 16 << 10)
+    ->ArgPair(16, 1 << 20);
+
+static const char *kDeepPath = "/vfs0/tc_bench/dir-7/sub-3/data/file-1234";
+
+static void BM_PathTokenize(benchmark::State &state)
+{
+	slice_t path = toslice(kDeepPath);
+
+	while (state.KeepRunning()) {
+		slice_t *comps;
+		int n = tc_path_tokenize_s(path, &comps);
+		if (n <= 0) {
+			state.SkipWithError("tokenizing failed");
+			break;
+		}
+		free(comps);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PathTokenize);
+
+static void BM_PathTokenizeArray(benchmark::State &state)
+{
+	slice_t path = toslice(kDeepPath);
+	slice_t comps[TC_PATH_MAX_COMPS];
+
+	while (state.KeepRunning()) {
+		int n = tc_path_tokenize_a(path, comps, TC_PATH_MAX_COMPS);
+		if (n <= 0) {
+			state.SkipWithError("tokenizing failed");
+			break;
+		}
+		benchmark::DoNotOptimize(comps);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PathTokenizeArray);
+
+static void BM_PathRebase(benchmark::State &state)
+{
+	slice_t base = toslice("/vfs0/tc_bench/dir-7/sub-3/data/file-1233");
+	slice_t path = toslice(kDeepPath);
+	char rawbuf[PATH_MAX];
+	buf_t buf = mkbuf(rawbuf, PATH_MAX);
+
+	while (state.KeepRunning()) {
+		buf_reset(&buf);
+		int n = tc_path_rebase_s(base, path, &buf);
+		if (n <= 0) {
+			state.SkipWithError("rebasing failed");
+			break;
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PathRebase);
+
+static void BM_PathRebaseArray(benchmark::State &state)
+{
+	slice_t base = toslice("/vfs0/tc_bench/dir-7/sub-3/data/file-1233");
+	slice_t path = toslice(kDeepPath);
+	slice_t comps[TC_PATH_MAX_COMPS];
+
+	while (state.KeepRunning()) {
+		int n = tc_path_rebase_a(base, path, comps, TC_PATH_MAX_COMPS);
+		if (n <= 0) {
+			state.SkipWithError("rebasing failed");
+			break;
+		}
+		benchmark::DoNotOptimize(comps);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PathRebaseArray);
+
+static void BM_CompressPaths(benchmark::State &state)
+{
+	int count = state.range(0);
+	vector<struct tc_iovec> iovs(count);
+	vector<string> paths(count);
+
+	for (int i = 0; i < count; ++i) {
+		paths[i] = "/vfs0/tc_bench/dir-" + std::to_string(i / 16) +
+			   "/file-" + std::to_string(i);
+		iovs[i].file = tc_file_from_path(paths[i].c_str());
+		iovs[i].length = 4096;
+	}
+
+	while (state.KeepRunning()) {
+		tc_file *saved = nfs4_compress_paths(iovs.data(), count);
+		if (!saved) {
+			state.SkipWithError("compressing failed");
+			break;
+		}
+		nfs4_decompress_paths(iovs.data(), count, saved);
+	}
+
+	state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_CompressPaths)->RangeMultiplier(4)->Range(4, 256);
+
+BENCHMARK_MAIN();
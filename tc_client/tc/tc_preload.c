@@ -0,0 +1,2109 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "tc_preload.h"
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "tc_api.h"
+#include "tc_helper.h"
+#include "path_utils.h"
+
+#define TCP_MAX_FDS 4096
+#define TCP_BUCKETS 4096
+#define TCP_MAX_CACHED (64 << 10)	/* entries */
+#define TCP_READAHEAD (64 << 10)
+#define TCP_MAX_READAHEAD (1 << 20)
+#define TCP_WRITE_BUFSIZE (1 << 20)
+#define TCP_SMALL_FILE (64 << 10)	/* largest file prefetched in batches */
+#define TCP_BATCH 16			/* files per prefetch */
+#define TCP_BATCH_BYTES (1 << 20)
+
+/* Attributes and prefetched contents of a TC path. */
+struct tcp_entry {
+	struct tcp_entry *next;
+	char *path;
+	uint64_t expires;	/* in ns since the epoch */
+	bool has_stat;
+	struct stat st;
+	char *data;		/* NULL if not prefetched */
+	size_t len;
+	bool whole;		/* whether "data" is the whole file */
+};
+
+struct tcp_file {
+	char *path;		/* TC path */
+	int flags;
+	mode_t mode;		/* of the file to create */
+	int kind;		/* TC_PRELOAD_READ or TC_PRELOAD_WRITE */
+	off_t pos;
+	bool create;		/* creation not sent yet */
+	bool trunc;		/* truncation not sent yet */
+	/* read buffer holding [roff, roff + rlen) */
+	char *rbuf;
+	size_t rlen;
+	off_t roff;
+	bool reof;
+	size_t readahead;
+	/* write-behind buffer holding [woff, woff + wlen) */
+	char *wbuf;
+	size_t wlen;
+	size_t wcap;
+	off_t woff;
+};
+
+struct tcp_dir {
+	struct tcp_dir *next;
+	struct dirent *ents;
+	int count;
+	int capacity;
+	int pos;
+	char *path;		/* TC path */
+};
+
+/* Small regular files of the last listed directory, in listing order. */
+struct tcp_hint {
+	char **paths;
+	size_t *sizes;
+	int count;
+	int capacity;
+	int next;		/* where the next open() is expected */
+};
+
+static struct {
+	int (*open)(const char *path, int flags, ...);
+	int (*open64)(const char *path, int flags, ...);
+	int (*openat)(int dirfd, const char *path, int flags, ...);
+	int (*openat64)(int dirfd, const char *path, int flags, ...);
+	int (*close)(int fd);
+	ssize_t (*read)(int fd, void *buf, size_t count);
+	ssize_t (*write)(int fd, const void *buf, size_t count);
+	ssize_t (*pread)(int fd, void *buf, size_t count, off_t off);
+	ssize_t (*pwrite)(int fd, const void *buf, size_t count, off_t off);
+	ssize_t (*readv)(int fd, const struct iovec *iov, int iovcnt);
+	ssize_t (*writev)(int fd, const struct iovec *iov, int iovcnt);
+	ssize_t (*preadv)(int fd, const struct iovec *iov, int iovcnt,
+			  off_t off);
+	ssize_t (*pwritev)(int fd, const struct iovec *iov, int iovcnt,
+			   off_t off);
+	int (*ftruncate)(int fd, off_t len);
+	int (*dup)(int fd);
+	int (*dup2)(int oldfd, int newfd);
+	int (*dup3)(int oldfd, int newfd, int flags);
+	int (*fcntl)(int fd, int cmd, ...);
+	int (*fcntl64)(int fd, int cmd, ...);
+	off_t (*lseek)(int fd, off_t off, int whence);
+	int (*fsync)(int fd);
+	int (*fdatasync)(int fd);
+	int (*stat)(const char *path, struct stat *st);
+	int (*lstat)(const char *path, struct stat *st);
+	int (*fstat)(int fd, struct stat *st);
+	int (*__xstat)(int ver, const char *path, struct stat *st);
+	int (*__lxstat)(int ver, const char *path, struct stat *st);
+	int (*__fxstat)(int ver, int fd, struct stat *st);
+	int (*fstatat)(int dirfd, const char *path, struct stat *st,
+		       int flags);
+	int (*__fxstatat)(int ver, int dirfd, const char *path,
+			  struct stat *st, int flags);
+#ifdef STATX_BASIC_STATS
+	int (*statx)(int dirfd, const char *path, int flags,
+		     unsigned int mask, struct statx *stx);
+#endif
+	int (*access)(const char *path, int mode);
+	int (*faccessat)(int dirfd, const char *path, int mode, int flags);
+	DIR *(*opendir)(const char *path);
+	struct dirent *(*readdir)(DIR *dir);
+	int (*closedir)(DIR *dir);
+	void (*rewinddir)(DIR *dir);
+	int (*dirfd)(DIR *dir);
+	int (*unlink)(const char *path);
+	int (*mkdir)(const char *path, mode_t mode);
+	int (*rmdir)(const char *path);
+	int (*rename)(const char *oldpath, const char *newpath);
+	FILE *(*fopen)(const char *path, const char *mode);
+} real;
+
+static pthread_once_t tcp_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t tcp_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *tcp_prefix;	/* NULL if disabled */
+static size_t tcp_prefix_len;
+static char *tcp_root;
+static uint64_t tcp_ttl = 1000000000ULL;
+static mode_t tcp_umask;
+static void *tcp_context;
+static bool tcp_init_failed;
+
+/* non-zero while a thread is inside TC, whose own calls go to libc */
+static __thread int tcp_depth;
+
+static struct tcp_file *tcp_files[TCP_MAX_FDS];
+static struct tcp_entry *tcp_cache[TCP_BUCKETS];
+static int tcp_cached;
+static struct tcp_dir *tcp_dirs;
+static struct tcp_hint tcp_hint;
+
+static uint64_t tcp_calls[TC_PRELOAD_KINDS];
+static uint64_t tcp_rpcs[TC_PRELOAD_KINDS];
+static uint64_t tcp_folded;	/* calls since the last RPC */
+static struct tc_func_counter tcp_rpc_counter = { .name = "preload_rpc" };
+
+static void tcp_load_config(void)
+{
+	const char *prefix = getenv("TC_PRELOAD_PREFIX");
+	const char *root = getenv("TC_PRELOAD_ROOT");
+	const char *ttl = getenv("TC_PRELOAD_TTL_MS");
+	char buf[PATH_MAX];
+
+#define TCP_REAL(name) real.name = dlsym(RTLD_NEXT, #name)
+	TCP_REAL(open);
+	TCP_REAL(open64);
+	TCP_REAL(openat);
+	TCP_REAL(openat64);
+	TCP_REAL(close);
+	TCP_REAL(read);
+	TCP_REAL(write);
+	TCP_REAL(pread);
+	TCP_REAL(pwrite);
+	TCP_REAL(readv);
+	TCP_REAL(writev);
+	TCP_REAL(preadv);
+	TCP_REAL(pwritev);
+	TCP_REAL(ftruncate);
+	TCP_REAL(dup);
+	TCP_REAL(dup2);
+	TCP_REAL(dup3);
+	TCP_REAL(fcntl);
+	TCP_REAL(fcntl64);
+	TCP_REAL(lseek);
+	TCP_REAL(fsync);
+	TCP_REAL(fdatasync);
+	TCP_REAL(stat);
+	TCP_REAL(lstat);
+	TCP_REAL(fstat);
+	TCP_REAL(__xstat);
+	TCP_REAL(__lxstat);
+	TCP_REAL(__fxstat);
+	TCP_REAL(fstatat);
+	TCP_REAL(__fxstatat);
+#ifdef STATX_BASIC_STATS
+	TCP_REAL(statx);
+#endif
+	TCP_REAL(access);
+	TCP_REAL(faccessat);
+	TCP_REAL(opendir);
+	TCP_REAL(readdir);
+	TCP_REAL(closedir);
+	TCP_REAL(rewinddir);
+	TCP_REAL(dirfd);
+	TCP_REAL(unlink);
+	TCP_REAL(mkdir);
+	TCP_REAL(rmdir);
+	TCP_REAL(rename);
+	TCP_REAL(fopen);
+#undef TCP_REAL
+
+	if (!prefix || prefix[0] != '/' ||
+	    tc_path_normalize(prefix, buf, sizeof(buf)) < 0) {
+		return;
+	}
+	tcp_umask = umask(022);
+	umask(tcp_umask);
+	tcp_prefix = strdup(buf);
+	tcp_prefix_len = strcmp(buf, "/") == 0 ? 0 : strlen(buf);
+	tcp_root = strdup(root ? root : buf);
+	if (ttl) {
+		tcp_ttl = strtoull(ttl, NULL, 10) * 1000000ULL;
+	}
+}
+
+static inline bool tcp_enabled(void)
+{
+	if (tcp_depth) {
+		return false;
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return tcp_prefix != NULL && !tcp_init_failed;
+}
+
+/* Initialize TC on the first call under the prefix; "tcp_lock" is held. */
+static bool tcp_init_tc(void)
+{
+	const char *config = getenv("TC_PRELOAD_CONFIG");
+	const char *export_id = getenv("TC_PRELOAD_EXPORT_ID");
+	char buf[PATH_MAX];
+
+	if (tcp_context || tcp_init_failed) {
+		return tcp_context != NULL;
+	}
+	++tcp_depth;
+	if (!config) {
+		config = get_tc_config_file(buf, PATH_MAX);
+	} else if (strcmp(config, "posix") == 0) {
+		config = NULL;
+	}
+	tcp_context = tc_init_lite(config, "/tmp/tc-preload.log",
+				   export_id ? atoi(export_id) : 77);
+	tcp_init_failed = (tcp_context == NULL);
+	--tcp_depth;
+	return tcp_context != NULL;
+}
+
+/*
+ * Translate "path" into the TC path "buf" if it is under the prefix.
+ */
+static bool tcp_map(const char *path, char *buf)
+{
+	char norm[PATH_MAX];
+	const char *rest;
+	bool ok;
+
+	if (!tcp_enabled() || !path || path[0] != '/' ||
+	    tc_path_normalize(path, norm, sizeof(norm)) < 0 ||
+	    strncmp(norm, tcp_prefix, tcp_prefix_len) != 0) {
+		return false;
+	}
+	rest = norm + tcp_prefix_len;
+	if (*rest != '/' && *rest != '\0') {
+		return false;
+	}
+	if (snprintf(buf, PATH_MAX, "%s%s", tcp_root,
+		     strcmp(tcp_root, "/") == 0 && *rest == '/' ? rest + 1
+								: rest) >=
+	    PATH_MAX) {
+		return false;
+	}
+
+	pthread_mutex_lock(&tcp_lock);
+	ok = tcp_init_tc();
+	pthread_mutex_unlock(&tcp_lock);
+	return ok;
+}
+
+static inline void tcp_count_call(int kind)
+{
+	__atomic_fetch_add(&tcp_calls[kind], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&tcp_folded, 1, __ATOMIC_RELAXED);
+}
+
+/* Account for an RPC, which carries the calls made since the last one. */
+static void tcp_count_rpc(int kind, const struct timespec *start, bool ok)
+{
+	struct timespec stop;
+	uint64_t calls;
+
+	now(&stop);
+	calls = __atomic_exchange_n(&tcp_folded, 0, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&tcp_rpcs[kind], 1, __ATOMIC_RELAXED);
+	tc_register_counter(&tcp_rpc_counter);
+	tc_counter_record(&tcp_rpc_counter, calls,
+			  timespec_diff(start, &stop), ok);
+}
+
+int tc_preload_get_stats(int kind, struct tc_preload_stats *stats)
+{
+	int i;
+
+	if (kind < 0 || kind > TC_PRELOAD_KINDS) {
+		return -EINVAL;
+	}
+	stats->calls = 0;
+	stats->rpcs = 0;
+	for (i = 0; i < TC_PRELOAD_KINDS; ++i) {
+		if (kind == i || kind == TC_PRELOAD_KINDS) {
+			stats->calls += tcp_calls[i];
+			stats->rpcs += tcp_rpcs[i];
+		}
+	}
+	return 0;
+}
+
+static inline int tcp_fail(int err)
+{
+	errno = err;
+	return -1;
+}
+
+/*
+ * Cache of attributes and prefetched data; all called with "tcp_lock" held.
+ */
+
+static inline uint64_t tcp_now(void)
+{
+	struct timespec ts;
+
+	now(&ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct tcp_entry **tcp_bucket(const char *path)
+{
+	uint64_t h = 14695981039346656037ULL;	/* FNV-1a */
+
+	for (; *path; ++path) {
+		h = (h ^ (unsigned char)*path) * 1099511628211ULL;
+	}
+	return &tcp_cache[h % TCP_BUCKETS];
+}
+
+static void tcp_free_entry(struct tcp_entry *e)
+{
+	free(e->path);
+	free(e->data);
+	free(e);
+	--tcp_cached;
+}
+
+static struct tcp_entry *tcp_lookup(const char *path)
+{
+	struct tcp_entry **pe = tcp_bucket(path);
+	struct tcp_entry *e;
+
+	for (; (e = *pe) != NULL; pe = &e->next) {
+		if (strcmp(e->path, path) != 0) {
+			continue;
+		}
+		if (e->expires > tcp_now()) {
+			return e;
+		}
+		*pe = e->next;
+		tcp_free_entry(e);
+		return NULL;
+	}
+	return NULL;
+}
+
+static void tcp_invalidate(const char *path)
+{
+	struct tcp_entry **pe = tcp_bucket(path);
+	struct tcp_entry *e;
+
+	for (; (e = *pe) != NULL; pe = &e->next) {
+		if (strcmp(e->path, path) == 0) {
+			*pe = e->next;
+			tcp_free_entry(e);
+			return;
+		}
+	}
+}
+
+static void tcp_clear_cache(void)
+{
+	struct tcp_entry *e;
+	int i;
+
+	for (i = 0; i < TCP_BUCKETS; ++i) {
+		while ((e = tcp_cache[i]) != NULL) {
+			tcp_cache[i] = e->next;
+			tcp_free_entry(e);
+		}
+	}
+}
+
+static struct tcp_entry *tcp_insert(const char *path)
+{
+	struct tcp_entry **pb;
+	struct tcp_entry *e = tcp_lookup(path);
+
+	if (e) {
+		e->expires = tcp_now() + tcp_ttl;
+		return e;
+	}
+	if (tcp_cached >= TCP_MAX_CACHED) {
+		tcp_clear_cache();
+	}
+	e = calloc(1, sizeof(*e));
+	if (!e || !(e->path = strdup(path))) {
+		free(e);
+		return NULL;
+	}
+	e->expires = tcp_now() + tcp_ttl;
+	pb = tcp_bucket(path);
+	e->next = *pb;
+	*pb = e;
+	++tcp_cached;
+	return e;
+}
+
+/* Symlinks are not cached, so cached attributes serve stat and lstat. */
+static void tcp_cache_stat(const char *path, const struct stat *st)
+{
+	struct tcp_entry *e;
+
+	if (S_ISLNK(st->st_mode)) {
+		return;
+	}
+	e = tcp_insert(path);
+	if (e) {
+		e->st = *st;
+		e->has_stat = true;
+	}
+}
+
+static void tcp_clear_hint(void)
+{
+	int i;
+
+	for (i = 0; i < tcp_hint.count; ++i) {
+		free(tcp_hint.paths[i]);
+	}
+	free(tcp_hint.paths);
+	free(tcp_hint.sizes);
+	memset(&tcp_hint, 0, sizeof(tcp_hint));
+}
+
+/*
+ * Directories
+ */
+
+/* Called with "tcp_lock" held. */
+static void tcp_add_hint(const char *path, size_t size)
+{
+	char **paths;
+	size_t *sizes;
+	int capacity;
+
+	if (tcp_hint.count == tcp_hint.capacity) {
+		capacity = tcp_hint.capacity ? tcp_hint.capacity * 2 : 64;
+		paths = realloc(tcp_hint.paths, capacity * sizeof(*paths));
+		if (!paths) {
+			return;
+		}
+		tcp_hint.paths = paths;
+		sizes = realloc(tcp_hint.sizes, capacity * sizeof(*sizes));
+		if (!sizes) {
+			return;
+		}
+		tcp_hint.sizes = sizes;
+		tcp_hint.capacity = capacity;
+	}
+	tcp_hint.paths[tcp_hint.count] = strdup(path);
+	if (tcp_hint.paths[tcp_hint.count]) {
+		tcp_hint.sizes[tcp_hint.count++] = size;
+	}
+}
+
+static bool tcp_add_dirent(const struct tc_attrs *entry, const char *dir,
+			   void *arg)
+{
+	struct tcp_dir *d = arg;
+	char path[PATH_MAX];
+	struct dirent *ents;
+	struct dirent *ent;
+	struct stat st;
+	slice_t name = tc_path_basename(entry->file.path);
+
+	if (d->count == d->capacity) {
+		d->capacity = d->capacity ? d->capacity * 2 : 64;
+		ents = realloc(d->ents, d->capacity * sizeof(*ents));
+		if (!ents) {
+			return false;
+		}
+		d->ents = ents;
+	}
+	ent = &d->ents[d->count++];
+	memset(ent, 0, sizeof(*ent));
+	ent->d_ino = entry->fileid;
+	ent->d_reclen = sizeof(*ent);
+	snprintf(ent->d_name, sizeof(ent->d_name), "%.*s", (int)name.size,
+		 name.data);
+	memset(&st, 0, sizeof(st));
+	tc_attrs2stat(entry, &st);
+	ent->d_type = IFTODT(st.st_mode);
+
+	/* for the stat() and open() that usually follow */
+	snprintf(path, sizeof(path), "%s/%s", d->path, ent->d_name);
+	pthread_mutex_lock(&tcp_lock);
+	tcp_cache_stat(path, &st);
+	if (S_ISREG(st.st_mode) && st.st_size <= TCP_SMALL_FILE) {
+		tcp_add_hint(path, st.st_size);
+	}
+	pthread_mutex_unlock(&tcp_lock);
+	return true;
+}
+
+static DIR *tcp_opendir(const char *path)
+{
+	struct timespec start;
+	struct tcp_dir *d;
+	tc_res tcres;
+
+	tcp_count_call(TC_PRELOAD_DIR);
+	d = calloc(1, sizeof(*d));
+	if (!d || !(d->path = strdup(path))) {
+		free(d);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&tcp_lock);
+	tcp_clear_hint();
+	pthread_mutex_unlock(&tcp_lock);
+
+	now(&start);
+	++tcp_depth;
+	tcres = tc_listdirv(&path, 1, TC_ATTRS_MASK_ALL, 0, false,
+			    tcp_add_dirent, d, false);
+	--tcp_depth;
+	tcp_count_rpc(TC_PRELOAD_DIR, &start, tc_okay(tcres));
+	if (!tc_okay(tcres)) {
+		free(d->ents);
+		free(d->path);
+		free(d);
+		errno = tcres.err_no;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&tcp_lock);
+	d->next = tcp_dirs;
+	tcp_dirs = d;
+	pthread_mutex_unlock(&tcp_lock);
+	return (DIR *)d;
+}
+
+/* Return "dir" if it was opened by us, and unlink it if "remove". */
+static struct tcp_dir *tcp_find_dir(DIR *dir, bool remove)
+{
+	struct tcp_dir **pd;
+	struct tcp_dir *d;
+
+	pthread_mutex_lock(&tcp_lock);
+	for (pd = &tcp_dirs; (d = *pd) != NULL; pd = &d->next) {
+		if ((DIR *)d == dir) {
+			if (remove) {
+				*pd = d->next;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&tcp_lock);
+	return d;
+}
+
+/*
+ * Files
+ */
+
+static inline struct tcp_file *tcp_file(int fd)
+{
+	if (fd < 0 || fd >= TCP_MAX_FDS || tcp_depth) {
+		return NULL;
+	}
+	return __atomic_load_n(&tcp_files[fd], __ATOMIC_ACQUIRE);
+}
+
+/* Return the index of "path" in the hint, or -1; "tcp_lock" is held. */
+static int tcp_hint_find(const char *path)
+{
+	int i;
+
+	if (tcp_hint.next < tcp_hint.count &&
+	    strcmp(tcp_hint.paths[tcp_hint.next], path) == 0) {
+		return tcp_hint.next;
+	}
+	for (i = 0; i < tcp_hint.count; ++i) {
+		if (strcmp(tcp_hint.paths[i], path) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Read the beginning of "f" into its read buffer.  If "f" is among the small
+ * files just listed, the files listed after it are read in the same
+ * compound, and kept in the cache for their own open().
+ *
+ * Return 0 or -errno.
+ */
+static int tcp_prefetch(struct tcp_file *f)
+{
+	struct tc_iovec iovs[TCP_BATCH];
+	size_t lens[TCP_BATCH];
+	struct timespec start;
+	struct tcp_entry *e;
+	size_t bytes;
+	tc_res tcres;
+	int ret = 0;
+	int n = 1;
+	int i;
+
+	memset(iovs, 0, sizeof(iovs));
+	lens[0] = TCP_READAHEAD;
+
+	pthread_mutex_lock(&tcp_lock);
+	e = tcp_lookup(f->path);
+	if (e && e->data) {
+		/* read along with an earlier file */
+		f->rbuf = e->data;
+		f->rlen = e->len;
+		f->reof = e->whole;
+		e->data = NULL;
+		pthread_mutex_unlock(&tcp_lock);
+		return 0;
+	}
+	i = tcp_hint_find(f->path);
+	if (i >= 0) {
+		/* one more byte tells whether the file has grown since */
+		lens[0] = tcp_hint.sizes[i] + 1;
+		bytes = lens[0];
+		tcp_hint.next = i + 1;
+		for (++i; i < tcp_hint.count && n < TCP_BATCH; ++i) {
+			if (bytes + tcp_hint.sizes[i] + 1 > TCP_BATCH_BYTES) {
+				break;
+			}
+			e = tcp_lookup(tcp_hint.paths[i]);
+			if (e && e->data) {
+				continue;
+			}
+			iovs[n].file = tc_file_from_path(
+			    strdup(tcp_hint.paths[i]));
+			lens[n] = tcp_hint.sizes[i] + 1;
+			bytes += lens[n++];
+		}
+	}
+	pthread_mutex_unlock(&tcp_lock);
+
+	iovs[0].file = tc_file_from_path(f->path);
+	for (i = 0; i < n; ++i) {
+		iovs[i].length = lens[i];
+		iovs[i].data = malloc(lens[i]);
+		if (!iovs[i].file.path || !iovs[i].data) {
+			ret = -ENOMEM;
+			n = i + 1;
+			goto exit;
+		}
+	}
+
+	now(&start);
+	++tcp_depth;
+	tcres = tc_readv(iovs, n, false);
+	--tcp_depth;
+	tcp_count_rpc(TC_PRELOAD_READ, &start, tc_okay(tcres));
+	if (!tc_okay(tcres) && tcres.index == 0) {
+		ret = -tcres.err_no;
+		goto exit;
+	}
+
+	f->rbuf = iovs[0].data;
+	f->rlen = iovs[0].length;
+	f->reof = iovs[0].length < lens[0];
+	iovs[0].data = NULL;
+
+	/* files after a failed one were not read */
+	pthread_mutex_lock(&tcp_lock);
+	for (i = 1; i < n && (tc_okay(tcres) || i < tcres.index); ++i) {
+		e = tcp_insert(iovs[i].file.path);
+		if (e) {
+			free(e->data);
+			e->data = iovs[i].data;
+			e->len = iovs[i].length;
+			e->whole = iovs[i].length < lens[i];
+			iovs[i].data = NULL;
+		}
+	}
+	pthread_mutex_unlock(&tcp_lock);
+
+exit:
+	for (i = 0; i < n; ++i) {
+		free(iovs[i].data);
+		if (i > 0) {
+			free((char *)iovs[i].file.path);
+		}
+	}
+	return ret;
+}
+
+/* Read at least "count" bytes at "off" into the read buffer of "f". */
+static int tcp_fill(struct tcp_file *f, off_t off, size_t count)
+{
+	struct timespec start;
+	struct tc_iovec iov;
+	tc_res tcres;
+	size_t len;
+	char *buf;
+
+	/* grow the read-ahead as long as reads are sequential */
+	if (f->rbuf && off == f->roff + (off_t)f->rlen) {
+		f->readahead = f->readahead * 2 > TCP_MAX_READAHEAD
+				   ? TCP_MAX_READAHEAD
+				   : f->readahead * 2;
+	} else {
+		f->readahead = TCP_READAHEAD;
+	}
+	len = count > f->readahead ? count : f->readahead;
+	buf = malloc(len);
+	if (!buf) {
+		return -ENOMEM;
+	}
+
+	memset(&iov, 0, sizeof(iov));
+	tc_iov2path(&iov, f->path, off, len, buf);
+	now(&start);
+	++tcp_depth;
+	tcres = tc_readv(&iov, 1, false);
+	--tcp_depth;
+	tcp_count_rpc(f->kind, &start, tc_okay(tcres));
+	if (!tc_okay(tcres)) {
+		free(buf);
+		return -tcres.err_no;
+	}
+
+	free(f->rbuf);
+	f->rbuf = buf;
+	f->roff = off;
+	f->rlen = iov.length;
+	f->reof = iov.length < len;
+	return 0;
+}
+
+/*
+ * Send the buffered writes of "f", along with its creation and truncation
+ * if they are still pending, in one compound.
+ *
+ * Return 0 or -errno.
+ */
+static int tcp_flush(struct tcp_file *f)
+{
+	struct tc_compound cpd = TC_COMPOUND_INITIALIZER;
+	tc_file file = tc_file_from_path(f->path);
+	struct timespec start;
+	struct tc_attrs attrs;
+	tc_res tcres;
+	int ret = 0;
+
+	if (!f->wlen && !f->create && !f->trunc) {
+		return 0;
+	}
+
+	/* create the file first, as the other operations need it */
+	if (f->create) {
+		ret = tc_cpd_write(&cpd, file, 0, 0, NULL, true);
+	}
+	if (ret >= 0 && (f->create || f->trunc)) {
+		memset(&attrs, 0, sizeof(attrs));
+		attrs.file = file;
+		if (f->create) {
+			tc_attrs_set_mode(&attrs, f->mode);
+		}
+		if (f->trunc) {
+			tc_attrs_set_size(&attrs, 0);
+		}
+		ret = tc_cpd_setattrs(&cpd, &attrs);
+	}
+	if (ret >= 0 && f->wlen) {
+		ret = tc_cpd_write(&cpd, file, f->woff, f->wlen, f->wbuf,
+				   false);
+	}
+	if (ret < 0) {
+		tc_cpd_destroy(&cpd);
+		return ret;
+	}
+
+	now(&start);
+	++tcp_depth;
+	tcres = tc_cpd_execute(&cpd, false);
+	--tcp_depth;
+	tcp_count_rpc(TC_PRELOAD_WRITE, &start, tc_okay(tcres));
+	if (tc_okay(tcres) && f->wlen &&
+	    cpd.ops[cpd.count - 1].iov.length != f->wlen) {
+		tcres = tc_failure(cpd.count - 1, EIO);
+	}
+	tc_cpd_destroy(&cpd);
+
+	pthread_mutex_lock(&tcp_lock);
+	tcp_invalidate(f->path);
+	pthread_mutex_unlock(&tcp_lock);
+
+	/* a failed write-behind is not retried; close() reports it */
+	f->wlen = 0;
+	if (!tc_okay(tcres)) {
+		return -tcres.err_no;
+	}
+	f->create = false;
+	f->trunc = false;
+	return 0;
+}
+
+static ssize_t tcp_pread(struct tcp_file *f, void *buf, size_t count,
+			 off_t off)
+{
+	size_t n;
+	int ret;
+
+	/* pending creation and truncation change what is read, too */
+	if ((f->wlen || f->create || f->trunc) && (ret = tcp_flush(f)) < 0) {
+		return tcp_fail(-ret);
+	}
+	for (;;) {
+		if (f->rbuf && off >= f->roff &&
+		    off < f->roff + (off_t)f->rlen) {
+			n = f->roff + f->rlen - off;
+			n = n < count ? n : count;
+			memcpy(buf, f->rbuf + (off - f->roff), n);
+			return n;
+		}
+		if (count == 0 ||
+		    (f->rbuf && f->reof && off >= f->roff + (off_t)f->rlen)) {
+			return 0;
+		}
+		ret = tcp_fill(f, off, count);
+		if (ret < 0) {
+			return tcp_fail(-ret);
+		}
+		if (f->rlen == 0) {
+			return 0;
+		}
+	}
+}
+
+static ssize_t tcp_pwrite(struct tcp_file *f, const void *buf, size_t count,
+			  off_t off)
+{
+	size_t cap;
+	char *wbuf;
+	int ret;
+
+	free(f->rbuf);
+	f->rbuf = NULL;
+	f->rlen = 0;
+
+	if (f->wlen && (off != f->woff + (off_t)f->wlen ||
+			f->wlen + count > TCP_WRITE_BUFSIZE)) {
+		ret = tcp_flush(f);
+		if (ret < 0) {
+			return tcp_fail(-ret);
+		}
+	}
+	if (!f->wlen) {
+		f->woff = off;
+	}
+	if (f->wlen + count > f->wcap) {
+		cap = f->wcap ? f->wcap * 2 : TCP_READAHEAD;
+		while (cap < f->wlen + count) {
+			cap *= 2;
+		}
+		wbuf = realloc(f->wbuf, cap);
+		if (!wbuf) {
+			return tcp_fail(ENOMEM);
+		}
+		f->wbuf = wbuf;
+		f->wcap = cap;
+	}
+	memcpy(f->wbuf + f->wlen, buf, count);
+	f->wlen += count;
+
+	if (f->wlen >= TCP_WRITE_BUFSIZE && (ret = tcp_flush(f)) < 0) {
+		return tcp_fail(-ret);
+	}
+	return count;
+}
+
+static void tcp_free_file(struct tcp_file *f)
+{
+	free(f->path);
+	free(f->rbuf);
+	free(f->wbuf);
+	free(f);
+}
+
+static int tcp_getattr(const char *path, struct stat *st, bool follow)
+{
+	struct timespec start;
+	struct tcp_entry *e;
+	int ret;
+
+	pthread_mutex_lock(&tcp_lock);
+	e = tcp_lookup(path);
+	if (e && e->has_stat) {
+		*st = e->st;
+		pthread_mutex_unlock(&tcp_lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&tcp_lock);
+
+	now(&start);
+	++tcp_depth;
+	ret = follow ? tc_stat(path, st) : tc_lstat(path, st);
+	--tcp_depth;
+	tcp_count_rpc(TC_PRELOAD_STAT, &start, ret == 0);
+	if (ret != 0) {
+		return ret < 0 ? ret : -ret;
+	}
+
+	pthread_mutex_lock(&tcp_lock);
+	tcp_cache_stat(path, st);
+	pthread_mutex_unlock(&tcp_lock);
+	return 0;
+}
+
+static int tcp_stat(const char *path, struct stat *st, bool follow)
+{
+	int ret;
+
+	tcp_count_call(TC_PRELOAD_STAT);
+	ret = tcp_getattr(path, st, follow);
+	return ret < 0 ? tcp_fail(-ret) : 0;
+}
+
+/*
+ * Open the TC file "path", which "orig" is mapped to.  Directories opened
+ * without O_DIRECTORY, e.g., for fchdir(), are opened with the real open().
+ */
+static int tcp_open(const char *orig, const char *path, int flags,
+		    mode_t mode)
+{
+	struct tcp_file *f;
+	struct stat st;
+	int acc = flags & O_ACCMODE;
+	int ret;
+	int fd;
+
+	f = calloc(1, sizeof(*f));
+	if (!f || !(f->path = strdup(path))) {
+		free(f);
+		return tcp_fail(ENOMEM);
+	}
+	f->kind = acc == O_RDONLY ? TC_PRELOAD_READ : TC_PRELOAD_WRITE;
+	f->flags = flags;
+	f->mode = mode & ~tcp_umask & 07777;
+	tcp_count_call(f->kind);
+
+	if (acc == O_RDONLY && !(flags & (O_CREAT | O_TRUNC | O_DIRECTORY))) {
+		ret = tcp_prefetch(f);
+		if (ret == -EISDIR) {
+			tcp_free_file(f);
+			return real.open(orig, flags, mode);
+		}
+	} else {
+		ret = tcp_getattr(path, &st, true);
+		if (ret == 0) {
+			if ((flags & O_CREAT) && (flags & O_EXCL)) {
+				ret = -EEXIST;
+			} else if (S_ISDIR(st.st_mode) && acc != O_RDONLY) {
+				ret = -EISDIR;
+			} else if (!S_ISDIR(st.st_mode) &&
+				   (flags & O_DIRECTORY)) {
+				ret = -ENOTDIR;
+			}
+			f->trunc = (flags & O_TRUNC) && acc != O_RDONLY;
+			if ((flags & O_APPEND) && !f->trunc) {
+				f->pos = st.st_size;
+			}
+		} else if (ret == -ENOENT && (flags & O_CREAT)) {
+			f->create = true;
+			ret = 0;
+		}
+	}
+	if (ret < 0) {
+		tcp_free_file(f);
+		return tcp_fail(-ret);
+	}
+
+	/* a placeholder, so that the descriptor is not reused */
+	fd = real.open("/dev/null", O_RDONLY | (flags & O_CLOEXEC));
+	if (fd < 0 || fd >= TCP_MAX_FDS) {
+		if (fd >= 0) {
+			real.close(fd);
+		}
+		tcp_free_file(f);
+		return tcp_fail(fd < 0 ? errno : EMFILE);
+	}
+	__atomic_store_n(&tcp_files[fd], f, __ATOMIC_RELEASE);
+	return fd;
+}
+
+/*
+ * Flush and forget the TC file of "fd", leaving its placeholder open.
+ *
+ * Return 0 or -errno.
+ */
+static int tcp_detach(int fd, struct tcp_file *f)
+{
+	int ret;
+
+	ret = tcp_flush(f);
+	__atomic_store_n(&tcp_files[fd], NULL, __ATOMIC_RELEASE);
+	tcp_free_file(f);
+	return ret;
+}
+
+static int tcp_close(int fd, struct tcp_file *f)
+{
+	int ret;
+
+	tcp_count_call(f->kind);
+	ret = tcp_detach(fd, f);
+	real.close(fd);
+	return ret < 0 ? tcp_fail(-ret) : 0;
+}
+
+static off_t tcp_lseek(struct tcp_file *f, off_t off, int whence)
+{
+	struct stat st;
+	int ret;
+
+	tcp_count_call(f->kind);
+	switch (whence) {
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		off += f->pos;
+		break;
+	case SEEK_END:
+		ret = tcp_flush(f);
+		if (ret == 0) {
+			ret = tcp_getattr(f->path, &st, true);
+		}
+		if (ret < 0) {
+			return tcp_fail(-ret);
+		}
+		off += st.st_size;
+		break;
+	default:
+		return tcp_fail(EINVAL);
+	}
+	if (off < 0) {
+		return tcp_fail(EINVAL);
+	}
+	f->pos = off;
+	return off;
+}
+
+static int tcp_fstat(struct tcp_file *f, struct stat *st)
+{
+	int ret;
+
+	tcp_count_call(TC_PRELOAD_STAT);
+	ret = tcp_flush(f);
+	if (ret == 0) {
+		ret = tcp_getattr(f->path, st, true);
+	}
+	return ret < 0 ? tcp_fail(-ret) : 0;
+}
+
+static int tcp_sync(struct tcp_file *f)
+{
+	int ret;
+
+	tcp_count_call(f->kind);
+	ret = tcp_flush(f);
+	return ret < 0 ? tcp_fail(-ret) : 0;
+}
+
+static ssize_t tcp_preadv(struct tcp_file *f, const struct iovec *iov,
+			  int iovcnt, off_t off)
+{
+	ssize_t total = 0;
+	ssize_t n;
+	size_t done;
+	int i;
+
+	for (i = 0; i < iovcnt; ++i) {
+		/* tcp_pread() stops at the end of its read buffer */
+		for (done = 0; done < iov[i].iov_len; done += n) {
+			n = tcp_pread(f, (char *)iov[i].iov_base + done,
+				      iov[i].iov_len - done, off + total);
+			if (n < 0) {
+				return total > 0 ? total : n;
+			}
+			if (n == 0) {
+				return total;
+			}
+			total += n;
+		}
+	}
+	return total;
+}
+
+static ssize_t tcp_pwritev(struct tcp_file *f, const struct iovec *iov,
+			   int iovcnt, off_t off)
+{
+	ssize_t total = 0;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < iovcnt; ++i) {
+		n = tcp_pwrite(f, iov[i].iov_base, iov[i].iov_len,
+			       off + total);
+		if (n < 0) {
+			return total > 0 ? total : n;
+		}
+		total += n;
+	}
+	return total;
+}
+
+static int tcp_truncate(struct tcp_file *f, off_t len)
+{
+	struct timespec start;
+	struct tc_attrs attrs;
+	tc_res tcres;
+	int ret;
+
+	tcp_count_call(f->kind);
+	if ((f->flags & O_ACCMODE) == O_RDONLY || len < 0) {
+		return tcp_fail(EINVAL);
+	}
+	ret = tcp_flush(f);
+	if (ret < 0) {
+		return tcp_fail(-ret);
+	}
+	free(f->rbuf);
+	f->rbuf = NULL;
+	f->rlen = 0;
+
+	memset(&attrs, 0, sizeof(attrs));
+	attrs.file = tc_file_from_path(f->path);
+	tc_attrs_set_size(&attrs, len);
+	now(&start);
+	++tcp_depth;
+	tcres = tc_setattrsv(&attrs, 1, false);
+	--tcp_depth;
+	tcp_count_rpc(f->kind, &start, tc_okay(tcres));
+
+	pthread_mutex_lock(&tcp_lock);
+	tcp_invalidate(f->path);
+	pthread_mutex_unlock(&tcp_lock);
+	return tc_okay(tcres) ? 0 : tcp_fail(tcres.err_no);
+}
+
+/*
+ * Only the descriptor flags, which the placeholder keeps, and the status
+ * flags are supported; other commands, e.g., F_DUPFD and locks, fail with
+ * EBADF as the placeholder is not the TC file.
+ */
+static int tcp_fcntl(int fd, struct tcp_file *f, int cmd, void *arg)
+{
+	switch (cmd) {
+	case F_GETFD:
+	case F_SETFD:
+		return real.fcntl(fd, cmd, arg);
+	case F_GETFL:
+		return f->flags &
+		       ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC | O_CLOEXEC);
+	default:
+		return tcp_fail(EBADF);
+	}
+}
+
+/*
+ * Check "mode" (R_OK, W_OK and X_OK) against the permission bits of "path"
+ * as access() does, with the effective IDs if "effective".  The server
+ * still checks permissions when the file is used.
+ */
+static int tcp_access(const char *path, int mode, bool effective,
+		      bool follow)
+{
+	struct stat st;
+	uid_t uid = effective ? geteuid() : getuid();
+	gid_t gid = effective ? getegid() : getgid();
+	int bits;
+	int ret;
+
+	tcp_count_call(TC_PRELOAD_STAT);
+	ret = tcp_getattr(path, &st, follow);
+	if (ret < 0) {
+		return tcp_fail(-ret);
+	}
+	mode &= R_OK | W_OK | X_OK;
+	if (uid == 0) {
+		/* root may execute if anyone may */
+		bits = (st.st_mode & 0111) || S_ISDIR(st.st_mode)
+			   ? R_OK | W_OK | X_OK
+			   : R_OK | W_OK;
+	} else if (st.st_uid == uid) {
+		bits = (st.st_mode >> 6) & 07;
+	} else if (st.st_gid == gid || group_member(st.st_gid)) {
+		bits = (st.st_mode >> 3) & 07;
+	} else {
+		bits = st.st_mode & 07;
+	}
+	return (mode & bits) == mode ? 0 : tcp_fail(EACCES);
+}
+
+#ifdef STATX_BASIC_STATS
+static void tcp_stat_to_statx(const struct stat *st, struct statx *stx)
+{
+	memset(stx, 0, sizeof(*stx));
+	stx->stx_mask = STATX_BASIC_STATS;
+	stx->stx_blksize = st->st_blksize;
+	stx->stx_nlink = st->st_nlink;
+	stx->stx_uid = st->st_uid;
+	stx->stx_gid = st->st_gid;
+	stx->stx_mode = st->st_mode;
+	stx->stx_ino = st->st_ino;
+	stx->stx_size = st->st_size;
+	stx->stx_blocks = st->st_blocks;
+	stx->stx_atime.tv_sec = st->st_atim.tv_sec;
+	stx->stx_atime.tv_nsec = st->st_atim.tv_nsec;
+	stx->stx_ctime.tv_sec = st->st_ctim.tv_sec;
+	stx->stx_ctime.tv_nsec = st->st_ctim.tv_nsec;
+	stx->stx_mtime.tv_sec = st->st_mtim.tv_sec;
+	stx->stx_mtime.tv_nsec = st->st_mtim.tv_nsec;
+	stx->stx_rdev_major = major(st->st_rdev);
+	stx->stx_rdev_minor = minor(st->st_rdev);
+	stx->stx_dev_major = major(st->st_dev);
+	stx->stx_dev_minor = minor(st->st_dev);
+}
+#endif
+
+/*
+ * Metadata
+ */
+
+static int tcp_meta_done(const struct timespec *start, tc_res tcres)
+{
+	tcp_count_rpc(TC_PRELOAD_META, start, tc_okay(tcres));
+	/* renamed directories make any cached path stale */
+	pthread_mutex_lock(&tcp_lock);
+	tcp_clear_cache();
+	pthread_mutex_unlock(&tcp_lock);
+	return tc_okay(tcres) ? 0 : tcp_fail(tcres.err_no);
+}
+
+static int tcp_remove(const char *path)
+{
+	struct timespec start;
+	tc_file file = tc_file_from_path(path);
+	tc_res tcres;
+
+	tcp_count_call(TC_PRELOAD_META);
+	now(&start);
+	++tcp_depth;
+	tcres = tc_removev(&file, 1, false);
+	--tcp_depth;
+	return tcp_meta_done(&start, tcres);
+}
+
+static int tcp_mkdir(const char *path, mode_t mode)
+{
+	struct timespec start;
+	struct tc_attrs attrs;
+	tc_res tcres;
+
+	tcp_count_call(TC_PRELOAD_META);
+	tc_set_up_creation(&attrs, path, mode & ~tcp_umask);
+	now(&start);
+	++tcp_depth;
+	tcres = tc_mkdirv(&attrs, 1, false);
+	--tcp_depth;
+	return tcp_meta_done(&start, tcres);
+}
+
+static int tcp_rename(const char *oldpath, const char *newpath)
+{
+	struct timespec start;
+	tc_file_pair pair;
+	tc_res tcres;
+
+	tcp_count_call(TC_PRELOAD_META);
+	pair.src_file = tc_file_from_path(oldpath);
+	pair.dst_file = tc_file_from_path(newpath);
+	now(&start);
+	++tcp_depth;
+	tcres = tc_renamev(&pair, 1, false);
+	--tcp_depth;
+	return tcp_meta_done(&start, tcres);
+}
+
+/*
+ * Interposed libc calls
+ */
+
+#ifdef _STAT_VER
+#define TCP_STAT_VER _STAT_VER
+#else
+#define TCP_STAT_VER 1	/* only used with glibc older than 2.33 */
+#endif
+
+/* glibc before 2.33 implements stat() and friends with these */
+int __xstat(int ver, const char *path, struct stat *st);
+int __lxstat(int ver, const char *path, struct stat *st);
+int __fxstat(int ver, int fd, struct stat *st);
+int __fxstatat(int ver, int dirfd, const char *path, struct stat *st,
+	       int flags);
+
+static inline mode_t tcp_open_mode(int flags, va_list ap)
+{
+	return (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE
+		   ? va_arg(ap, mode_t)
+		   : 0;
+}
+
+int open(const char *path, int flags, ...)
+{
+	char buf[PATH_MAX];
+	mode_t mode;
+	va_list ap;
+
+	va_start(ap, flags);
+	mode = tcp_open_mode(flags, ap);
+	va_end(ap);
+	if (tcp_map(path, buf)) {
+		return tcp_open(path, buf, flags, mode);
+	}
+	return real.open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	char buf[PATH_MAX];
+	mode_t mode;
+	va_list ap;
+
+	va_start(ap, flags);
+	mode = tcp_open_mode(flags, ap);
+	va_end(ap);
+	if (tcp_map(path, buf)) {
+		return tcp_open(path, buf, flags, mode);
+	}
+	return real.open64(path, flags, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+	char buf[PATH_MAX];
+	mode_t mode;
+	va_list ap;
+
+	va_start(ap, flags);
+	mode = tcp_open_mode(flags, ap);
+	va_end(ap);
+	if (tcp_map(path, buf)) {
+		return tcp_open(path, buf, flags, mode);
+	}
+	return real.openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...)
+{
+	char buf[PATH_MAX];
+	mode_t mode;
+	va_list ap;
+
+	va_start(ap, flags);
+	mode = tcp_open_mode(flags, ap);
+	va_end(ap);
+	if (tcp_map(path, buf)) {
+		return tcp_open(path, buf, flags, mode);
+	}
+	return real.openat64(dirfd, path, flags, mode);
+}
+
+int close(int fd)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (f) {
+		return tcp_close(fd, f);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return real.close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	struct tcp_file *f = tcp_file(fd);
+	ssize_t n;
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.read(fd, buf, count);
+	}
+	tcp_count_call(f->kind);
+	n = tcp_pread(f, buf, count, f->pos);
+	if (n > 0) {
+		f->pos += n;
+	}
+	return n;
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	struct tcp_file *f = tcp_file(fd);
+	ssize_t n;
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.write(fd, buf, count);
+	}
+	tcp_count_call(f->kind);
+	n = tcp_pwrite(f, buf, count, f->pos);
+	if (n > 0) {
+		f->pos += n;
+	}
+	return n;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t off)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.pread(fd, buf, count, off);
+	}
+	tcp_count_call(f->kind);
+	return tcp_pread(f, buf, count, off);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t off)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.pwrite(fd, buf, count, off);
+	}
+	tcp_count_call(f->kind);
+	return tcp_pwrite(f, buf, count, off);
+}
+
+off_t lseek(int fd, off_t off, int whence)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.lseek(fd, off, whence);
+	}
+	return tcp_lseek(f, off, whence);
+}
+
+int fsync(int fd)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.fsync(fd);
+	}
+	return tcp_sync(f);
+}
+
+int fdatasync(int fd)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.fdatasync(fd);
+	}
+	return tcp_sync(f);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct tcp_file *f = tcp_file(fd);
+	ssize_t n;
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.readv(fd, iov, iovcnt);
+	}
+	tcp_count_call(f->kind);
+	n = tcp_preadv(f, iov, iovcnt, f->pos);
+	if (n > 0) {
+		f->pos += n;
+	}
+	return n;
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct tcp_file *f = tcp_file(fd);
+	ssize_t n;
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.writev(fd, iov, iovcnt);
+	}
+	tcp_count_call(f->kind);
+	n = tcp_pwritev(f, iov, iovcnt, f->pos);
+	if (n > 0) {
+		f->pos += n;
+	}
+	return n;
+}
+
+ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t off)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.preadv(fd, iov, iovcnt, off);
+	}
+	tcp_count_call(f->kind);
+	return tcp_preadv(f, iov, iovcnt, off);
+}
+
+ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t off)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.pwritev(fd, iov, iovcnt, off);
+	}
+	tcp_count_call(f->kind);
+	return tcp_pwritev(f, iov, iovcnt, off);
+}
+
+int ftruncate(int fd, off_t len)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (!f) {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.ftruncate(fd, len);
+	}
+	return tcp_truncate(f, len);
+}
+
+/* A TC descriptor cannot be duplicated, as it is not the TC file. */
+int dup(int fd)
+{
+	if (tcp_file(fd)) {
+		return tcp_fail(EBADF);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return real.dup(fd);
+}
+
+int dup3(int oldfd, int newfd, int flags)
+{
+	struct tcp_file *f = tcp_file(newfd);
+
+	if (tcp_file(oldfd)) {
+		return tcp_fail(EBADF);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	/* "newfd" is closed silently, errors included */
+	if (f && oldfd != newfd) {
+		tcp_detach(newfd, f);
+	}
+	return real.dup3(oldfd, newfd, flags);
+}
+
+int dup2(int oldfd, int newfd)
+{
+	struct tcp_file *f = tcp_file(newfd);
+
+	if (tcp_file(oldfd)) {
+		return tcp_fail(EBADF);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	if (f && oldfd != newfd) {
+		tcp_detach(newfd, f);
+	}
+	return real.dup2(oldfd, newfd);
+}
+
+int fcntl(int fd, int cmd, ...)
+{
+	struct tcp_file *f = tcp_file(fd);
+	va_list ap;
+	void *arg;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	if (f) {
+		return tcp_fcntl(fd, f, cmd, arg);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return real.fcntl(fd, cmd, arg);
+}
+
+/* what fcntl() is with _FILE_OFFSET_BITS=64 since glibc 2.28 */
+int fcntl64(int fd, int cmd, ...)
+{
+	struct tcp_file *f = tcp_file(fd);
+	va_list ap;
+	void *arg;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	if (f) {
+		return tcp_fcntl(fd, f, cmd, arg);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return real.fcntl64 ? real.fcntl64(fd, cmd, arg)
+			    : real.fcntl(fd, cmd, arg);
+}
+
+int stat(const char *path, struct stat *st)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_stat(buf, st, true);
+	}
+	return real.stat ? real.stat(path, st)
+			 : real.__xstat(TCP_STAT_VER, path, st);
+}
+
+int lstat(const char *path, struct stat *st)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_stat(buf, st, false);
+	}
+	return real.lstat ? real.lstat(path, st)
+			  : real.__lxstat(TCP_STAT_VER, path, st);
+}
+
+int fstat(int fd, struct stat *st)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (f) {
+		return tcp_fstat(f, st);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return real.fstat ? real.fstat(fd, st)
+			  : real.__fxstat(TCP_STAT_VER, fd, st);
+}
+
+int __xstat(int ver, const char *path, struct stat *st)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_stat(buf, st, true);
+	}
+	return real.__xstat ? real.__xstat(ver, path, st)
+			    : real.stat(path, st);
+}
+
+int __lxstat(int ver, const char *path, struct stat *st)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_stat(buf, st, false);
+	}
+	return real.__lxstat ? real.__lxstat(ver, path, st)
+			     : real.lstat(path, st);
+}
+
+int __fxstat(int ver, int fd, struct stat *st)
+{
+	struct tcp_file *f = tcp_file(fd);
+
+	if (f) {
+		return tcp_fstat(f, st);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return real.__fxstat ? real.__fxstat(ver, fd, st)
+			     : real.fstat(fd, st);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *st, int flags)
+{
+	struct tcp_file *f = tcp_file(dirfd);
+	char buf[PATH_MAX];
+
+	if (f && (!path || !path[0]) && (flags & AT_EMPTY_PATH)) {
+		return tcp_fstat(f, st);
+	}
+	if (f && path && path[0] != '/') {
+		return tcp_fail(ENOTDIR);
+	}
+	if (tcp_map(path, buf)) {
+		return tcp_stat(buf, st, !(flags & AT_SYMLINK_NOFOLLOW));
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return real.fstatat
+		   ? real.fstatat(dirfd, path, st, flags)
+		   : real.__fxstatat(TCP_STAT_VER, dirfd, path, st, flags);
+}
+
+int __fxstatat(int ver, int dirfd, const char *path, struct stat *st,
+	       int flags)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_file(dirfd) || tcp_map(path, buf)) {
+		return fstatat(dirfd, path, st, flags);
+	}
+	pthread_once(&tcp_once, tcp_load_config);
+	return real.__fxstatat ? real.__fxstatat(ver, dirfd, path, st, flags)
+			       : real.fstatat(dirfd, path, st, flags);
+}
+
+#ifdef STATX_BASIC_STATS
+int statx(int dirfd, const char *path, int flags, unsigned int mask,
+	  struct statx *stx)
+{
+	struct tcp_file *f = tcp_file(dirfd);
+	char buf[PATH_MAX];
+	struct stat st;
+	int ret;
+
+	if (f && (!path || !path[0]) && (flags & AT_EMPTY_PATH)) {
+		ret = tcp_fstat(f, &st);
+	} else if (f && path && path[0] != '/') {
+		return tcp_fail(ENOTDIR);
+	} else if (tcp_map(path, buf)) {
+		ret = tcp_stat(buf, &st, !(flags & AT_SYMLINK_NOFOLLOW));
+	} else {
+		pthread_once(&tcp_once, tcp_load_config);
+		return real.statx ? real.statx(dirfd, path, flags, mask, stx)
+				  : tcp_fail(ENOSYS);
+	}
+	if (ret == 0) {
+		tcp_stat_to_statx(&st, stx);
+	}
+	return ret;
+}
+#endif
+
+int access(const char *path, int mode)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_access(buf, mode, false, true);
+	}
+	return real.access(path, mode);
+}
+
+int faccessat(int dirfd, const char *path, int mode, int flags)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_file(dirfd) && path[0] != '/') {
+		return tcp_fail(ENOTDIR);
+	}
+	if (tcp_map(path, buf)) {
+		return tcp_access(buf, mode, flags & AT_EACCESS,
+				  !(flags & AT_SYMLINK_NOFOLLOW));
+	}
+	return real.faccessat(dirfd, path, mode, flags);
+}
+
+#if __WORDSIZE == 64
+/* the 64-bit variants share the layout of the plain ones */
+int stat64(const char *path, struct stat64 *st)
+{
+	return stat(path, (struct stat *)st);
+}
+
+int lstat64(const char *path, struct stat64 *st)
+{
+	return lstat(path, (struct stat *)st);
+}
+
+int fstat64(int fd, struct stat64 *st)
+{
+	return fstat(fd, (struct stat *)st);
+}
+
+int __xstat64(int ver, const char *path, struct stat64 *st)
+{
+	return __xstat(ver, path, (struct stat *)st);
+}
+
+int __lxstat64(int ver, const char *path, struct stat64 *st)
+{
+	return __lxstat(ver, path, (struct stat *)st);
+}
+
+int __fxstat64(int ver, int fd, struct stat64 *st)
+{
+	return __fxstat(ver, fd, (struct stat *)st);
+}
+
+int fstatat64(int dirfd, const char *path, struct stat64 *st, int flags)
+{
+	return fstatat(dirfd, path, (struct stat *)st, flags);
+}
+
+int __fxstatat64(int ver, int dirfd, const char *path, struct stat64 *st,
+		 int flags)
+{
+	return __fxstatat(ver, dirfd, path, (struct stat *)st, flags);
+}
+
+ssize_t preadv64(int fd, const struct iovec *iov, int iovcnt, off64_t off)
+{
+	return preadv(fd, iov, iovcnt, off);
+}
+
+ssize_t pwritev64(int fd, const struct iovec *iov, int iovcnt, off64_t off)
+{
+	return pwritev(fd, iov, iovcnt, off);
+}
+
+int ftruncate64(int fd, off64_t len)
+{
+	return ftruncate(fd, len);
+}
+#endif
+
+DIR *opendir(const char *path)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_opendir(buf);
+	}
+	return real.opendir(path);
+}
+
+struct dirent *readdir(DIR *dir)
+{
+	struct tcp_dir *d = tcp_enabled() ? tcp_find_dir(dir, false) : NULL;
+
+	if (!d) {
+		return real.readdir(dir);
+	}
+	tcp_count_call(TC_PRELOAD_DIR);
+	return d->pos < d->count ? &d->ents[d->pos++] : NULL;
+}
+
+#if __WORDSIZE == 64
+struct dirent64 *readdir64(DIR *dir)
+{
+	return (struct dirent64 *)readdir(dir);
+}
+#endif
+
+void rewinddir(DIR *dir)
+{
+	struct tcp_dir *d = tcp_enabled() ? tcp_find_dir(dir, false) : NULL;
+
+	if (!d) {
+		real.rewinddir(dir);
+		return;
+	}
+	d->pos = 0;
+}
+
+int dirfd(DIR *dir)
+{
+	struct tcp_dir *d = tcp_enabled() ? tcp_find_dir(dir, false) : NULL;
+
+	if (!d) {
+		return real.dirfd(dir);
+	}
+	return tcp_fail(ENOTSUP);
+}
+
+int closedir(DIR *dir)
+{
+	struct tcp_dir *d = tcp_enabled() ? tcp_find_dir(dir, true) : NULL;
+
+	if (!d) {
+		return real.closedir(dir);
+	}
+	tcp_count_call(TC_PRELOAD_DIR);
+	free(d->ents);
+	free(d->path);
+	free(d);
+	return 0;
+}
+
+int unlink(const char *path)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_remove(buf);
+	}
+	return real.unlink(path);
+}
+
+int rmdir(const char *path)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_remove(buf);
+	}
+	return real.rmdir(path);
+}
+
+int mkdir(const char *path, mode_t mode)
+{
+	char buf[PATH_MAX];
+
+	if (tcp_map(path, buf)) {
+		return tcp_mkdir(buf, mode);
+	}
+	return real.mkdir(path, mode);
+}
+
+int rename(const char *oldpath, const char *newpath)
+{
+	char oldbuf[PATH_MAX];
+	char newbuf[PATH_MAX];
+	bool old_mapped = tcp_map(oldpath, oldbuf);
+	bool new_mapped = tcp_map(newpath, newbuf);
+
+	if (old_mapped && new_mapped) {
+		return tcp_rename(oldbuf, newbuf);
+	} else if (old_mapped || new_mapped) {
+		return tcp_fail(EXDEV);
+	}
+	return real.rename(oldpath, newpath);
+}
+
+static ssize_t tcp_cookie_read(void *cookie, char *buf, size_t size)
+{
+	return read((int)(intptr_t)cookie, buf, size);
+}
+
+static ssize_t tcp_cookie_write(void *cookie, const char *buf, size_t size)
+{
+	return write((int)(intptr_t)cookie, buf, size);
+}
+
+static int tcp_cookie_seek(void *cookie, off64_t *off, int whence)
+{
+	off_t pos = lseek((int)(intptr_t)cookie, *off, whence);
+
+	if (pos < 0) {
+		return -1;
+	}
+	*off = pos;
+	return 0;
+}
+
+static int tcp_cookie_close(void *cookie)
+{
+	return close((int)(intptr_t)cookie);
+}
+
+/* glibc opens the file of fopen() internally, out of our reach */
+FILE *fopen(const char *path, const char *mode)
+{
+	static const cookie_io_functions_t io = {
+		.read = tcp_cookie_read,
+		.write = tcp_cookie_write,
+		.seek = tcp_cookie_seek,
+		.close = tcp_cookie_close,
+	};
+	char buf[PATH_MAX];
+	FILE *fp;
+	int flags;
+	int fd;
+
+	if (!tcp_map(path, buf)) {
+		return real.fopen(path, mode);
+	}
+
+	switch (mode[0]) {
+	case 'r':
+		flags = 0;
+		break;
+	case 'w':
+		flags = O_CREAT | O_TRUNC;
+		break;
+	case 'a':
+		flags = O_CREAT | O_APPEND;
+		break;
+	default:
+		errno = EINVAL;
+		return NULL;
+	}
+	if (strchr(mode, '+')) {
+		flags |= O_RDWR;
+	} else if (mode[0] != 'r') {
+		flags |= O_WRONLY;
+	}
+	if (strchr(mode, 'x')) {
+		flags |= O_EXCL;
+	}
+	if (strchr(mode, 'e')) {
+		flags |= O_CLOEXEC;
+	}
+
+	fd = tcp_open(path, buf, flags, 0666);
+	if (fd < 0) {
+		return NULL;
+	}
+	fp = fopencookie((void *)(intptr_t)fd, mode, io);
+	if (!fp) {
+		close(fd);
+	}
+	return fp;
+}
+
+FILE *fopen64(const char *path, const char *mode)
+{
+	return fopen(path, mode);
+}
+
+/* Send buffered writes that were never closed, and report statistics. */
+__attribute__((destructor)) static void tcp_fini(void)
+{
+	static const char *names[TC_PRELOAD_KINDS + 1] = {
+		"stat", "dir", "read", "write", "meta", "total",
+	};
+	struct tc_preload_stats stats;
+	struct tcp_file *f;
+	int i;
+
+	if (!tcp_context) {
+		return;
+	}
+	for (i = 0; i < TCP_MAX_FDS; ++i) {
+		f = __atomic_exchange_n(&tcp_files[i], NULL, __ATOMIC_ACQ_REL);
+		if (f) {
+			tcp_flush(f);
+			tcp_free_file(f);
+		}
+	}
+
+	if (getenv("TC_PRELOAD_STATS")) {
+		for (i = 0; i <= TC_PRELOAD_KINDS; ++i) {
+			tc_preload_get_stats(i, &stats);
+			fprintf(stderr,
+				"tc_preload: %-5s %10llu calls %10llu RPCs "
+				"%8.1f calls/RPC\n",
+				names[i], (unsigned long long)stats.calls,
+				(unsigned long long)stats.rpcs,
+				stats.rpcs ? (double)stats.calls / stats.rpcs
+					   : 0.0);
+		}
+	}
+
+	++tcp_depth;
+	tc_deinit(tcp_context);
+	tcp_context = NULL;
+}
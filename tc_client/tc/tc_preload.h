@@ -0,0 +1,94 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * LD_PRELOAD interposer that runs libc file calls under a prefix on TC:
+ *
+ *	TC_PRELOAD_PREFIX=/mnt/tc LD_PRELOAD=libtc_preload.so ./app
+ *
+ * Besides mapping calls one-to-one, it folds common patterns into fewer
+ * RPCs:
+ *
+ *  - opendir() lists the directory with attributes in one RPC, and the
+ *    attributes are cached so that the stat() loop that usually follows
+ *    does not send any RPC;
+ *  - open() for reading prefetches the file; when it follows a listing,
+ *    the next small files of the directory are read in the same compound,
+ *    so open/read/close of many small files takes one RPC per batch;
+ *  - writes are buffered (write-behind) and sent with the creation and
+ *    truncation of the file when the buffer fills, or at fsync() or
+ *    close().  Errors of buffered writes are thus reported by close().
+ *
+ * Environment variables:
+ *
+ *  TC_PRELOAD_PREFIX	absolute path under which calls go to TC (required)
+ *  TC_PRELOAD_ROOT	TC path the prefix maps to (default: the prefix)
+ *  TC_PRELOAD_CONFIG	TC config file, or "posix" for the POSIX backend
+ *			(default: get_tc_config_file())
+ *  TC_PRELOAD_EXPORT_ID	export id (default: 77)
+ *  TC_PRELOAD_TTL_MS	how long listed attributes and prefetched data are
+ *			used (default: 1000)
+ *  TC_PRELOAD_STATS	print the calls folded per RPC at exit if set
+ *
+ * Only absolute paths are mapped.  Calls glibc makes internally, such as
+ * the open() inside fopen(), are not seen by the interposer, which is why
+ * fopen() is interposed as well.  A descriptor should not be used by two
+ * threads at the same time.
+ *
+ * A descriptor of a TC file is a placeholder opened on /dev/null, so that
+ * its number is not reused.  It cannot be duplicated with dup() or fcntl(),
+ * and fcntl() only supports F_GETFD, F_SETFD and F_GETFL on it.
+ */
+
+#ifndef __TC_PRELOAD_H__
+#define __TC_PRELOAD_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum TC_PRELOAD_KIND {
+	TC_PRELOAD_STAT = 0,	/* stat and its variants, access */
+	TC_PRELOAD_DIR,		/* opendir, readdir, closedir */
+	TC_PRELOAD_READ,	/* open, read(v), lseek and close of readers */
+	TC_PRELOAD_WRITE,	/* open, write(v), fsync, ftruncate, close */
+	TC_PRELOAD_META,	/* unlink, mkdir, rmdir, rename */
+	TC_PRELOAD_KINDS,
+};
+
+struct tc_preload_stats {
+	uint64_t calls;		/* libc calls interposed */
+	uint64_t rpcs;		/* TC calls made for them */
+};
+
+/**
+ * Get the statistics of calls of "kind", or of all calls if "kind" is
+ * TC_PRELOAD_KINDS.
+ *
+ * Return 0 or -EINVAL.
+ */
+int tc_preload_get_stats(int kind, struct tc_preload_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __TC_PRELOAD_H__ */
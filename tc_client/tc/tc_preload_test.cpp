@@ -0,0 +1,358 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Unittest of tc_preload.  The test is linked against the interposer, so the
+ * libc calls below go through it; ctest sets TC_PRELOAD_PREFIX to kDir and
+ * uses the POSIX backend.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "tc_preload.h"
+
+static const char *kDir = "/tmp/tc_preload_test";
+
+static struct tc_preload_stats GetStats(int kind)
+{
+	struct tc_preload_stats stats;
+
+	EXPECT_EQ(0, tc_preload_get_stats(kind, &stats));
+	return stats;
+}
+
+static uint64_t CountRpcs(int kind)
+{
+	return GetStats(kind).rpcs;
+}
+
+class TcPreloadTest : public ::testing::Test
+{
+protected:
+	void SetUp() override
+	{
+		system("rm -rf /tmp/tc_preload_test");
+		ASSERT_EQ(0, mkdir(kDir, 0755));
+	}
+
+	static std::string Path(const std::string &name)
+	{
+		return std::string(kDir) + "/" + name;
+	}
+
+	static void WriteFile(const std::string &path, const std::string &data)
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		ASSERT_GE(fd, 0) << strerror(errno);
+		EXPECT_EQ((ssize_t)data.size(),
+			  write(fd, data.data(), data.size()));
+		EXPECT_EQ(0, close(fd));
+	}
+
+	static std::string ReadFile(const std::string &path)
+	{
+		std::string data;
+		char buf[100];
+		ssize_t n;
+		int fd = open(path.c_str(), O_RDONLY);
+
+		EXPECT_GE(fd, 0) << strerror(errno);
+		while ((n = read(fd, buf, sizeof(buf))) > 0) {
+			data.append(buf, n);
+		}
+		EXPECT_EQ(0, n);
+		EXPECT_EQ(0, close(fd));
+		return data;
+	}
+
+	/* Create "n" small files in "dir" and return their names. */
+	static std::vector<std::string> MakeFiles(const std::string &dir,
+						  int n)
+	{
+		std::vector<std::string> names;
+
+		EXPECT_EQ(0, mkdir(Path(dir).c_str(), 0755));
+		for (int i = 0; i < n; ++i) {
+			names.push_back("file" + std::to_string(i));
+			WriteFile(Path(dir + "/" + names.back()), names.back());
+		}
+		return names;
+	}
+};
+
+TEST_F(TcPreloadTest, StatAfterListingIsFolded)
+{
+	const int N = 40;
+	struct dirent *ent;
+	struct stat st;
+	int count = 0;
+
+	MakeFiles("dir", N);
+
+	uint64_t dir_rpcs = CountRpcs(TC_PRELOAD_DIR);
+	uint64_t stat_rpcs = CountRpcs(TC_PRELOAD_STAT);
+	DIR *dir = opendir(Path("dir").c_str());
+	ASSERT_TRUE(dir != NULL);
+	while ((ent = readdir(dir)) != NULL) {
+		std::string path = Path("dir/") + ent->d_name;
+		EXPECT_EQ(0, stat(path.c_str(), &st));
+		EXPECT_TRUE(S_ISREG(st.st_mode));
+		EXPECT_EQ((off_t)strlen(ent->d_name), st.st_size);
+		++count;
+	}
+	EXPECT_EQ(0, closedir(dir));
+
+	EXPECT_EQ(N, count);
+	EXPECT_EQ(dir_rpcs + 1, CountRpcs(TC_PRELOAD_DIR));
+	EXPECT_EQ(stat_rpcs, CountRpcs(TC_PRELOAD_STAT));
+}
+
+TEST_F(TcPreloadTest, SmallFilesAreReadInBatches)
+{
+	const int N = 40;
+	struct dirent *ent;
+	int count = 0;
+
+	MakeFiles("dir", N);
+
+	uint64_t read_rpcs = CountRpcs(TC_PRELOAD_READ);
+	DIR *dir = opendir(Path("dir").c_str());
+	ASSERT_TRUE(dir != NULL);
+	while ((ent = readdir(dir)) != NULL) {
+		std::string path = Path("dir/") + ent->d_name;
+		EXPECT_EQ(ent->d_name, ReadFile(path));
+		++count;
+	}
+	EXPECT_EQ(0, closedir(dir));
+
+	EXPECT_EQ(N, count);
+	EXPECT_LT(CountRpcs(TC_PRELOAD_READ) - read_rpcs, (uint64_t)N / 4);
+}
+
+TEST_F(TcPreloadTest, WritesAreBufferedUntilClose)
+{
+	const int N = 1000;
+	std::string line = "0123456789\n";
+	std::string expected;
+
+	uint64_t write_rpcs = CountRpcs(TC_PRELOAD_WRITE);
+	int fd = open(Path("out").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	for (int i = 0; i < N; ++i) {
+		EXPECT_EQ((ssize_t)line.size(),
+			  write(fd, line.data(), line.size()));
+		expected += line;
+	}
+	EXPECT_EQ(write_rpcs, CountRpcs(TC_PRELOAD_WRITE));
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ(write_rpcs + 1, CountRpcs(TC_PRELOAD_WRITE));
+
+	struct stat st;
+	EXPECT_EQ(0, stat(Path("out").c_str(), &st));
+	EXPECT_EQ((off_t)expected.size(), st.st_size);
+	EXPECT_EQ(0600, st.st_mode & 0777);
+	EXPECT_EQ(expected, ReadFile(Path("out")));
+}
+
+TEST_F(TcPreloadTest, AppendAndTruncate)
+{
+	WriteFile(Path("file"), "hello");
+
+	int fd = open(Path("file").c_str(), O_WRONLY | O_APPEND);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	EXPECT_EQ(6, write(fd, " world", 6));
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ("hello world", ReadFile(Path("file")));
+
+	WriteFile(Path("file"), "bye");
+	EXPECT_EQ("bye", ReadFile(Path("file")));
+
+	fd = open(Path("file").c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+	EXPECT_EQ(-1, fd);
+	EXPECT_EQ(EEXIST, errno);
+}
+
+/* Reads see the creation and truncation still pending at open(). */
+TEST_F(TcPreloadTest, ReadAfterTruncateOrCreate)
+{
+	char buf[10];
+
+	WriteFile(Path("file"), "hello");
+	int fd = open(Path("file").c_str(), O_RDWR | O_TRUNC);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	EXPECT_EQ(0, read(fd, buf, sizeof(buf)));
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ("", ReadFile(Path("file")));
+
+	fd = open(Path("new").c_str(), O_RDWR | O_CREAT, 0644);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	EXPECT_EQ(0, read(fd, buf, sizeof(buf)));
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ("", ReadFile(Path("new")));
+}
+
+TEST_F(TcPreloadTest, OpenDirectory)
+{
+	struct stat st;
+
+	EXPECT_EQ(0, mkdir(Path("dir").c_str(), 0755));
+	int fd = open(Path("dir").c_str(), O_RDONLY);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	EXPECT_EQ(0, fstat(fd, &st));
+	EXPECT_TRUE(S_ISDIR(st.st_mode));
+	EXPECT_EQ(0, close(fd));
+}
+
+TEST_F(TcPreloadTest, LseekAndPread)
+{
+	std::string data(200000, 'a');
+	char buf[10];
+
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = 'a' + i % 26;
+	}
+	WriteFile(Path("big"), data);
+
+	int fd = open(Path("big").c_str(), O_RDONLY);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	EXPECT_EQ(150000, lseek(fd, 150000, SEEK_SET));
+	EXPECT_EQ(10, read(fd, buf, sizeof(buf)));
+	EXPECT_EQ(data.substr(150000, 10), std::string(buf, 10));
+	EXPECT_EQ(10, pread(fd, buf, sizeof(buf), 7));
+	EXPECT_EQ(data.substr(7, 10), std::string(buf, 10));
+	EXPECT_EQ((off_t)data.size(), lseek(fd, 0, SEEK_END));
+	EXPECT_EQ(0, read(fd, buf, sizeof(buf)));
+	EXPECT_EQ(0, close(fd));
+}
+
+TEST_F(TcPreloadTest, Fopen)
+{
+	char buf[100];
+
+	FILE *fp = fopen(Path("file").c_str(), "w");
+	ASSERT_TRUE(fp != NULL);
+	EXPECT_GT(fprintf(fp, "hello %d\n", 42), 0);
+	EXPECT_EQ(0, fclose(fp));
+
+	fp = fopen(Path("file").c_str(), "r");
+	ASSERT_TRUE(fp != NULL);
+	EXPECT_TRUE(fgets(buf, sizeof(buf), fp) != NULL);
+	EXPECT_STREQ("hello 42\n", buf);
+	EXPECT_EQ(0, fclose(fp));
+}
+
+TEST_F(TcPreloadTest, MetadataCalls)
+{
+	struct stat st;
+
+	EXPECT_EQ(0, mkdir(Path("dir").c_str(), 0755));
+	WriteFile(Path("dir/a"), "a");
+	EXPECT_EQ(0, rename(Path("dir/a").c_str(), Path("dir/b").c_str()));
+	EXPECT_EQ(-1, stat(Path("dir/a").c_str(), &st));
+	EXPECT_EQ(ENOENT, errno);
+	EXPECT_EQ("a", ReadFile(Path("dir/b")));
+
+	EXPECT_EQ(-1, rmdir(Path("dir").c_str()));
+	EXPECT_EQ(ENOTEMPTY, errno);
+	EXPECT_EQ(0, unlink(Path("dir/b").c_str()));
+	EXPECT_EQ(0, rmdir(Path("dir").c_str()));
+	EXPECT_EQ(-1, lstat(Path("dir").c_str(), &st));
+	EXPECT_EQ(ENOENT, errno);
+
+	/* paths outside the prefix are not affected */
+	EXPECT_EQ(0, stat("/", &st));
+	EXPECT_EQ(-1, rename(Path("x").c_str(), "/tmp/tc_preload_test_x"));
+	EXPECT_EQ(EXDEV, errno);
+}
+
+/* Calls on descriptors do not reach their /dev/null placeholders. */
+TEST_F(TcPreloadTest, VectoredIoAndDescriptorCalls)
+{
+	char hello[6];
+	char world[6];
+	struct iovec iov[2] = {
+		{ (void *)"hello ", 6 }, { (void *)"world!", 6 },
+	};
+	struct stat st;
+
+	int fd = open(Path("file").c_str(), O_WRONLY | O_CREAT, 0644);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	EXPECT_EQ(12, writev(fd, iov, 2));
+	EXPECT_EQ(O_WRONLY, fcntl(fd, F_GETFL) & O_ACCMODE);
+	EXPECT_EQ(-1, dup(fd));
+	EXPECT_EQ(EBADF, errno);
+	EXPECT_EQ(0, close(fd));
+
+	fd = open(Path("file").c_str(), O_RDONLY);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	iov[0] = { hello, sizeof(hello) };
+	iov[1] = { world, sizeof(world) };
+	EXPECT_EQ(12, readv(fd, iov, 2));
+	EXPECT_EQ("hello ", std::string(hello, 6));
+	EXPECT_EQ("world!", std::string(world, 6));
+	EXPECT_EQ(0, fstatat(fd, "", &st, AT_EMPTY_PATH));
+	EXPECT_TRUE(S_ISREG(st.st_mode));
+	EXPECT_EQ(12, st.st_size);
+	EXPECT_EQ(-1, ftruncate(fd, 5));
+	EXPECT_EQ(EINVAL, errno);
+	EXPECT_EQ(0, close(fd));
+
+	fd = open(Path("file").c_str(), O_RDWR);
+	ASSERT_GE(fd, 0) << strerror(errno);
+	EXPECT_EQ(0, ftruncate(fd, 5));
+	EXPECT_EQ(0, close(fd));
+	EXPECT_EQ("hello", ReadFile(Path("file")));
+
+	uint64_t stat_calls = GetStats(TC_PRELOAD_STAT).calls;
+	EXPECT_EQ(0, fstatat(AT_FDCWD, Path("file").c_str(), &st, 0));
+	EXPECT_EQ(5, st.st_size);
+	EXPECT_EQ(0, access(Path("file").c_str(), R_OK | W_OK));
+	EXPECT_EQ(-1, access(Path("none").c_str(), F_OK));
+	EXPECT_EQ(ENOENT, errno);
+	EXPECT_EQ(stat_calls + 3, GetStats(TC_PRELOAD_STAT).calls);
+}
+
+TEST_F(TcPreloadTest, TotalStats)
+{
+	struct tc_preload_stats total = GetStats(TC_PRELOAD_KINDS);
+	uint64_t calls = 0;
+	uint64_t rpcs = 0;
+
+	for (int i = 0; i < TC_PRELOAD_KINDS; ++i) {
+		calls += GetStats(i).calls;
+		rpcs += GetStats(i).rpcs;
+	}
+	EXPECT_EQ(calls, total.calls);
+	EXPECT_EQ(rpcs, total.rpcs);
+
+	struct tc_preload_stats stats;
+	EXPECT_EQ(-EINVAL, tc_preload_get_stats(TC_PRELOAD_KINDS + 1, &stats));
+}
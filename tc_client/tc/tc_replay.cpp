@@ -0,0 +1,819 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Replay a file-system trace with the TC API.
+ *
+ * The trace is either the output of "strace -ttt [-f]", or a CSV file with
+ * one operation per line:
+ *
+ *	time,read,path,offset,length
+ *	time,write,path,offset,length
+ *	time,create,path
+ *	time,stat,path
+ *	time,chmod,path,mode
+ *	time,rename,src,dst
+ *	time,unlink,path
+ *	time,mkdir,path[,mode]
+ *	time,rmdir,path
+ *
+ * where "time" is in seconds.  Trace paths are replayed under --root.  The
+ * trace is first replayed one call at a time; with --batch, it is replayed
+ * again after runs of independent operations of the same kind are merged
+ * into vector calls, and the speedup is reported.  Each replay runs in its
+ * own copy of the files the trace uses without creating; writes create
+ * missing files.
+ *
+ * Usage: tc_replay [--tc] [--batch] [--timing=recorded] <trace-file>
+ */
+
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tc_api.h"
+#include "tc_helper.h"
+#include "path_utils.h"
+#include "tc_bench_util.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+DEFINE_bool(tc, true, "Use TC implementation");
+
+DEFINE_string(root, "Replay", "Directory to replay the trace in");
+
+DEFINE_string(format, "auto", "Trace format: auto, strace, or csv");
+
+DEFINE_bool(batch, true, "Also replay with independent calls batched");
+
+DEFINE_int32(max_batch, 256, "Maximum number of operations in a batch");
+
+DEFINE_string(timing, "full",
+	      "full: issue calls back to back; recorded: keep the trace timing");
+
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+enum OpKind {
+	OP_READ = 0,
+	OP_WRITE,
+	OP_CREATE,
+	OP_STAT,
+	OP_CHMOD,
+	OP_RENAME,
+	OP_UNLINK,
+	OP_MKDIR,
+	OP_RMDIR,
+	OP_KINDS,
+};
+
+static const char *kOpNames[OP_KINDS] = {
+	"read", "write", "create", "stat", "chmod",
+	"rename", "unlink", "mkdir", "rmdir",
+};
+
+struct TraceOp {
+	double time;
+	OpKind kind;
+	string path;
+	string path2;
+	size_t offset;
+	size_t length;
+	mode_t mode;
+};
+
+static bool ParseKind(const string &name, OpKind *kind)
+{
+	for (int k = 0; k < OP_KINDS; ++k) {
+		if (name == kOpNames[k]) {
+			*kind = (OpKind)k;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Map a trace path to the path replayed under "root". */
+static string ReplayPath(const string &root, const string &path)
+{
+	char buf[PATH_MAX];
+	tc_path_join(root.c_str(), path.c_str(), buf, PATH_MAX);
+	return buf;
+}
+
+/*
+ * CSV traces
+ */
+
+static vector<string> SplitCsv(const string &line)
+{
+	vector<string> fields;
+	size_t start = 0;
+	while (true) {
+		size_t end = line.find(',', start);
+		fields.push_back(line.substr(start, end - start));
+		if (end == string::npos) {
+			break;
+		}
+		start = end + 1;
+	}
+	return fields;
+}
+
+static bool ParseCsvLine(const string &line, TraceOp *op)
+{
+	vector<string> f = SplitCsv(line);
+	if (f.size() < 3 || !ParseKind(f[1], &op->kind)) {
+		return false;
+	}
+	op->time = atof(f[0].c_str());
+	op->path = f[2];
+	op->path2.clear();
+	op->offset = op->length = 0;
+	op->mode = op->kind == OP_MKDIR ? 0755 : 0644;
+	switch (op->kind) {
+	case OP_READ:
+	case OP_WRITE:
+		if (f.size() < 5) {
+			return false;
+		}
+		op->offset = strtoull(f[3].c_str(), NULL, 0);
+		op->length = strtoull(f[4].c_str(), NULL, 0);
+		break;
+	case OP_CHMOD:
+	case OP_MKDIR:
+		if (f.size() > 3) {
+			op->mode = strtoul(f[3].c_str(), NULL, 8);
+		}
+		break;
+	case OP_RENAME:
+		if (f.size() < 4) {
+			return false;
+		}
+		op->path2 = f[3];
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+/*
+ * strace traces
+ */
+
+struct OpenFile {
+	string path;
+	size_t offset;
+};
+
+class StraceParser
+{
+public:
+	StraceParser(vector<TraceOp> *ops) : ops_(ops) {}
+
+	void Parse(string line);
+
+private:
+	bool ParseCall(double time, const string &call);
+	static bool ParseString(const char **p, string *s);
+	static void ParseArgs(const string &call, vector<string> *args,
+			      long *ret);
+
+	void Emit(double time, OpKind kind, const string &path,
+		  size_t offset = 0, size_t length = 0, mode_t mode = 0644,
+		  const string &path2 = "")
+	{
+		ops_->push_back(
+		    {time, kind, path, path2, offset, length, mode});
+	}
+
+	vector<TraceOp> *ops_;
+	map<int, OpenFile> fds_;
+	map<string, string> unfinished_;  // pid -> first half of a call
+};
+
+/*
+ * Parse a C string quoted by strace at "*p", which is advanced past it.
+ */
+bool StraceParser::ParseString(const char **p, string *s)
+{
+	const char *c = *p;
+
+	if (*c != '"') {
+		return false;
+	}
+	s->clear();
+	for (++c; *c && *c != '"'; ++c) {
+		if (*c != '\\') {
+			s->push_back(*c);
+			continue;
+		}
+		++c;
+		switch (*c) {
+		case 'n':
+			s->push_back('\n');
+			break;
+		case 't':
+			s->push_back('\t');
+			break;
+		case 'x':
+			s->push_back((char)strtol(std::string(c + 1, 2).c_str(),
+						  NULL, 16));
+			c += 2;
+			break;
+		default:
+			if (*c >= '0' && *c <= '7') {
+				int v = 0, n = 0;
+				for (; n < 3 && *c >= '0' && *c <= '7'; ++n)
+					v = v * 8 + (*c++ - '0');
+				s->push_back((char)v);
+				--c;
+			} else {
+				s->push_back(*c);
+			}
+		}
+	}
+	*p = *c ? c + 1 : c;
+	return true;
+}
+
+/*
+ * Split the top-level arguments of "name(arg, ...) = ret"; strings are
+ * unquoted.
+ */
+void StraceParser::ParseArgs(const string &call, vector<string> *args,
+			     long *ret)
+{
+	const char *p = strchr(call.c_str(), '(');
+	int depth = 0;
+	string cur;
+
+	args->clear();
+	for (++p; *p; ++p) {
+		if (*p == '"') {
+			string s;
+			ParseString(&p, &s);
+			cur += s;
+			--p;
+			continue;
+		}
+		if (*p == '(' || *p == '{' || *p == '[') {
+			++depth;
+		} else if ((*p == ')' || *p == '}' || *p == ']') &&
+			   depth > 0) {
+			--depth;
+		} else if (depth == 0 && (*p == ',' || *p == ')')) {
+			size_t b = cur.find_first_not_of(' ');
+			args->push_back(b == string::npos ? "" : cur.substr(b));
+			cur.clear();
+			if (*p == ')') {
+				break;
+			}
+			continue;
+		}
+		cur.push_back(*p);
+	}
+
+	const char *eq = *p ? strstr(p, "= ") : NULL;
+	*ret = eq ? strtol(eq + 2, NULL, 0) : -1;
+}
+
+bool StraceParser::ParseCall(double time, const string &call)
+{
+	vector<string> a;
+	long ret;
+	size_t paren = call.find('(');
+
+	if (paren == string::npos) {
+		return false;
+	}
+	string name = call.substr(0, paren);
+	ParseArgs(call, &a, &ret);
+	if (ret < 0) {
+		return false;  // failed calls are not replayed
+	}
+
+	/* drop the dirfd of *at() calls on AT_FDCWD */
+	if (name.size() > 2 && name.compare(name.size() - 2, 2, "at") == 0 &&
+	    name != "stat" && name != "fstat" && name != "lstat" &&
+	    name != "creat") {
+		if (a.empty() || a[0] != "AT_FDCWD") {
+			return false;
+		}
+		a.erase(a.begin());
+		name = name.substr(0, name.size() - 2);
+		if (name == "newfstat") {
+			name = "stat";
+		} else if (name == "fchmod") {
+			name = "chmod";
+		} else if (name == "rename" && a.size() >= 3) {
+			a.erase(a.begin() + 1);  // newdirfd
+		} else if (name == "unlink" && a.size() >= 2 &&
+			   a[1].find("AT_REMOVEDIR") != string::npos) {
+			name = "rmdir";
+		}
+	} else if (name == "renameat2" && a.size() >= 4 &&
+		   a[0] == "AT_FDCWD" && a[2] == "AT_FDCWD") {
+		a = {a[1], a[3]};
+		name = "rename";
+	} else if (name == "statx" && a.size() >= 2 && a[0] == "AT_FDCWD") {
+		a.erase(a.begin());
+		name = "stat";
+	}
+
+	if ((name == "open" || name == "creat") && a.size() >= 2) {
+		bool create = name == "creat" ||
+			      a[1].find("O_CREAT") != string::npos;
+		bool append = name != "creat" &&
+			      a[1].find("O_APPEND") != string::npos;
+		if (create) {
+			Emit(time, OP_CREATE, a[0]);
+		}
+		fds_[ret] = {a[0], append ? TC_OFFSET_END : 0};
+	} else if (name == "close") {
+		fds_.erase(atoi(a[0].c_str()));
+	} else if (name == "read" || name == "write" || name == "pread64" ||
+		   name == "pwrite64") {
+		auto it = fds_.find(atoi(a[0].c_str()));
+		if (it == fds_.end() || ret == 0) {
+			return false;
+		}
+		bool positional = name[0] == 'p';
+		if (positional && a.size() < 4) {
+			return false;
+		}
+		size_t offset = positional ? strtoull(a[3].c_str(), NULL, 0)
+					   : it->second.offset;
+		Emit(time, name.find("read") != string::npos ? OP_READ
+							      : OP_WRITE,
+		     it->second.path, offset, ret);
+		if (!positional && it->second.offset != TC_OFFSET_END) {
+			it->second.offset += ret;
+		}
+	} else if (name == "lseek") {
+		auto it = fds_.find(atoi(a[0].c_str()));
+		if (it != fds_.end()) {
+			it->second.offset = ret;
+		}
+	} else if (name == "stat" || name == "lstat") {
+		Emit(time, OP_STAT, a[0]);
+	} else if (name == "chmod" && a.size() >= 2) {
+		Emit(time, OP_CHMOD, a[0], 0, 0, strtoul(a[1].c_str(), NULL, 8));
+	} else if (name == "rename" && a.size() >= 2) {
+		Emit(time, OP_RENAME, a[0], 0, 0, 0, a[1]);
+	} else if (name == "unlink") {
+		Emit(time, OP_UNLINK, a[0]);
+	} else if (name == "mkdir" && a.size() >= 2) {
+		Emit(time, OP_MKDIR, a[0], 0, 0, strtoul(a[1].c_str(), NULL, 8));
+	} else if (name == "rmdir") {
+		Emit(time, OP_RMDIR, a[0]);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * A line is "[PID] [TIME] call(...) = ret", where PID may also be
+ * "[pid PID]".  TIME is seconds (-ttt) or HH:MM:SS.usec (-tt).
+ */
+void StraceParser::Parse(string line)
+{
+	string pid;
+	double time = 0;
+	size_t pos = 0;
+
+	if (line.compare(0, 5, "[pid ") == 0) {
+		pos = line.find(']');
+		pid = line.substr(5, pos - 5);
+		pos = line.find_first_not_of(' ', pos + 1);
+	} else if (isdigit(line[0])) {
+		size_t end = line.find(' ');
+		string tok = line.substr(0, end);
+		if (tok.find_first_not_of("0123456789") == string::npos &&
+		    end != string::npos && isdigit(line[end + 1])) {
+			pid = tok;
+			pos = end + 1;
+		}
+	}
+	if (pos < line.size() && isdigit(line[pos])) {
+		size_t end = line.find(' ', pos);
+		string tok = line.substr(pos, end - pos);
+		int h, m;
+		double s;
+		if (sscanf(tok.c_str(), "%d:%d:%lf", &h, &m, &s) == 3) {
+			time = h * 3600 + m * 60 + s;
+		} else {
+			time = atof(tok.c_str());
+		}
+		pos = line.find_first_not_of(' ', end);
+	}
+	if (pos == string::npos) {
+		return;
+	}
+	string call = line.substr(pos);
+
+	size_t unfinished = call.find(" <unfinished ...>");
+	if (unfinished != string::npos) {
+		unfinished_[pid] = call.substr(0, unfinished);
+		return;
+	}
+	if (call.compare(0, 5, "<... ") == 0) {
+		size_t resumed = call.find(" resumed>");
+		auto it = unfinished_.find(pid);
+		if (resumed == string::npos || it == unfinished_.end()) {
+			return;
+		}
+		call = it->second + call.substr(resumed + 9);
+		unfinished_.erase(it);
+	}
+	ParseCall(time, call);
+}
+
+static vector<TraceOp> LoadTrace(const char *path)
+{
+	vector<TraceOp> ops;
+	StraceParser strace(&ops);
+	string format = FLAGS_format;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		error(1, errno, "cannot open %s", path);
+	}
+	while ((n = getline(&line, &len, fp)) > 0) {
+		if (line[n - 1] == '\n') {
+			line[--n] = 0;
+		}
+		if (n == 0 || line[0] == '#') {
+			continue;
+		}
+		if (format == "auto") {
+			format = strchr(line, '(') ? "strace" : "csv";
+		}
+		if (format == "strace") {
+			strace.Parse(line);
+		} else {
+			TraceOp op;
+			if (ParseCsvLine(line, &op)) {
+				ops.push_back(op);
+			}
+		}
+	}
+	free(line);
+	fclose(fp);
+	return ops;
+}
+
+/*
+ * Batching
+ */
+
+struct Batch {
+	OpKind kind;
+	size_t begin;  // index of the first op
+	size_t end;    // index past the last op
+};
+
+static string Parent(const string &path)
+{
+	size_t slash = path.rfind('/');
+	return slash == string::npos ? "" : path.substr(0, slash);
+}
+
+/*
+ * Whether "op" can execute in the same vector call as the ops whose paths
+ * are in "paths" and "dirs" without changing the result.  Reads and stats
+ * of the same file are independent; other ops must touch distinct objects,
+ * and must not use a directory created or removed in the batch.
+ */
+static bool Independent(const TraceOp &op, const set<string> &paths,
+			const set<string> &dirs)
+{
+	bool readonly = op.kind == OP_READ || op.kind == OP_STAT;
+
+	if (!readonly && paths.count(op.path)) {
+		return false;
+	}
+	if (!op.path2.empty() && paths.count(op.path2)) {
+		return false;
+	}
+	if (dirs.count(Parent(op.path)) ||
+	    (!op.path2.empty() && dirs.count(Parent(op.path2)))) {
+		return false;
+	}
+	return true;
+}
+
+static vector<Batch> MakeBatches(const vector<TraceOp> &ops, bool batch)
+{
+	vector<Batch> batches;
+	set<string> paths;
+	set<string> dirs;
+
+	for (size_t i = 0; i < ops.size(); ++i) {
+		const TraceOp &op = ops[i];
+		if (batch && !batches.empty()) {
+			Batch &b = batches.back();
+			if (b.kind == op.kind &&
+			    (int)(b.end - b.begin) < FLAGS_max_batch &&
+			    Independent(op, paths, dirs)) {
+				b.end = i + 1;
+				paths.insert(op.path);
+				if (!op.path2.empty())
+					paths.insert(op.path2);
+				if (op.kind == OP_MKDIR || op.kind == OP_RMDIR)
+					dirs.insert(op.path);
+				continue;
+			}
+		}
+		batches.push_back({op.kind, i, i + 1});
+		paths = {op.path};
+		if (!op.path2.empty())
+			paths.insert(op.path2);
+		dirs.clear();
+		if (op.kind == OP_MKDIR || op.kind == OP_RMDIR)
+			dirs.insert(op.path);
+	}
+	return batches;
+}
+
+/*
+ * Replay
+ */
+
+/*
+ * Create under "root" the files and directories the trace uses before
+ * creating them, large enough for the reads.
+ */
+static void Prepare(const string &root, const vector<TraceOp> &ops)
+{
+	map<string, size_t> files;  // path -> size
+	set<string> created;
+	set<string> dirs;
+
+	ResetTestDirectory(root.c_str());
+	for (const TraceOp &op : ops) {
+		string parent = Parent(op.path);
+		if (!created.count(parent)) {
+			dirs.insert(parent);
+		}
+		if (!op.path2.empty() && !created.count(Parent(op.path2))) {
+			dirs.insert(Parent(op.path2));
+		}
+
+		if (op.kind == OP_RMDIR && !created.count(op.path)) {
+			dirs.insert(op.path);
+		} else if (op.kind != OP_CREATE && op.kind != OP_WRITE &&
+			   op.kind != OP_MKDIR && op.kind != OP_RMDIR &&
+			   !created.count(op.path)) {
+			size_t &size = files[op.path];
+			if (op.kind == OP_READ) {
+				size = std::max(size, op.offset + op.length);
+			}
+		}
+
+		if (op.kind == OP_CREATE || op.kind == OP_WRITE ||
+		    op.kind == OP_MKDIR) {
+			created.insert(op.path);
+		} else if (op.kind == OP_RENAME) {
+			created.insert(op.path2);
+		}
+	}
+
+	for (const string &d : dirs) {
+		tc_ensure_dir(ReplayPath(root, d).c_str(), 0755, NULL);
+	}
+	vector<char> data;
+	for (const auto &f : files) {
+		data.resize(std::max(data.size(), f.second + 1));
+		tc_iovec iov = {};
+		string path = ReplayPath(root, f.first);
+		tc_iov4creation(&iov, path.c_str(), f.second, data.data());
+		iov.is_write_stable = false;
+		tc_res tcres = tc_writev(&iov, 1, false);
+		if (!tc_okay(tcres)) {
+			error(1, tcres.err_no, "failed to create %s",
+			      path.c_str());
+		}
+	}
+}
+
+struct ReplayStats {
+	double seconds;
+	size_t calls;
+	size_t failures;
+	size_t calls_by_kind[OP_KINDS];
+};
+
+/*
+ * Execute ops[begin, end) of the same kind in one vector call; return the
+ * number executed before the first failure, or "end - begin".
+ */
+static size_t Execute(const string &root, const vector<TraceOp> &ops,
+		      size_t begin, size_t end, vector<char> *buf)
+{
+	size_t n = end - begin;
+	OpKind kind = ops[begin].kind;
+	vector<string> p1(n), p2(n);
+	tc_res tcres;
+
+	for (size_t i = 0; i < n; ++i) {
+		p1[i] = ReplayPath(root, ops[begin + i].path);
+		if (!ops[begin + i].path2.empty())
+			p2[i] = ReplayPath(root, ops[begin + i].path2);
+	}
+
+	switch (kind) {
+	case OP_READ:
+	case OP_WRITE:
+	case OP_CREATE: {
+		vector<tc_iovec> iovs(n);
+		size_t total = 0;
+		for (size_t i = 0; i < n; ++i)
+			total += ops[begin + i].length;
+		if (buf->size() < total)
+			buf->resize(total);
+		total = 0;
+		for (size_t i = 0; i < n; ++i) {
+			const TraceOp &op = ops[begin + i];
+			if (kind == OP_CREATE) {
+				tc_iov4creation(&iovs[i], p1[i].c_str(), 0,
+						buf->data());
+			} else {
+				tc_iov2path(&iovs[i], p1[i].c_str(), op.offset,
+					    op.length, buf->data() + total);
+				/* the trace may write files it did not create */
+				iovs[i].is_creation = kind == OP_WRITE;
+			}
+			total += op.length;
+		}
+		tcres = kind == OP_READ ? tc_readv(iovs.data(), n, false)
+					: tc_writev(iovs.data(), n, false);
+		break;
+	}
+	case OP_STAT:
+	case OP_CHMOD: {
+		vector<tc_attrs> attrs(n);
+		for (size_t i = 0; i < n; ++i) {
+			attrs[i].file = tc_file_from_path(p1[i].c_str());
+			if (kind == OP_STAT) {
+				attrs[i].masks = TC_ATTRS_MASK_ALL;
+			} else {
+				attrs[i].masks = TC_ATTRS_MASK_NONE;
+				tc_attrs_set_mode(&attrs[i],
+						  ops[begin + i].mode);
+			}
+		}
+		tcres = kind == OP_STAT ? tc_getattrsv(attrs.data(), n, false)
+					: tc_setattrsv(attrs.data(), n, false);
+		break;
+	}
+	case OP_RENAME: {
+		vector<tc_file_pair> pairs(n);
+		for (size_t i = 0; i < n; ++i) {
+			pairs[i].src_file = tc_file_from_path(p1[i].c_str());
+			pairs[i].dst_file = tc_file_from_path(p2[i].c_str());
+		}
+		tcres = tc_renamev(pairs.data(), n, false);
+		break;
+	}
+	case OP_UNLINK:
+	case OP_RMDIR: {
+		vector<tc_file> files(n);
+		for (size_t i = 0; i < n; ++i)
+			files[i] = tc_file_from_path(p1[i].c_str());
+		tcres = tc_removev(files.data(), n, false);
+		break;
+	}
+	case OP_MKDIR: {
+		vector<tc_attrs> dirs(n);
+		for (size_t i = 0; i < n; ++i)
+			tc_set_up_creation(&dirs[i], p1[i].c_str(),
+					   ops[begin + i].mode);
+		tcres = tc_mkdirv(dirs.data(), n, false);
+		break;
+	}
+	default:
+		return n;
+	}
+	return tc_okay(tcres) ? n : tcres.index;
+}
+
+static ReplayStats Replay(const string &root, const vector<TraceOp> &ops,
+			  const vector<Batch> &batches)
+{
+	ReplayStats st = {};
+	vector<char> buf;
+	bool recorded = FLAGS_timing == "recorded";
+	double t0 = ops.empty() ? 0 : ops[0].time;
+
+	auto start = Clock::now();
+	for (const Batch &b : batches) {
+		if (recorded) {
+			std::this_thread::sleep_until(
+			    start + std::chrono::duration_cast<Clock::duration>(
+					std::chrono::duration<double>(
+					    ops[b.begin].time - t0)));
+		}
+		// Skip a failed op, like the application would, and go on.
+		for (size_t i = b.begin; i < b.end;) {
+			size_t done = Execute(root, ops, i, b.end, &buf);
+			st.calls++;
+			st.calls_by_kind[b.kind]++;
+			i += done;
+			if (i < b.end) {
+				st.failures++;
+				i++;
+			}
+		}
+	}
+	st.seconds = std::chrono::duration<double>(Clock::now() - start)
+			 .count();
+	return st;
+}
+
+static void Print(const char *name, const ReplayStats &st)
+{
+	printf("%-10s %10.3f s %10zu calls %8zu failed  (", name, st.seconds,
+	       st.calls, st.failures);
+	for (int k = 0, first = 1; k < OP_KINDS; ++k) {
+		if (st.calls_by_kind[k]) {
+			printf("%s%s:%zu", first ? "" : " ", kOpNames[k],
+			       st.calls_by_kind[k]);
+			first = 0;
+		}
+	}
+	printf(")\n");
+}
+
+int main(int argc, char *argv[])
+{
+	std::string usage("This program replays a file-system trace.\nUsage: ");
+	usage += argv[0];
+	usage += " <trace-file>";
+	gflags::SetUsageMessage(usage);
+	gflags::ParseCommandLineFlags(&argc, &argv, true);
+	if (argc < 2) {
+		gflags::ShowUsageWithFlags(argv[0]);
+		return 1;
+	}
+
+	vector<TraceOp> ops = LoadTrace(argv[1]);
+	fprintf(stderr, "Loaded %zu operations from %s\n", ops.size(),
+		argv[1]);
+
+	void *tcdata = SetUp(FLAGS_tc);
+
+	string root = FLAGS_root + "/single";
+	Prepare(root, ops);
+	ReplayStats single = Replay(root, ops, MakeBatches(ops, false));
+	Print("single", single);
+
+	if (FLAGS_batch) {
+		root = FLAGS_root + "/batched";
+		Prepare(root, ops);
+		ReplayStats batched = Replay(root, ops, MakeBatches(ops, true));
+		Print("batched", batched);
+		printf("speedup: %.2fx (%.1f ops per call)\n",
+		       single.seconds / batched.seconds,
+		       (double)ops.size() / std::max<size_t>(batched.calls, 1));
+	}
+
+	TearDown(tcdata);
+	return 0;
+}
@@ -0,0 +1,867 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "tc_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TC_SHM_MAGIC 0x54435348	/* "TCSH" */
+#define TC_SHM_ALIGN 64
+
+#define tc_shm_align(n, a) (((n) + (a) - 1) & ~((size_t)(a) - 1))
+
+enum TC_SHM_SLOT_STATE {
+	TC_SHM_SLOT_FREE = 0,
+	TC_SHM_SLOT_FILLING,	/* being filled or drained by its owner */
+	TC_SHM_SLOT_SUBMITTED,
+	TC_SHM_SLOT_DONE,
+};
+
+struct tc_shm_slot {
+	int state;
+	pid_t owner;
+	int count;
+	bool is_transaction;
+	tc_res res;
+	pthread_cond_t done;
+	struct tc_cpd_op ops[TC_SHM_MAX_OPS];
+	/* followed by "slot_size" bytes of paths and data */
+};
+
+struct tc_shm_header {
+	uint32_t magic;
+	uint32_t nslots;
+	size_t slot_size;
+	size_t slots_offset;
+	size_t slot_stride;
+	size_t map_size;
+	pid_t daemon;
+	char cwd[PATH_MAX];
+	pthread_mutex_t lock;	/* protects the fields below and slot states */
+	pthread_cond_t slot_freed;
+	pthread_cond_t submitted;
+	bool stopping;
+	uint32_t sq_head;	/* # of slots ever taken by workers */
+	uint32_t sq_tail;	/* # of slots ever submitted */
+	uint32_t sq[];		/* submission ring of "nslots" slot indices */
+};
+
+struct tc_shm {
+	struct tc_shm_header *hdr;
+	size_t map_size;
+	char name[NAME_MAX + 1];
+	/* daemon only */
+	tc_shm_run_fn run;
+	int nworkers;
+	pthread_t *workers;
+	/* client only; absolute */
+	char cwd[PATH_MAX];
+};
+
+/* Where the paths and data of one slot are put. */
+struct tc_shm_buf {
+	char *base;
+	size_t size;
+	size_t used;
+};
+
+static inline struct tc_shm_slot *tc_shm_slot(struct tc_shm_header *hdr,
+					      int i)
+{
+	return (struct tc_shm_slot *)((char *)hdr + hdr->slots_offset +
+				      i * hdr->slot_stride);
+}
+
+static inline char *tc_shm_slot_data(struct tc_shm_slot *slot)
+{
+	return (char *)(slot + 1);
+}
+
+/* The lock is robust: a client may die holding it. */
+static void tc_shm_lock(struct tc_shm_header *hdr)
+{
+	if (pthread_mutex_lock(&hdr->lock) == EOWNERDEAD) {
+		pthread_mutex_consistent(&hdr->lock);
+	}
+}
+
+static inline void tc_shm_unlock(struct tc_shm_header *hdr)
+{
+	pthread_mutex_unlock(&hdr->lock);
+}
+
+static int tc_shm_wait(pthread_cond_t *cv, struct tc_shm_header *hdr,
+		       int timeout_sec)
+{
+	struct timespec ts;
+	int rc;
+
+	if (timeout_sec == 0) {
+		rc = pthread_cond_wait(cv, &hdr->lock);
+	} else {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout_sec;
+		rc = pthread_cond_timedwait(cv, &hdr->lock, &ts);
+	}
+	if (rc == EOWNERDEAD) {
+		pthread_mutex_consistent(&hdr->lock);
+		rc = 0;
+	}
+	return rc;
+}
+
+static inline bool tc_shm_is_dead(pid_t pid)
+{
+	return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+static void tc_shm_set_name(struct tc_shm *shm, const char *name)
+{
+	snprintf(shm->name, sizeof(shm->name), "%s%s",
+		 name[0] == '/' ? "" : "/", name);
+}
+
+struct tc_shm *tc_shm_create(const char *name, int nslots, size_t slot_size,
+			     const char *cwd)
+{
+	struct tc_shm *shm;
+	struct tc_shm_header *hdr;
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	size_t slots_offset;
+	size_t stride;
+	size_t size;
+	int fd;
+	int i;
+
+	if (nslots < 1 || slot_size < PATH_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	shm = calloc(1, sizeof(*shm));
+	if (!shm) {
+		return NULL;
+	}
+	tc_shm_set_name(shm, name);
+
+	slots_offset = tc_shm_align(sizeof(*hdr) + nslots * sizeof(uint32_t),
+				    TC_SHM_ALIGN);
+	stride = tc_shm_align(sizeof(struct tc_shm_slot) + slot_size,
+			      TC_SHM_ALIGN);
+	size = slots_offset + nslots * stride;
+
+	shm_unlink(shm->name);	/* left by a crashed daemon */
+	fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		goto err;
+	}
+	if (ftruncate(fd, size) != 0) {
+		close(fd);
+		goto err_unlink;
+	}
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		goto err_unlink;
+	}
+
+	hdr->nslots = nslots;
+	hdr->slot_size = slot_size;
+	hdr->slots_offset = slots_offset;
+	hdr->slot_stride = stride;
+	hdr->map_size = size;
+	hdr->daemon = getpid();
+	snprintf(hdr->cwd, sizeof(hdr->cwd), "%s", cwd ? cwd : "/");
+
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&hdr->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+	pthread_cond_init(&hdr->slot_freed, &cattr);
+	pthread_cond_init(&hdr->submitted, &cattr);
+	for (i = 0; i < nslots; ++i) {
+		pthread_cond_init(&tc_shm_slot(hdr, i)->done, &cattr);
+	}
+	pthread_condattr_destroy(&cattr);
+
+	__sync_synchronize();
+	hdr->magic = TC_SHM_MAGIC;	/* ready for clients */
+
+	shm->hdr = hdr;
+	shm->map_size = size;
+	return shm;
+
+err_unlink:
+	shm_unlink(shm->name);
+err:
+	free(shm);
+	return NULL;
+}
+
+/* Return the files of "op" in "files", and their number. */
+static int tc_shm_op_files(struct tc_cpd_op *op, tc_file **files)
+{
+	switch (op->type) {
+	case TC_CPD_READ:
+	case TC_CPD_WRITE:
+		files[0] = &op->iov.file;
+		return 1;
+	case TC_CPD_REMOVE:
+		files[0] = &op->file;
+		return 1;
+	case TC_CPD_RENAME:
+		files[0] = &op->pair.src_file;
+		files[1] = &op->pair.dst_file;
+		return 2;
+	default:
+		files[0] = &op->attrs.file;
+		return 1;
+	}
+}
+
+static inline bool tc_shm_file_has_path(const tc_file *file)
+{
+	return (file->type == TC_FILE_PATH || file->type == TC_FILE_CURRENT ||
+		file->type == TC_FILE_SAVED) && file->path;
+}
+
+/*
+ * Whether a client may send "file": an absolute path, or the current or
+ * saved FH.  Descriptors and handles are local to a process.
+ */
+static bool tc_shm_file_is_valid(const tc_file *file)
+{
+	switch (file->type) {
+	case TC_FILE_NULL:
+	case TC_FILE_CURRENT:
+	case TC_FILE_SAVED:
+		return true;
+	case TC_FILE_PATH:
+		return file->fd == TC_FD_ABS && file->path;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Turn the offsets in "op" into pointers into "buf", checking that they
+ * are within it and that its files can be used by the daemon.
+ *
+ * Return 0, EINVAL or EFAULT.
+ */
+static int tc_shm_relocate(struct tc_cpd_op *op, struct tc_shm_buf *buf)
+{
+	tc_file *files[2];
+	uintptr_t off;
+	int n;
+	int i;
+
+	n = tc_shm_op_files(op, files);
+	for (i = 0; i < n; ++i) {
+		if (!tc_shm_file_is_valid(files[i])) {
+			return EINVAL;
+		}
+		if (!tc_shm_file_has_path(files[i])) {
+			continue;
+		}
+		off = (uintptr_t)files[i]->path;
+		if (off >= buf->size ||
+		    !memchr(buf->base + off, '\0', buf->size - off)) {
+			return EFAULT;
+		}
+		files[i]->path = buf->base + off;
+	}
+
+	if (op->type == TC_CPD_READ || op->type == TC_CPD_WRITE) {
+		off = (uintptr_t)op->iov.data;
+		if (off > buf->size || op->iov.length > buf->size - off) {
+			return EFAULT;
+		}
+		op->iov.data = buf->base + off;
+	}
+	return 0;
+}
+
+static void tc_shm_execute(struct tc_shm *shm, struct tc_shm_slot *slot)
+{
+	struct tc_cpd_op ops[TC_SHM_MAX_OPS];
+	struct tc_shm_buf buf = {
+		.base = tc_shm_slot_data(slot),
+		.size = shm->hdr->slot_size,
+	};
+	int count = slot->count;
+	int err;
+	int i;
+
+	if (count < 1 || count > TC_SHM_MAX_OPS) {
+		slot->res = tc_failure(0, EINVAL);
+		return;
+	}
+	memcpy(ops, slot->ops, count * sizeof(ops[0]));
+	for (i = 0; i < count; ++i) {
+		err = tc_shm_relocate(&ops[i], &buf);
+		if (err) {
+			slot->ops[i].err_no = err;
+			slot->res = tc_failure(i, err);
+			return;
+		}
+	}
+
+	slot->res = shm->run(ops, count, slot->is_transaction);
+	/* the client ignores the pointers, which are ours now */
+	memcpy(slot->ops, ops, count * sizeof(ops[0]));
+}
+
+static void *tc_shm_worker(void *arg)
+{
+	struct tc_shm *shm = arg;
+	struct tc_shm_header *hdr = shm->hdr;
+	struct tc_shm_slot *slot;
+
+	tc_shm_lock(hdr);
+	for (;;) {
+		while (!hdr->stopping && hdr->sq_head == hdr->sq_tail) {
+			tc_shm_wait(&hdr->submitted, hdr, 0);
+		}
+		if (hdr->stopping) {
+			break;
+		}
+		slot = tc_shm_slot(hdr, hdr->sq[hdr->sq_head++ % hdr->nslots]);
+		tc_shm_unlock(hdr);
+
+		tc_shm_execute(shm, slot);
+
+		tc_shm_lock(hdr);
+		slot->state = TC_SHM_SLOT_DONE;
+		pthread_cond_broadcast(&slot->done);
+	}
+	tc_shm_unlock(hdr);
+	return NULL;
+}
+
+int tc_shm_serve(struct tc_shm *shm, int nworkers, tc_shm_run_fn run)
+{
+	int rc;
+
+	shm->run = run;
+	shm->workers = calloc(nworkers, sizeof(pthread_t));
+	if (!shm->workers) {
+		return -ENOMEM;
+	}
+	for (shm->nworkers = 0; shm->nworkers < nworkers; ++shm->nworkers) {
+		rc = pthread_create(&shm->workers[shm->nworkers], NULL,
+				    tc_shm_worker, shm);
+		if (rc != 0) {
+			return -rc;
+		}
+	}
+	return 0;
+}
+
+void tc_shm_destroy(struct tc_shm *shm)
+{
+	struct tc_shm_header *hdr = shm->hdr;
+	struct tc_shm_slot *slot;
+	int i;
+
+	tc_shm_lock(hdr);
+	hdr->stopping = true;
+	pthread_cond_broadcast(&hdr->submitted);
+	pthread_cond_broadcast(&hdr->slot_freed);
+	tc_shm_unlock(hdr);
+
+	for (i = 0; i < shm->nworkers; ++i) {
+		pthread_join(shm->workers[i], NULL);
+	}
+	free(shm->workers);
+
+	tc_shm_lock(hdr);
+	while (hdr->sq_head != hdr->sq_tail) {
+		slot = tc_shm_slot(hdr, hdr->sq[hdr->sq_head++ % hdr->nslots]);
+		slot->res = tc_failure(0, ESHUTDOWN);
+		slot->state = TC_SHM_SLOT_DONE;
+		pthread_cond_broadcast(&slot->done);
+	}
+	tc_shm_unlock(hdr);
+
+	/* attached clients keep their mappings until they detach */
+	shm_unlink(shm->name);
+	munmap(hdr, shm->map_size);
+	free(shm);
+}
+
+struct tc_shm *tc_shm_attach(const char *name)
+{
+	struct tc_shm *shm;
+	struct tc_shm_header *hdr;
+	struct stat st;
+	int fd;
+
+	shm = calloc(1, sizeof(*shm));
+	if (!shm) {
+		return NULL;
+	}
+	tc_shm_set_name(shm, name);
+
+	fd = shm_open(shm->name, O_RDWR, 0);
+	if (fd < 0) {
+		goto err;
+	}
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		goto err;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		   0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		goto err;
+	}
+	if (hdr->magic != TC_SHM_MAGIC || hdr->map_size != st.st_size) {
+		munmap(hdr, st.st_size);
+		errno = EPROTO;
+		goto err;
+	}
+
+	shm->hdr = hdr;
+	shm->map_size = st.st_size;
+	snprintf(shm->cwd, sizeof(shm->cwd), "%s", hdr->cwd);
+	return shm;
+
+err:
+	free(shm);
+	return NULL;
+}
+
+void tc_shm_detach(struct tc_shm *shm)
+{
+	munmap(shm->hdr, shm->map_size);
+	free(shm);
+}
+
+/* Return the index of a slot now owned by the caller, or -errno. */
+static int tc_shm_get_slot(struct tc_shm *shm)
+{
+	struct tc_shm_header *hdr = shm->hdr;
+	struct tc_shm_slot *slot;
+	bool reclaimed;
+	int i;
+
+	tc_shm_lock(hdr);
+	for (;;) {
+		if (hdr->stopping || tc_shm_is_dead(hdr->daemon)) {
+			tc_shm_unlock(hdr);
+			return -ESHUTDOWN;
+		}
+		reclaimed = false;
+		for (i = 0; i < hdr->nslots; ++i) {
+			slot = tc_shm_slot(hdr, i);
+			if (slot->state == TC_SHM_SLOT_FREE) {
+				slot->state = TC_SHM_SLOT_FILLING;
+				slot->owner = getpid();
+				tc_shm_unlock(hdr);
+				return i;
+			}
+			/* slots of clients that died */
+			if ((slot->state == TC_SHM_SLOT_FILLING ||
+			     slot->state == TC_SHM_SLOT_DONE) &&
+			    tc_shm_is_dead(slot->owner)) {
+				slot->state = TC_SHM_SLOT_FREE;
+				reclaimed = true;
+			}
+		}
+		if (!reclaimed) {
+			tc_shm_wait(&hdr->slot_freed, hdr, 1);
+		}
+	}
+}
+
+static void tc_shm_put_slot(struct tc_shm *shm, struct tc_shm_slot *slot)
+{
+	tc_shm_lock(shm->hdr);
+	slot->state = TC_SHM_SLOT_FREE;
+	slot->owner = 0;
+	pthread_cond_signal(&shm->hdr->slot_freed);
+	tc_shm_unlock(shm->hdr);
+}
+
+/* Return the offset of "size" bytes in "buf", or -1 if they do not fit. */
+static ssize_t tc_shm_alloc(struct tc_shm_buf *buf, size_t size)
+{
+	size_t off = tc_shm_align(buf->used, sizeof(void *));
+
+	if (off > buf->size || size > buf->size - off) {
+		return -1;
+	}
+	buf->used = off + size;
+	return off;
+}
+
+static int tc_shm_put_file(struct tc_shm *shm, struct tc_shm_buf *buf,
+			   tc_file *file)
+{
+	const char *dir = "";
+	const char *sep = "";
+	ssize_t off;
+	size_t len;
+
+	if (file->type == TC_FILE_NULL) {
+		return 0;
+	}
+	if (!tc_shm_file_has_path(file)) {
+		/* the current or saved FH can be used as is */
+		return (file->type == TC_FILE_CURRENT ||
+			file->type == TC_FILE_SAVED) ? 0 : EINVAL;
+	}
+	if (file->type == TC_FILE_PATH) {
+		if (file->fd != TC_FD_CWD && file->fd != TC_FD_ABS) {
+			/* descriptors are local to the process */
+			return EINVAL;
+		}
+		if (file->path[0] != '/') {
+			dir = shm->cwd;
+			sep = "/";
+		}
+		file->fd = TC_FD_ABS;
+	}
+
+	len = strlen(dir) + strlen(sep) + strlen(file->path) + 1;
+	off = tc_shm_alloc(buf, len);
+	if (off < 0) {
+		return E2BIG;
+	}
+	snprintf(buf->base + off, len, "%s%s%s", dir, sep, file->path);
+	file->path = (const char *)(uintptr_t)off;
+	return 0;
+}
+
+/*
+ * Copy "op" into "dst" of the slot, with its paths and data in "buf".
+ * "data_off" is where READ data will be.
+ *
+ * Return 0, E2BIG if it does not fit, or EINVAL.
+ */
+static int tc_shm_put_op(struct tc_shm *shm, struct tc_shm_buf *buf,
+			 struct tc_cpd_op *dst, const struct tc_cpd_op *op,
+			 size_t *data_off)
+{
+	tc_file *files[2];
+	ssize_t off;
+	int err;
+	int n;
+	int i;
+
+	*dst = *op;
+	n = tc_shm_op_files(dst, files);
+	for (i = 0; i < n; ++i) {
+		err = tc_shm_put_file(shm, buf, files[i]);
+		if (err) {
+			return err;
+		}
+	}
+
+	if (op->type == TC_CPD_READ || op->type == TC_CPD_WRITE) {
+		off = tc_shm_alloc(buf, op->iov.length);
+		if (off < 0) {
+			return E2BIG;
+		}
+		if (op->type == TC_CPD_WRITE) {
+			memcpy(buf->base + off, op->iov.data, op->iov.length);
+		}
+		dst->iov.data = (char *)(uintptr_t)off;
+		*data_off = off;
+	}
+	return 0;
+}
+
+/* Copy the results in "res" back into "op". */
+static void tc_shm_get_op(struct tc_cpd_op *op, const struct tc_cpd_op *res,
+			  const char *data)
+{
+	tc_file file;
+
+	op->err_no = res->err_no;
+	switch (op->type) {
+	case TC_CPD_READ:
+		if (res->iov.length <= op->iov.length) {
+			memcpy(op->iov.data, data, res->iov.length);
+			op->iov.length = res->iov.length;
+		}
+		op->iov.is_eof = res->iov.is_eof;
+		op->iov.is_failure = res->iov.is_failure;
+		break;
+	case TC_CPD_WRITE:
+		op->iov.length = res->iov.length;
+		op->iov.is_failure = res->iov.is_failure;
+		op->iov.is_write_stable = res->iov.is_write_stable;
+		break;
+	case TC_CPD_GETATTRS:
+		file = op->attrs.file;
+		op->attrs = res->attrs;
+		op->attrs.file = file;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Submit the filled slot "i" and wait for its completion. */
+static int tc_shm_submit(struct tc_shm *shm, int i)
+{
+	struct tc_shm_header *hdr = shm->hdr;
+	struct tc_shm_slot *slot = tc_shm_slot(hdr, i);
+
+	tc_shm_lock(hdr);
+	if (hdr->stopping) {
+		tc_shm_unlock(hdr);
+		return ESHUTDOWN;
+	}
+	slot->state = TC_SHM_SLOT_SUBMITTED;
+	hdr->sq[hdr->sq_tail++ % hdr->nslots] = i;
+	pthread_cond_signal(&hdr->submitted);
+	while (slot->state != TC_SHM_SLOT_DONE) {
+		if (tc_shm_wait(&slot->done, hdr, 1) == ETIMEDOUT &&
+		    tc_shm_is_dead(hdr->daemon)) {
+			tc_shm_unlock(hdr);
+			return ECONNRESET;
+		}
+	}
+	slot->state = TC_SHM_SLOT_FILLING;
+	tc_shm_unlock(hdr);
+	return 0;
+}
+
+static inline bool tc_shm_is_rw(const struct tc_cpd_op *op)
+{
+	return op->type == TC_CPD_READ || op->type == TC_CPD_WRITE;
+}
+
+/*
+ * Whether "ops" can be sent in different slots before and after ops[k],
+ * which is not so for a VERIFY or NVERIFY and the operation it guards, nor
+ * for an operation on the current or saved FH left by the ones before it.
+ */
+static bool tc_shm_can_split(struct tc_cpd_op *ops, int k)
+{
+	tc_file *files[2];
+	int n;
+	int i;
+
+	if (ops[k - 1].type == TC_CPD_VERIFY ||
+	    ops[k - 1].type == TC_CPD_NVERIFY) {
+		return false;
+	}
+	n = tc_shm_op_files(&ops[k], files);
+	for (i = 0; i < n; ++i) {
+		if (files[i]->type == TC_FILE_CURRENT ||
+		    files[i]->type == TC_FILE_SAVED) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Execute the READ or WRITE "op", which is too large for a slot, in pieces
+ * that each fit in one.  It stops at a failure, a short I/O, or EOF.
+ */
+static tc_res tc_shm_split_rw(struct tc_shm *shm, struct tc_cpd_op *op)
+{
+	struct tc_cpd_op piece;
+	size_t reserve;
+	size_t chunk;
+	size_t done = 0;
+	tc_res res;
+
+	/* the path, the NULL offset and two alignments, see tc_shm_put_op() */
+	reserve = 1 + 2 * sizeof(void *);
+	if (tc_shm_file_has_path(&op->iov.file)) {
+		reserve += strlen(shm->cwd) + strlen(op->iov.file.path) + 2;
+	}
+	if (reserve >= shm->hdr->slot_size) {
+		op->err_no = E2BIG;
+		return tc_failure(0, E2BIG);
+	}
+	chunk = shm->hdr->slot_size - reserve;
+
+	do {
+		piece = *op;
+		piece.iov.data = op->iov.data + done;
+		piece.iov.length = op->iov.length - done;
+		if (piece.iov.length > chunk) {
+			piece.iov.length = chunk;
+		}
+		/* appends and the current offset advance by themselves */
+		if (op->iov.offset != TC_OFFSET_END &&
+		    op->iov.offset != TC_OFFSET_CUR) {
+			piece.iov.offset = op->iov.offset + done;
+		}
+		res = tc_shm_cpdv(shm, &piece, 1, false);
+		if (!tc_okay(res)) {
+			break;
+		}
+		done += piece.iov.length;
+	} while (done < op->iov.length && piece.iov.length == chunk &&
+		 !piece.iov.is_eof);
+
+	op->err_no = piece.err_no;
+	op->iov.length = done;
+	op->iov.is_eof = piece.iov.is_eof;
+	op->iov.is_failure = piece.iov.is_failure;
+	op->iov.is_write_stable = piece.iov.is_write_stable;
+	return res;
+}
+
+tc_res tc_shm_cpdv(struct tc_shm *shm, struct tc_cpd_op *ops, int count,
+		   bool is_transaction)
+{
+	size_t data_off[TC_SHM_MAX_OPS];
+	struct tc_shm_slot *slot;
+	struct tc_shm_buf buf;
+	tc_res res;
+	int done = 0;
+	int err;
+	int n;
+	int i;
+
+	while (done < count) {
+		i = tc_shm_get_slot(shm);
+		if (i < 0) {
+			return tc_failure(done, -i);
+		}
+		slot = tc_shm_slot(shm->hdr, i);
+		buf.base = tc_shm_slot_data(slot);
+		buf.size = shm->hdr->slot_size;
+		buf.used = 1;	/* offset 0 would read as a NULL path */
+
+		err = 0;
+		for (n = 0; done + n < count && n < TC_SHM_MAX_OPS; ++n) {
+			err = tc_shm_put_op(shm, &buf, &slot->ops[n],
+					    &ops[done + n], &data_off[n]);
+			if (err) {
+				break;
+			}
+		}
+		/* the rest goes into the next slot */
+		if (err == E2BIG && n > 0 && !is_transaction) {
+			err = 0;
+		}
+		if (!err && is_transaction && done + n < count) {
+			err = E2BIG;
+		}
+		if (!err && done + n < count) {
+			while (n > 0 && !tc_shm_can_split(ops, done + n)) {
+				--n;
+			}
+			if (n == 0) {
+				err = E2BIG;
+			}
+		}
+		/* a single READ or WRITE larger than a slot is split */
+		if (err == E2BIG && n == 0 && !is_transaction &&
+		    tc_shm_is_rw(&ops[done]) &&
+		    ops[done].iov.file.type == TC_FILE_PATH &&
+		    (done + 1 == count || tc_shm_can_split(ops, done + 1))) {
+			tc_shm_put_slot(shm, slot);
+			res = tc_shm_split_rw(shm, &ops[done]);
+			if (!tc_okay(res)) {
+				return tc_failure(done, res.err_no);
+			}
+			done += 1;
+			continue;
+		}
+		if (err) {
+			tc_shm_put_slot(shm, slot);
+			ops[done + n].err_no = err;
+			return tc_failure(done + n, err);
+		}
+
+		slot->count = n;
+		slot->is_transaction = is_transaction;
+		err = tc_shm_submit(shm, i);
+		if (err) {
+			if (err != ECONNRESET) {
+				tc_shm_put_slot(shm, slot);
+			}
+			return tc_failure(done, err);
+		}
+
+		for (i = 0; i < n; ++i) {
+			tc_shm_get_op(&ops[done + i], &slot->ops[i],
+				      buf.base + data_off[i]);
+		}
+		res = slot->res;
+		tc_shm_put_slot(shm, slot);
+		if (!tc_okay(res)) {
+			return tc_failure(done + res.index, res.err_no);
+		}
+		done += n;
+	}
+
+	return tc_failure(-1, 0);
+}
+
+int tc_shm_chdir(struct tc_shm *shm, const char *path)
+{
+	struct tc_cpd_op op;
+	tc_res res;
+
+	memset(&op, 0, sizeof(op));
+	op.type = TC_CPD_GETATTRS;
+	op.attrs.file = tc_file_from_path(path);
+	op.attrs.masks.has_mode = true;
+	res = tc_shm_cpdv(shm, &op, 1, false);
+	if (!tc_okay(res)) {
+		return -res.err_no;
+	}
+	if (!S_ISDIR(op.attrs.mode)) {
+		return -ENOTDIR;
+	}
+
+	if (path[0] == '/') {
+		snprintf(shm->cwd, sizeof(shm->cwd), "%s", path);
+	} else if (strlen(shm->cwd) + strlen(path) + 2 <= sizeof(shm->cwd)) {
+		strcat(shm->cwd, "/");
+		strcat(shm->cwd, path);
+	} else {
+		return -ENAMETOOLONG;
+	}
+	return 0;
+}
+
+const char *tc_shm_getcwd(struct tc_shm *shm)
+{
+	return shm->cwd;
+}
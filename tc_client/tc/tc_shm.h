@@ -0,0 +1,113 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Shared-memory transport between application processes and a local TC
+ * daemon (tc_daemon), so that many processes share the daemon's session.
+ *
+ * The daemon creates a region with "nslots" request slots, each holding up
+ * to TC_SHM_MAX_OPS compound operations (struct tc_cpd_op) and "slot_size"
+ * bytes of paths and data.  A client fills a free slot, puts its index on
+ * the submission ring, and sleeps until the slot is completed.  Daemon
+ * workers take slots from the ring and execute them in place: READs and
+ * WRITEs use the buffers inside the slot directly.
+ *
+ * Pointers inside a slot are stored as offsets into its data area, as the
+ * region is mapped at different addresses in different processes.  Only
+ * files identified by paths (or the current/saved filehandle) can cross
+ * process boundaries; relative paths are resolved by the client against its
+ * own working directory (see tc_shm_chdir()).
+ */
+
+#ifndef __TC_SHM_H__
+#define __TC_SHM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "tc_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TC_SHM_MAX_OPS 64
+
+struct tc_shm;
+
+typedef tc_res (*tc_shm_run_fn)(struct tc_cpd_op *ops, int count,
+				bool is_transaction);
+
+/**
+ * Create the region "name" (see shm_open(3)), replacing any stale one.
+ * Clients start in the daemon's working directory "cwd".
+ *
+ * Return NULL and set errno on failure.
+ */
+struct tc_shm *tc_shm_create(const char *name, int nslots, size_t slot_size,
+			     const char *cwd);
+
+/**
+ * Start "nworkers" threads executing submitted slots with "run".
+ *
+ * Return 0 or -errno.
+ */
+int tc_shm_serve(struct tc_shm *shm, int nworkers, tc_shm_run_fn run);
+
+/**
+ * Stop the workers, fail the slots still queued with ESHUTDOWN, remove the
+ * region, and free "shm".
+ */
+void tc_shm_destroy(struct tc_shm *shm);
+
+/**
+ * Attach to the region "name" created by a daemon.
+ *
+ * Return NULL and set errno on failure.
+ */
+struct tc_shm *tc_shm_attach(const char *name);
+
+void tc_shm_detach(struct tc_shm *shm);
+
+/**
+ * Execute "ops" in the daemon, in as few slots as possible; a READ or WRITE
+ * larger than a slot is split over several.  "ops" are only split where no
+ * operation depends on an earlier one, i.e., not after a VERIFY or NVERIFY
+ * and not before an operation on the current or saved FH.  A transaction
+ * must fit in one slot.  Otherwise it fails with E2BIG.  Results are copied
+ * back into "ops" and the caller's read buffers.  It is thread-safe.
+ */
+tc_res tc_shm_cpdv(struct tc_shm *shm, struct tc_cpd_op *ops, int count,
+		   bool is_transaction);
+
+/**
+ * Set the working directory of the client, against which relative paths
+ * are resolved.  It is not thread-safe.
+ *
+ * Return 0 or -errno.
+ */
+int tc_shm_chdir(struct tc_shm *shm, const char *path);
+
+const char *tc_shm_getcwd(struct tc_shm *shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* __TC_SHM_H__ */
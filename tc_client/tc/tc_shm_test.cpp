@@ -0,0 +1,237 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Unittest of the shared-memory transport to tc_daemon.  The daemon and the
+ * client are in the same process here, with the POSIX backend behind them.
+ */
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "tc_api.h"
+#include "tc_shm.h"
+
+#define EXPECT_OK(x)                                                           \
+	EXPECT_TRUE(tc_okay(x)) << "Failed at " << x.index << ": "             \
+				<< strerror(x.err_no)
+
+static const char *kDir = "/tmp/tc_shm_test";
+static const size_t kSlotSize = 64 << 10;
+
+static tc_res RunCompound(struct tc_cpd_op *ops, int count,
+			  bool is_transaction)
+{
+	struct tc_compound cpd;
+
+	cpd.ops = ops;
+	cpd.count = count;
+	cpd.capacity = count;
+	return tc_cpd_execute(&cpd, is_transaction);
+}
+
+class TcShmTest : public ::testing::Test
+{
+protected:
+	static void SetUpTestCase()
+	{
+		context_ = tc_init(NULL, "/tmp/tc_shm_test.log", 0);
+		ASSERT_TRUE(context_ != NULL);
+	}
+
+	static void TearDownTestCase() { tc_deinit(context_); }
+
+	void SetUp() override
+	{
+		system("rm -rf /tmp/tc_shm_test");
+		ASSERT_EQ(0, mkdir(kDir, 0755));
+		daemon_ = tc_shm_create("tc_shm_test", 4, kSlotSize, kDir);
+		ASSERT_TRUE(daemon_ != NULL);
+		ASSERT_EQ(0, tc_shm_serve(daemon_, 2, RunCompound));
+		client_ = tc_shm_attach("tc_shm_test");
+		ASSERT_TRUE(client_ != NULL);
+	}
+
+	void TearDown() override
+	{
+		tc_shm_detach(client_);
+		tc_shm_destroy(daemon_);
+	}
+
+	tc_res Write(const char *path, const std::string &data)
+	{
+		struct tc_cpd_op op = {};
+
+		op.type = TC_CPD_WRITE;
+		tc_iov4creation(&op.iov, path, data.size(),
+				(char *)data.data());
+		return tc_shm_cpdv(client_, &op, 1, false);
+	}
+
+	static void *context_;
+	struct tc_shm *daemon_;
+	struct tc_shm *client_;
+};
+
+void *TcShmTest::context_;
+
+TEST_F(TcShmTest, WriteThenRead)
+{
+	std::string data(10000, 'x');
+	std::vector<char> buf(20000);
+	struct tc_cpd_op ops[2] = {};
+
+	EXPECT_OK(Write("file", data));
+
+	ops[0].type = TC_CPD_READ;
+	tc_iov2path(&ops[0].iov, "/tmp/tc_shm_test/file", 0, buf.size(),
+		    buf.data());
+	/* relative to the working directory of the daemon */
+	ops[1].type = TC_CPD_GETATTRS;
+	ops[1].attrs.file = tc_file_from_path("file");
+	ops[1].attrs.masks = TC_ATTRS_MASK_ALL;
+	EXPECT_OK(tc_shm_cpdv(client_, ops, 2, true));
+
+	EXPECT_EQ(data.size(), ops[0].iov.length);
+	EXPECT_TRUE(ops[0].iov.is_eof);
+	EXPECT_EQ(data, std::string(buf.data(), ops[0].iov.length));
+	EXPECT_EQ(data.size(), ops[1].attrs.size);
+	EXPECT_STREQ("file", ops[1].attrs.file.path);
+}
+
+TEST_F(TcShmTest, RenameAndRemove)
+{
+	struct tc_cpd_op ops[2] = {};
+	struct stat st;
+
+	EXPECT_OK(Write("a", "hello"));
+
+	ops[0].type = TC_CPD_RENAME;
+	ops[0].pair.src_file = tc_file_from_path("a");
+	ops[0].pair.dst_file = tc_file_from_path("b");
+	ops[1].type = TC_CPD_REMOVE;
+	ops[1].file = tc_file_from_path("b");
+	EXPECT_OK(tc_shm_cpdv(client_, ops, 2, false));
+
+	EXPECT_EQ(-1, stat("/tmp/tc_shm_test/a", &st));
+	EXPECT_EQ(-1, stat("/tmp/tc_shm_test/b", &st));
+}
+
+TEST_F(TcShmTest, Chdir)
+{
+	struct tc_cpd_op op = {};
+
+	EXPECT_EQ(0, mkdir("/tmp/tc_shm_test/dir", 0755));
+	EXPECT_EQ(0, tc_shm_chdir(client_, "dir"));
+	EXPECT_STREQ("/tmp/tc_shm_test/dir", tc_shm_getcwd(client_));
+	EXPECT_EQ(-ENOENT, tc_shm_chdir(client_, "nonexistent"));
+
+	EXPECT_OK(Write("file", "hello"));
+	op.type = TC_CPD_GETATTRS;
+	op.attrs.file = tc_file_from_path("/tmp/tc_shm_test/dir/file");
+	op.attrs.masks = TC_ATTRS_MASK_ALL;
+	EXPECT_OK(tc_shm_cpdv(client_, &op, 1, false));
+}
+
+/* Operations that do not fit in one slot are sent in several. */
+TEST_F(TcShmTest, LargeVectorsAreSplit)
+{
+	const int N = TC_SHM_MAX_OPS + 10;
+	std::string data(kSlotSize / 16, 'y');
+	std::vector<std::string> paths(N);
+	std::vector<struct tc_cpd_op> ops(N);
+
+	for (int i = 0; i < N; ++i) {
+		paths[i] = "file" + std::to_string(i);
+		ops[i].type = TC_CPD_WRITE;
+		tc_iov4creation(&ops[i].iov, paths[i].c_str(), data.size(),
+				(char *)data.data());
+	}
+
+	tc_res res = tc_shm_cpdv(client_, ops.data(), N, true);
+	EXPECT_FALSE(tc_okay(res));
+	EXPECT_EQ(E2BIG, res.err_no);
+
+	EXPECT_OK(tc_shm_cpdv(client_, ops.data(), N, false));
+	for (int i = 0; i < N; ++i) {
+		EXPECT_EQ(0, ops[i].err_no);
+		EXPECT_EQ(data.size(), ops[i].iov.length);
+	}
+}
+
+/* A READ or WRITE larger than a slot is split, unless in a transaction. */
+TEST_F(TcShmTest, OversizedOperationIsSplit)
+{
+	std::string data(2 * kSlotSize + 100, 'z');
+	std::vector<char> buf(data.size() + 10);
+	struct tc_cpd_op op = {};
+
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = 'a' + i % 26;
+	EXPECT_OK(Write("big", data));
+
+	op.type = TC_CPD_READ;
+	tc_iov2path(&op.iov, "big", 0, buf.size(), buf.data());
+	EXPECT_OK(tc_shm_cpdv(client_, &op, 1, false));
+	EXPECT_EQ(data.size(), op.iov.length);
+	EXPECT_TRUE(op.iov.is_eof);
+	EXPECT_EQ(data, std::string(buf.data(), op.iov.length));
+
+	tc_iov2path(&op.iov, "big", 0, buf.size(), buf.data());
+	tc_res res = tc_shm_cpdv(client_, &op, 1, true);
+	EXPECT_EQ(0, res.index);
+	EXPECT_EQ(E2BIG, res.err_no);
+}
+
+/* Operations on the current FH are not sent apart from the ones before. */
+TEST_F(TcShmTest, DependentOperationsAreNotSplit)
+{
+	const int N = TC_SHM_MAX_OPS + 1;
+	std::vector<struct tc_cpd_op> ops(N);
+
+	EXPECT_OK(Write("file", "hello"));
+	ops[0].type = TC_CPD_GETATTRS;
+	ops[0].attrs.file = tc_file_from_path("file");
+	ops[0].attrs.masks = TC_ATTRS_MASK_ALL;
+	for (int i = 1; i < N; ++i) {
+		ops[i] = ops[0];
+		ops[i].attrs.file = tc_file_current();
+	}
+
+	tc_res res = tc_shm_cpdv(client_, ops.data(), N, false);
+	EXPECT_EQ(0, res.index);
+	EXPECT_EQ(E2BIG, res.err_no);
+}
+
+TEST_F(TcShmTest, DescriptorsAreRejected)
+{
+	struct tc_cpd_op op = {};
+
+	op.type = TC_CPD_REMOVE;
+	op.file.type = TC_FILE_DESCRIPTOR;
+	op.file.fd = 3;
+	tc_res res = tc_shm_cpdv(client_, &op, 1, false);
+	EXPECT_EQ(EINVAL, res.err_no);
+}
@@ -0,0 +1,160 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Measure how long a short-lived program takes to start, send its first
+ * RPC, and exit.  Each run is a new process, so nothing is warmed up:
+ *
+ *	tc_startup --runs=20 --lite --max_first_rpc_ms=10
+ *
+ * It exits with 1 if the median time to the first RPC exceeds
+ * --max_first_rpc_ms, so it can guard tc_init_lite() against regressions.
+ */
+
+#include <error.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tc_api.h"
+#include "tc_helper.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <vector>
+
+DEFINE_bool(tc, true, "Use TC implementation");
+
+DEFINE_bool(lite, true, "Use tc_init_lite() instead of tc_init()");
+
+DEFINE_int32(runs, 10, "Number of processes to start");
+
+DEFINE_double(max_first_rpc_ms, 0,
+	      "Fail if the median time to first RPC is larger (0: no limit)");
+
+using std::vector;
+
+struct StartupTimes {
+	double init_ms;		/* tc_init() */
+	double first_rpc_ms;	/* since the start, including tc_init() */
+	double deinit_ms;	/* tc_deinit() */
+};
+
+static double Ms(const struct timespec *start, const struct timespec *stop)
+{
+	return timespec_diff(start, stop) / 1e6;
+}
+
+static void RunChild(int fd)
+{
+	struct timespec t0, t1, t2, t3;
+	struct StartupTimes times;
+	struct stat st;
+	void *tcdata;
+	char buf[PATH_MAX];
+	const char *config = FLAGS_tc ? get_tc_config_file(buf, PATH_MAX)
+				      : NULL;
+
+	now(&t0);
+	tcdata = FLAGS_lite ? tc_init_lite(config, "/tmp/tc-startup.log", 77)
+			    : tc_init(config, "/tmp/tc-startup.log", 77);
+	if (!tcdata) {
+		error(1, 0, "failed to initialize TC");
+	}
+	now(&t1);
+	if (tc_stat(".", &st) != 0) {
+		error(1, errno, "failed to stat the export root");
+	}
+	now(&t2);
+	tc_deinit(tcdata);
+	now(&t3);
+
+	times.init_ms = Ms(&t0, &t1);
+	times.first_rpc_ms = Ms(&t0, &t2);
+	times.deinit_ms = Ms(&t2, &t3);
+	if (write(fd, &times, sizeof(times)) != sizeof(times)) {
+		error(1, errno, "failed to report times");
+	}
+	_exit(0);
+}
+
+static double Percentile(vector<double> v, double p)
+{
+	std::sort(v.begin(), v.end());
+	return v[(size_t)(p * (v.size() - 1))];
+}
+
+static void Report(const char *name, const vector<double> &v)
+{
+	printf("%-12s median %8.3f ms  p90 %8.3f ms  max %8.3f ms\n", name,
+	       Percentile(v, 0.5), Percentile(v, 0.9), Percentile(v, 1.0));
+}
+
+int main(int argc, char *argv[])
+{
+	vector<double> inits, first_rpcs, deinits;
+	int fds[2];
+
+	gflags::SetUsageMessage("Measure the startup time of TC clients.");
+	gflags::ParseCommandLineFlags(&argc, &argv, true);
+	if (FLAGS_runs < 1) {
+		error(1, 0, "--runs must be at least 1");
+	}
+
+	for (int i = 0; i < FLAGS_runs; ++i) {
+		struct StartupTimes times;
+		int status;
+
+		if (pipe(fds) != 0) {
+			error(1, errno, "pipe");
+		}
+		pid_t pid = fork();
+		if (pid < 0) {
+			error(1, errno, "fork");
+		} else if (pid == 0) {
+			close(fds[0]);
+			RunChild(fds[1]);
+		}
+		close(fds[1]);
+		ssize_t n = read(fds[0], &times, sizeof(times));
+		close(fds[0]);
+		waitpid(pid, &status, 0);
+		if (n != sizeof(times) || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0) {
+			error(1, 0, "run %d failed", i);
+		}
+		inits.push_back(times.init_ms);
+		first_rpcs.push_back(times.first_rpc_ms);
+		deinits.push_back(times.deinit_ms);
+	}
+
+	Report("tc_init", inits);
+	Report("first RPC", first_rpcs);
+	Report("tc_deinit", deinits);
+
+	if (FLAGS_max_first_rpc_ms > 0 &&
+	    Percentile(first_rpcs, 0.5) > FLAGS_max_first_rpc_ms) {
+		fprintf(stderr, "median time to first RPC exceeds %.3f ms\n",
+			FLAGS_max_first_rpc_ms);
+		return 1;
+	}
+	return 0;
+}
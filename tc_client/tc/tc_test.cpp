@@ -26,6 +26,8 @@
  * https://github.com/google/googletest/blob/master/googletest/docs/V1_7_AdvancedGuide.md
  */
 #include <sys/types.h>
+#include <sys/xattr.h>
+#include <endian.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdarg.h>
@@ -36,13 +38,16 @@
 #include <random>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
 #include "tc_api.h"
+#include "tc_compound.h"
 #include "tc_helper.h"
+#include "nfs4/compound_sched.h"
 #include "path_utils.h"
 #include "test_util.h"
 #include "util/fileutil.h"
@@ -76,6 +81,32 @@ void DoParallel(int nthread, std::function<void(int)> worker)
 }
 } // anonymous namespace
 
+static bool AddCounterCalls(struct tc_func_counter *tfc, void *arg)
+{
+	auto *nc = static_cast<std::pair<const char *, uint64_t> *>(arg);
+	struct tc_counter_stats stats;
+
+	if (strcmp(tfc->name, nc->first) == 0) {
+		tc_read_counter(tfc, &stats);
+		nc->second = stats.calls;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Return the number of NFS compounds sent so far that contain "op", e.g.,
+ * "READLINK".
+ */
+static uint64_t CountCompoundsWith(const char *op)
+{
+	std::string name = std::string("nfs4_op_") + op;
+	std::pair<const char *, uint64_t> nc(name.c_str(), 0);
+
+	tc_iterate_counters(AddCounterCalls, &nc);
+	return nc.second;
+}
+
 /**
  * Ensure files or directories do not exist before test.
  */
@@ -291,6 +322,134 @@ TYPED_TEST_P(TcTest, TestFileDesc)
 	free_iovec(readv, N);
 }
 
+TYPED_TEST_P(TcTest, LazyCloseAndReopen)
+{
+	const int N = 4;
+	const char *PATHS[] = { "TcTest-LazyClose1.txt",
+				"TcTest-LazyClose2.txt",
+				"TcTest-LazyClose3.txt",
+				"TcTest-LazyClose4.txt" };
+	tc_file *files;
+
+	Removev(PATHS, N);
+	tc_enable_lazy_close(true);
+
+	files = tc_openv_simple(PATHS, N, O_RDWR | O_CREAT, 0);
+	EXPECT_NOTNULL(files);
+	struct tc_iovec *writev = build_iovec(files, N, 0);
+	EXPECT_OK(tc_writev(writev, N, false));
+	EXPECT_OK(tc_closev(files, N));
+
+	// reopen the files whose CLOSEs may still be queued
+	files = tc_openv_simple(PATHS, N, O_RDONLY, 0);
+	EXPECT_NOTNULL(files);
+	struct tc_iovec *readv = build_iovec(files, N, 0);
+	EXPECT_OK(tc_readv(readv, N, false));
+	EXPECT_TRUE(compare_content(writev, readv, N));
+	EXPECT_OK(tc_closev(files, N));
+
+	// an unrelated compound carries the queued CLOSEs
+	EXPECT_OK(tc_unlinkv(PATHS, N));
+	tc_enable_lazy_close(false);
+
+	free_iovec(writev, N);
+	free_iovec(readv, N);
+}
+
+namespace
+{
+int QueuedCompounds(int prio)
+{
+	struct tc_sched_stats stats;
+
+	EXPECT_EQ(0, tc_get_priority_stats(prio, &stats));
+	return stats.queued;
+}
+
+void WaitQueuedCompounds(int prio, int n)
+{
+	while (QueuedCompounds(prio) < n) {
+		std::this_thread::yield();
+	}
+}
+
+/*
+ * Admit a compound of class "prio" in a new thread, which leaves the
+ * scheduler once "done" is set.
+ */
+std::thread EnterInThread(int prio, volatile bool *done)
+{
+	return std::thread([prio, done]() {
+		tc_set_thread_priority(prio);
+		EXPECT_EQ(prio, tc_sched_enter());
+		while (!*done) {
+			std::this_thread::yield();
+		}
+		tc_sched_leave(prio);
+	});
+}
+
+/*
+ * With all slots taken, a bulk compound and then an interactive one are
+ * queued; the interactive one is admitted first when a slot is freed.
+ */
+void CheckInteractiveBeforeBulk()
+{
+	struct tc_sched_stats stats;
+	volatile bool done = false;
+	int i;
+
+	for (i = 0; i < TC_SCHED_CAPACITY; ++i) {
+		EXPECT_EQ(TC_PRIO_NORMAL, tc_sched_enter());
+	}
+	std::thread bulk = EnterInThread(TC_PRIO_BULK, &done);
+	WaitQueuedCompounds(TC_PRIO_BULK, 1);
+	std::thread interactive = EnterInThread(TC_PRIO_INTERACTIVE, &done);
+	WaitQueuedCompounds(TC_PRIO_INTERACTIVE, 1);
+
+	tc_sched_leave(TC_PRIO_NORMAL);
+	EXPECT_EQ(0, tc_get_priority_stats(TC_PRIO_INTERACTIVE, &stats));
+	EXPECT_EQ(0, stats.queued);
+	EXPECT_EQ(1, stats.inflight);
+	EXPECT_EQ(0, tc_get_priority_stats(TC_PRIO_BULK, &stats));
+	EXPECT_EQ(1, stats.queued);
+	EXPECT_EQ(0, stats.inflight);
+
+	done = true;
+	for (i = 1; i < TC_SCHED_CAPACITY; ++i) {
+		tc_sched_leave(TC_PRIO_NORMAL);
+	}
+	interactive.join();
+	bulk.join();
+}
+} // namespace
+
+TYPED_TEST_P(TcTest, PriorityClasses)
+{
+	const char *PATH = "TcTest-PriorityClasses.txt";
+	struct tc_sched_stats before;
+	struct tc_sched_stats after;
+	struct stat st;
+	bool sched = tc_get_priority_stats(TC_PRIO_BULK, &before) == 0;
+
+	EXPECT_EQ(-EINVAL, tc_set_thread_priority(TC_PRIO_COUNT));
+	EXPECT_EQ(TC_PRIO_NORMAL, tc_set_thread_priority(TC_PRIO_BULK));
+	tc_touch(PATH, 4096);
+	EXPECT_EQ(0, tc_stat(PATH, &st));
+	EXPECT_EQ(TC_PRIO_BULK, tc_set_thread_priority(TC_PRIO_NORMAL));
+
+	// only the NFS4 backend schedules compounds
+	if (sched) {
+		EXPECT_EQ(0, tc_get_priority_stats(TC_PRIO_BULK, &after));
+		EXPECT_LT(before.compounds, after.compounds);
+		EXPECT_EQ(0, after.inflight);
+		CheckInteractiveBeforeBulk();
+	}
+	EXPECT_EQ(-EINVAL, tc_set_priority_limits(TC_PRIO_BULK, 0, 1));
+	EXPECT_EQ(-EINVAL, tc_set_priority_limits(TC_PRIO_COUNT, 1, 1));
+	EXPECT_EQ(0, tc_unlink(PATH));
+}
+
 /**
  * Compare the attributes once set, to check if set properly
  */
@@ -1411,6 +1570,95 @@ TYPED_TEST_P(TcTest, CompressPathForRemove)
 	EXPECT_OK(tc_removev(files, FILES_PER_DIR * 2, false));
 }
 
+/*
+ * tc_getattrsv() follows chains of symlinks, also when they are cached, and
+ * leaves "mode" alone unless it is asked for.
+ */
+TYPED_TEST_P(TcTest, GetattrsFollowsSymlinks)
+{
+	/* link1 -> file, link2 -> link1, link3 -> link2 */
+	const char *TARGETS[] = { "file", "link1", "link2" };
+	const char *LINKS[] = { "TcTest-GetattrsFollowsSymlinks/link1",
+				"TcTest-GetattrsFollowsSymlinks/link2",
+				"TcTest-GetattrsFollowsSymlinks/link3" };
+	const int N = sizeof(LINKS) / sizeof(LINKS[0]);
+	struct tc_attrs attrs[N];
+
+	EXPECT_OK(tc_ensure_dir("TcTest-GetattrsFollowsSymlinks", 0755, NULL));
+	Removev(LINKS, N);
+	tc_touch("TcTest-GetattrsFollowsSymlinks/file", 4_KB);
+	EXPECT_OK(tc_symlinkv(TARGETS, LINKS, N, false));
+
+	/* the second round may use cached symlinks */
+	for (int round = 0; round < 2; ++round) {
+		for (int i = 0; i < N; ++i) {
+			attrs[i].file = tc_file_from_path(LINKS[i]);
+			attrs[i].masks = TC_ATTRS_MASK_NONE;
+			attrs[i].masks.has_size = true;
+			attrs[i].mode = (mode_t)0123;
+		}
+		EXPECT_OK(tc_getattrsv(attrs, N, false));
+		for (int i = 0; i < N; ++i) {
+			EXPECT_EQ(4_KB, attrs[i].size);
+			EXPECT_EQ((mode_t)0123, attrs[i].mode);
+		}
+	}
+
+	for (int i = 0; i < N; ++i) {
+		attrs[i].masks.has_mode = true;
+	}
+	EXPECT_OK(tc_getattrsv(attrs, N, false));
+	for (int i = 0; i < N; ++i) {
+		EXPECT_TRUE(S_ISREG(attrs[i].mode));
+	}
+}
+
+/**
+ * A symlink given by absolute path is cached: the second tc_getattrsv() takes
+ * a single compound, which also verifies and reads the link.  Removing the
+ * link, also by relative path, drops it from the cache.
+ */
+TYPED_TEST_P(TcTest, GetattrsCachesSymlinks)
+{
+	const bool nfs4 = std::is_same<TypeParam, TcNFS4Impl>::value;
+	const char *LINK = "TcTest-GetattrsCachesSymlinks/link";
+	char *cwd = tc_getcwd();
+	char *abslink = new_auto_path("%s/%s", cwd, LINK);
+	struct tc_attrs attrs;
+	uint64_t n;
+
+	free(cwd);
+	EXPECT_OK(tc_ensure_dir("TcTest-GetattrsCachesSymlinks", 0755, NULL));
+	tc_touch("TcTest-GetattrsCachesSymlinks/file1", 4_KB);
+	tc_touch("TcTest-GetattrsCachesSymlinks/file2", 8_KB);
+	tc_unlink(LINK);
+	EXPECT_EQ(0, tc_symlink("file1", LINK));
+
+	attrs.file = tc_file_from_path(abslink);
+	attrs.masks = TC_ATTRS_MASK_NONE;
+	attrs.masks.has_size = true;
+	EXPECT_OK(tc_getattrsv(&attrs, 1, false));
+	EXPECT_EQ(4_KB, attrs.size);
+
+	n = CountCompoundsWith("READLINK");
+	EXPECT_OK(tc_getattrsv(&attrs, 1, false));
+	EXPECT_EQ(4_KB, attrs.size);
+	if (nfs4) {
+		EXPECT_EQ(1U, CountCompoundsWith("READLINK") - n);
+	}
+
+	/* a stale entry would cost an extra compound failing its VERIFY */
+	EXPECT_EQ(0, tc_unlink(LINK));
+	EXPECT_EQ(0, tc_symlink("file2", LINK));
+	n = CountCompoundsWith("READLINK");
+	EXPECT_OK(tc_getattrsv(&attrs, 1, false));
+	EXPECT_EQ(8_KB, attrs.size);
+	if (nfs4) {
+		/* one to read the link, and one to verify it */
+		EXPECT_EQ(2U, CountCompoundsWith("READLINK") - n);
+	}
+}
+
 TYPED_TEST_P(TcTest, SymlinkBasics)
 {
 	const char *TARGETS[] = { "TcTest-SymlinkBasics/001.file",
@@ -1651,9 +1899,361 @@ TYPED_TEST_P(TcTest, TcRmRecursive)
 	EXPECT_TRUE(tc_rm_recursive("NonExistDir"));
 }
 
+TYPED_TEST_P(TcTest, ReadWholeFiles)
+{
+	const int N = 4;
+	const char *PATHS[N] = { "ReadWholeFiles-empty", "ReadWholeFiles-small",
+				 "ReadWholeFiles-cap", "ReadWholeFiles-large" };
+	// the large file needs more than one compound after the first
+	const size_t SIZES[N] = { 0, 100, 4_KB, 3_MB };
+	char *data = getRandomBytes(3_MB);
+	struct tc_iovec iovs[N];
+	char *bufs[N];
+	size_t sizes[N];
+
+	for (int i = 0; i < N; ++i) {
+		tc_iov4creation(&iovs[i], PATHS[i], SIZES[i], data);
+	}
+	EXPECT_OK(tc_writev(iovs, N, false));
+
+	EXPECT_OK(tc_read_files(PATHS, bufs, sizes, N, 4_KB));
+	for (int i = 0; i < N; ++i) {
+		EXPECT_EQ(SIZES[i], sizes[i]);
+		EXPECT_EQ(0, memcmp(data, bufs[i], SIZES[i]));
+		free(bufs[i]);
+	}
+
+	const char *MISSING[2] = { PATHS[1], "ReadWholeFiles-missing" };
+	tc_res tcres = tc_read_files(MISSING, bufs, sizes, 2, 4_KB);
+	EXPECT_FALSE(tc_okay(tcres));
+	EXPECT_EQ(1, tcres.index);
+	EXPECT_EQ(ENOENT, tcres.err_no);
+	EXPECT_EQ(NULL, bufs[0]);
+	EXPECT_EQ(NULL, bufs[1]);
+
+	free(data);
+}
+
+TYPED_TEST_P(TcTest, ComposeMixedCompound)
+{
+	const char *NEW = "ComposeMixedCompound-new.dat";
+	const char *OLD = "ComposeMixedCompound-old.dat";
+	char hdr[] = "header";
+	char buf[64];
+	struct tc_attrs mode;
+
+	tc_unlink(NEW);
+	tc_touch(OLD, 4_KB);
+
+	tc::Compound cpd;
+	mode.file = tc_file_from_path(NEW);
+	mode.masks = TC_ATTRS_MASK_NONE;
+	tc_attrs_set_mode(&mode, 0640);
+	int wr = cpd.Write(tc_file_from_path(NEW), 0, sizeof(hdr), hdr, true);
+	int sa = cpd.SetAttrs(mode);
+	int ga = cpd.GetAttrs(tc_file_from_path(OLD), TC_ATTRS_MASK_ALL);
+	int rd = cpd.Read(tc_file_from_path(NEW), 0, sizeof(buf), buf);
+	EXPECT_OK(cpd.Execute());
+
+	EXPECT_EQ(0, cpd[wr].err_no);
+	EXPECT_EQ(sizeof(hdr), cpd[wr].iov.length);
+	EXPECT_EQ(0, cpd[sa].err_no);
+	EXPECT_EQ(4_KB, cpd[ga].attrs.size);
+	EXPECT_EQ(sizeof(hdr), cpd[rd].iov.length);
+	EXPECT_TRUE(cpd[rd].iov.is_eof);
+	EXPECT_STREQ(hdr, buf);
+	struct stat st;
+	EXPECT_EQ(0, tc_stat(NEW, &st));
+	EXPECT_EQ((mode_t)0640, st.st_mode & 0777);
+
+	// ops after a failing one are not executed
+	cpd.Clear();
+	cpd.Remove(tc_file_from_path("ComposeMixedCompound-missing"));
+	cpd.Remove(tc_file_from_path(NEW));
+	tc_res tcres = cpd.Execute();
+	EXPECT_EQ(0, tcres.index);
+	EXPECT_EQ(ENOENT, cpd[0].err_no);
+	EXPECT_EQ(ECANCELED, cpd[1].err_no);
+	EXPECT_TRUE(tc_exists(NEW));
+}
+
+TYPED_TEST_P(TcTest, ConditionalWritesAndRenames)
+{
+	const char *FILES[] = { "CondWrite-a.dat", "CondWrite-b.dat",
+				"CondWrite-c.dat" };
+	char data[] = "new data";
+	struct tc_iovec writes[3];
+	struct tc_attrs conds[3];
+	bool conflicts[3];
+	struct tc_attrs_masks masks = TC_ATTRS_MASK_NONE;
+	const char *DST[] = { "CondWrite-a2.dat", "CondWrite-b2.dat" };
+
+	tc_unlinkv(DST, 2);
+	masks.has_change = true;
+	for (int i = 0; i < 3; ++i) {
+		tc_unlink(FILES[i]);
+		tc_touch(FILES[i], 4_KB);
+		conds[i].file = tc_file_from_path(FILES[i]);
+		conds[i].masks = masks;
+	}
+	EXPECT_OK(tc_getattrsv(conds, 3, false));
+	for (int i = 0; i < 3; ++i) {
+		EXPECT_TRUE(conds[i].masks.has_change);
+		conds[i].file.type = TC_FILE_NULL; /* use the file written */
+		tc_iov4creation(&writes[i], FILES[i], sizeof(data), data);
+	}
+
+	// the 2nd file changes behind our back
+	sleep(1);
+	tc_touch(FILES[1], 8_KB);
+	EXPECT_OK(tc_writev_if(writes, conds, conflicts, 3));
+	EXPECT_FALSE(conflicts[0]);
+	EXPECT_TRUE(conflicts[1]);
+	EXPECT_FALSE(conflicts[2]);
+	EXPECT_EQ(sizeof(data), writes[0].length);
+	EXPECT_EQ(sizeof(data), writes[2].length);
+	struct stat st;
+	EXPECT_EQ(0, tc_stat(FILES[1], &st));
+	EXPECT_EQ(8_KB, st.st_size);
+
+	// rename iff size is 8KB
+	struct tc_file_pair pairs[2];
+	for (int i = 0; i < 2; ++i) {
+		pairs[i].src_file = tc_file_from_path(FILES[i]);
+		pairs[i].dst_file = tc_file_from_path(DST[i]);
+		conds[i].file.type = TC_FILE_NULL;
+		conds[i].masks = TC_ATTRS_MASK_NONE;
+		tc_attrs_set_size(&conds[i], 8_KB);
+	}
+	EXPECT_OK(tc_renamev_if(pairs, conds, conflicts, 2));
+	EXPECT_TRUE(conflicts[0]);
+	EXPECT_FALSE(conflicts[1]);
+	EXPECT_TRUE(tc_exists(FILES[0]));
+	EXPECT_FALSE(tc_exists(DST[0]));
+	EXPECT_TRUE(tc_exists(DST[1]));
+}
+
+/* Locks of one client never conflict with each other. */
+TYPED_TEST_P(TcTest, ByteRangeLocks)
+{
+	const char *PATHS[] = { "Lock-1.dat", "Lock-2.dat" };
+	struct tc_lock locks[3];
+	tc_file *files;
+
+	Removev(PATHS, 2);
+	files = tc_openv_simple(PATHS, 2, O_RDWR | O_CREAT, 0644);
+	ASSERT_TRUE(files != NULL);
+
+	tc_fill_lock(&locks[0], files[0], F_WRLCK, 0, 100);
+	tc_fill_lock(&locks[1], files[0], F_RDLCK, 200, 0);
+	tc_fill_lock(&locks[2], files[1], F_WRLCK, 0, 0);
+	EXPECT_OK(tc_lockv(locks, 3, false));
+
+	for (int i = 0; i < 3; ++i) {
+		tc_fill_lock(&locks[i], files[i / 2], F_WRLCK, 0, 0);
+	}
+	EXPECT_OK(tc_testlockv(locks, 3, false));
+	for (int i = 0; i < 3; ++i) {
+		EXPECT_EQ(F_UNLCK, locks[i].type);
+	}
+
+	tc_fill_lock(&locks[0], files[0], F_UNLCK, 0, 0);
+	tc_fill_lock(&locks[1], files[1], F_UNLCK, 0, 0);
+	EXPECT_OK(tc_unlockv(locks, 2, false));
+	// unlocking what is not locked is not an error
+	EXPECT_OK(tc_unlockv(locks, 2, false));
+
+	// locks need file descriptors
+	tc_fill_lock(&locks[0], files[0], F_RDLCK, 0, 0);
+	tc_fill_lock(&locks[1], tc_file_from_path(PATHS[1]), F_RDLCK, 0, 0);
+	tc_res tcres = tc_lockv(locks, 2, false);
+	EXPECT_EQ(1, tcres.index);
+	EXPECT_EQ(EINVAL, tcres.err_no);
+
+	// closing releases the locks
+	EXPECT_OK(tc_closev(files, 2));
+}
+
+TYPED_TEST_P(TcTest, FallocateAndPunchHole)
+{
+	const char *PATHS[] = { "Fallocate-1.dat", "Fallocate-2.dat" };
+	char *data = getRandomBytes(16_KB);
+	char *buf = (char *)malloc(16_KB);
+	char zeros[4_KB] = { 0 };
+	struct tc_extent exts[2];
+	struct tc_iovec iov;
+	struct stat st;
+
+	tc_unlinkv(PATHS, 2);
+	for (int i = 0; i < 2; ++i) {
+		tc_fill_extent(&exts[i], tc_file_from_path(PATHS[i]), 0,
+			       (i + 1) * 1_MB, true);
+	}
+	EXPECT_OK(tc_fallocatev(exts, 2, false));
+	for (int i = 0; i < 2; ++i) {
+		EXPECT_EQ(0, tc_stat(PATHS[i], &st));
+		EXPECT_EQ((i + 1) * 1_MB, st.st_size);
+	}
+
+	// punch the 2nd 4KB; the size does not change
+	tc_iov4creation(&iov, PATHS[0], 16_KB, data);
+	EXPECT_OK(tc_writev(&iov, 1, false));
+	tc_fill_extent(&exts[0], tc_file_from_path(PATHS[0]), 4_KB, 4_KB,
+		       false);
+	EXPECT_OK(tc_punchholev(exts, 1, false));
+	EXPECT_EQ(0, tc_stat(PATHS[0], &st));
+	EXPECT_EQ(1_MB, st.st_size);
+	tc_iov2path(&iov, PATHS[0], 0, 16_KB, buf);
+	EXPECT_OK(tc_readv(&iov, 1, false));
+	EXPECT_EQ(0, memcmp(data, buf, 4_KB));
+	EXPECT_EQ(0, memcmp(zeros, buf + 4_KB, 4_KB));
+	EXPECT_EQ(0, memcmp(data + 8_KB, buf + 8_KB, 8_KB));
+
+	// punching does not create files
+	tc_fill_extent(&exts[0], tc_file_from_path(PATHS[1]), 0, 4_KB, false);
+	tc_fill_extent(&exts[1], tc_file_from_path("Fallocate-missing.dat"),
+		       0, 4_KB, true);
+	tc_res tcres = tc_punchholev(exts, 2, false);
+	EXPECT_EQ(1, tcres.index);
+	EXPECT_EQ(ENOENT, tcres.err_no);
+
+	free(buf);
+	free(data);
+}
+
+TYPED_TEST_P(TcTest, WriteAdb)
+{
+	const char *PATH = "WriteAdb.dat";
+	const size_t BS = 512;
+	const size_t N = 8;
+	char pattern[] = "ADB!";
+	char zeros[BS] = { 0 };
+	struct tc_adb adb;
+	struct tc_iovec iov;
+	uint64_t adbn;
+
+	tc_unlink(PATH);
+	adb.path = PATH;
+	adb.adb_offset = 1_KB;
+	adb.adb_block_size = BS;
+	adb.adb_block_count = N;
+	adb.adb_reloff_blocknum = 0;
+	adb.adb_block_num = 100;
+	adb.adb_reloff_pattern = sizeof(adbn);
+	adb.adb_pattern_size = 4;
+	adb.adb_pattern_data = pattern;
+	EXPECT_OK(tc_write_adb(&adb, 1, false));
+	EXPECT_EQ(N, adb.adb_block_count);
+
+	std::vector<char> buf(1_KB + N * BS + 1);
+	tc_iov2path(&iov, PATH, 0, buf.size(), buf.data());
+	EXPECT_OK(tc_readv(&iov, 1, false));
+	EXPECT_EQ(1_KB + N * BS, iov.length);
+	for (size_t k = 0; k < N; ++k) {
+		const char *block = buf.data() + 1_KB + k * BS;
+		memcpy(&adbn, block, sizeof(adbn));
+		EXPECT_EQ(100 + k, be64toh(adbn));
+		EXPECT_EQ(0, memcmp(pattern, block + sizeof(adbn), 4));
+		EXPECT_EQ(0, memcmp(zeros, block + sizeof(adbn) + 4,
+				    BS - sizeof(adbn) - 4));
+	}
+
+	// the pattern does not fit in a block
+	adb.adb_reloff_pattern = BS - 2;
+	tc_res tcres = tc_write_adb(&adb, 1, false);
+	EXPECT_EQ(0, tcres.index);
+	EXPECT_EQ(EINVAL, tcres.err_no);
+	EXPECT_EQ(0U, adb.adb_block_count);
+
+	// nothing is written for the patterns after a failed one
+	struct tc_adb adbs[3];
+	adb.adb_reloff_pattern = sizeof(adbn);
+	for (int i = 0; i < 3; ++i) {
+		adbs[i] = adb;
+		adbs[i].adb_block_count = N;
+	}
+	adbs[1].path = "WriteAdb-nonexistent-dir/WriteAdb.dat";
+	tcres = tc_write_adb(adbs, 3, false);
+	EXPECT_EQ(1, tcres.index);
+	EXPECT_EQ(ENOENT, tcres.err_no);
+	EXPECT_EQ(N, adbs[0].adb_block_count);
+	EXPECT_EQ(0U, adbs[1].adb_block_count);
+	EXPECT_EQ(0U, adbs[2].adb_block_count);
+}
+
+TYPED_TEST_P(TcTest, ExtendedAttributes)
+{
+	const char *PATHS[] = { "Xattr-1.dat", "Xattr-2.dat" };
+	const char *NAMES[] = { "user.tc.a", "user.tc.b" };
+	const char *VALUES[] = { "value-a", "a-longer-value-b" };
+	struct tc_xattr xattrs[3];
+	char bufs[2][64];
+	char *lists[2] = { bufs[0], bufs[1] };
+	size_t sizes[2] = { sizeof(bufs[0]), sizeof(bufs[1]) };
+	int n = 0;
+
+	tc_unlinkv(PATHS, 2);
+	tc_touchv(PATHS, 2, 4_KB);
+
+	for (int i = 0; i < 2; ++i) {
+		tc_fill_xattr(&xattrs[n++], tc_file_from_path(PATHS[0]),
+			      NAMES[i], (char *)VALUES[i], strlen(VALUES[i]),
+			      XATTR_CREATE);
+	}
+	EXPECT_OK(tc_setxattrsv(xattrs, n, false));
+	tc_res tcres = tc_setxattrsv(xattrs, 1, false);
+	EXPECT_EQ(0, tcres.index);
+	EXPECT_EQ(EEXIST, tcres.err_no);
+
+	for (int i = 0; i < 2; ++i) {
+		tc_fill_xattr(&xattrs[i], tc_file_from_path(PATHS[0]),
+			      NAMES[i], bufs[i], sizeof(bufs[i]), 0);
+	}
+	tc_fill_xattr(&xattrs[2], tc_file_from_path(PATHS[0]), NAMES[1],
+		      NULL, 0, 0);
+	EXPECT_OK(tc_getxattrsv(xattrs, 3, false));
+	for (int i = 0; i < 2; ++i) {
+		EXPECT_EQ(strlen(VALUES[i]), xattrs[i].size);
+		EXPECT_EQ(0, memcmp(VALUES[i], bufs[i], xattrs[i].size));
+	}
+	EXPECT_EQ(strlen(VALUES[1]), xattrs[2].size);
+
+	// a smaller value replaces the old one
+	tc_fill_xattr(&xattrs[0], tc_file_from_path(PATHS[0]), NAMES[1],
+		      (char *)"b", 1, XATTR_REPLACE);
+	EXPECT_OK(tc_setxattrsv(xattrs, 1, false));
+	tc_fill_xattr(&xattrs[0], tc_file_from_path(PATHS[0]), NAMES[1],
+		      bufs[0], sizeof(bufs[0]), 0);
+	EXPECT_OK(tc_getxattrsv(xattrs, 1, false));
+	EXPECT_EQ(1U, xattrs[0].size);
+	EXPECT_EQ('b', bufs[0][0]);
+
+	// "Xattr-2.dat" has no extended attributes
+	EXPECT_OK(tc_listxattrsv(PATHS, lists, sizes, 2, false));
+	std::vector<std::string> names;
+	for (size_t off = 0; off < sizes[0]; off += names.back().size() + 1) {
+		names.emplace_back(bufs[0] + off);
+	}
+	EXPECT_THAT(names, testing::UnorderedElementsAre(NAMES[0], NAMES[1]));
+	EXPECT_EQ(0U, sizes[1]);
+
+	tc_fill_xattr(&xattrs[0], tc_file_from_path(PATHS[0]), NAMES[0],
+		      bufs[0], 2, 0);
+	tc_fill_xattr(&xattrs[1], tc_file_from_path(PATHS[1]), NAMES[0],
+		      bufs[1], sizeof(bufs[1]), 0);
+	tcres = tc_getxattrsv(xattrs, 1, false);
+	EXPECT_EQ(0, tcres.index);
+	EXPECT_EQ(ERANGE, tcres.err_no);
+	tcres = tc_getxattrsv(xattrs + 1, 1, false);
+	EXPECT_EQ(0, tcres.index);
+	EXPECT_EQ(ENODATA, tcres.err_no);
+}
+
 REGISTER_TYPED_TEST_CASE_P(TcTest,
 			   WritevCanCreateFiles,
 			   TestFileDesc,
+			   LazyCloseAndReopen,
+			   PriorityClasses,
 			   AttrsTestPath,
 			   AttrsTestFileDesc,
 			   AttrsTestSymlinks,
@@ -1683,6 +2283,8 @@ REGISTER_TYPED_TEST_CASE_P(TcTest,
 			   CompressPathForRemove,
 			   TestHardLinks,
 			   SymlinkBasics,
+			   GetattrsFollowsSymlinks,
+			   GetattrsCachesSymlinks,
 			   ManyLinksDontFitInOneCompound,
 			   TcStatBasics,
 			   CopyLargeDirectory,
@@ -1690,7 +2292,36 @@ REGISTER_TYPED_TEST_CASE_P(TcTest,
 			   TcRmBasic,
 			   TcRmManyFiles,
 			   TcRmRecursive,
+			   ReadWholeFiles,
+			   ComposeMixedCompound,
+			   ConditionalWritesAndRenames,
+			   ByteRangeLocks,
+			   FallocateAndPunchHole,
+			   WriteAdb,
+			   ExtendedAttributes,
 			   RequestDoesNotFitIntoOneCompound);
 
 typedef ::testing::Types<TcNFS4Impl, TcPosixImpl> TcImpls;
 INSTANTIATE_TYPED_TEST_CASE_P(TC, TcTest, TcImpls);
+
+/**
+ * tc_deinit() after tc_init_lite() neither stops the counter thread, which
+ * tc_init_lite() does not start, nor writes the counters.
+ */
+TEST(TcInitLite, DeinitLeavesCountersAlone)
+{
+	const char *COUNTERS = "/tmp/tc-counters.json";
+	struct stat before;
+	struct stat after;
+	bool existed = stat(COUNTERS, &before) == 0;
+	void *context = tc_init_lite(NULL, "/tmp/tc-posix.log", 0);
+
+	EXPECT_NOTNULL(context);
+	tc_deinit(context);
+	if (existed) {
+		EXPECT_EQ(0, stat(COUNTERS, &after));
+		EXPECT_EQ(before.st_size, after.st_size);
+	} else {
+		EXPECT_NE(0, stat(COUNTERS, &after));
+	}
+}
@@ -0,0 +1,228 @@
+/**
+ * Copyright (C) Stony Brook University 2016
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/**
+ * Summarize a compound trace dumped by tc_dump_trace() or SIGUSR2: how full
+ * the compounds are, how long they wait for a session slot, and their RTTs,
+ * overall and per caller.
+ *
+ * Usage: tc_trace_stat [--callers=N] <trace-file>
+ */
+
+#include <errno.h>
+#include <error.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+DEFINE_int32(callers, 20, "Number of the busiest callers to show");
+
+using std::map;
+using std::string;
+using std::vector;
+
+struct Compound {
+	string caller;
+	int slot;
+	unsigned nops;
+	unsigned max_ops;
+	uint32_t request_bytes;
+	uint32_t max_request_bytes;
+	uint32_t reply_bytes;
+	uint64_t reset_ns;
+	uint64_t slot_ns;
+	uint64_t send_ns;
+	uint64_t reply_ns;
+	uint64_t done_ns;
+	int rpc_status;
+	int nfs_status;
+	vector<string> ops;
+};
+
+static bool ParseLine(const char *line, Compound *c)
+{
+	char caller[256];
+	char ops[4096];
+	int tid;
+	uint32_t xid;
+
+	ops[0] = 0;
+	int n = sscanf(line,
+		       "%d %255s %" SCNu32 " %d %u %u %" SCNu32 " %" SCNu32
+		       " %" SCNu32 " %" SCNu64 " %" SCNu64 " %" SCNu64
+		       " %" SCNu64 " %" SCNu64 " %d %d %4095s",
+		       &tid, caller, &xid, &c->slot, &c->nops, &c->max_ops,
+		       &c->request_bytes, &c->max_request_bytes,
+		       &c->reply_bytes, &c->reset_ns, &c->slot_ns, &c->send_ns,
+		       &c->reply_ns, &c->done_ns, &c->rpc_status,
+		       &c->nfs_status, ops);
+	if (n < 16) {
+		return false;
+	}
+	c->caller = caller;
+	c->ops.clear();
+	for (char *op = strtok(ops, ","); op; op = strtok(NULL, ",")) {
+		c->ops.push_back(op);
+	}
+	return true;
+}
+
+/* Print count, mean and percentiles of "v", which is sorted in place. */
+static void PrintDist(const char *name, vector<double> &v, const char *unit)
+{
+	if (v.empty()) {
+		printf("%-16s (none)\n", name);
+		return;
+	}
+	std::sort(v.begin(), v.end());
+	double sum = 0;
+	for (double x : v) {
+		sum += x;
+	}
+	auto pct = [&v](double p) {
+		size_t i = std::min(v.size() - 1, (size_t)(p * v.size()));
+		return v[i];
+	};
+	printf("%-16s n=%-8zu mean=%-10.2f p50=%-10.2f p90=%-10.2f "
+	       "p99=%-10.2f max=%.2f %s\n",
+	       name, v.size(), sum / v.size(), pct(0.5), pct(0.9), pct(0.99),
+	       v.back(), unit);
+}
+
+struct CallerStats {
+	size_t compounds = 0;
+	size_t ops = 0;
+	uint64_t request_bytes = 0;
+	uint64_t rtt_ns = 0;
+	size_t rtts = 0;
+	size_t failures = 0;
+};
+
+static void Summarize(const vector<Compound> &compounds)
+{
+	vector<double> op_fill, byte_fill, slot_wait_us, rtt_us, total_us;
+	map<string, CallerStats> callers;
+	map<string, size_t> op_counts;
+
+	for (const Compound &c : compounds) {
+		if (c.max_ops > 0) {
+			op_fill.push_back(100.0 * c.nops / c.max_ops);
+		}
+		if (c.max_request_bytes > 0) {
+			byte_fill.push_back(100.0 * c.request_bytes /
+					    c.max_request_bytes);
+		}
+		if (c.slot >= 0 && c.reset_ns && c.slot_ns) {
+			slot_wait_us.push_back((c.slot_ns - c.reset_ns) / 1e3);
+		}
+		if (c.send_ns && c.reply_ns) {
+			rtt_us.push_back((c.reply_ns - c.send_ns) / 1e3);
+		}
+		if (c.reset_ns && c.done_ns) {
+			total_us.push_back((c.done_ns - c.reset_ns) / 1e3);
+		}
+
+		CallerStats &cs = callers[c.caller];
+		cs.compounds++;
+		cs.ops += c.nops;
+		cs.request_bytes += c.request_bytes;
+		if (c.send_ns && c.reply_ns) {
+			cs.rtt_ns += c.reply_ns - c.send_ns;
+			cs.rtts++;
+		}
+		if (c.rpc_status != 0 || c.nfs_status != 0) {
+			cs.failures++;
+		}
+		for (const string &op : c.ops) {
+			op_counts[op]++;
+		}
+	}
+
+	printf("%zu compounds\n\n", compounds.size());
+	PrintDist("op fill", op_fill, "%");
+	PrintDist("byte fill", byte_fill, "%");
+	PrintDist("slot wait", slot_wait_us, "us");
+	PrintDist("RTT", rtt_us, "us");
+	PrintDist("total", total_us, "us");
+
+	vector<std::pair<string, CallerStats>> sorted(callers.begin(),
+						      callers.end());
+	std::sort(sorted.begin(), sorted.end(),
+		  [](const std::pair<string, CallerStats> &a,
+		     const std::pair<string, CallerStats> &b) {
+			  return a.second.compounds > b.second.compounds;
+		  });
+	printf("\n%-32s %10s %8s %10s %10s %8s\n", "caller", "compounds",
+	       "ops/cpd", "bytes/cpd", "RTT(us)", "failed");
+	for (size_t i = 0; i < sorted.size() && (int)i < FLAGS_callers; ++i) {
+		const CallerStats &cs = sorted[i].second;
+		printf("%-32s %10zu %8.1f %10.0f %10.1f %8zu\n",
+		       sorted[i].first.c_str(), cs.compounds,
+		       (double)cs.ops / cs.compounds,
+		       (double)cs.request_bytes / cs.compounds,
+		       cs.rtts ? cs.rtt_ns / 1e3 / cs.rtts : 0.0,
+		       cs.failures);
+	}
+
+	printf("\n%-24s %10s\n", "op", "count");
+	for (const auto &oc : op_counts) {
+		printf("%-24s %10zu\n", oc.first.c_str(), oc.second);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::string usage("Summarize a trace of TC compounds.\nUsage: ");
+	usage += argv[0];
+	usage += " <trace-file>";
+	gflags::SetUsageMessage(usage);
+	gflags::ParseCommandLineFlags(&argc, &argv, true);
+	if (argc < 2) {
+		gflags::ShowUsageWithFlags(argv[0]);
+		return 1;
+	}
+
+	FILE *fp = fopen(argv[1], "r");
+	if (!fp) {
+		error(1, errno, "cannot open %s", argv[1]);
+	}
+
+	vector<Compound> compounds;
+	char *line = NULL;
+	size_t len = 0;
+	Compound c;
+	while (getline(&line, &len, fp) > 0) {
+		if (line[0] != '#' && ParseLine(line, &c)) {
+			compounds.push_back(c);
+		}
+	}
+	free(line);
+	fclose(fp);
+
+	Summarize(compounds);
+	return 0;
+}
@@ -27,22 +27,29 @@
 
 /* command line syntax */
 
-char options[] = "c:qdx:s:n:p:h?";
+char options[] = "c:qdx:s:n:p:l:r:i:h?";
 char usage[] =
 	"Usage: ml_posix_client -s server -p port -n name [-q] [-d] [-c path]\n"
 	"       ml_posix_client -x script [-q] [-d] [-c path]\n"
-	"       ml_posix_client [-q] [-d] [-c path]\n" "\n"
-	"  ml_posix_client may be run in three modes\n"
+	"       ml_posix_client [-q] [-d] [-c path]\n"
+	"       ml_posix_client -l file [-r records] [-i iterations] [-c path]\n"
+	"\n"
+	"  ml_posix_client may be run in four modes\n"
 	"  - In the first mode, the client will be driven by a master.\n"
 	"  - In the second mode, the client is driven by a script.\n"
-	"  - In the third mode, the client interractive.\n" "\n"
+	"  - In the third mode, the client interractive.\n"
+	"  - In the fourth mode, the client locks and unlocks many records\n"
+	"    of a file and reports the lock throughput.\n" "\n"
 	"  -s server - specify the master's hostname or IP address\n"
 	"  -p port   - specify the master's port number\n"
 	"  -n name   - specify the client's name\n"
 	"  -x script - specify the name of a script to execute\n"
 	"  -q        - specify quiet mode\n"
 	"  -d        - specify dup errors mode (errors are sent to stdout and stderr)\n"
-	"  -c path   - chdir\n";
+	"  -c path   - chdir\n"
+	"  -l file   - specify the file to lock in lock-heavy mode\n"
+	"  -r records - specify the number of records to lock (default 1024)\n"
+	"  -i iterations - specify the number of rounds (default 100)\n";
 
 char server[MAXSTR];
 char name[MAXSTR];
@@ -689,6 +696,48 @@ void do_list(struct response *resp)
 	resp->r_length = length;
 }
 
+/*
+ * Lock-heavy mode: lock "records" adjacent 4K records of "fname" one fcntl()
+ * at a time and then unlock them, "iterations" times.  This is the
+ * per-syscall baseline of vectorized locking such as tc_lockv().
+ */
+int lock_heavy(const char *fname, long records, long iterations)
+{
+	struct flock lock;
+	struct timespec start, end;
+	double secs;
+	long i, j;
+	int fd;
+
+	fd = open(fname, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		fatal("Could not open %s errno = %d \"%s\"\n", fname, errno,
+		      strerror(errno));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < records * 2; j++) {
+			lock.l_type = j < records ? F_WRLCK : F_UNLCK;
+			lock.l_whence = SEEK_SET;
+			lock.l_start = (j % records) * 4096;
+			lock.l_len = 4096;
+			if (fcntl(fd, F_SETLK, &lock) == -1)
+				fatal("fcntl failed at record %ld errno = %d "
+				      "\"%s\"\n", j % records, errno,
+				      strerror(errno));
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(fd);
+
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stdout, "%ld lock and %ld unlock operations in %.3f seconds: "
+		"%.0f ops/s\n", records * iterations, records * iterations,
+		secs, 2 * records * iterations / secs);
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
 	int opt;
@@ -697,6 +746,9 @@ int main(int argc, char **argv)
 	char *rest;
 	int oflags = 0;
 	int no_tag;
+	char *lock_file = NULL;
+	long records = 1024;
+	long iterations = 100;
 
 	memset(&sigact, 0, sizeof(sigact));
 	sigact.sa_handler = sighandler;
@@ -769,6 +821,22 @@ int main(int argc, char **argv)
 			port = atoi(optarg);
 			break;
 
+		case 'l':
+			lock_file = optarg;
+			break;
+
+		case 'r':
+			records = atol(optarg);
+			if (records <= 0)
+				show_usage(1, "Invalid number of records\n");
+			break;
+
+		case 'i':
+			iterations = atol(optarg);
+			if (iterations <= 0)
+				show_usage(1, "Invalid number of iterations\n");
+			break;
+
 		case '?':
 		case 'h':
 		default:
@@ -777,6 +845,12 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (lock_file != NULL) {
+		if (oflags != 0)
+			show_usage(1, "Can not combine -l and -s/-p/-n/-x\n");
+		return lock_heavy(lock_file, records, iterations);
+	}
+
 	if (oflags > 0 && oflags < 7)
 		show_usage(1, "Must specify -s, -p, and -n together\n");
 
@@ -20,232 +20,816 @@
 
 #include "iovec_utils.h"
 
+#include <stddef.h>
+
 #include <algorithm>
 #include <vector>
 
 #include "tc_helper.h"
 #include "path_utils.h"
 
-// We should indeed include "nfsv41.h" and use sizeof(XXX) to get the overhead
-// of the operations.  But "nfsv41.h" include some libntirpc header files which
-// include syntax not compatible with C++.  We could not do that, so we define
-// const variable to replace the sizeof(XXX) operations.
-// #include "nfsv41.h"
-
-// # of bytes of NFSv4.1 operation code
-static const size_t OPSIZE = sizeof(int);
-
-// sizeof(PUTFH4args) == 16
-static const size_t PUTFH4SZ = 16;
-
-// sizeof(LOOKUP4args) == 16
-static const size_t LOOKUP4SZ = 16;
-
-// sizeof(OPEN4args) == 136
-static const size_t OPEN4SZ = 136;
-
-// sizeof(CLOSE4args) == 20
-static const size_t CLOSE4SZ = 20;
+// Sizes below are of the XDR encoding of the compounds built by the NFS4
+// backend.  We cannot include "nfsv41.h" whose libntirpc headers include
+// syntax not compatible with C++, so they are derived by hand from RFC 5661.
+// Where a size depends on the server (e.g., delegations), we take its bound.
 
-// sizeof(COMPOUND4args) == 40
-static const size_t COMPOUND4SZ = 40;
-
-// sizeof(READ4args) == 32
-static const size_t READ4SZ = 32;
-
-// sizeof(WRITE4args) == 48
-static const size_t WRITE4SZ = 48;
+static inline size_t xdr_pad(size_t n)
+{
+	return (n + 3) & ~(size_t)3;
+}
 
 // Also defined in "nfsv41.h".
 static const size_t NFS4_FHSIZE = 128;
 
-// The base size of a compound (or RPC)
-// 192 is the Fragment lenght of a RPC with no securiy payload (XID etc.)
-// 256 is the space for securiy payload
-// COMPOUND4SZ is for compound header size
-static const size_t CPDSIZE = 192 + 256 + COMPOUND4SZ;
-
-// MAX(sizeof(READ4args), sizeof(WRITE4args)) == 48;
-static const size_t RDWRSIZE = 48;
-
-// Return the RPC overhead byte excluding the data size.
-static inline size_t tc_get_iov_overhead(const struct tc_iovec *iov)
+// Also defined in <rpc/auth.h>.
+static const size_t MAX_AUTH_BYTES = 400;
+
+// Record mark, xid, msg_type, rpcvers, prog, vers, proc, and credential and
+// verifier (flavor, length and body).
+static const size_t RPC_CALL_SZ = 4 * 7 + 2 * (8 + MAX_AUTH_BYTES);
+// Record mark, xid, msg_type, reply_stat, verifier and accept_stat.
+static const size_t RPC_REPLY_SZ = 4 * 4 + (8 + MAX_AUTH_BYTES) + 4;
+
+// Empty tag, minorversion and # of ops; status, empty tag and # of ops.
+static const size_t COMPOUND_CALL_SZ = 12;
+static const size_t COMPOUND_REPLY_SZ = 12;
+
+// Every operation is preceded by its opcode; every result by its opcode and
+// status.  Operations without arguments or results (PUTROOTFH, SAVEFH,
+// RESTOREFH and results of PUTFH and LOOKUP) are of these sizes.
+static const size_t OP_CALL_SZ = 4;
+static const size_t OP_REPLY_SZ = 8;
+
+// sessionid, sequenceid, slotid, highest_slotid and cachethis
+static const size_t SEQUENCE_CALL_SZ = OP_CALL_SZ + 16 + 4 * 4;
+// sessionid, sequenceid, slotid, highest_slotid, target_highest_slotid and
+// status_flags
+static const size_t SEQUENCE_REPLY_SZ = OP_REPLY_SZ + 16 + 4 * 5;
+
+// The fixed size of a compound (or RPC) with its SEQUENCE
+static const size_t CPDSIZE =
+    std::max(RPC_CALL_SZ + COMPOUND_CALL_SZ + SEQUENCE_CALL_SZ,
+	     RPC_REPLY_SZ + COMPOUND_REPLY_SZ + SEQUENCE_REPLY_SZ);
+
+// Ops of a compound; one of them is SEQUENCE.  Also defined in
+// "nfs4/handle.c".
+static const int MAX_NUM_OPS_PER_COMPOUND = 256;
+
+// seqid, share_access, share_deny, clientid, owner of at most 64 bytes,
+// opentype, claim type and the length of the claimed name
+static const size_t OPEN_CALL_SZ = OP_CALL_SZ + 4 * 3 + 8 + 4 + 64 + 4 + 4 + 4;
+// createmode and fattr4 of mode, owner and owner_group, each name of at most
+// 128 bytes
+static const size_t OPEN_CREATE_SZ = 4 + (4 + 4 * 3) + 4 + 4 + 2 * (4 + 128);
+// stateid, change_info, rflags, attrset of at most 3 words, and a delegation
+// of at most 184 bytes (a write delegation with an ACE of a 128-byte name)
+static const size_t OPEN_REPLY_SZ = OP_REPLY_SZ + 16 + 20 + 4 + 16 + 184;
+
+// seqid and stateid; stateid
+static const size_t CLOSE_CALL_SZ = OP_CALL_SZ + 4 + 16;
+static const size_t CLOSE_REPLY_SZ = OP_REPLY_SZ + 16;
+
+// stateid, offset, stable and length of data; count, committed and verifier
+static const size_t WRITE_CALL_SZ = OP_CALL_SZ + 16 + 8 + 4 + 4;
+static const size_t WRITE_REPLY_SZ = OP_REPLY_SZ + 4 + 4 + 8;
+// stateid, offset and count; eof and length of data
+static const size_t READ_CALL_SZ = OP_CALL_SZ + 16 + 8 + 4;
+static const size_t READ_REPLY_SZ = OP_REPLY_SZ + 4 + 4;
+
+struct iov_overhead
+{
+	size_t bytes;  // of both the call and the reply excluding the data
+	int ops;
+};
+
+// Return the XDR bytes and ops needed for an iovec, excluding its data.  As
+// an iovec is either read or written, the bytes cover both a WRITE call and
+// a READ reply.  Each iovec is assumed to open and close its file, and path
+// components are counted as they are, so this is an upper bound.
+static struct iov_overhead tc_get_iov_overhead(const struct tc_iovec *iov)
 {
-	int n = 0;
-	size_t putfh_bytes = 0;
-	size_t lookup_bytes = 0;
-	size_t open_close_bytes = 0;
-	size_t rdwr_bytes = OPSIZE + RDWRSIZE;
+	size_t call = std::max(READ_CALL_SZ, WRITE_CALL_SZ);
+	size_t reply = std::max(READ_REPLY_SZ, WRITE_REPLY_SZ);
+	int ops = 1;
+	struct tc_path_iter it;
+	slice_t comp;
+	slice_t leaf = mkslice(NULL, 0);
+	bool open = false;
 
 	switch (iov->file.type) {
 	case TC_FILE_DESCRIPTOR:
-		putfh_bytes = OPSIZE + NFS4_FHSIZE;
+		call += OP_CALL_SZ + 4 + NFS4_FHSIZE;  // PUTFH
+		reply += OP_REPLY_SZ;
+		ops += 1;
 		break;
 	case TC_FILE_PATH:
 		assert(iov->file.path);
 		if (iov->file.path[0] == '/') {
-			// PUTROOTFH does not have args
-			putfh_bytes = OPSIZE;
+			call += OP_CALL_SZ;  // PUTROOTFH
 		} else {
-			putfh_bytes = PUTFH4SZ + NFS4_FHSIZE;
-		}
-		n = tc_path_tokenize(iov->file.path, NULL);
-		// n-1 LOOKUPs.  The last component of path will be used by
-		// OPEN, we count all path length here for simplicity.
-		lookup_bytes =
-		    strlen(iov->file.path) + (OPSIZE + LOOKUP4SZ) * (n - 1);
-		// OPEN, CLOSE, and GETFH
-		open_close_bytes = OPEN4SZ + CLOSE4SZ + OPSIZE * 3;
+			call += OP_CALL_SZ + 4 + NFS4_FHSIZE;  // PUTFH
+		}
+		call += OP_CALL_SZ;  // SAVEFH
+		reply += OP_REPLY_SZ * 2;
+		ops += 2;
+		// fallthrough
+	case TC_FILE_CURRENT:
+		if (!iov->file.path) {
+			break;
+		}
+		// A LOOKUP for each component but the last, which is opened.
+		tc_path_iter_init(&it, toslice(iov->file.path));
+		while (tc_path_iter_next(&it, &comp)) {
+			if (leaf.data) {
+				call += OP_CALL_SZ + 4 + xdr_pad(leaf.size);
+				reply += OP_REPLY_SZ;
+				ops += 1;
+			}
+			leaf = comp;
+		}
+		open = leaf.data != NULL;
 		break;
 	case TC_FILE_HANDLE:
 		assert(iov->file.handle);
-		putfh_bytes = PUTFH4SZ + NFS4_FHSIZE;
-		open_close_bytes = OPEN4SZ + CLOSE4SZ + OPSIZE * 2;
-		break;
-	case TC_FILE_CURRENT:
-		if (iov->file.path) {
-			assert(iov->file.path[0] != '/');
-			n = tc_path_tokenize(iov->file.path, NULL);
-			lookup_bytes = strlen(iov->file.path) +
-				       (OPSIZE + LOOKUP4SZ) * (n - 1);
-			open_close_bytes = OPEN4SZ + CLOSE4SZ + OPSIZE * 3;
-		}
+		call += OP_CALL_SZ + 4 + xdr_pad(iov->file.handle->handle_bytes);
+		reply += OP_REPLY_SZ;
+		ops += 1;
+		open = true;
 		break;
 	case TC_FILE_SAVED:
-		putfh_bytes = OPSIZE;  // for RESTOREFH4
+		call += OP_CALL_SZ;  // RESTOREFH
+		reply += OP_REPLY_SZ;
+		ops += 1;
 		break;
 	default:
 		assert(false);
 	}
 
-	return putfh_bytes + lookup_bytes + open_close_bytes + rdwr_bytes;
+	if (open) {
+		call += OPEN_CALL_SZ + xdr_pad(leaf.size) + CLOSE_CALL_SZ;
+		if (iov->is_creation) {
+			call += OPEN_CREATE_SZ;
+		}
+		reply += OPEN_REPLY_SZ + CLOSE_REPLY_SZ;
+		ops += 2;
+	}
+
+	return iov_overhead{ std::max(call, reply), ops };
 }
 
-struct tc_iov_array *tc_split_iov_array(const struct tc_iov_array *iova,
-					int size_limit, int *nparts)
+// A piece of a caller's iovec; it is the whole iovec unless it is split.
+struct iov_piece
 {
-	std::vector<struct tc_iov_array> parts;
-	std::vector<struct tc_iovec> cur_cpd; // iovec of current compound
-	size_t cpd_size = CPDSIZE;
-
-	auto add_part = [&parts, &cur_cpd, &cpd_size]() {
-		struct tc_iov_array iova;
-		iova.size = cur_cpd.size();
-		size_t iovs_memsize = sizeof(struct tc_iovec) * iova.size;
-		iova.iovs = (struct tc_iovec *)malloc(iovs_memsize);
-		memmove(iova.iovs, cur_cpd.data(), iovs_memsize);
-		parts.push_back(iova);
-		cur_cpd.clear();
-		cpd_size = CPDSIZE;
-	};
+	size_t offset;  // relative to the caller's iovec
+	size_t length;
+	int origin;     // index of the caller's iovec
+	int part;
+};
+
+// The bytes and ops of a compound
+struct cpd_space
+{
+	size_t bytes;
+	int ops;
+};
 
-	struct tc_iovec *i_iov = iova->iovs; // current iovec to split
-	int i = 0;			     // index of current iovec
-	size_t i_off = 0; // offset of iovs[i].data to be split
-
-	auto add_iov_to_cpd = [&i_iov, &i_off, &cur_cpd, &cpd_size](
-	    size_t len) {
-		struct tc_iovec iov = *i_iov;
-		iov.offset += i_off;
-		iov.data += i_off;
-		iov.length = len;
-		iov.is_creation = i_iov->is_creation && i_off == 0;
-		cur_cpd.push_back(iov);
-		cpd_size += (tc_get_iov_overhead(&iov) + len);
-		i_off += iov.length;
-	};
+// A plan of pieces and the number of compounds they take.
+struct iov_plan
+{
+	std::vector<iov_piece> pieces;
+	std::vector<cpd_space> cpds;
 
-	while (i < iova->size) {
-		size_t space_left = size_limit - cpd_size;
-		size_t data_remain =
-		    tc_get_iov_overhead(i_iov) + i_iov->length - i_off;
-		if (space_left >= data_remain) {
-			add_iov_to_cpd(i_iov->length - i_off);
-			++i;
-			i_off = 0;
-			i_iov = iova->iovs + i;
-		} else {
+	int add_cpd()
+	{
+		cpds.push_back(cpd_space{ CPDSIZE, 1 });  // SEQUENCE
+		return cpds.size() - 1;
+	}
+
+	bool fits(int c, size_t bytes, int ops, size_t size_limit) const
+	{
+		return cpds[c].bytes + bytes <= size_limit &&
+		       cpds[c].ops + ops <= MAX_NUM_OPS_PER_COMPOUND;
+	}
+
+	void add_piece(int c, int origin, size_t offset, size_t length,
+		       const iov_overhead &ovh)
+	{
+		pieces.push_back(iov_piece{ offset, length, origin, c });
+		cpds[c].bytes += ovh.bytes + xdr_pad(length);
+		cpds[c].ops += ovh.ops;
+	}
+
+	int splits(int count) const
+	{
+		return pieces.size() - count;
+	}
+};
+
+// Offsets that are resolved by the server cannot be split.
+static inline bool tc_iov_splittable(const struct tc_iovec *iov)
+{
+	return iov->offset != TC_OFFSET_CUR && iov->offset != TC_OFFSET_END;
+}
+
+// The max data of a piece that fits in "space" bytes after "ovh".
+static inline size_t tc_piece_room(size_t space, const iov_overhead &ovh)
+{
+	return space > ovh.bytes ? (space - ovh.bytes) & ~(size_t)3 : 0;
+}
+
+// Fill compounds in the order of the iovecs, splitting an iovec when it does
+// not fit in what is left of the current compound.
+static void tc_plan_in_order(const struct tc_iov_array *iova,
+			     const std::vector<iov_overhead> &ovhs,
+			     size_t size_limit, iov_plan *plan)
+{
+	int c = plan->add_cpd();
+
+	for (int i = 0; i < iova->size; ++i) {
+		const struct tc_iovec *iov = iova->iovs + i;
+		const iov_overhead &ovh = ovhs[i];
+		size_t off = 0;
+
+		while (true) {
+			size_t remain = iov->length - off;
+			size_t used = plan->cpds[c].bytes;
+			if (plan->fits(c, ovh.bytes + xdr_pad(remain), ovh.ops,
+				       size_limit)) {
+				plan->add_piece(c, i, off, remain, ovh);
+				break;
+			}
+
+			bool empty = plan->cpds[c].ops == 1;
+			bool ops_fit = plan->fits(c, 0, ovh.ops, size_limit);
+			size_t room =
+			    ops_fit && used < size_limit
+				? tc_piece_room(size_limit - used, ovh)
+				: 0;
 			// Don't split if we will create a tiny head or tail.
-			bool tiny_head = space_left <= TC_SPLIT_THRESHOLD;
+			bool tiny_head = room <= TC_SPLIT_THRESHOLD;
 			bool tiny_tail =
-			    (data_remain + CPDSIZE) <= size_limit &&
-			    (data_remain - space_left) <= TC_SPLIT_THRESHOLD;
-			if (tiny_head || tiny_tail) {
-				add_part();
+			    CPDSIZE + ovh.bytes + xdr_pad(remain) <= size_limit &&
+			    remain - room <= TC_SPLIT_THRESHOLD;
+			if (!empty && (!tc_iov_splittable(iov) || !ops_fit ||
+				       tiny_head || tiny_tail)) {
+				c = plan->add_cpd();
 				continue;
 			}
-			add_iov_to_cpd(size_limit - cpd_size);
-			add_part();
+			if (!tc_iov_splittable(iov) || room == 0) {
+				// too big for any compound; send it as it is
+				plan->add_piece(c, i, off, remain, ovh);
+				break;
+			}
+			plan->add_piece(c, i, off, room, ovh);
+			off += room;
+			c = plan->add_cpd();
 		}
 	}
+}
 
-	if (!cur_cpd.empty()) {
-		add_part();
+// Return a hash of what tells the file of "iov" from others: the base name
+// of a path, the descriptor or the handle.
+static size_t tc_iov_file_key(const struct tc_iovec *iov)
+{
+	const unsigned char *p;
+	size_t n;
+	size_t h = 14695981039346656037ULL;  // FNV-1a
+
+	switch (iov->file.type) {
+	case TC_FILE_PATH: {
+		slice_t base = tc_path_basename(iov->file.path);
+		p = (const unsigned char *)base.data;
+		n = base.size;
+		break;
 	}
+	case TC_FILE_DESCRIPTOR:
+		p = (const unsigned char *)&iov->file.fd;
+		n = sizeof(iov->file.fd);
+		break;
+	case TC_FILE_HANDLE:
+		p = iov->file.handle->f_handle;
+		n = iov->file.handle->handle_bytes;
+		break;
+	default:
+		assert(false);
+		return 0;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		h = (h ^ p[i]) * 1099511628211ULL;
+	}
+	return h;
+}
 
-	*nparts = parts.size();
-	struct tc_iov_array *iovas =
-	    (struct tc_iov_array *)malloc(sizeof(*iovas) * parts.size());
-	memmove(iovas, parts.data(), sizeof(*iovas) * parts.size());
-	return iovas;
+// Iovecs can be sent out of order only if no two of them may be of the same
+// file (overlapping writes, or a creation, must keep their order) and none of
+// them depends on the iovec before it (TC_FILE_CURRENT and TC_FILE_SAVED).
+static bool tc_iovs_reorderable(const struct tc_iov_array *iova)
+{
+	std::vector<size_t> keys(iova->size);
+
+	for (int i = 0; i < iova->size; ++i) {
+		int type = iova->iovs[i].file.type;
+		if ((type != TC_FILE_PATH && type != TC_FILE_DESCRIPTOR &&
+		     type != TC_FILE_HANDLE) ||
+		    type != iova->iovs[0].file.type) {
+			return false;
+		}
+		keys[i] = tc_iov_file_key(iova->iovs + i);
+	}
+	std::sort(keys.begin(), keys.end());
+	return std::adjacent_find(keys.begin(), keys.end()) == keys.end();
 }
 
-bool tc_restore_iov_array(struct tc_iov_array *iova,
-			  struct tc_iov_array **parts, int nparts)
+// Pack the iovecs first-fit-decreasing.  An iovec larger than a compound is
+// split into a head put first-fit and full compounds after it, so its pieces
+// are still sent in order.
+static void tc_plan_packed(const struct tc_iov_array *iova,
+			   const std::vector<iov_overhead> &ovhs,
+			   size_t size_limit, iov_plan *plan)
 {
-	int i = 0;
-	int i_off = 0;
-	struct tc_iovec *i_iov = iova->iovs;
-	bool res = true;
-
-	auto advance = [&iova, &i, &i_off, &i_iov](bool eof) {
-		i_iov->length = i_off;
-		i_iov->is_eof = eof;
-		++i;
-		i_off = 0;
-		i_iov = iova->iovs + i;
-	};
+	std::vector<int> order(iova->size);
 
-	auto match = [&i_iov, &i_off](const struct tc_iovec *iov) {
-		return tc_cmp_file(&iov->file, &i_iov->file) &&
-		       iov->offset == (i_iov->offset + i_off);
+	for (int i = 0; i < iova->size; ++i) {
+		order[i] = i;
+	}
+	auto cost = [iova, &ovhs](int i) {
+		return ovhs[i].bytes + xdr_pad(iova->iovs[i].length);
 	};
-
-	for (int n = 0; n < nparts && res; ++n) {
-		struct tc_iov_array *part = *parts + n;
-		for (int j = 0; j < part->size; ++j) {
-			struct tc_iovec *iov = part->iovs + j;
-			if (!match(iov)) {
-				advance(false);
+	std::stable_sort(order.begin(), order.end(),
+			 [&cost](int a, int b) { return cost(a) > cost(b); });
+
+	for (int i : order) {
+		const struct tc_iovec *iov = iova->iovs + i;
+		const iov_overhead &ovh = ovhs[i];
+		size_t room = tc_piece_room(size_limit - CPDSIZE, ovh);
+		size_t head = iov->length;
+
+		if (cost(i) + CPDSIZE > size_limit && tc_iov_splittable(iov) &&
+		    room > 2 * TC_SPLIT_THRESHOLD) {
+			head = iov->length % room;
+			if (head == 0) {
+				head = room;
+			} else if (head <= TC_SPLIT_THRESHOLD) {
+				head += TC_SPLIT_THRESHOLD;
 			}
-			if (match(iov)) {
-				i_off += iov->length;
-				if (iov->is_eof || i_off == i_iov->length) {
-					advance(iov->is_eof);
-				}
+		}
+
+		int c = 0;
+		int ncpds = plan->cpds.size();
+		while (c < ncpds &&
+		       !plan->fits(c, ovh.bytes + xdr_pad(head), ovh.ops,
+				   size_limit)) {
+			++c;
+		}
+		if (c == ncpds) {
+			c = plan->add_cpd();
+		}
+		plan->add_piece(c, i, 0, head, ovh);
+
+		for (size_t off = head; off < iov->length; off += room) {
+			plan->add_piece(plan->add_cpd(), i, off,
+					std::min(room, iov->length - off), ovh);
+		}
+	}
+
+	// Within a compound, keep the order of the caller so that pieces of the
+	// same file stay next to each other.
+	std::sort(plan->pieces.begin(), plan->pieces.end(),
+		  [](const iov_piece &a, const iov_piece &b) {
+			  if (a.part != b.part)
+				  return a.part < b.part;
+			  if (a.origin != b.origin)
+				  return a.origin < b.origin;
+			  return a.offset < b.offset;
+		  });
+}
+
+// Everything of a split lives in one block of memory, which starts with this
+// header and is followed by the parts.  When no iovec is split, the parts
+// are views into the caller's array, which is reordered in place; otherwise
+// the pieces follow the parts.
+struct tc_iov_split
+{
+	int count;      // # of the caller's iovecs
+	int npieces;
+	bool in_place;
+	struct tc_iovec *pieces;
+	struct iov_piece *plan;  // one for each piece
+	struct tc_iov_array parts[0];
+};
+
+static inline struct tc_iov_split *tc_split_of(struct tc_iov_array *parts)
+{
+	return (struct tc_iov_split *)((char *)parts -
+				       offsetof(struct tc_iov_split, parts));
+}
+
+// Permute "iovs" so that iovs[k] becomes what was iovs[perm[k]], or, if
+// "inverse", undo that.  "perm" is used to mark visited entries and is
+// unchanged on return.
+static void tc_permute_iovs(struct tc_iovec *iovs, int *perm, int n,
+			    bool inverse)
+{
+	for (int start = 0; start < n; ++start) {
+		if (perm[start] < 0) {
+			continue;
+		}
+		struct tc_iovec tmp = iovs[start];
+		int k = start;
+		while (true) {
+			int j = perm[k];
+			perm[k] = ~j;
+			if (inverse) {
+				std::swap(tmp, iovs[j]);
+			} else if (j == start) {
+				iovs[k] = tmp;
 			} else {
-				res = false;
+				iovs[k] = iovs[j];
+			}
+			if (j == start) {
 				break;
 			}
+			k = j;
+		}
+	}
+	for (int k = 0; k < n; ++k) {
+		perm[k] = ~perm[k];
+	}
+}
+
+struct tc_iov_array *tc_split_iov_array(const struct tc_iov_array *iova,
+					int size_limit, int *nparts)
+{
+	std::vector<iov_overhead> ovhs(iova->size);
+	iov_plan in_order;
+	iov_plan packed;
+
+	for (int i = 0; i < iova->size; ++i) {
+		ovhs[i] = tc_get_iov_overhead(iova->iovs + i);
+	}
+	tc_plan_in_order(iova, ovhs, size_limit, &in_order);
+	if (tc_iovs_reorderable(iova)) {
+		tc_plan_packed(iova, ovhs, size_limit, &packed);
+	}
+
+	// Reorder only if it saves compounds or splits.
+	iov_plan &plan = !packed.cpds.empty() &&
+				 (packed.cpds.size() < in_order.cpds.size() ||
+				  (packed.cpds.size() == in_order.cpds.size() &&
+				   packed.splits(iova->size) <
+				       in_order.splits(iova->size)))
+			     ? packed
+			     : in_order;
+
+	int npieces = plan.pieces.size();
+	bool in_place = npieces == iova->size;
+	size_t memsize = sizeof(struct tc_iov_split) +
+			 sizeof(struct tc_iov_array) * plan.cpds.size() +
+			 sizeof(struct iov_piece) * npieces;
+	if (!in_place) {
+		memsize += sizeof(struct tc_iovec) * npieces;
+	}
+	struct tc_iov_split *split = (struct tc_iov_split *)malloc(memsize);
+	if (!split) {
+		return NULL;
+	}
+	split->count = iova->size;
+	split->npieces = npieces;
+	split->in_place = in_place;
+	split->plan = (struct iov_piece *)(split->parts + plan.cpds.size());
+	split->pieces = in_place ? iova->iovs
+				 : (struct tc_iovec *)(split->plan + npieces);
+	std::copy(plan.pieces.begin(), plan.pieces.end(), split->plan);
+
+	if (in_place) {
+		std::vector<int> perm(npieces);
+		bool reordered = false;
+		for (int k = 0; k < npieces; ++k) {
+			perm[k] = plan.pieces[k].origin;
+			reordered = reordered || perm[k] != k;
+		}
+		if (reordered) {
+			tc_permute_iovs(iova->iovs, perm.data(), npieces,
+					false);
+		}
+	} else {
+		for (int k = 0; k < npieces; ++k) {
+			const iov_piece &p = plan.pieces[k];
+			struct tc_iovec *iov = split->pieces + k;
+			*iov = iova->iovs[p.origin];
+			iov->offset += p.offset;
+			iov->data += p.offset;
+			iov->length = p.length;
+			iov->is_creation = iov->is_creation && p.offset == 0;
 		}
 	}
-	if (i_off != 0) {
-		advance(false);
+
+	*nparts = 0;
+	for (int k = 0; k < npieces; ++k) {
+		if (k == 0 || plan.pieces[k].part != plan.pieces[k - 1].part) {
+			split->parts[*nparts].iovs = split->pieces + k;
+			split->parts[*nparts].size = 0;
+			++*nparts;
+		}
+		++split->parts[*nparts - 1].size;
 	}
 
-	if (res) {
-		for (int n = 0; n < nparts; ++n) {
-			free((*parts)[n].iovs);
+	return split->parts;
+}
+
+bool tc_restore_iov_array(struct tc_iov_array *iova,
+			  struct tc_iov_array **parts, int nparts)
+{
+	if (*parts == NULL) {
+		return false;
+	}
+
+	struct tc_iov_split *split = tc_split_of(*parts);
+	const struct iov_piece *plan = split->plan;
+
+	if (split->count != iova->size) {
+		return false;
+	}
+
+	if (split->in_place) {
+		std::vector<int> perm(split->npieces);
+		bool reordered = false;
+		for (int k = 0; k < split->npieces; ++k) {
+			perm[k] = plan[k].origin;
+			reordered = reordered || perm[k] != k;
+		}
+		if (reordered) {
+			tc_permute_iovs(iova->iovs, perm.data(),
+					split->npieces, true);
+		}
+	} else {
+		for (int i = 0; i < iova->size; ++i) {
+			iova->iovs[i].is_eof = false;
+			iova->iovs[i].is_failure = false;
+			iova->iovs[i].is_write_stable = true;
+		}
+		// The result of an iovec ends at its first short piece.
+		for (int k = 0; k < split->npieces; ++k) {
+			const struct tc_iovec *piece = split->pieces + k;
+			struct tc_iovec *iov = iova->iovs + plan[k].origin;
+			size_t end = plan[k].offset + piece->length;
+			iov->is_failure = iov->is_failure || piece->is_failure;
+			iov->is_write_stable =
+			    iov->is_write_stable && piece->is_write_stable;
+			if (piece->length == plan[k].length && !piece->is_eof) {
+				continue;
+			}
+			if (end < iov->length) {
+				iov->length = end;
+				iov->is_eof = piece->is_eof;
+			} else if (end == iov->length) {
+				iov->is_eof = iov->is_eof || piece->is_eof;
+			}
+		}
+	}
+
+	free(split);
+	*parts = NULL;
+	return true;
+}
+
+static inline bool tc_iov_mergeable(const struct tc_iovec *iov)
+{
+	int type = iov->file.type;
+	return (type == TC_FILE_PATH || type == TC_FILE_DESCRIPTOR ||
+		type == TC_FILE_HANDLE) &&
+	       tc_iov_splittable(iov);
+}
+
+// A total order of the files that can be merged.
+static int tc_order_file(const tc_file *a, const tc_file *b)
+{
+	if (a->type != b->type) {
+		return a->type - b->type;
+	}
+	switch (a->type) {
+	case TC_FILE_DESCRIPTOR:
+		return (a->fd > b->fd) - (a->fd < b->fd);
+	case TC_FILE_PATH:
+		return strcmp(a->path, b->path);
+	case TC_FILE_HANDLE:
+		if (a->handle->handle_type != b->handle->handle_type) {
+			return a->handle->handle_type - b->handle->handle_type;
+		}
+		if (a->handle->handle_bytes != b->handle->handle_bytes) {
+			return a->handle->handle_bytes < b->handle->handle_bytes
+				   ? -1
+				   : 1;
 		}
-		free(*parts);
-		*parts = NULL;
+		return memcmp(a->handle->f_handle, b->handle->f_handle,
+			      a->handle->handle_bytes);
+	default:
+		assert(false);
+		return 0;
 	}
+}
 
-	return res;
+// Iovecs of one file whose ranges are adjacent or overlap.
+struct iov_run
+{
+	size_t start;
+	size_t end;
+	int leader;     // the first of them in the caller's array
+	int nmembers;
+	bool contiguous;  // in memory as well, so no bounce buffer is needed
+};
+
+// Everything of a merge lives in one block of memory, which starts with
+// this header and is followed by the merged iovecs, their bounce buffers and
+// members, the merged iovec of each of the caller's, and the bounce buffers.
+struct tc_iov_merge
+{
+	int count;  // # of the caller's iovecs
+	struct tc_iov_array merged;
+	char **bounce;  // bounce buffer of each merged iovec, or NULL
+	int *nmembers;  // caller's iovecs of each merged iovec
+	int *merged_of;
+};
+
+static inline struct tc_iov_merge *tc_merge_of(struct tc_iov_array *merged)
+{
+	return (struct tc_iov_merge *)((char *)merged -
+				       offsetof(struct tc_iov_merge, merged));
 }
 
-bool tc_merge_iov_array(struct tc_iov_array *iova)
+struct tc_iov_array *tc_merge_iov_array(const struct tc_iov_array *iova,
+					size_t max_io, bool write)
 {
-	return false;
+	const struct tc_iovec *iovs = iova->iovs;
+	std::vector<int> order;
+	std::vector<int> run_of(iova->size, -1);
+	std::vector<iov_run> runs;
+	size_t bounce_size = 0;
+	bool merging = false;
+
+	for (int i = 0; i < iova->size; ++i) {
+		int type = iovs[i].file.type;
+		if (type == TC_FILE_CURRENT || type == TC_FILE_SAVED) {
+			return NULL;  // cannot be moved
+		}
+		if (tc_iov_mergeable(iovs + i)) {
+			order.push_back(i);
+		}
+	}
+	std::sort(order.begin(), order.end(), [iovs](int a, int b) {
+		int r = tc_order_file(&iovs[a].file, &iovs[b].file);
+		if (r != 0)
+			return r < 0;
+		if (iovs[a].offset != iovs[b].offset)
+			return iovs[a].offset < iovs[b].offset;
+		return a < b;
+	});
+
+	for (size_t k = 0; k < order.size(); ++k) {
+		const struct tc_iovec *iov = iovs + order[k];
+		size_t end = iov->offset + iov->length;
+		if (k > 0) {
+			const struct tc_iovec *prev = iovs + order[k - 1];
+			iov_run &run = runs.back();
+			bool same_file =
+			    tc_order_file(&prev->file, &iov->file) == 0;
+			bool fits =
+			    std::max(run.end, end) - run.start <= max_io;
+			// Overlapping writes must be in one run because the
+			// order of two runs would not be theirs.
+			if (same_file && write && iov->offset < run.end &&
+			    !fits) {
+				return NULL;
+			}
+			if (same_file && iov->offset <= run.end && fits) {
+				run.contiguous = run.contiguous &&
+						 iov->offset == run.end &&
+						 iov->data == prev->data +
+								  prev->length;
+				run.end = std::max(run.end, end);
+				run.leader = std::min(run.leader, order[k]);
+				++run.nmembers;
+				run_of[order[k]] = runs.size() - 1;
+				merging = true;
+				continue;
+			}
+		}
+		runs.push_back(iov_run{ iov->offset, end, order[k], 1, true });
+		run_of[order[k]] = runs.size() - 1;
+	}
+	if (!merging) {
+		return NULL;
+	}
+
+	int nmerged = iova->size;
+	for (const iov_run &run : runs) {
+		nmerged -= run.nmembers - 1;
+		if (!run.contiguous) {
+			bounce_size += run.end - run.start;
+		}
+	}
+
+	size_t memsize = sizeof(struct tc_iov_merge) +
+			 (sizeof(struct tc_iovec) + sizeof(char *) +
+			  sizeof(int)) * nmerged +
+			 sizeof(int) * iova->size + bounce_size;
+	struct tc_iov_merge *merge = (struct tc_iov_merge *)malloc(memsize);
+	if (!merge) {
+		return NULL;
+	}
+	merge->count = iova->size;
+	merge->merged.size = nmerged;
+	merge->merged.iovs = (struct tc_iovec *)(merge + 1);
+	merge->bounce = (char **)(merge->merged.iovs + nmerged);
+	merge->nmembers = (int *)(merge->bounce + nmerged);
+	merge->merged_of = merge->nmembers + nmerged;
+	char *bounce = (char *)(merge->merged_of + iova->size);
+
+	std::vector<int> merged_of_run(runs.size());
+	int m = 0;
+	for (int i = 0; i < iova->size; ++i) {
+		struct tc_iovec *merged;
+		int r = run_of[i];
+		if (r >= 0 && runs[r].leader != i) {
+			// a later member; its leader has been placed
+			merged = merge->merged.iovs + merged_of_run[r];
+			merged->is_creation |= iovs[i].is_creation;
+			merged->is_write_stable |= iovs[i].is_write_stable;
+			merge->merged_of[i] = merged_of_run[r];
+			continue;
+		}
+		merged = merge->merged.iovs + m;
+		*merged = iovs[i];
+		merge->bounce[m] = NULL;
+		merge->nmembers[m] = 1;
+		if (r >= 0 && runs[r].nmembers > 1) {
+			const iov_run &run = runs[r];
+			merged->offset = run.start;
+			merged->length = run.end - run.start;
+			merge->nmembers[m] = run.nmembers;
+			if (run.contiguous) {
+				// the member at "start" has the lowest address
+				merged->data =
+				    iovs[i].data - (iovs[i].offset - run.start);
+			} else {
+				merge->bounce[m] = bounce;
+				merged->data = bounce;
+				bounce += run.end - run.start;
+			}
+			merged_of_run[r] = m;
+		}
+		merge->merged_of[i] = m;
+		++m;
+	}
+
+	if (write && bounce_size > 0) {
+		// in the caller's order, so that later writes overwrite
+		for (int i = 0; i < iova->size; ++i) {
+			int m = merge->merged_of[i];
+			char *b = merge->bounce[m];
+			if (b) {
+				memcpy(b + (iovs[i].offset -
+					    merge->merged.iovs[m].offset),
+				       iovs[i].data, iovs[i].length);
+			}
+		}
+	}
+	return &merge->merged;
 }
 
+void tc_unmerge_iov_array(struct tc_iov_array *iova,
+			  struct tc_iov_array **merged, bool write)
+{
+	struct tc_iov_merge *merge = tc_merge_of(*merged);
+
+	assert(merge->count == iova->size);
+	for (int i = 0; i < iova->size; ++i) {
+		struct tc_iovec *iov = iova->iovs + i;
+		int m = merge->merged_of[i];
+		const struct tc_iovec *miov = merge->merged.iovs + m;
+
+		iov->is_failure = miov->is_failure;
+		iov->is_write_stable = miov->is_write_stable;
+		if (merge->nmembers[m] == 1) {
+			iov->length = miov->length;
+			iov->is_eof = miov->is_eof;
+			continue;
+		}
+		// "miov->length" is now what has been read or written
+		size_t end = miov->offset + miov->length;
+		size_t n = end > iov->offset
+			       ? std::min(iov->length, end - iov->offset)
+			       : 0;
+		if (!write && merge->bounce[m] && n > 0) {
+			memcpy(iov->data,
+			       merge->bounce[m] + (iov->offset - miov->offset),
+			       n);
+		}
+		iov->is_eof = !write && miov->is_eof &&
+			      iov->offset + iov->length >= end;
+		iov->length = n;
+	}
+
+	free(merge);
+	*merged = NULL;
+}
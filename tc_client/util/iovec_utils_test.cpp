@@ -251,3 +251,258 @@ TEST(IovecUtils, HandleOverlappedIovecs)
 	delete[] iovs[0].data;
 	delete[] iovs[1].data;
 }
+
+TEST(IovecUtils, PackIovecsFirstFitDecreasing)
+{
+	// In order, the second iovec would be split; packed, each compound has
+	// a big and a small iovec.
+	vector<size_t> sizes {600_KB, 600_KB, 300_KB, 300_KB};
+	vector<tc_iovec> iovs(sizes.size());
+	for (int i = 0; i < sizes.size(); ++i) {
+		tc_iov2fd(&iovs[i], (1 << 30) + i, 0, sizes[i],
+			  new char[sizes[i]]);
+	}
+
+	struct tc_iov_array iova = vec2array(iovs);
+	int nparts;
+	auto parts = tc_split_iov_array(&iova, 1_MB, &nparts);
+
+	EXPECT_EQ(2, nparts);
+	for (int p = 0; p < nparts; ++p) {
+		EXPECT_EQ(2, parts[p].size);
+		// views into the caller's array
+		EXPECT_GE(parts[p].iovs, iovs.data());
+		EXPECT_LE(parts[p].iovs + parts[p].size,
+			  iovs.data() + iovs.size());
+		EXPECT_EQ((1 << 30) + p, parts[p].iovs[0].file.fd);
+		EXPECT_EQ((1 << 30) + p + 2, parts[p].iovs[1].file.fd);
+	}
+	parts[1].iovs[1].length = 100_KB;
+	parts[1].iovs[1].is_eof = true;
+
+	EXPECT_TRUE(tc_restore_iov_array(&iova, &parts, nparts));
+	for (int i = 0; i < sizes.size(); ++i) {
+		EXPECT_EQ((1 << 30) + i, iovs[i].file.fd);
+		EXPECT_EQ(i == 3 ? 100_KB : sizes[i], iovs[i].length);
+		EXPECT_EQ(i == 3, iovs[i].is_eof);
+		delete[] iovs[i].data;
+	}
+}
+
+TEST(IovecUtils, IovecsOfSameFileAreNotReordered)
+{
+	vector<size_t> sizes {600_KB, 600_KB, 300_KB, 300_KB};
+	vector<tc_iovec> iovs(sizes.size());
+	size_t off = 0;
+	for (int i = 0; i < sizes.size(); ++i) {
+		tc_iov2fd(&iovs[i], 1 << 30, off, sizes[i],
+			  new char[sizes[i]]);
+		off += sizes[i];
+	}
+
+	struct tc_iov_array iova = vec2array(iovs);
+	int nparts;
+	auto parts = tc_split_iov_array(&iova, 1_MB, &nparts);
+
+	EXPECT_EQ(2, nparts);
+	off = 0;
+	for (int p = 0; p < nparts; ++p) {
+		for (int s = 0; s < parts[p].size; ++s) {
+			EXPECT_EQ(off, parts[p].iovs[s].offset);
+			off += parts[p].iovs[s].length;
+		}
+	}
+	EXPECT_EQ(1800_KB, off);
+
+	EXPECT_TRUE(tc_restore_iov_array(&iova, &parts, nparts));
+	for (int i = 0; i < sizes.size(); ++i) {
+		EXPECT_EQ(sizes[i], iovs[i].length);
+		delete[] iovs[i].data;
+	}
+}
+
+TEST(IovecUtils, SplitByNumberOfOps)
+{
+	// Each iovec of a file descriptor takes a PUTFH and a READ or WRITE.
+	const int N = 300;
+	vector<tc_iovec> iovs(N);
+	char buf[1024];
+	for (int i = 0; i < N; ++i) {
+		tc_iov2fd(&iovs[i], (1 << 30) + i, 0, sizeof(buf), buf);
+	}
+
+	struct tc_iov_array iova = vec2array(iovs);
+	int nparts;
+	auto parts = tc_split_iov_array(&iova, 1_MB, &nparts);
+
+	EXPECT_EQ(3, nparts);
+	for (int p = 0; p < nparts; ++p) {
+		EXPECT_LE(1 + 2 * parts[p].size, 256);
+	}
+	EXPECT_TRUE(tc_restore_iov_array(&iova, &parts, nparts));
+}
+
+TEST(IovecUtils, MergeAdjacentReads)
+{
+	const int N = 4;
+	char *buf = new char[N * 4_KB];
+	char other[4_KB];
+	vector<tc_iovec> iovs(N + 1);
+	// read a file backwards into one buffer
+	for (int i = 0; i < N; ++i) {
+		tc_iov2fd(&iovs[i], 1 << 30, (N - 1 - i) * 4_KB, 4_KB,
+			  buf + (N - 1 - i) * 4_KB);
+	}
+	tc_iov2fd(&iovs[N], (1 << 30) + 1, 4_KB, 4_KB, other);
+
+	struct tc_iov_array iova = vec2array(iovs);
+	auto merged = tc_merge_iov_array(&iova, 1_MB, false);
+	ASSERT_TRUE(merged);
+	ASSERT_EQ(2, merged->size);
+	EXPECT_EQ(0, merged->iovs[0].offset);
+	EXPECT_EQ(N * 4_KB, merged->iovs[0].length);
+	EXPECT_EQ(buf, merged->iovs[0].data);  // no bounce buffer
+	EXPECT_EQ(other, merged->iovs[1].data);
+
+	// the file has only 10KB
+	merged->iovs[0].length = 10_KB;
+	merged->iovs[0].is_eof = true;
+	tc_unmerge_iov_array(&iova, &merged, false);
+	EXPECT_EQ(NULL, merged);
+	EXPECT_EQ(0, iovs[0].length);
+	EXPECT_TRUE(iovs[0].is_eof);
+	EXPECT_EQ(2_KB, iovs[1].length);
+	EXPECT_TRUE(iovs[1].is_eof);
+	EXPECT_EQ(4_KB, iovs[2].length);
+	EXPECT_FALSE(iovs[2].is_eof);
+	EXPECT_EQ(4_KB, iovs[3].length);
+	EXPECT_EQ(4_KB, iovs[4].length);
+	delete[] buf;
+}
+
+TEST(IovecUtils, MergeOverlappedReadsIntoBounceBuffer)
+{
+	char file[12_KB];
+	for (size_t i = 0; i < sizeof(file); ++i) {
+		file[i] = (char)(i * 7);
+	}
+	char bufs[3][8_KB];
+	vector<tc_iovec> iovs(3);
+	tc_iov2fd(&iovs[0], 1 << 30, 0, 8_KB, bufs[0]);
+	tc_iov2fd(&iovs[1], 1 << 30, 4_KB, 8_KB, bufs[1]);
+	tc_iov2fd(&iovs[2], 1 << 30, 2_KB, 1_KB, bufs[2]);
+
+	struct tc_iov_array iova = vec2array(iovs);
+	auto merged = tc_merge_iov_array(&iova, 1_MB, false);
+	ASSERT_TRUE(merged);
+	ASSERT_EQ(1, merged->size);
+	EXPECT_EQ(0, merged->iovs[0].offset);
+	EXPECT_EQ(12_KB, merged->iovs[0].length);
+	memcpy(merged->iovs[0].data, file, sizeof(file));
+
+	tc_unmerge_iov_array(&iova, &merged, false);
+	EXPECT_EQ(8_KB, iovs[0].length);
+	EXPECT_EQ(0, memcmp(bufs[0], file, 8_KB));
+	EXPECT_EQ(8_KB, iovs[1].length);
+	EXPECT_EQ(0, memcmp(bufs[1], file + 4_KB, 8_KB));
+	EXPECT_EQ(1_KB, iovs[2].length);
+	EXPECT_EQ(0, memcmp(bufs[2], file + 2_KB, 1_KB));
+}
+
+TEST(IovecUtils, MergeOverlappedWritesLastWriterWins)
+{
+	char bufs[3][4_KB];
+	memset(bufs[0], 'a', 4_KB);
+	memset(bufs[1], 'b', 4_KB);
+	memset(bufs[2], 'c', 4_KB);
+	vector<tc_iovec> iovs(3);
+	tc_iov2fd(&iovs[0], 1 << 30, 2_KB, 4_KB, bufs[0]);
+	tc_iov2fd(&iovs[1], 1 << 30, 0, 4_KB, bufs[1]);
+	tc_iov2fd(&iovs[2], 1 << 30, 5_KB, 1_KB, bufs[2]);
+	iovs[2].is_write_stable = true;
+
+	struct tc_iov_array iova = vec2array(iovs);
+	auto merged = tc_merge_iov_array(&iova, 1_MB, true);
+	ASSERT_TRUE(merged);
+	ASSERT_EQ(1, merged->size);
+	EXPECT_EQ(0, merged->iovs[0].offset);
+	EXPECT_EQ(6_KB, merged->iovs[0].length);
+	EXPECT_TRUE(merged->iovs[0].is_write_stable);
+	const char *data = merged->iovs[0].data;
+	for (size_t i = 0; i < 6_KB; ++i) {
+		char expected = i < 4_KB ? 'b' : (i < 5_KB ? 'a' : 'c');
+		ASSERT_EQ(expected, data[i]) << "at " << i;
+	}
+
+	tc_unmerge_iov_array(&iova, &merged, true);
+	for (int i = 0; i < 3; ++i) {
+		EXPECT_EQ(i == 2 ? 1_KB : 4_KB, iovs[i].length);
+		EXPECT_TRUE(iovs[i].is_write_stable);
+		EXPECT_FALSE(iovs[i].is_failure);
+	}
+}
+
+TEST(IovecUtils, MergeIsLimitedByMaxIoSize)
+{
+	const int N = 8;
+	char *buf = new char[N * 256_KB];
+	vector<tc_iovec> iovs(N);
+	for (int i = 0; i < N; ++i) {
+		tc_iov2fd(&iovs[i], 1 << 30, i * 256_KB, 256_KB,
+			  buf + i * 256_KB);
+	}
+
+	struct tc_iov_array iova = vec2array(iovs);
+	auto merged = tc_merge_iov_array(&iova, 1_MB, false);
+	ASSERT_TRUE(merged);
+	ASSERT_EQ(2, merged->size);
+	for (int i = 0; i < merged->size; ++i) {
+		EXPECT_EQ(i * 1_MB, merged->iovs[i].offset);
+		EXPECT_EQ(1_MB, merged->iovs[i].length);
+	}
+	tc_unmerge_iov_array(&iova, &merged, false);
+	for (int i = 0; i < N; ++i) {
+		EXPECT_EQ(256_KB, iovs[i].length);
+	}
+	delete[] buf;
+}
+
+TEST(IovecUtils, OverlappedWritesAreMergedOnlyWithinMaxIoSize)
+{
+	char *buf = new char[1_MB];
+	vector<tc_iovec> iovs(3);
+	tc_iov2fd(&iovs[0], 1 << 30, 0, 512_KB, buf);
+	tc_iov2fd(&iovs[1], 1 << 30, 256_KB, 768_KB, buf + 256_KB);
+	tc_iov2fd(&iovs[2], 1 << 30, 1_MB, 4_KB, buf);
+
+	// the overlapping writes fill "max_io" exactly
+	struct tc_iov_array iova = vec2array(iovs);
+	auto merged = tc_merge_iov_array(&iova, 1_MB, true);
+	ASSERT_TRUE(merged);
+	ASSERT_EQ(2, merged->size);
+	EXPECT_EQ(0, merged->iovs[0].offset);
+	EXPECT_EQ(1_MB, merged->iovs[0].length);
+	EXPECT_EQ(1_MB, merged->iovs[1].offset);
+	EXPECT_EQ(4_KB, merged->iovs[1].length);
+	tc_unmerge_iov_array(&iova, &merged, true);
+
+	// one byte more, so the writes are sent as they are
+	iovs[1].length = 768_KB + 1;
+	EXPECT_EQ(NULL, tc_merge_iov_array(&iova, 1_MB, true));
+	delete[] buf;
+}
+
+TEST(IovecUtils, IovecsOfCurrentFileAreNotMerged)
+{
+	char buf[8_KB];
+	vector<tc_iovec> iovs(2);
+	tc_iov2fd(&iovs[0], 1 << 30, 0, 4_KB, buf);
+	tc_iov2current(&iovs[1], 4_KB, 4_KB, buf + 4_KB);
+
+	struct tc_iov_array iova = vec2array(iovs);
+	EXPECT_EQ(NULL, tc_merge_iov_array(&iova, 1_MB, false));
+
+	tc_iov2fd(&iovs[1], 1 << 30, 4_KB, 4_KB, buf + 4_KB);
+	iovs[1].offset = TC_OFFSET_END;
+	EXPECT_EQ(NULL, tc_merge_iov_array(&iova, 1_MB, false));
+}
@@ -24,10 +24,184 @@
 #include <vector>
 #include "util/slice.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define TC_PATH_MAX 4096
 
 using util::Slice;
 
+const char *tc_path_find_sep(const char *s, size_t n)
+{
+	const char *end = s + n;
+#ifdef __SSE2__
+	const __m128i sep = _mm_set1_epi8('/');
+	for (; end - s >= 16; s += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, sep));
+		if (mask) {
+			return s + __builtin_ctz(mask);
+		}
+	}
+#endif
+	while (s < end && *s != '/')
+		++s;
+	return s;
+}
+
+bool tc_path_iter_next(struct tc_path_iter *it, slice_t *comp)
+{
+	const char *p;
+	const char *sep;
+
+	while (it->pos < it->end) {
+		p = it->pos;
+		sep = tc_path_find_sep(p, it->end - p);
+		it->pos = sep < it->end ? sep + 1 : sep;
+		if (sep == p || (sep - p == 1 && *p == '.')) {
+			continue;  // ignore empty components and "."
+		}
+		fillslice(comp, p, sep - p);
+		return true;
+	}
+	return false;
+}
+
+static inline bool is_dotdot(slice_t comp)
+{
+	return comp.size == 2 && comp.data[0] == '.' && comp.data[1] == '.';
+}
+
+static inline bool slice_equal(slice_t a, slice_t b)
+{
+	return a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
+}
+
+/**
+ * Store the normalized components of "path" into "comps" (if not NULL)
+ * without gluing the leading '/' of an absolute path to the first one.
+ *
+ * Return the number of components, or -1 if there are more than "max_comps".
+ */
+static int tc_path_comps(slice_t path, bool absolute, slice_t *comps,
+			 int max_comps)
+{
+	struct tc_path_iter it;
+	slice_t comp;
+	int n = 0;
+	int up = 0;  // leading ".." of a relative path
+
+	tc_path_iter_init(&it, path);
+	while (tc_path_iter_next(&it, &comp)) {
+		if (is_dotdot(comp)) {
+			if (n > up) {
+				--n;
+				continue;
+			}
+			if (absolute) {
+				continue;  // ".." of "/" is "/"
+			}
+			++up;
+		}
+		// Components beyond "max_comps" are dropped; that is fine as long
+		// as ".." brings "n" back within "max_comps" in the end.
+		if (comps && n < max_comps) {
+			comps[n] = comp;
+		}
+		++n;
+	}
+	return (comps && n > max_comps) ? -1 : n;
+}
+
+static inline bool is_absolute(slice_t path)
+{
+	return path.size > 0 && path.data[0] == '/';
+}
+
+int tc_path_tokenize_a(slice_t path, slice_t *comps, int max_comps)
+{
+	bool absolute = is_absolute(path);
+	int n = tc_path_comps(path, absolute, comps, max_comps);
+
+	if (n < 0 || !absolute) {
+		return n;
+	}
+	if (n == 0) {
+		if (max_comps < 1) {
+			return -1;
+		}
+		fillslice(&comps[0], path.data, 1);
+		return 1;
+	}
+	// keep the leading '/' in the first component
+	comps[0].data--;
+	comps[0].size++;
+	assert(comps[0].data[0] == '/');
+	return n;
+}
+
+int tc_path_count_s(slice_t path)
+{
+	bool absolute = is_absolute(path);
+	int n = tc_path_comps(path, absolute, NULL, 0);
+
+	return (absolute && n == 0) ? 1 : n;
+}
+
+int tc_path_rebase_a(slice_t base, slice_t path, slice_t *comps,
+		     int max_comps)
+{
+	static const char dotdot[] = "..";
+	bool absolute = is_absolute(path);
+	struct tc_path_iter it;
+	slice_t comp;
+	int n;
+	int depth = 0;  // components of normalized "base"
+	int up = 0;     // leading ".." of normalized "base"
+	int same = 0;   // common leading components of "base" and "path"
+	int i;
+
+	if (absolute != is_absolute(base)) {
+		return -1;
+	}
+	n = tc_path_comps(path, absolute, comps, max_comps);
+	if (n < 0) {
+		return -1;
+	}
+
+	// Normalize "base" on the fly: its first "same" components are always
+	// comps[0, same), so they do not need to be stored.
+	tc_path_iter_init(&it, base);
+	while (tc_path_iter_next(&it, &comp)) {
+		if (is_dotdot(comp)) {
+			if (depth > up) {
+				if (same == depth)
+					--same;
+				--depth;
+				continue;
+			}
+			if (absolute) {
+				continue;
+			}
+			++up;
+		}
+		if (same == depth && same < n && slice_equal(comps[same], comp))
+			++same;
+		++depth;
+	}
+
+	if (depth - same + n - same > max_comps) {
+		return -1;
+	}
+	memmove(comps + depth - same, comps + same,
+		sizeof(*comps) * (n - same));
+	for (i = 0; i < depth - same; ++i) {
+		fillslice(&comps[i], dotdot, 2);
+	}
+	return depth - same + n - same;
+}
+
 static std::vector<Slice> tc_get_path_components(Slice path)
 {
 	std::vector<Slice> components;
@@ -73,24 +247,20 @@ static std::vector<Slice> tc_get_path_components(Slice path)
 
 int tc_path_tokenize_s(slice_t path, slice_t **components)
 {
-	std::vector<Slice> comps = tc_get_path_components(path);
+	int n = tc_path_count_s(path);
 	if (components == NULL) {
-		return comps.size();
+		return n;
 	}
-	if (comps.empty()) {
+	if (n == 0) {
 		*components = NULL;
 		return 0;
 	}
-	slice_t *sls = (slice_t *)malloc(sizeof(slice_t) * comps.size());
+	slice_t *sls = (slice_t *)malloc(sizeof(slice_t) * n);
 	if (!sls) {
 		return -1;
 	}
-	for (int i = 0; i < comps.size(); ++i) {
-		sls[i].data = comps[i].data();
-		sls[i].size = comps[i].size();
-	}
 	*components = sls;
-	return comps.size();
+	return tc_path_tokenize_a(path, sls, n);
 }
 
 int tc_path_tokenize(const char *path, slice_t **components)
@@ -103,14 +273,7 @@ int tc_path_tokenize(const char *path, slice_t **components)
 
 int tc_path_depth_s(slice_t path)
 {
-	std::vector<Slice> comps = tc_get_path_components(path);
-	int depth;
-	if (comps.size() == 1 && comps[0] == "/") {
-		depth = 0;
-	} else {
-		depth = comps.size();
-	}
-	return depth;
+	return tc_path_comps(path, is_absolute(path), NULL, 0);
 }
 
 int tc_path_depth(const char *path)
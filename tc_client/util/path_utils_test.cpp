@@ -173,6 +173,89 @@ TEST(PathUtilsTest, RebaseTest) {
 	Expect("/a/b/c/d/e", "/a/b/c/d/f", "../f");
 }
 
+TEST(PathUtilsTest, TokenizeArrayTest) {
+	auto Expect = [](const char *input, const vector<string> &expected) {
+		slice_t comps[8];
+		int ret = tc_path_tokenize_a(toslice(input), comps, 8);
+		ASSERT_EQ(expected.size(), ret) << input;
+		EXPECT_EQ(ret, tc_path_count_s(toslice(input))) << input;
+		for (int i = 0; i < ret; ++i) {
+			EXPECT_EQ(expected[i], string(comps[i].data, comps[i].size));
+		}
+	};
+
+	Expect(".././a", vector<string>{ "..", "a" });
+	Expect("/a/b/c/d", vector<string>{ "/a", "b", "c", "d" });
+	Expect("/", vector<string>{"/"});
+	Expect("///a", vector<string>{"/a"});
+	Expect("///a/../b", vector<string>{"/b"});
+	Expect("/../a", vector<string>{"/a"});
+	Expect("../../a/..", vector<string>{ "..", ".." });
+	Expect(".", vector<string>{});
+	Expect("", vector<string>{});
+
+	slice_t comps[2];
+	EXPECT_EQ(-1, tc_path_tokenize_a(toslice("a/b/c"), comps, 2));
+	EXPECT_EQ(2, tc_path_tokenize_a(toslice("a/b/c/.."), comps, 2));
+}
+
+TEST(PathUtilsTest, FindSepTest) {
+	string path(100, 'x');
+	for (size_t pos = 0; pos < path.size(); ++pos) {
+		path[pos] = '/';
+		EXPECT_EQ(path.data() + pos,
+			  tc_path_find_sep(path.data(), path.size()));
+		EXPECT_EQ(path.data() + path.size(),
+			  tc_path_find_sep(path.data() + pos + 1,
+					   path.size() - pos - 1));
+		path[pos] = 'x';
+	}
+	EXPECT_EQ(path.data() + path.size(),
+		  tc_path_find_sep(path.data(), path.size()));
+}
+
+TEST(PathUtilsTest, IterTest) {
+	string longcomp(40, 'c');
+	string path = "//a/./" + longcomp + "/../b//";
+	vector<string> comps;
+	struct tc_path_iter it;
+	slice_t comp;
+
+	tc_path_iter_init(&it, toslice(path.c_str()));
+	while (tc_path_iter_next(&it, &comp)) {
+		comps.emplace_back(comp.data, comp.size);
+	}
+	EXPECT_THAT(comps, testing::ElementsAre("a", longcomp, "..", "b"));
+}
+
+TEST(PathUtilsTest, RebaseArrayTest) {
+	auto Expect = [](const char *base, const char *p,
+			 const vector<string> &expected) {
+		slice_t comps[8];
+		int ret = tc_path_rebase_a(toslice(base), toslice(p), comps, 8);
+		ASSERT_EQ(expected.size(), ret) << p << " relative to " << base;
+		for (int i = 0; i < ret; ++i) {
+			EXPECT_EQ(expected[i], string(comps[i].data, comps[i].size))
+			    << p << " relative to " << base;
+		}
+	};
+	Expect("a", "a", vector<string>{});
+	Expect("a", "b", vector<string>{ "..", "b" });
+	Expect("a", "a/b", vector<string>{"b"});
+	Expect("/a/b/", "/a/b/c/d", vector<string>{ "c", "d" });
+	Expect("/a/b/c/d/e", "/a/b/c", vector<string>{ "..", ".." });
+	Expect("/a/b/c/d/e", "/a/b/c/d/f", vector<string>{ "..", "f" });
+	Expect("/a/x/../b/c", "/a/b/d", vector<string>{ "..", "d" });
+	Expect("/a/b/../../c", "/a/b", vector<string>{ "..", "a", "b" });
+	Expect("/", "/a/b", vector<string>{ "a", "b" });
+	Expect("../a", "../b", vector<string>{ "..", "b" });
+
+	slice_t comps[2];
+	EXPECT_EQ(-1, tc_path_rebase_a(toslice("/a"), toslice("b"), comps, 2));
+	EXPECT_EQ(-1, tc_path_rebase_a(toslice("/a/b/c"), toslice("/d"),
+				       comps, 2));
+}
+
 TEST(PathUtilsTest, AppendTest) {
 	buf_t *pbuf = new_auto_buf(1024);
 	tc_path_append(pbuf, toslice("a"));